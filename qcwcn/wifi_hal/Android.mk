@@ -113,6 +113,8 @@ LOCAL_SRC_FILES := \
 	list.cpp \
 	wifi_hal.cpp \
 	common.cpp \
+	event_cb.cpp \
+	cmd_sock_pool.cpp \
 	cpp_bindings.cpp \
 	llstats.cpp \
 	gscan.cpp \
@@ -129,6 +131,9 @@ LOCAL_SRC_FILES := \
 	wifilogger_diag.cpp \
 	ring_buffer.cpp \
 	rb_wrapper.cpp \
+	rb_compress.cpp \
+	pcapng.cpp \
+	diag_worker.cpp \
 	rssi_monitor.cpp \
 	roam.cpp \
 	radio_mode.cpp \
@@ -244,6 +249,8 @@ LOCAL_SRC_FILES := \
 	list.cpp \
 	wifi_hal.cpp \
 	common.cpp \
+	event_cb.cpp \
+	cmd_sock_pool.cpp \
 	cpp_bindings.cpp \
 	llstats.cpp \
 	gscan.cpp \
@@ -260,6 +267,9 @@ LOCAL_SRC_FILES := \
 	wifilogger_diag.cpp \
 	ring_buffer.cpp \
 	rb_wrapper.cpp \
+	rb_compress.cpp \
+	pcapng.cpp \
+	diag_worker.cpp \
 	rssi_monitor.cpp \
 	roam.cpp \
 	radio_mode.cpp \
@@ -306,3 +316,22 @@ LOCAL_CFLAGS += -DTARGET_SUPPORTS_WEARABLES
 endif
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Host benchmark and model check of the logger ring buffer
+# ============================================================
+include $(CLEAR_VARS)
+
+LOCAL_CFLAGS := -Wno-unused-parameter
+LOCAL_CFLAGS += -Wall -Werror
+LOCAL_MODULE := wifi_hal_rb_bench
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/rb_bench/include $(LOCAL_PATH)
+LOCAL_SRC_FILES := ring_buffer.cpp event_cb.cpp rb_compress.cpp \
+	cmd_sock_pool.cpp \
+	rb_bench/rb_bench.cpp rb_bench/rate_check.cpp \
+	rb_bench/event_cb_check.cpp rb_bench/lz_check.cpp \
+	rb_bench/pktlog_replay.cpp rb_bench/cmd_sock_check.cpp \
+	rb_bench/nl_attr_check.cpp
+LOCAL_CFLAGS += -DEVENT_CB_DEBUG
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#include "cmd_sock_pool.h"
+
+cmd_sock_info *cmd_sock_pool_get(cmd_sock_info *socks, int num,
+                                 uint32_t *next)
+{
+    cmd_sock_info *cs;
+    int start, i;
+
+    start = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED) % num;
+
+    for (i = 0; i < num; i++) {
+        cs = &socks[(start + i) % num];
+        if (pthread_mutex_trylock(&cs->lock) == 0)
+            return cs;
+    }
+
+    cs = &socks[start];
+    pthread_mutex_lock(&cs->lock);
+    return cs;
+}
+
+void cmd_sock_pool_put(cmd_sock_info *cs)
+{
+    if (cs)
+        pthread_mutex_unlock(&cs->lock);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __WIFI_HAL_CMD_SOCK_POOL_H
+#define __WIFI_HAL_CMD_SOCK_POOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+struct nl_sock;
+
+/* One entry of the command socket pool. The lock is held by the caller for
+ * the whole send/receive exchange on the socket, so replies of concurrent
+ * commands never interleave on the same socket.
+ */
+typedef struct {
+    struct nl_sock *sock;
+    pthread_mutex_t lock;
+} cmd_sock_info;
+
+/* Checks out one of the num sockets. An idle socket is preferred; if all of
+ * them are busy, waits on the round robin candidate taken from *next. The
+ * returned entry is locked and must be given back with cmd_sock_pool_put().
+ */
+cmd_sock_info *cmd_sock_pool_get(cmd_sock_info *socks, int num,
+                                 uint32_t *next);
+
+void cmd_sock_pool_put(cmd_sock_info *cs);
+
+#endif /* __WIFI_HAL_CMD_SOCK_POOL_H */
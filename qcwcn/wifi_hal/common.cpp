@@ -26,6 +26,8 @@
 #endif /* has netlink-private */
 #include <dlfcn.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <hardware_legacy/wifi_hal.h>
 #include "common.h"
 #include <errno.h>
@@ -60,37 +62,25 @@ wifi_interface_handle getIfaceHandle(interface_info *info)
     return (wifi_interface_handle)info;
 }
 
+static wifi_error event_cb_error(int err)
+{
+    if (err == 0)
+        return WIFI_SUCCESS;
+    return err == -ENOMEM ? WIFI_ERROR_OUT_OF_MEMORY : WIFI_ERROR_UNINITIALIZED;
+}
+
 wifi_error wifi_register_handler(wifi_handle handle, int cmd, nl_recvmsg_msg_cb_t func, void *arg)
 {
     hal_info *info = (hal_info *)handle;
+    wifi_error result;
 
     pthread_mutex_lock(&info->cb_lock);
 
-    wifi_error result = WIFI_ERROR_OUT_OF_MEMORY;
-
-    for (int i = 0; i < info->num_event_cb; i++) {
-        if(info->event_cb[i].nl_cmd == cmd &&
-           info->event_cb[i].cb_arg == arg) {
-            info->event_cb[i].cb_func = func;
-            ALOGV("Updated event handler %p for nl_cmd 0x%0x"
-                    " and arg %p", func, cmd, arg);
-            pthread_mutex_unlock(&info->cb_lock);
-            return WIFI_SUCCESS;
-        }
-    }
-
-    if (info->num_event_cb < info->alloc_event_cb) {
-        info->event_cb[info->num_event_cb].nl_cmd  = cmd;
-        info->event_cb[info->num_event_cb].vendor_id  = 0;
-        info->event_cb[info->num_event_cb].vendor_subcmd  = 0;
-        info->event_cb[info->num_event_cb].cb_func = func;
-        info->event_cb[info->num_event_cb].cb_arg  = arg;
-        info->num_event_cb++;
+    /* The first handler of a non-vendor command keeps its events */
+    result = event_cb_error(event_cb_add(&info->event_cbs, cmd, 0, 0, func,
+                                         arg, true));
+    if (result == WIFI_SUCCESS)
         ALOGV("Successfully added event handler %p for command %d", func, cmd);
-        result = WIFI_SUCCESS;
-    } else {
-        result = WIFI_ERROR_OUT_OF_MEMORY;
-    }
 
     pthread_mutex_unlock(&info->cb_lock);
     return result;
@@ -100,37 +90,15 @@ wifi_error wifi_register_vendor_handler(wifi_handle handle,
         uint32_t id, int subcmd, nl_recvmsg_msg_cb_t func, void *arg)
 {
     hal_info *info = (hal_info *)handle;
+    wifi_error result;
 
     pthread_mutex_lock(&info->cb_lock);
 
-    wifi_error result = WIFI_ERROR_OUT_OF_MEMORY;
-
-    for (int i = 0; i < info->num_event_cb; i++) {
-        if(info->event_cb[i].vendor_id  == id &&
-           info->event_cb[i].vendor_subcmd == subcmd)
-        {
-            info->event_cb[i].cb_func = func;
-            info->event_cb[i].cb_arg  = arg;
-            ALOGV("Updated event handler %p for vendor 0x%0x, subcmd 0x%0x"
-                " and arg %p", func, id, subcmd, arg);
-            pthread_mutex_unlock(&info->cb_lock);
-            return WIFI_SUCCESS;
-        }
-    }
-
-    if (info->num_event_cb < info->alloc_event_cb) {
-        info->event_cb[info->num_event_cb].nl_cmd  = NL80211_CMD_VENDOR;
-        info->event_cb[info->num_event_cb].vendor_id  = id;
-        info->event_cb[info->num_event_cb].vendor_subcmd  = subcmd;
-        info->event_cb[info->num_event_cb].cb_func = func;
-        info->event_cb[info->num_event_cb].cb_arg  = arg;
-        info->num_event_cb++;
+    result = event_cb_error(event_cb_add(&info->event_cbs, NL80211_CMD_VENDOR,
+                                         id, subcmd, func, arg, false));
+    if (result == WIFI_SUCCESS)
         ALOGV("Added event handler %p for vendor 0x%0x, subcmd 0x%0x and arg"
             " %p", func, id, subcmd, arg);
-        result = WIFI_SUCCESS;
-    } else {
-        result = WIFI_ERROR_OUT_OF_MEMORY;
-    }
 
     pthread_mutex_unlock(&info->cb_lock);
     return result;
@@ -147,20 +115,8 @@ void wifi_unregister_handler(wifi_handle handle, int cmd)
 
     pthread_mutex_lock(&info->cb_lock);
 
-    for (int i = 0; i < info->num_event_cb; i++) {
-        if (info->event_cb[i].nl_cmd == cmd) {
-            if(i < info->num_event_cb-1) {
-                /* No need to memmove if only one entry exist and deleting
-                 * the same, as the num_event_cb will become 0 in this case.
-                 */
-                memmove(&info->event_cb[i], &info->event_cb[i+1],
-                        (info->num_event_cb - i) * sizeof(cb_info));
-            }
-            info->num_event_cb--;
-            ALOGV("Successfully removed event handler for command %d", cmd);
-            break;
-        }
-    }
+    if (event_cb_remove(&info->event_cbs, cmd, 0, 0))
+        ALOGV("Successfully removed event handler for command %d", cmd);
 
     pthread_mutex_unlock(&info->cb_lock);
 }
@@ -171,27 +127,630 @@ void wifi_unregister_vendor_handler(wifi_handle handle, uint32_t id, int subcmd)
 
     pthread_mutex_lock(&info->cb_lock);
 
-    for (int i = 0; i < info->num_event_cb; i++) {
-
-        if (info->event_cb[i].nl_cmd == NL80211_CMD_VENDOR
-                && info->event_cb[i].vendor_id == id
-                && info->event_cb[i].vendor_subcmd == subcmd) {
-            if(i < info->num_event_cb-1) {
-                /* No need to memmove if only one entry exist and deleting
-                 * the same, as the num_event_cb will become 0 in this case.
-                 */
-                memmove(&info->event_cb[i], &info->event_cb[i+1],
-                        (info->num_event_cb - i) * sizeof(cb_info));
+    if (event_cb_remove(&info->event_cbs, NL80211_CMD_VENDOR, id, subcmd))
+        ALOGV("Successfully removed event handler for vendor 0x%0x", id);
+
+    pthread_mutex_unlock(&info->cb_lock);
+}
+
+/* Copy up to max_stats known keys with their hit counters into stats;
+ * returns the number copied. */
+int wifi_get_event_cb_stats(hal_info *info, event_cb_stats *stats, int max_stats)
+{
+    event_cb_table *table;
+    cb_info *cbi;
+    int n = 0;
+
+    pthread_mutex_lock(&info->cb_lock);
+    table = info->event_cbs.table;
+    for (int i = 0; table && i < table->alloc && n < max_stats; i++) {
+        cbi = &table->slots[i];
+        if (!cbi->in_use)
+            continue;
+        stats[n].nl_cmd = cbi->nl_cmd;
+        stats[n].vendor_id = cbi->vendor_id;
+        stats[n].vendor_subcmd = cbi->vendor_subcmd;
+        stats[n].hits = __atomic_load_n(cbi->hits, __ATOMIC_RELAXED);
+        stats[n].registered = cbi->cb_func != NULL;
+        n++;
+    }
+    pthread_mutex_unlock(&info->cb_lock);
+    return n;
+}
+
+void wifi_log_event_cb_stats(hal_info *info)
+{
+    event_cb_table *table;
+    cb_info *cbi;
+    u32 hits;
+
+    pthread_mutex_lock(&info->cb_lock);
+    table = info->event_cbs.table;
+    if (table) {
+        ALOGI("Event handler table: %d keys, %d handlers, %d slots, %u retired",
+              table->num, table->num_active, table->alloc,
+              __atomic_load_n(&info->event_cbs.num_retired,
+                              __ATOMIC_RELAXED));
+        for (int i = 0; i < table->alloc; i++) {
+            cbi = &table->slots[i];
+            if (!cbi->in_use)
+                continue;
+            hits = __atomic_load_n(cbi->hits, __ATOMIC_RELAXED);
+            if (hits)
+                ALOGI("nl_cmd %d vendor 0x%x subcmd 0x%x: %u events%s",
+                      cbi->nl_cmd, cbi->vendor_id, cbi->vendor_subcmd,
+                      hits, cbi->cb_func ? "" : " (unregistered)");
+        }
+    }
+    pthread_mutex_unlock(&info->cb_lock);
+}
+
+static int cmd_latency_bucket(u64 us)
+{
+    int msb, idx;
+
+    if (us < 8)
+        return (int)us;
+    msb = 63 - __builtin_clzll(us);
+    idx = 8 + (msb - 3) * 4 + (int)((us >> (msb - 2)) & 3);
+    return idx < CMD_LATENCY_BUCKETS ? idx : CMD_LATENCY_BUCKETS - 1;
+}
+
+/* Smallest value of the bucket following idx, i.e. upper bound of idx */
+static u32 cmd_latency_bucket_limit(int idx)
+{
+    int msb;
+
+    idx++;
+    if (idx < 8)
+        return idx;
+    msb = 3 + (idx - 8) / 4;
+    if (msb > 31)
+        return UINT32_MAX;
+    return (u32)((1ULL << msb) + ((u64)((idx - 8) % 4) << (msb - 2)));
+}
+
+static u32 cmd_latency_percentile(const u32 *buckets, u32 count, int pct)
+{
+    u64 target = ((u64)count * pct + 99) / 100;
+    u64 sum = 0;
+
+    for (int i = 0; i < CMD_LATENCY_BUCKETS; i++) {
+        sum += __atomic_load_n(&buckets[i], __ATOMIC_RELAXED);
+        if (target && sum >= target)
+            return cmd_latency_bucket_limit(i);
+    }
+    return 0;
+}
+
+static u64 cmd_latency_key(int nl_cmd, uint32_t vendor_id, int subcmd)
+{
+    return (1ULL << 63) | ((u64)(nl_cmd & 0xff) << 48) |
+           ((u64)(vendor_id & 0xffffff) << 16) | (u64)(subcmd & 0xffff);
+}
+
+static cmd_latency_hist *cmd_latency_lookup(cmd_latency_table *table, u64 key)
+{
+    u32 mask = CMD_LATENCY_SLOTS - 1;
+    u32 idx = (u32)((key ^ (key >> 29)) * 0x9E3779B1U) & mask;
+    cmd_latency_hist *hist;
+    u64 cur;
+
+    for (u32 i = 0; i < CMD_LATENCY_SLOTS; i++) {
+        hist = &table->slots[(idx + i) & mask];
+        cur = __atomic_load_n(&hist->key, __ATOMIC_ACQUIRE);
+        if (cur == 0) {
+            if (__atomic_compare_exchange_n(&hist->key, &cur, key, false,
+                                            __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE))
+                return hist;
+            /* cur now holds the key installed by the racing writer */
+        }
+        if (cur == key)
+            return hist;
+    }
+    return NULL;
+}
+
+/* Record one command round trip; times are relative to the send */
+void wifi_record_cmd_latency(hal_info *info, int nl_cmd, uint32_t vendor_id,
+                             int subcmd, u64 first_reply_us, u64 complete_us,
+                             bool error)
+{
+    cmd_latency_table *table = info->cmd_latency;
+    cmd_latency_hist *hist;
+    u32 max, us;
+
+    if (table == NULL)
+        return;
+
+    hist = cmd_latency_lookup(table,
+                              cmd_latency_key(nl_cmd, vendor_id, subcmd));
+    if (hist == NULL) {
+        __atomic_fetch_add(&table->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    if (error)
+        __atomic_fetch_add(&hist->errors, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total_us, complete_us, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->first_reply[cmd_latency_bucket(first_reply_us)],
+                       1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->complete[cmd_latency_bucket(complete_us)],
+                       1, __ATOMIC_RELAXED);
+
+    us = complete_us > UINT32_MAX ? UINT32_MAX : (u32)complete_us;
+    max = __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+    while (us > max &&
+           !__atomic_compare_exchange_n(&hist->max_us, &max, us, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Record the round trip of the request in msg. Vendor commands are keyed by
+ * vendor id and subcommand, others by the nl80211 command alone. A zero
+ * complete_us is now, a zero first_reply_us is the completion.
+ */
+void wifi_record_msg_latency(hal_info *info, struct nl_msg *msg, u64 send_us,
+                             u64 first_reply_us, u64 complete_us, bool error)
+{
+    struct genlmsghdr *gnlh;
+    struct nlattr *attr;
+    uint32_t vendor_id = 0;
+    int subcmd = 0;
+
+    if (info->cmd_latency == NULL || msg == NULL)
+        return;
+
+    gnlh = (struct genlmsghdr *)nlmsg_data(nlmsg_hdr(msg));
+    if (gnlh->cmd == NL80211_CMD_VENDOR) {
+        attr = nla_find(genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0),
+                        NL80211_ATTR_VENDOR_ID);
+        if (attr)
+            vendor_id = nla_get_u32(attr);
+        attr = nla_find(genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0),
+                        NL80211_ATTR_VENDOR_SUBCMD);
+        if (attr)
+            subcmd = nla_get_u32(attr);
+    }
+
+    if (!complete_us)
+        complete_us = wifi_monotonic_us();
+    if (!first_reply_us)
+        first_reply_us = complete_us;
+    wifi_record_cmd_latency(info, gnlh->cmd, vendor_id, subcmd,
+                            first_reply_us - send_us, complete_us - send_us,
+                            error);
+}
+
+/* Summarize the latency histograms of up to max_stats keys */
+wifi_error wifi_get_cmd_latency_stats(wifi_handle handle,
+                                      wifi_cmd_latency_stats *stats,
+                                      int max_stats, int *num_stats)
+{
+    hal_info *info = getHalInfo(handle);
+    cmd_latency_table *table;
+    cmd_latency_hist *hist;
+    wifi_cmd_latency_stats *st;
+    u64 key;
+    u32 count;
+    int n = 0;
+
+    if (info == NULL || stats == NULL || num_stats == NULL)
+        return WIFI_ERROR_INVALID_ARGS;
+
+    table = info->cmd_latency;
+    if (table == NULL)
+        return WIFI_ERROR_NOT_AVAILABLE;
+
+    for (int i = 0; i < CMD_LATENCY_SLOTS && n < max_stats; i++) {
+        hist = &table->slots[i];
+        key = __atomic_load_n(&hist->key, __ATOMIC_ACQUIRE);
+        count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+        if (key == 0 || count == 0)
+            continue;
+
+        st = &stats[n++];
+        st->nl_cmd = (int)((key >> 48) & 0xff);
+        st->vendor_id = (uint32_t)((key >> 16) & 0xffffff);
+        st->vendor_subcmd = (int)(key & 0xffff);
+        st->count = count;
+        st->errors = __atomic_load_n(&hist->errors, __ATOMIC_RELAXED);
+        st->avg_us = (u32)(__atomic_load_n(&hist->total_us, __ATOMIC_RELAXED) /
+                           count);
+        st->max_us = __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+        st->first_reply_p50_us = cmd_latency_percentile(hist->first_reply,
+                                                        count, 50);
+        st->first_reply_p99_us = cmd_latency_percentile(hist->first_reply,
+                                                        count, 99);
+        st->complete_p50_us = cmd_latency_percentile(hist->complete, count, 50);
+        st->complete_p90_us = cmd_latency_percentile(hist->complete, count, 90);
+        st->complete_p99_us = cmd_latency_percentile(hist->complete, count, 99);
+    }
+    *num_stats = n;
+    return WIFI_SUCCESS;
+}
+
+void wifi_log_cmd_latency_stats(hal_info *info)
+{
+    wifi_cmd_latency_stats stats[CMD_LATENCY_SLOTS];
+    int num = 0;
+
+    if (wifi_get_cmd_latency_stats(getWifiHandle(info), stats,
+                                   CMD_LATENCY_SLOTS, &num) != WIFI_SUCCESS)
+        return;
+
+    for (int i = 0; i < num; i++)
+        ALOGI("nl_cmd %d vendor 0x%x subcmd %d: %u cmds, %u errors, avg %uus "
+              "p50 %uus p99 %uus max %uus", stats[i].nl_cmd,
+              stats[i].vendor_id, stats[i].vendor_subcmd, stats[i].count,
+              stats[i].errors, stats[i].avg_us, stats[i].complete_p50_us,
+              stats[i].complete_p99_us, stats[i].max_us);
+    if (info->cmd_latency->dropped)
+        ALOGI("%u command latency samples dropped", info->cmd_latency->dropped);
+}
+
+/* Grow the socket receive buffer to size (clamped to NL_RECV_MAX_RCVBUF).
+ * SO_RCVBUFFORCE lets the HAL go past rmem_max; plain SO_RCVBUF is the
+ * fallback without CAP_NET_ADMIN.
+ */
+static void recv_batch_grow_rcvbuf(nl_recv_batch *batch, int size)
+{
+    int fd = nl_socket_get_fd(batch->sock);
+
+    if (size > NL_RECV_MAX_RCVBUF)
+        size = NL_RECV_MAX_RCVBUF;
+    if (size <= batch->rcvbuf)
+        return;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+        ALOGE("%s: Failed to grow receive buffer to %d: %s", batch->name,
+              size, strerror(errno));
+        return;
+    }
+    ALOGI("%s: Receive buffer grown from %d to %d", batch->name,
+          batch->rcvbuf, size);
+    batch->rcvbuf = size;
+}
+
+/* Account received bytes in one second windows. A second of traffic at the
+ * observed rate should fit in the receive buffer; skb overhead roughly
+ * doubles the payload, so this keeps about half a second of headroom.
+ */
+static void recv_batch_account(nl_recv_batch *batch, u64 bytes)
+{
+    if (batch->last_rx.tv_sec != batch->window_start) {
+        if (batch->window_bytes > (u64)batch->rcvbuf) {
+            u64 size = batch->rcvbuf;
+
+            while (size < batch->window_bytes && size < NL_RECV_MAX_RCVBUF)
+                size <<= 1;
+            recv_batch_grow_rcvbuf(batch, (int)size);
+        }
+        batch->window_start = batch->last_rx.tv_sec;
+        batch->window_bytes = 0;
+    }
+    batch->window_bytes += bytes;
+}
+
+nl_recv_batch *wifi_alloc_recv_batch(hal_info *info, struct nl_sock *sock,
+                                     const char *name,
+                                     const nl_recv_handlers *handlers)
+{
+    nl_recv_batch *batch;
+    size_t page = getpagesize();
+    void *bufs;
+    int i;
+
+    batch = (nl_recv_batch *)calloc(1, sizeof(nl_recv_batch));
+    if (batch == NULL)
+        return NULL;
+
+    /* Untouched pages of the buffers are never backed */
+    batch->buf_stride = (NL_RECV_MAX_DATAGRAM + page - 1) & ~(page - 1);
+    bufs = mmap(NULL, batch->buf_stride * NL_RECV_BATCH_SIZE,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs == MAP_FAILED) {
+        ALOGE("%s: Failed to map receive buffers: %s", name, strerror(errno));
+        free(batch);
+        return NULL;
+    }
+    batch->bufs = (unsigned char *)bufs;
+
+    batch->msg = nlmsg_alloc();
+    if (batch->msg == NULL) {
+        munmap(batch->bufs, batch->buf_stride * NL_RECV_BATCH_SIZE);
+        free(batch);
+        return NULL;
+    }
+
+    for (i = 0; i < NL_RECV_BATCH_SIZE; i++) {
+        batch->iov[i].iov_base = batch->bufs + i * batch->buf_stride;
+        batch->iov[i].iov_len = NL_RECV_MAX_DATAGRAM;
+        batch->msgs[i].msg_hdr.msg_name = &batch->addr[i];
+        batch->msgs[i].msg_hdr.msg_iov = &batch->iov[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    batch->sock = sock;
+    batch->name = name;
+    batch->info = info;
+    batch->handlers = *handlers;
+    batch->rcvbuf = NL_RECV_MIN_RCVBUF;
+    return batch;
+}
+
+void wifi_free_recv_batch(nl_recv_batch *batch)
+{
+    if (batch == NULL)
+        return;
+
+    nlmsg_free(batch->msg);
+    munmap(batch->bufs, batch->buf_stride * NL_RECV_BATCH_SIZE);
+    free(batch);
+}
+
+/* Runs the messages of one datagram through the handlers of the batch, the
+ * way nl_recvmsgs() runs them through the socket callbacks. The reused
+ * nl_msg is pointed at each message in the receive buffer in turn, so
+ * nothing is copied or allocated.
+ */
+static void recv_batch_dispatch(nl_recv_batch *batch, unsigned char *buf,
+                                int len, struct sockaddr_nl *nla)
+{
+    const nl_recv_handlers *h = &batch->handlers;
+    struct nl_msg *msg = batch->msg;
+    struct nlmsghdr *own_nlh = msg->nm_nlh;
+    struct nlmsghdr *hdr = (struct nlmsghdr *)buf;
+    struct nlmsgerr *e;
+    int res;
+
+    nlmsg_set_src(msg, nla);
+    for (; nlmsg_ok(hdr, len); hdr = nlmsg_next(hdr, &len)) {
+        msg->nm_nlh = hdr;
+        res = NL_OK;
+
+        switch (hdr->nlmsg_type) {
+        case NLMSG_NOOP:
+        case NLMSG_OVERRUN:
+            break;
+        case NLMSG_DONE:
+            if (h->finish)
+                res = h->finish(msg, h->status_arg);
+            break;
+        case NLMSG_ERROR:
+            e = (struct nlmsgerr *)nlmsg_data(hdr);
+            if (hdr->nlmsg_len < (u32)nlmsg_size(sizeof(*e)))
+                break;
+            if (e->error) {
+                if (h->err)
+                    res = h->err(nla, e, h->status_arg);
+            } else if (h->ack) {
+                res = h->ack(msg, h->status_arg);
             }
-            info->num_event_cb--;
-            ALOGV("Successfully removed event handler for vendor 0x%0x", id);
+            break;
+        default:
+            if (h->valid)
+                res = h->valid(msg, h->valid_arg);
             break;
         }
+        if (res == NL_STOP)
+            break;
     }
+    msg->nm_nlh = own_nlh;
+}
 
-    pthread_mutex_unlock(&info->cb_lock);
+/* Read up to NL_RECV_BATCH_SIZE pending datagrams with a single recvmmsg()
+ * and run each through the handlers of the batch. Returns the number of
+ * datagrams read or a negative errno.
+ */
+int wifi_recv_batch(nl_recv_batch *batch)
+{
+    size_t page = getpagesize();
+    size_t hot = (NL_RECV_BATCH_BUF_SIZE + page - 1) & ~(page - 1);
+    unsigned char *buf;
+    u64 bytes = 0;
+    u32 len;
+    int i, n, res;
+
+    for (i = 0; i < NL_RECV_BATCH_SIZE; i++) {
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addr[i]);
+        batch->msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    n = recvmmsg(nl_socket_get_fd(batch->sock), batch->msgs,
+                 NL_RECV_BATCH_SIZE, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        res = errno;
+        if (res == EAGAIN || res == EWOULDBLOCK || res == EINTR)
+            return 0;
+        if (res == ENOBUFS) {
+            /* The kernel dropped messages; the socket stays usable */
+            recv_batch_grow_rcvbuf(batch, batch->rcvbuf * 2);
+            if (batch->on_overflow)
+                batch->on_overflow(batch->info, batch->overflow);
+            return -res;
+        }
+        ALOGE("%s: recvmmsg failed: %s", batch->name, strerror(res));
+        return -res;
+    }
+
+    batch->wakeups++;
+    batch->datagrams += n;
+    batch->batch_hist[n]++;
+    if (n > 0) {
+        for (i = 0; i < n; i++)
+            bytes += batch->msgs[i].msg_len;
+        clock_gettime(CLOCK_MONOTONIC, &batch->last_rx);
+        recv_batch_account(batch, bytes);
+    }
+
+    for (i = 0; i < n; i++) {
+        buf = (unsigned char *)batch->iov[i].iov_base;
+        len = batch->msgs[i].msg_len;
+        if (batch->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            batch->truncated++;
+            ALOGE("%s: Dropped truncated datagram", batch->name);
+        } else {
+            recv_batch_dispatch(batch, buf, len, &batch->addr[i]);
+        }
+        /* Give back the pages a large datagram brought in */
+        if (len > hot)
+            madvise(buf + hot, batch->buf_stride - hot, MADV_DONTNEED);
+    }
+
+    return n;
+}
+
+void wifi_log_recv_batch_stats(nl_recv_batch *batch)
+{
+    if (batch == NULL || batch->wakeups == 0)
+        return;
+
+    ALOGI("%s: %" PRIu64 " datagrams in %" PRIu64 " wakeups, %" PRIu64
+          " truncated, %" PRIu64 " overflows, rcvbuf %d", batch->name,
+          batch->datagrams, batch->wakeups, batch->truncated,
+          batch->overflow ? batch->overflow->overflows : 0, batch->rcvbuf);
+    for (int i = 0; i <= NL_RECV_BATCH_SIZE; i++) {
+        if (batch->batch_hist[i])
+            ALOGI("%s: batch of %d: %" PRIu64 " wakeups", batch->name, i,
+                  batch->batch_hist[i]);
+    }
+}
+
+/* Check out a command socket from the pool, see cmd_sock_pool_get() */
+cmd_sock_info *wifi_get_cmd_sock(hal_info *info)
+{
+    if (info == NULL || info->cmd_socks == NULL || info->num_cmd_socks <= 0)
+        return NULL;
+
+    return cmd_sock_pool_get(info->cmd_socks, info->num_cmd_socks,
+                             &info->next_cmd_sock);
+}
+
+void wifi_put_cmd_sock(cmd_sock_info *cs)
+{
+    cmd_sock_pool_put(cs);
+}
+
+/* Send msg on the async socket and track it by its sequence number. The
+ * pending entry is added before the message goes out so the event loop
+ * always finds it, whichever thread wins the race to the reply.
+ */
+wifi_error wifi_send_async_cmd(hal_info *info, struct nl_msg *msg,
+                               async_cmd_reply_handler reply_func,
+                               async_cmd_done_handler done_func, void *arg)
+{
+    async_cmd_info *cmds;
+    int err, idx;
+
+    if (info->async_sock == NULL || info->async_cmds == NULL)
+        return WIFI_ERROR_NOT_SUPPORTED;
+
+    pthread_mutex_lock(&info->async_lock);
+
+    if (info->num_async_cmds == info->alloc_async_cmds) {
+        cmds = (async_cmd_info *)realloc(info->async_cmds,
+                   sizeof(async_cmd_info) * info->alloc_async_cmds * 2);
+        if (cmds == NULL) {
+            ALOGE("%s: Failed to grow async command table", __FUNCTION__);
+            pthread_mutex_unlock(&info->async_lock);
+            return WIFI_ERROR_OUT_OF_MEMORY;
+        }
+        info->async_cmds = cmds;
+        info->alloc_async_cmds *= 2;
+    }
+
+    nl_complete_msg(info->async_sock, msg);
+
+    idx = info->num_async_cmds;
+    info->async_cmds[idx].seq = nlmsg_hdr(msg)->nlmsg_seq;
+    info->async_cmds[idx].reply_func = reply_func;
+    info->async_cmds[idx].done_func = done_func;
+    info->async_cmds[idx].arg = arg;
+    info->num_async_cmds++;
+
+    err = nl_send(info->async_sock, msg);
+    if (err < 0) {
+        ALOGE("%s: nl_send failed: %d", __FUNCTION__, err);
+        /* Nothing else can have been added while we hold the lock */
+        info->num_async_cmds--;
+    }
+
+    pthread_mutex_unlock(&info->async_lock);
+    return mapKernelErrortoWifiHalError(err);
+}
+
+/* Called from the event loop for a reply message on the async socket */
+int wifi_async_cmd_reply(hal_info *info, struct nl_msg *msg)
+{
+    async_cmd_reply_handler reply_func = NULL;
+    void *arg = NULL;
+    u32 seq = nlmsg_hdr(msg)->nlmsg_seq;
+
+    pthread_mutex_lock(&info->async_lock);
+    for (int i = 0; i < info->num_async_cmds; i++) {
+        if (info->async_cmds[i].seq == seq) {
+            reply_func = info->async_cmds[i].reply_func;
+            arg = info->async_cmds[i].arg;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&info->async_lock);
+
+    /* Entries are only removed from the event loop, so arg stays valid */
+    if (reply_func)
+        return reply_func(msg, arg);
+
+    ALOGV("%s: No pending command for seq %u", __FUNCTION__, seq);
+    return NL_SKIP;
+}
+
+/* Called from the event loop when the command with sequence number seq has
+ * completed; removes it from the pending table and runs its done handler.
+ */
+void wifi_async_cmd_done(hal_info *info, u32 seq, int status)
+{
+    async_cmd_done_handler done_func = NULL;
+    void *arg = NULL;
+
+    pthread_mutex_lock(&info->async_lock);
+    for (int i = 0; i < info->num_async_cmds; i++) {
+        if (info->async_cmds[i].seq == seq) {
+            done_func = info->async_cmds[i].done_func;
+            arg = info->async_cmds[i].arg;
+            info->async_cmds[i] =
+                info->async_cmds[info->num_async_cmds - 1];
+            info->num_async_cmds--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&info->async_lock);
+
+    if (done_func)
+        done_func(status, arg);
 }
 
+/* Complete all pending async commands with -ECANCELED */
+void wifi_cancel_async_cmds(hal_info *info)
+{
+    async_cmd_info cmd;
+
+    if (info->async_cmds == NULL)
+        return;
+
+    pthread_mutex_lock(&info->async_lock);
+    while (info->num_async_cmds > 0) {
+        cmd = info->async_cmds[--info->num_async_cmds];
+        pthread_mutex_unlock(&info->async_lock);
+        if (cmd.done_func)
+            cmd.done_func(-ECANCELED, cmd.arg);
+        pthread_mutex_lock(&info->async_lock);
+    }
+    pthread_mutex_unlock(&info->async_lock);
+}
 
 #ifdef __cplusplus
 extern "C"
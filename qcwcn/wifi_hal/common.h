@@ -60,6 +60,7 @@
 #include <stdint.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netlink/genl/genl.h>
@@ -79,6 +80,8 @@
 
 #include <utils/Log.h>
 #include "rb_wrapper.h"
+#include "event_cb.h"
+#include "cmd_sock_pool.h"
 #include "pkt_stats.h"
 #include "wifihal_internal.h"
 #include "qca-vendor_copy.h"
@@ -86,6 +89,8 @@
 #define SOCKET_BUFFER_SIZE      (32768U)
 #define RECV_BUF_SIZE           (4096)
 #define DEFAULT_EVENT_CB_SIZE   (64)
+#define DEFAULT_CMD_SOCK_POOL_SIZE (4)
+#define DEFAULT_ASYNC_CMD_SIZE  (16)
 #define NUM_RING_BUFS           5
 #define MAX_NUM_RADAR_HISTORY   64
 #define MAX_NUM_MLO_LINKS       15
@@ -120,15 +125,103 @@ typedef struct {
     int nl_cmd;
     uint32_t vendor_id;
     int vendor_subcmd;
-    nl_recvmsg_msg_cb_t cb_func;
-    void *cb_arg;
-} cb_info;
+    u32 hits;
+    bool registered;
+} event_cb_stats;
 
 typedef struct {
     wifi_request_id id;
     WifiCommand *cmd;
 } cmd_info;
 
+/* Command latency histograms are log-linear in microseconds: one bucket per
+ * value below 8us, then four buckets per power of two up to ~2 minutes.
+ */
+#define CMD_LATENCY_BUCKETS     (8 + 24 * 4)
+#define CMD_LATENCY_SLOTS       (128)               // power of two
+
+/* Round-trip latency of one (nl_cmd, vendor_id, subcmd) key. key is set once
+ * with a compare-and-swap and all counters are updated with atomics, so
+ * commands on any thread record without a lock.
+ */
+typedef struct {
+    u64 key;                                        // 0 when the slot is free
+    u32 count;
+    u32 errors;
+    u64 total_us;
+    u32 max_us;
+    u32 first_reply[CMD_LATENCY_BUCKETS];           // send to first reply
+    u32 complete[CMD_LATENCY_BUCKETS];              // send to ACK/FINISH/event
+} cmd_latency_hist;
+
+typedef struct {
+    u32 dropped;                                    // samples of keys not fitting
+    cmd_latency_hist slots[CMD_LATENCY_SLOTS];
+} cmd_latency_table;
+
+/* Summary of a cmd_latency_hist; percentiles are bucket upper bounds */
+typedef struct {
+    int nl_cmd;
+    uint32_t vendor_id;
+    int vendor_subcmd;
+    u32 count;
+    u32 errors;
+    u32 avg_us;
+    u32 max_us;
+    u32 first_reply_p50_us;
+    u32 first_reply_p99_us;
+    u32 complete_p50_us;
+    u32 complete_p90_us;
+    u32 complete_p99_us;
+} wifi_cmd_latency_stats;
+
+/* Counters of one firmware diag event decoder, see process_diag_event() */
+#define DIAG_EVENT_COUNTER_SLOTS 32
+typedef struct {
+    u64 events;
+    u64 bytes;                                      // payload bytes
+    u64 failures;                                   // short or not decoded
+} diag_event_counter;
+
+typedef struct {
+    u32 event_id;                                   // 0: events without decoder
+    u64 events;
+    u64 bytes;
+    u64 failures;
+} wifi_diag_event_stats;
+
+/* Counters of the diag worker queue, see diag_worker.cpp */
+typedef struct {
+    u64 queued;                                     // messages queued
+    u64 decoded;                                    // messages decoded
+    u64 dropped;                                    // oldest messages dropped on a full queue
+    u64 oversized;                                  // messages larger than a pool buffer
+    u32 depth;                                      // messages waiting
+    u32 max_depth;                                  // high watermark of depth
+    u32 queue_len;                                  // messages the queue holds
+} wifi_diag_queue_stats;
+
+/* Counters of a compressed ring, see rb_compress.h */
+typedef struct {
+    char name[MAX_RB_NAME_SIZE];                    // ring name
+    struct rb_compress_stats stats;
+} wifi_ring_compress_stats;
+
+typedef int (*async_cmd_reply_handler)(struct nl_msg *msg, void *arg);
+typedef void (*async_cmd_done_handler)(int status, void *arg);
+
+/* Command sent on the async socket and waiting for its reply. reply_func is
+ * called for every reply message carrying the command's sequence number;
+ * done_func is called once with the kernel status on ACK, error or end of
+ * dump, or with -ECANCELED when the HAL is cleaned up.
+ */
+typedef struct {
+    u32 seq;
+    async_cmd_reply_handler reply_func;
+    async_cmd_done_handler done_func;
+    void *arg;
+} async_cmd_info;
+
 typedef struct {
     wifi_handle handle;                             // handle to wifi data
     char name[IFNAMSIZ+1];                          // interface name + trailing null
@@ -157,16 +250,112 @@ enum pkt_log_version {
 struct gscan_event_handlers_s;
 struct rssi_monitor_event_handler_s;
 struct wpa_secure_nan;
+struct pcapng_writer;
+struct diag_worker;
 
 struct ctrl_sock {
     int s;
     struct sockaddr_un local;
 };
 
+struct hal_info_s;
+typedef void (*loop_fd_handler)(struct hal_info_s *info, int fd, u32 events,
+                                void *arg);
+
+/* File descriptor watched by wifi_event_loop; events are EPOLL* bits */
+typedef struct {
+    struct list_head list;
+    int fd;
+    loop_fd_handler handler;
+    void *arg;
+} loop_fd_info;
+
+/* Max datagrams read with one recvmmsg() per wakeup, and the size of each
+ * receive buffer (netlink event and diag messages fit in two pages).
+ * Each buffer still has room for the largest message, an attribute of
+ * 64KB (nla_len is 16 bits) plus headers; the pages past the first
+ * NL_RECV_BATCH_BUF_SIZE bytes are only backed while such a message is
+ * handled.
+ */
+#define NL_RECV_BATCH_SIZE      (16)
+#define NL_RECV_BATCH_BUF_SIZE  (8192)
+#define NL_RECV_MAX_DATAGRAM    (68 * 1024)
+
+/* Socket receive buffer limits; the buffer starts at the minimum and grows
+ * on overflow or when a second of traffic would not fit anymore.
+ */
+#define NL_RECV_MIN_RCVBUF      (256 * 1024)
+#define NL_RECV_MAX_RCVBUF      (4 * 1024 * 1024)
+
+/* Kernel drops of an event loop netlink socket. The kernel reports ENOBUFS
+ * when the socket receive buffer overruns; the drops are counted here
+ * whether the socket is read in batches or through nl_recvmsgs(), so a quiet
+ * socket (no overflows, old last_rx) can be told apart from lost data.
+ */
+typedef struct {
+    const char *name;
+    u64 overflows;                                  // ENOBUFS reported by the kernel
+    u64 overflows_alerted;                          // overflows already sent as alert
+    struct timespec last_overflow;
+    struct timespec last_alert;
+    int timer_fd;                                   // fires when the alert window closes
+    bool timer_armed;                               // drops wait for the window to close
+} nl_overflow_info;
+
+typedef void (*nl_overflow_handler)(struct hal_info_s *info,
+                                    nl_overflow_info *overflow);
+
+/* Handlers a batched socket runs its messages through; the same ones that
+ * are set in the libnl callbacks of the socket */
+typedef struct {
+    nl_recvmsg_msg_cb_t valid;                      // NL_CB_VALID
+    void *valid_arg;
+    nl_recvmsg_msg_cb_t ack;                        // NL_CB_ACK
+    nl_recvmsg_msg_cb_t finish;                     // NL_CB_FINISH
+    nl_recvmsg_err_cb_t err;                        // error replies
+    void *status_arg;                               // arg of ack, finish and err
+} nl_recv_handlers;
+
+/* Batched receive state of an event loop netlink socket. Datagrams read by
+ * recvmmsg() into the buffers of the batch are parsed in place, and their
+ * messages are handed to the handlers through one reused nl_msg, so a
+ * wakeup allocates nothing; batch_hist[n] counts wakeups that read n
+ * datagrams.
+ *
+ * On ENOBUFS the receive buffer grows and the drop is handed to
+ * on_overflow with the overflow state of the socket.
+ */
+typedef struct nl_recv_batch_s {
+    struct nl_sock *sock;
+    const char *name;
+    struct hal_info_s *info;
+    nl_overflow_handler on_overflow;
+    nl_overflow_info *overflow;
+    nl_recv_handlers handlers;
+    struct nl_msg *msg;                             // points at the message being handled
+    unsigned char *bufs;                            // NL_RECV_BATCH_SIZE buffers
+    size_t buf_stride;                              // NL_RECV_MAX_DATAGRAM, page aligned
+    struct iovec iov[NL_RECV_BATCH_SIZE];
+    struct sockaddr_nl addr[NL_RECV_BATCH_SIZE];
+    struct mmsghdr msgs[NL_RECV_BATCH_SIZE];
+    u64 wakeups;
+    u64 datagrams;
+    u64 truncated;
+    u64 batch_hist[NL_RECV_BATCH_SIZE + 1];
+    struct timespec last_rx;
+    int rcvbuf;                                     // requested socket receive buffer
+    time_t window_start;                            // start of the rate window (sec)
+    u64 window_bytes;                               // bytes received in the window
+} nl_recv_batch;
+
 typedef struct hal_info_s {
 
-    struct nl_sock *cmd_sock;                       // command socket object
+    struct nl_sock *cmd_sock;                       // command socket object (pool entry 0)
+    cmd_sock_info *cmd_socks;                       // pool of command sockets
+    int num_cmd_socks;                              // number of sockets in the pool
+    u32 next_cmd_sock;                              // round robin start for checkout
     struct nl_sock *event_sock;                     // event socket object
+    struct nl_sock *async_sock;                     // socket for asynchronous commands
     struct nl_sock *user_sock;                      // user socket object
     struct ctrl_sock wifihal_ctrl_sock;             // ctrl sock object
     struct list_head monitor_sockets;               // list of monitor sockets
@@ -178,10 +367,15 @@ typedef struct hal_info_s {
     wifi_internal_event_handler event_handler;      // default event handler
     wifi_cleaned_up_handler cleaned_up_handler;     // socket cleaned up handler
 
-    cb_info *event_cb;                              // event callbacks
-    int num_event_cb;                               // number of event callbacks
-    int alloc_event_cb;                             // number of allocated callback objects
-    pthread_mutex_t cb_lock;                        // mutex for the event_cb access
+    event_cb_registry event_cbs;                    // event callbacks
+    pthread_mutex_t cb_lock;                        // mutex for event_cbs writers
+    cmd_latency_table *cmd_latency;                 // command round-trip histograms
+
+    async_cmd_info *async_cmds;                     // commands pending on async_sock
+    int num_async_cmds;                             // number of pending async commands
+    int alloc_async_cmds;                           // number of allocated async_cmds
+    pthread_mutex_t async_lock;                     // mutex for async_sock sends and async_cmds
+    bool async_inited;                              // async_lock is initialized
 
     interface_info **interfaces;                    // array of interfaces
     int num_interfaces;                             // number of interfaces
@@ -195,6 +389,8 @@ typedef struct hal_info_s {
     int user_sock_arg;
     int event_sock_arg;
     struct rb_info rb_infos[NUM_RING_BUFS];
+    size_t rb_mem_budget;   /* bytes all adaptive rings may use together */
+    diag_event_counter diag_event_counters[DIAG_EVENT_COUNTER_SLOTS];
     void (*on_ring_buffer_data) (char *ring_name, char *buffer, int buffer_size,
           wifi_ring_buffer_status *status);
     void (*on_alert) (wifi_request_id id, char *buffer, int buffer_size, int err_code);
@@ -202,6 +398,13 @@ typedef struct hal_info_s {
 
     /* socket pair used to exit from blocking poll*/
     int exit_sockets[2];
+    int epoll_fd;                                   // epoll instance of wifi_event_loop
+    struct list_head loop_fds;                      // fds registered with epoll_fd
+    pthread_mutex_t loop_fd_lock;                   // mutex for the loop_fds access
+    nl_recv_batch *event_recv_batch;                // batched receive of event_sock
+    nl_recv_batch *user_recv_batch;                 // batched receive of user_sock
+    nl_overflow_info event_overflow;                // kernel drops on event_sock
+    nl_overflow_info user_overflow;                 // kernel drops on user_sock
     u32 rx_buf_size_allocated;
     u32 rx_buf_size_occupied;
     wifi_ring_buffer_entry *rx_aggr_pkts;
@@ -219,6 +422,14 @@ typedef struct hal_info_s {
     packet_fate_monitor_info *pkt_fate_stats;
     /* mutex for the packet fate stats shared resource protection */
     pthread_mutex_t pkt_fate_stats_lock;
+    /* Held while diag messages are decoded into the rings and the rings
+     * are pushed out, which the diag worker does when it is running. Every
+     * ring write and read runs under it, which is what lets a drained ring
+     * be resized in place (see rb_adapt_size()) */
+    pthread_mutex_t diag_lock;
+    struct diag_worker *diag_worker;
+    /* pcapng export of packet fates and per packet stats, under diag_lock */
+    struct pcapng_writer *pcapng;
     struct rssi_monitor_event_handler_s *rssi_handlers;
     struct radio_event_handler_s *radio_handlers;
     wifi_capa capa;
@@ -252,6 +463,45 @@ wifi_error wifi_register_vendor_handler(wifi_handle handle,
 void wifi_unregister_handler(wifi_handle handle, int cmd);
 void wifi_unregister_vendor_handler(wifi_handle handle, uint32_t id, int subcmd);
 
+int wifi_get_event_cb_stats(hal_info *info, event_cb_stats *stats,
+            int max_stats);
+void wifi_log_event_cb_stats(hal_info *info);
+
+static inline u64 wifi_monotonic_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void wifi_record_cmd_latency(hal_info *info, int nl_cmd, uint32_t vendor_id,
+            int subcmd, u64 first_reply_us, u64 complete_us, bool error);
+void wifi_record_msg_latency(hal_info *info, struct nl_msg *msg, u64 send_us,
+            u64 first_reply_us, u64 complete_us, bool error);
+wifi_error wifi_get_cmd_latency_stats(wifi_handle handle,
+            wifi_cmd_latency_stats *stats, int max_stats, int *num_stats);
+void wifi_log_cmd_latency_stats(hal_info *info);
+
+cmd_sock_info *wifi_get_cmd_sock(hal_info *info);
+void wifi_put_cmd_sock(cmd_sock_info *cs);
+
+wifi_error wifi_loop_add_fd(hal_info *info, int fd, loop_fd_handler handler,
+            void *arg);
+
+nl_recv_batch *wifi_alloc_recv_batch(hal_info *info, struct nl_sock *sock,
+            const char *name, const nl_recv_handlers *handlers);
+void wifi_free_recv_batch(nl_recv_batch *batch);
+int wifi_recv_batch(nl_recv_batch *batch);
+void wifi_log_recv_batch_stats(nl_recv_batch *batch);
+
+wifi_error wifi_send_async_cmd(hal_info *info, struct nl_msg *msg,
+            async_cmd_reply_handler reply_func,
+            async_cmd_done_handler done_func, void *arg);
+int wifi_async_cmd_reply(hal_info *info, struct nl_msg *msg);
+void wifi_async_cmd_done(hal_info *info, u32 seq, int status);
+void wifi_cancel_async_cmds(hal_info *info);
+
 interface_info *getIfaceInfo(wifi_interface_handle);
 wifi_handle getWifiHandle(wifi_interface_handle handle);
 hal_info *getHalInfo(wifi_handle handle);
@@ -39,6 +39,7 @@
 
 #include "nl80211_copy.h"
 #include <ctype.h>
+#include <errno.h>
 
 #include <hardware_legacy/wifi_hal.h>
 #include "common.h"
@@ -543,10 +544,9 @@ int WifiEvent::parse() {
         return WIFI_SUCCESS;
     }
     mHeader = (genlmsghdr *)nlmsg_data(nlmsg_hdr(mMsg));
-    int result = nla_parse(mAttributes, NL80211_ATTR_MAX_INTERNAL, genlmsg_attrdata(mHeader, 0),
-          genlmsg_attrlen(mHeader, 0), NULL);
+    mAttrs.init(genlmsg_attrdata(mHeader, 0), genlmsg_attrlen(mHeader, 0));
 
-    return result;
+    return WIFI_SUCCESS;
 }
 
 wifi_error WifiRequest::create(int family, uint8_t cmd, int flags, int hdrlen) {
@@ -600,14 +600,23 @@ wifi_error WifiCommand::requestResponse()
 wifi_error WifiCommand::requestResponse(WifiRequest& request)
 {
     int err = 0;
+    struct nl_cb *cb = NULL;
+    u64 send_us;
+
+    cmd_sock_info *cs = wifi_get_cmd_sock(mInfo);
+    if (!cs) {
+        ALOGE("%s: No command socket available", __FUNCTION__);
+        mMsg.destroy();
+        return WIFI_ERROR_UNKNOWN;
+    }
 
-    pthread_mutex_lock(&mInfo->cb_lock);
-
-    struct nl_cb *cb = nl_cb_alloc(NL_CB_DEFAULT);
+    cb = nl_cb_alloc(NL_CB_DEFAULT);
     if (!cb)
         goto out;
 
-    err = nl_send_auto_complete(mInfo->cmd_sock, request.getMessage());    /* send message */
+    mFirstReplyUs = 0;
+    send_us = wifi_monotonic_us();
+    err = nl_send_auto_complete(cs->sock, request.getMessage());    /* send message */
     if (err < 0)
         goto out;
 
@@ -620,22 +629,260 @@ wifi_error WifiCommand::requestResponse(WifiRequest& request)
     nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, response_handler, this);
 
     while (err > 0) {                   /* wait for reply */
-        int res = nl_recvmsgs(mInfo->cmd_sock, cb);
+        int res = nl_recvmsgs(cs->sock, cb);
         if (res) {
             ALOGE("nl80211: %s->nl_recvmsgs failed: %d", __FUNCTION__, res);
         }
     }
+    wifi_record_msg_latency(mInfo, request.getMessage(), send_us, mFirstReplyUs,
+                            0, err < 0);
 out:
     nl_cb_put(cb);
     mMsg.destroy();
-    pthread_mutex_unlock(&mInfo->cb_lock);
+    wifi_put_cmd_sock(cs);
     return mapKernelErrortoWifiHalError(err);
 }
 
+wifi_error WifiCommand::requestResponseAsync(WifiRequest& request,
+                                             wifi_async_response_handler handler,
+                                             void *ctx)
+{
+    wifi_error ret;
+
+    mAsyncHandler = handler;
+    mAsyncCtx = ctx;
+
+    ret = wifi_send_async_cmd(mInfo, request.getMessage(), response_handler,
+                              async_done_handler, this);
+    if (ret != WIFI_SUCCESS) {
+        ALOGE("%s: Failed to send async command: %d", __FUNCTION__, ret);
+        mMsg.destroy();
+    }
+    /* On success the command may already be completed (and deleted) by the
+     * event loop, so it must not be touched here anymore. */
+    return ret;
+}
+
+/* Send the message on a pooled command socket without waiting for the reply;
+ * used by callers that wait for an event instead. */
+static int send_on_cmd_sock(hal_info *info, WifiRequest& request)
+{
+    int status;
+    cmd_sock_info *cs = wifi_get_cmd_sock(info);
+
+    if (!cs)
+        return -ENOTCONN;
+
+    status = nl_send_auto_complete(cs->sock, request.getMessage());
+    wifi_put_cmd_sock(cs);
+    return status;
+}
+
+wifi_error WifiRequestBatch::add(WifiCommand *cmd)
+{
+    batch_entry *entries;
+
+    if (cmd == NULL || cmd->mMsg.getMessage() == NULL)
+        return WIFI_ERROR_INVALID_ARGS;
+
+    if (mNumEntries == mAllocEntries) {
+        int alloc = mAllocEntries ? mAllocEntries * 2 : 4;
+
+        entries = (batch_entry *)realloc(mEntries, sizeof(batch_entry) * alloc);
+        if (entries == NULL) {
+            ALOGE("%s: Failed to grow batch", __FUNCTION__);
+            return WIFI_ERROR_OUT_OF_MEMORY;
+        }
+        mEntries = entries;
+        mAllocEntries = alloc;
+    }
+
+    memset(&mEntries[mNumEntries], 0, sizeof(batch_entry));
+    mEntries[mNumEntries].cmd = cmd;
+    mEntries[mNumEntries].err = -EINPROGRESS;
+    mNumEntries++;
+    return WIFI_SUCCESS;
+}
+
+WifiRequestBatch::batch_entry *WifiRequestBatch::findEntry(u32 seq)
+{
+    for (int i = 0; i < mNumEntries; i++) {
+        if (mEntries[i].seq == seq)
+            return &mEntries[i];
+    }
+    return NULL;
+}
+
+int WifiRequestBatch::valid_handler(struct nl_msg *msg, void *arg)
+{
+    WifiRequestBatch *batch = (WifiRequestBatch *)arg;
+    batch_entry *entry = batch->findEntry(nlmsg_hdr(msg)->nlmsg_seq);
+
+    if (entry == NULL || entry->done) {
+        ALOGE("%s: Unexpected reply seq %u", __FUNCTION__,
+              nlmsg_hdr(msg)->nlmsg_seq);
+        return NL_SKIP;
+    }
+    /* Keep parsing after the reply; the other commands' replies may follow
+     * in the same datagram. */
+    WifiCommand::response_handler(msg, entry->cmd);
+    return NL_SKIP;
+}
+
+int WifiRequestBatch::ack_handler(struct nl_msg *msg, void *arg)
+{
+    WifiRequestBatch *batch = (WifiRequestBatch *)arg;
+    batch_entry *entry = batch->findEntry(nlmsg_hdr(msg)->nlmsg_seq);
+
+    if (entry && !entry->done) {
+        entry->err = 0;
+        entry->done = true;
+        entry->complete_us = wifi_monotonic_us();
+        batch->mPending--;
+    }
+    return NL_SKIP;
+}
+
+int WifiRequestBatch::error_handler(struct sockaddr_nl *nla,
+                                    struct nlmsgerr *err, void *arg)
+{
+    WifiRequestBatch *batch = (WifiRequestBatch *)arg;
+    batch_entry *entry = batch->findEntry(err->msg.nlmsg_seq);
+
+    if (entry && !entry->done) {
+        entry->err = err->error;
+        entry->done = true;
+        entry->complete_us = wifi_monotonic_us();
+        batch->mPending--;
+    }
+    return NL_SKIP;
+}
+
+/* Send count entries starting at first in one datagram and collect their
+ * replies. */
+wifi_error WifiRequestBatch::sendAndReceive(struct nl_sock *sock, int first,
+                                            int count)
+{
+    struct iovec *iov;
+    struct nl_cb *cb;
+    batch_entry *entry;
+    u64 send_us;
+    int i, err;
+
+    iov = (struct iovec *)malloc(sizeof(struct iovec) * count);
+    if (!iov)
+        return WIFI_ERROR_OUT_OF_MEMORY;
+
+    for (i = 0; i < count; i++) {
+        struct nl_msg *msg = mEntries[first + i].cmd->mMsg.getMessage();
+
+        nl_complete_msg(sock, msg);
+        mEntries[first + i].seq = nlmsg_hdr(msg)->nlmsg_seq;
+        mEntries[first + i].cmd->mFirstReplyUs = 0;
+        iov[i].iov_base = nlmsg_hdr(msg);
+        iov[i].iov_len = NLMSG_ALIGN(nlmsg_hdr(msg)->nlmsg_len);
+    }
+
+    cb = nl_cb_alloc(NL_CB_DEFAULT);
+    if (!cb) {
+        free(iov);
+        return WIFI_ERROR_OUT_OF_MEMORY;
+    }
+
+    send_us = wifi_monotonic_us();
+    err = nl_send_iovec(sock, mEntries[first].cmd->mMsg.getMessage(), iov,
+                        count);
+    free(iov);
+    if (err < 0) {
+        ALOGE("%s: nl_send_iovec failed: %d", __FUNCTION__, err);
+        nl_cb_put(cb);
+        return mapKernelErrortoWifiHalError(err);
+    }
+
+    nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, NULL);
+    nl_cb_err(cb, NL_CB_CUSTOM, error_handler, this);
+    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, this);
+    nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, valid_handler, this);
+
+    mPending = count;
+    while (mPending > 0) {                      /* wait for all replies */
+        int res = nl_recvmsgs(sock, cb);
+        if (res < 0) {
+            ALOGE("nl80211: %s->nl_recvmsgs failed: %d", __FUNCTION__, res);
+            break;
+        }
+    }
+    nl_cb_put(cb);
+
+    /* Commands still pending when the receive failed count as errors */
+    for (i = 0; i < count; i++) {
+        entry = &mEntries[first + i];
+        wifi_record_msg_latency(mInfo, entry->cmd->mMsg.getMessage(), send_us,
+                                entry->cmd->mFirstReplyUs, entry->complete_us,
+                                !entry->done || entry->err < 0);
+    }
+
+    return mPending ? WIFI_ERROR_UNKNOWN : WIFI_SUCCESS;
+}
+
+wifi_error WifiRequestBatch::execute()
+{
+    wifi_error ret = WIFI_SUCCESS;
+    cmd_sock_info *cs;
+    int first, count;
+    size_t len;
+
+    if (mNumEntries == 0)
+        return WIFI_SUCCESS;
+
+    cs = wifi_get_cmd_sock(mInfo);
+    if (!cs) {
+        ALOGE("%s: No command socket available", __FUNCTION__);
+        ret = WIFI_ERROR_UNKNOWN;
+        goto out;
+    }
+
+    /* Split the batch so that a single datagram stays within the socket
+     * buffer size; each chunk is drained before the next one goes out. */
+    for (first = 0; first < mNumEntries; first += count) {
+        len = 0;
+        for (count = 0; first + count < mNumEntries; count++) {
+            nl_msg *msg = mEntries[first + count].cmd->mMsg.getMessage();
+            size_t msg_len = NLMSG_ALIGN(nlmsg_hdr(msg)->nlmsg_len);
+
+            if (count && len + msg_len > SOCKET_BUFFER_SIZE)
+                break;
+            len += msg_len;
+        }
+        ret = sendAndReceive(cs->sock, first, count);
+        if (ret != WIFI_SUCCESS)
+            break;
+    }
+
+out:
+    wifi_put_cmd_sock(cs);
+    for (int i = 0; i < mNumEntries; i++) {
+        mEntries[i].cmd->mMsg.destroy();
+        if (ret == WIFI_SUCCESS && mEntries[i].err < 0)
+            ret = mapKernelErrortoWifiHalError(mEntries[i].err);
+    }
+    return ret;
+}
+
+wifi_error WifiRequestBatch::status(int index)
+{
+    if (index < 0 || index >= mNumEntries)
+        return WIFI_ERROR_INVALID_ARGS;
+    if (!mEntries[index].done)
+        return WIFI_ERROR_UNKNOWN;
+    return mapKernelErrortoWifiHalError(mEntries[index].err);
+}
+
 wifi_error WifiCommand::requestEvent(int cmd)
 {
 
     int status;
+    u64 send_us;
     wifi_error res = wifi_register_handler(wifiHandle(), cmd, event_handler,
                                            this);
     if (res != WIFI_SUCCESS)
@@ -645,13 +892,16 @@ wifi_error WifiCommand::requestEvent(int cmd)
     if (res != WIFI_SUCCESS)
         goto out;
 
-    status = nl_send_auto_complete(mInfo->cmd_sock, mMsg.getMessage());    /* send message */
+    send_us = wifi_monotonic_us();
+    status = send_on_cmd_sock(mInfo, mMsg);                         /* send message */
     if (status < 0) {
         res = mapKernelErrortoWifiHalError(status);
         goto out;
     }
 
     res = mCondition.wait();
+    wifi_record_msg_latency(mInfo, mMsg.getMessage(), send_us, 0, 0,
+                            res != WIFI_SUCCESS);
     if (res != WIFI_SUCCESS)
         goto out;
 
@@ -662,6 +912,7 @@ out:
 
 wifi_error WifiCommand::requestVendorEvent(uint32_t id, int subcmd) {
     int status;
+    u64 send_us;
     wifi_error res = wifi_register_vendor_handler(wifiHandle(), id, subcmd,
                                                   event_handler, this);
     if (res != WIFI_SUCCESS)
@@ -671,13 +922,16 @@ wifi_error WifiCommand::requestVendorEvent(uint32_t id, int subcmd) {
     if (res != WIFI_SUCCESS)
         goto out;
 
-    status = nl_send_auto_complete(mInfo->cmd_sock, mMsg.getMessage());    /* send message */
+    send_us = wifi_monotonic_us();
+    status = send_on_cmd_sock(mInfo, mMsg);                         /* send message */
     if (status < 0) {
         res = mapKernelErrortoWifiHalError(status);
         goto out;
     }
 
     res = mCondition.wait();
+    wifi_record_msg_latency(mInfo, mMsg.getMessage(), send_us, 0, 0,
+                            res != WIFI_SUCCESS);
     if (res != WIFI_SUCCESS)
         goto out;
 
@@ -689,6 +943,9 @@ out:
 /* Event handlers */
 int WifiCommand::response_handler(struct nl_msg *msg, void *arg) {
     WifiCommand *cmd = (WifiCommand *)arg;
+
+    if (!cmd->mFirstReplyUs)
+        cmd->mFirstReplyUs = wifi_monotonic_us();
     WifiEvent reply(msg);
     int res = reply.parse();
     if (res < 0) {
@@ -700,6 +957,15 @@ int WifiCommand::response_handler(struct nl_msg *msg, void *arg) {
     }
 }
 
+void WifiCommand::async_done_handler(int status, void *arg) {
+    WifiCommand *cmd = (WifiCommand *)arg;
+    wifi_async_response_handler handler = cmd->mAsyncHandler;
+
+    cmd->mMsg.destroy();
+    if (handler)
+        handler(cmd, mapKernelErrortoWifiHalError(status), cmd->mAsyncCtx);
+}
+
 int WifiCommand::event_handler(struct nl_msg *msg, void *arg) {
     WifiCommand *cmd = (WifiCommand *)arg;
     WifiEvent event(msg);
@@ -765,13 +1031,13 @@ WifiVendorCommand::~WifiVendorCommand()
 // in the corresponding object
 int WifiVendorCommand::handleResponse(WifiEvent &reply)
 {
-    struct nlattr **tb = reply.attributes();
+    struct nlattr *vendor_data = reply.get_attribute(NL80211_ATTR_VENDOR_DATA);
     struct genlmsghdr *gnlh = reply.header();
 
     if (gnlh->cmd == NL80211_CMD_VENDOR) {
-        if (tb[NL80211_ATTR_VENDOR_DATA]) {
-            mVendorData = (char *)nla_data(tb[NL80211_ATTR_VENDOR_DATA]);
-            mDataLen = nla_len(tb[NL80211_ATTR_VENDOR_DATA]);
+        if (vendor_data) {
+            mVendorData = (char *)nla_data(vendor_data);
+            mDataLen = nla_len(vendor_data);
         }
     }
     return NL_SKIP;
@@ -781,7 +1047,7 @@ int WifiVendorCommand::handleResponse(WifiEvent &reply)
 // save it in the object
 int WifiVendorCommand::handleEvent(WifiEvent &event)
 {
-    struct nlattr **tb = event.attributes();
+    const WifiEvent::attr_view &tb = event.attributes();
     struct genlmsghdr *gnlh = event.header();
 
     if (gnlh->cmd == NL80211_CMD_VENDOR) {
@@ -840,6 +1106,12 @@ wifi_error WifiVendorCommand::requestResponse()
     return WifiCommand::requestResponse(mMsg);
 }
 
+wifi_error WifiVendorCommand::requestResponseAsync(wifi_async_response_handler handler,
+                                                   void *ctx)
+{
+    return WifiCommand::requestResponseAsync(mMsg, handler, ctx);
+}
+
 wifi_error WifiVendorCommand::requestEvent()
 {
     wifi_error res = requestVendorEvent(mVendor_id, mSubcmd);
@@ -1028,5 +1300,6 @@ wifi_error initialize_vendor_cmd(wifi_interface_handle iface,
 
 cleanup:
     delete *vCommand;
+    *vCommand = NULL;
     return ret;
 }
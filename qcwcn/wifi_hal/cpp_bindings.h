@@ -25,21 +25,23 @@
 #include <hardware_legacy/wifi_hal.h>
 #include "common.h"
 #include "sync.h"
+#include "nl_attr_view.h"
 
 class WifiEvent
 {
-    /* TODO: remove this when nl headers are updated */
+public:
     static const unsigned NL80211_ATTR_MAX_INTERNAL = 256;
+    typedef nl_attr_view<NL80211_ATTR_MAX_INTERNAL> attr_view;
+
 private:
     struct nl_msg *mMsg;
     struct genlmsghdr *mHeader;
-    struct nlattr *mAttributes[NL80211_ATTR_MAX_INTERNAL + 1];
+    attr_view mAttrs;
 
 public:
     WifiEvent(nl_msg *msg) {
         mMsg = msg;
         mHeader = NULL;
-        memset(mAttributes, 0, sizeof(mAttributes));
     }
     ~WifiEvent() {
         /* don't destroy mMsg; it doesn't belong to us */
@@ -75,36 +77,43 @@ public:
 
     const char *get_cmdString();
 
-    nlattr ** attributes() {
-        return mAttributes;
+    /* Attributes of the message, indexed by type like an nla_parse() table */
+    const attr_view& attributes() {
+        return mAttrs;
     }
 
     nlattr *get_attribute(int attribute) {
-        return mAttributes[attribute];
+        return mAttrs.get(attribute);
     }
 
     uint8_t get_u8(int attribute) {
-        return mAttributes[attribute] ? nla_get_u8(mAttributes[attribute]) : 0;
+        nlattr *attr = mAttrs.get(attribute);
+        return attr ? nla_get_u8(attr) : 0;
     }
 
     uint16_t get_u16(int attribute) {
-        return mAttributes[attribute] ? nla_get_u16(mAttributes[attribute]) : 0;
+        nlattr *attr = mAttrs.get(attribute);
+        return attr ? nla_get_u16(attr) : 0;
     }
 
     uint32_t get_u32(int attribute) {
-        return mAttributes[attribute] ? nla_get_u32(mAttributes[attribute]) : 0;
+        nlattr *attr = mAttrs.get(attribute);
+        return attr ? nla_get_u32(attr) : 0;
     }
 
     uint64_t get_u64(int attribute) {
-        return mAttributes[attribute] ? nla_get_u64(mAttributes[attribute]) : 0;
+        nlattr *attr = mAttrs.get(attribute);
+        return attr ? nla_get_u64(attr) : 0;
     }
 
     int get_len(int attribute) {
-        return mAttributes[attribute] ? nla_len(mAttributes[attribute]) : 0;
+        nlattr *attr = mAttrs.get(attribute);
+        return attr ? nla_len(attr) : 0;
     }
 
     void *get_data(int attribute) {
-        return mAttributes[attribute] ? nla_data(mAttributes[attribute]) : NULL;
+        nlattr *attr = mAttrs.get(attribute);
+        return attr ? nla_data(attr) : NULL;
     }
 
 private:
@@ -312,6 +321,13 @@ private:
 
 };
 
+class WifiCommand;
+
+/* Completion callback of requestResponseAsync(); runs on the event loop
+ * thread after handleResponse() has seen all replies. It may delete cmd. */
+typedef void (*wifi_async_response_handler)(WifiCommand *cmd,
+                                            wifi_error result, void *ctx);
+
 class WifiCommand
 {
 protected:
@@ -326,6 +342,9 @@ public:
     {
         mIfaceInfo = NULL;
         mInfo = getHalInfo(handle);
+        mAsyncHandler = NULL;
+        mAsyncCtx = NULL;
+        mFirstReplyUs = 0;
     }
 
     WifiCommand(wifi_interface_handle iface, wifi_request_id id)
@@ -333,6 +352,9 @@ public:
     {
         mIfaceInfo = getIfaceInfo(iface);
         mInfo = getHalInfo(iface);
+        mAsyncHandler = NULL;
+        mAsyncCtx = NULL;
+        mFirstReplyUs = 0;
     }
 
     virtual ~WifiCommand() {
@@ -357,6 +379,14 @@ public:
     wifi_error requestVendorEvent(uint32_t id, int subcmd);
     wifi_error requestResponse(WifiRequest& request);
 
+    /* Send the request without blocking the caller. Replies are passed to
+     * handleResponse() and handler is called with the final status from
+     * wifi_event_loop. The command must stay alive until then; if this
+     * returns an error the handler is never called. */
+    wifi_error requestResponseAsync(WifiRequest& request,
+                                    wifi_async_response_handler handler,
+                                    void *ctx);
+
 protected:
     wifi_handle wifiHandle() {
         return getWifiHandle(mInfo);
@@ -403,11 +433,22 @@ protected:
     }
 
 private:
+    friend class WifiRequestBatch;
+
     WifiCommand(const WifiCommand& );           // hide copy constructor to prevent copies
 
+    wifi_async_response_handler mAsyncHandler;
+    void *mAsyncCtx;
+
+    /* Monotonic time of the first reply to the pending request, 0 if none */
+    u64 mFirstReplyUs;
+
     /* Event handling */
     static int response_handler(struct nl_msg *msg, void *arg);
 
+    /* Async command completion */
+    static void async_done_handler(int status, void *arg);
+
     static int event_handler(struct nl_msg *msg, void *arg);
 
     /* Other event handlers */
@@ -420,6 +461,67 @@ private:
     static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg);
 };
 
+/* Sends the prepared messages of several commands with one sendmsg() on a
+ * single command socket and hands each reply to the handleResponse() of the
+ * command with the matching sequence number. The kernel processes the
+ * messages in order and a failing command does not stop the ones behind it,
+ * so only batch commands that do not depend on each other's replies. Dump
+ * requests (NLM_F_DUMP) must not be batched.
+ */
+class WifiRequestBatch
+{
+private:
+    typedef struct {
+        WifiCommand *cmd;
+        u32 seq;
+        int err;
+        bool done;
+        u64 complete_us;
+    } batch_entry;
+
+    hal_info *mInfo;
+    batch_entry *mEntries;
+    int mNumEntries;
+    int mAllocEntries;
+    int mPending;
+
+    batch_entry *findEntry(u32 seq);
+    wifi_error sendAndReceive(struct nl_sock *sock, int first, int count);
+
+    static int valid_handler(struct nl_msg *msg, void *arg);
+    static int ack_handler(struct nl_msg *msg, void *arg);
+    static int error_handler(struct sockaddr_nl *nla, struct nlmsgerr *err,
+                             void *arg);
+
+public:
+    WifiRequestBatch(hal_info *info)
+            : mInfo(info), mEntries(NULL), mNumEntries(0), mAllocEntries(0),
+              mPending(0)
+    {
+    }
+
+    ~WifiRequestBatch() {
+        free(mEntries);
+    }
+
+    /* Queue the message already built in cmd (cmd->create() and attributes
+     * done). The command must stay alive until execute() returns. */
+    wifi_error add(WifiCommand *cmd);
+
+    /* Send all queued messages and wait for every reply. Returns the first
+     * failure; per command status is available through status(). */
+    wifi_error execute();
+
+    wifi_error status(int index);
+
+    int count() {
+        return mNumEntries;
+    }
+
+private:
+    WifiRequestBatch(const WifiRequestBatch&);  // hide copy constructor to prevent copies
+};
+
 //WifiVendorCommand class
 class WifiVendorCommand: public WifiCommand
 {
@@ -439,6 +541,9 @@ public:
 
     virtual wifi_error requestResponse();
 
+    virtual wifi_error requestResponseAsync(wifi_async_response_handler handler,
+                                            void *ctx);
+
     virtual wifi_error requestEvent();
 
     virtual wifi_error put_u8(int attribute, uint8_t value);
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "common.h"
+#include "pcapng.h"
+#include "wifiloggercmd.h"
+
+/* Pool buffers fit the messages of a common batched receive buffer; larger
+ * ones are copied to the heap instead */
+#define DIAG_WORKER_QUEUE_LEN 64
+#define DIAG_WORKER_BUF_SIZE NL_RECV_BATCH_BUF_SIZE
+
+/* Diag messages of user_sock are decoded on this worker rather than on the
+ * event loop, so a burst of pktlog or firmware prints does not hold up the
+ * NAN, RSSI monitor and roam events queued behind it. The event loop copies
+ * each message into a pool buffer and queues it; with the queue full the
+ * oldest message is dropped to make room, so queueing never waits on the
+ * worker. Ring flush timers and push out requests of the event loop are
+ * posted here as well, which keeps all ring writes and reads on the worker.
+ * While a pcapng export holds buffered blocks the worker also wakes up on
+ * its own to flush them, so they reach the sink when traffic stops.
+ */
+struct diag_worker {
+    hal_info *info;
+    pthread_t thread;
+    pthread_mutex_t lock;           // protects everything below
+    pthread_cond_t cond;
+    bool stop;
+    u8 *pool;                       // one buffer more than the queue holds,
+                                    // for the message being decoded
+    int queue[DIAG_WORKER_QUEUE_LEN]; // pool buffers, oldest message first
+    int head;
+    int depth;
+    int free_bufs[DIAG_WORKER_QUEUE_LEN + 1];
+    u8 *big[DIAG_WORKER_QUEUE_LEN + 1]; // heap copy of an oversized message
+    int num_free;
+    u32 rb_timeouts;                // rings whose flush timer fired, by id
+    bool flush;                     // push out all rings
+    bool dropping;                  // dropped since the queue last ran empty
+    wifi_diag_queue_stats stats;
+};
+
+static inline struct nlmsghdr *diag_worker_msg(struct diag_worker *w, int buf)
+{
+    if (w->big[buf])
+        return (struct nlmsghdr *)w->big[buf];
+    return (struct nlmsghdr *)(w->pool + (size_t)buf * DIAG_WORKER_BUF_SIZE);
+}
+
+static void *diag_worker_thread(void *arg)
+{
+    struct diag_worker *w = (struct diag_worker *)arg;
+    hal_info *info = w->info;
+    struct timeval now;
+    struct timespec deadline;
+    bool export_pending = false;
+    bool tick;
+    u32 rb_timeouts;
+    bool flush;
+    int buf, i;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        tick = false;
+        while (!w->depth && !w->rb_timeouts && !w->flush && !w->stop) {
+            if (!export_pending) {
+                pthread_cond_wait(&w->cond, &w->lock);
+            } else if (pthread_cond_timedwait(&w->cond, &w->lock,
+                                              &deadline) == ETIMEDOUT) {
+                tick = true;
+                break;
+            }
+        }
+        /* Stop only once the queue is drained */
+        if (!tick && !w->depth && !w->rb_timeouts && !w->flush)
+            break;
+
+        buf = -1;
+        if (w->depth) {
+            buf = w->queue[w->head];
+            w->head = (w->head + 1) % DIAG_WORKER_QUEUE_LEN;
+            w->depth--;
+            if (!w->depth)
+                w->dropping = false;
+        }
+        rb_timeouts = w->rb_timeouts;
+        flush = w->flush;
+        w->rb_timeouts = 0;
+        w->flush = false;
+        pthread_mutex_unlock(&w->lock);
+
+        pthread_mutex_lock(&info->diag_lock);
+        if (buf >= 0)
+            process_diag_nlmsg(info, diag_worker_msg(w, buf));
+        if (flush)
+            push_out_all_ring_buffers(info);
+        if (rb_timeouts) {
+            gettimeofday(&now, NULL);
+            for (i = 0; i < NUM_RING_BUFS; i++) {
+                if (rb_timeouts & BIT(i))
+                    rb_check_for_timeout(&info->rb_infos[i], &now);
+            }
+        }
+        export_pending = pcapng_export_flush_due(info);
+        pthread_mutex_unlock(&info->diag_lock);
+        if (export_pending) {
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += PCAPNG_FLUSH_INTERVAL_US / 1000000;
+            deadline.tv_nsec += (PCAPNG_FLUSH_INTERVAL_US % 1000000) * 1000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+        }
+
+        pthread_mutex_lock(&w->lock);
+        if (buf >= 0) {
+            free(w->big[buf]);
+            w->big[buf] = NULL;
+            w->free_bufs[w->num_free++] = buf;
+            w->stats.decoded++;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+struct diag_worker *diag_worker_start(hal_info *info)
+{
+    struct diag_worker *w;
+    pthread_condattr_t attr;
+    int i, ret;
+
+    w = (struct diag_worker *)calloc(1, sizeof(struct diag_worker));
+    if (w == NULL) {
+        ALOGE("Failed to alloc diag worker");
+        return NULL;
+    }
+    w->pool = (u8 *)malloc((size_t)(DIAG_WORKER_QUEUE_LEN + 1) *
+                           DIAG_WORKER_BUF_SIZE);
+    if (w->pool == NULL) {
+        ALOGE("Failed to alloc diag worker pool");
+        free(w);
+        return NULL;
+    }
+    for (i = 0; i <= DIAG_WORKER_QUEUE_LEN; i++)
+        w->free_bufs[i] = i;
+    w->num_free = DIAG_WORKER_QUEUE_LEN + 1;
+    w->stats.queue_len = DIAG_WORKER_QUEUE_LEN;
+    w->info = info;
+    pthread_mutex_init(&w->lock, NULL);
+    /* The pcapng flush wake up is timed on the monotonic clock */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    ret = pthread_create(&w->thread, NULL, diag_worker_thread, w);
+    if (ret) {
+        ALOGE("Failed to start diag worker: %s", strerror(ret));
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        free(w->pool);
+        free(w);
+        return NULL;
+    }
+    pthread_setname_np(w->thread, "wifihal_diag");
+    return w;
+}
+
+/* Decodes what is still queued, then ends the worker */
+void diag_worker_stop(struct diag_worker *w)
+{
+    if (w == NULL)
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    ALOGI("Diag worker: %" PRIu64 " queued, %" PRIu64 " decoded, %" PRIu64
+          " dropped, %" PRIu64 " oversized, max depth %u of %u",
+          w->stats.queued, w->stats.decoded, w->stats.dropped,
+          w->stats.oversized, w->stats.max_depth, w->stats.queue_len);
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->pool);
+    free(w);
+}
+
+/* Queues a copy of a diag message; never waits for the worker */
+wifi_error diag_worker_queue_msg(struct diag_worker *w,
+                                 const struct nlmsghdr *nlh)
+{
+    bool first_drop = false;
+    u8 *big = NULL;
+    int buf;
+
+    if (nlh->nlmsg_len > DIAG_WORKER_BUF_SIZE) {
+        big = (u8 *)malloc(nlh->nlmsg_len);
+        pthread_mutex_lock(&w->lock);
+        w->stats.oversized++;
+        if (big == NULL)
+            w->stats.dropped++;
+        pthread_mutex_unlock(&w->lock);
+        if (big == NULL) {
+            ALOGE("Dropped diag message of %u bytes", nlh->nlmsg_len);
+            return WIFI_ERROR_OUT_OF_MEMORY;
+        }
+        memcpy(big, nlh, nlh->nlmsg_len);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    if (w->depth == DIAG_WORKER_QUEUE_LEN) {
+        /* Drop the oldest message and reuse its buffer */
+        buf = w->queue[w->head];
+        w->head = (w->head + 1) % DIAG_WORKER_QUEUE_LEN;
+        w->depth--;
+        free(w->big[buf]);
+        w->big[buf] = NULL;
+        w->stats.dropped++;
+        first_drop = !w->dropping;
+        w->dropping = true;
+    } else {
+        buf = w->free_bufs[--w->num_free];
+    }
+    if (big)
+        w->big[buf] = big;
+    else
+        memcpy(diag_worker_msg(w, buf), nlh, nlh->nlmsg_len);
+    w->queue[(w->head + w->depth) % DIAG_WORKER_QUEUE_LEN] = buf;
+    w->depth++;
+    w->stats.queued++;
+    if ((u32)w->depth > w->stats.max_depth)
+        w->stats.max_depth = w->depth;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    if (first_drop)
+        ALOGE("Diag queue full, dropping oldest messages");
+    return WIFI_SUCCESS;
+}
+
+/* Has the worker check the flush deadline of a ring whose timer fired */
+void diag_worker_post_rb_timeout(struct diag_worker *w, int rb_id)
+{
+    pthread_mutex_lock(&w->lock);
+    w->rb_timeouts |= BIT(rb_id);
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Has the worker push out all rings */
+void diag_worker_post_flush(struct diag_worker *w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->flush = true;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+wifi_error wifi_get_diag_queue_stats(wifi_handle handle,
+                                     wifi_diag_queue_stats *stats)
+{
+    hal_info *info = getHalInfo(handle);
+    struct diag_worker *w;
+
+    if (!info || !stats)
+        return WIFI_ERROR_INVALID_ARGS;
+
+    w = info->diag_worker;
+    if (w == NULL)
+        return WIFI_ERROR_NOT_AVAILABLE;
+
+    pthread_mutex_lock(&w->lock);
+    *stats = w->stats;
+    stats->depth = w->depth;
+    pthread_mutex_unlock(&w->lock);
+    return WIFI_SUCCESS;
+}
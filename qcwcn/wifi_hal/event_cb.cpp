@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#define LOG_TAG  "WifiHAL"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/Log.h>
+#include "event_cb.h"
+
+static inline uint32_t event_cb_hash(int cmd, uint32_t vendor_id, int subcmd)
+{
+    uint32_t h = (uint32_t)cmd * 0x9E3779B1U;
+
+    h ^= vendor_id * 0x85EBCA77U;
+    h ^= (uint32_t)subcmd * 0xC2B2AE3DU;
+    return h ^ (h >> 16);
+}
+
+static event_cb_table *event_cb_alloc(int alloc)
+{
+    event_cb_table *table;
+
+    table = (event_cb_table *)calloc(1, sizeof(event_cb_table) +
+                                        sizeof(cb_info) * alloc);
+    if (table)
+        table->alloc = alloc;
+    return table;
+}
+
+/* Returns the slot holding the key, or the free slot the key would use */
+static int event_cb_probe(event_cb_table *table, int cmd, uint32_t vendor_id,
+                          int subcmd)
+{
+    uint32_t mask = table->alloc - 1;
+    uint32_t i = event_cb_hash(cmd, vendor_id, subcmd) & mask;
+
+    while (table->slots[i].in_use) {
+        cb_info *cbi = &table->slots[i];
+
+        if (cbi->nl_cmd == cmd && cbi->vendor_id == vendor_id &&
+            cbi->vendor_subcmd == subcmd)
+            return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static cb_info *event_cb_lookup(event_cb_table *table, int cmd,
+                                uint32_t vendor_id, int subcmd)
+{
+    int i;
+
+    if (table == NULL)
+        return NULL;
+
+    i = event_cb_probe(table, cmd, vendor_id, subcmd);
+    return table->slots[i].in_use ? &table->slots[i] : NULL;
+}
+
+/* Copy of the current table with room for one more key; writer side */
+static event_cb_table *event_cb_copy(event_cb_registry *reg)
+{
+    event_cb_table *old = reg->table;
+    event_cb_table *table;
+    int alloc = old->alloc;
+
+    if ((old->num + 1) * 2 > alloc)
+        alloc *= 2;
+
+    table = event_cb_alloc(alloc);
+    if (table == NULL) {
+        ALOGE("Failed to allocate event handler table of %d", alloc);
+        return NULL;
+    }
+
+    if (alloc == old->alloc) {
+        memcpy(table->slots, old->slots, sizeof(cb_info) * alloc);
+    } else {
+        for (int i = 0; i < old->alloc; i++) {
+            cb_info *cbi = &old->slots[i];
+
+            if (!cbi->in_use)
+                continue;
+            table->slots[event_cb_probe(table, cbi->nl_cmd, cbi->vendor_id,
+                                        cbi->vendor_subcmd)] = *cbi;
+        }
+    }
+    table->num = old->num;
+    table->num_active = old->num_active;
+    return table;
+}
+
+static void event_cb_free_list(event_cb_table *table)
+{
+    event_cb_table *next;
+
+    for (; table; table = next) {
+        next = table->next_retired;
+#ifdef EVENT_CB_DEBUG
+        /* A reader still on this table now misses every key */
+        memset(table->slots, 0, sizeof(cb_info) * table->alloc);
+#endif
+        free(table);
+    }
+}
+
+/* Push a list of tables, first to last, on the retired list */
+static void event_cb_push_retired(event_cb_registry *reg, event_cb_table *first,
+                                  event_cb_table *last)
+{
+    event_cb_table *head = __atomic_load_n(&reg->retired, __ATOMIC_SEQ_CST);
+
+    do {
+        last->next_retired = head;
+    } while (!__atomic_compare_exchange_n(&reg->retired, &head, first, false,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+}
+
+/* Free the retired tables once no reader is active. The list is taken off
+ * before the reader count is read: every table on it was replaced before
+ * that, so a reader still using one was counted before the replacement and
+ * keeps the count above zero until it is done. Otherwise the list is put
+ * back, and taken again if the readers left meanwhile, as the last one may
+ * have found it missing.
+ */
+static void event_cb_reclaim(event_cb_registry *reg)
+{
+    event_cb_table *retired, *last;
+    uint32_t num;
+
+    while ((retired = __atomic_exchange_n(&reg->retired, NULL,
+                                          __ATOMIC_SEQ_CST)) != NULL) {
+        if (__atomic_load_n(&reg->readers, __ATOMIC_SEQ_CST) == 0) {
+            for (num = 0, last = retired; last; last = last->next_retired)
+                num++;
+            __atomic_fetch_sub(&reg->num_retired, num, __ATOMIC_RELAXED);
+            event_cb_free_list(retired);
+            continue;
+        }
+        for (last = retired; last->next_retired; last = last->next_retired)
+            ;
+        event_cb_push_retired(reg, retired, last);
+        if (__atomic_load_n(&reg->readers, __ATOMIC_SEQ_CST))
+            break;
+    }
+}
+
+/* Make table the current one and retire the old table; writer side. The old
+ * table is freed right away when no reader is active, otherwise by the last
+ * reader to leave. The table and retired list updates and the reader count
+ * accesses are sequentially consistent: a reader that is not counted here
+ * increments the count after the store and thus sees the new table, and
+ * one that leaves while we count sees the retired table.
+ */
+static void event_cb_publish(event_cb_registry *reg, event_cb_table *table)
+{
+    event_cb_table *old = reg->table;
+
+    __atomic_store_n(&reg->table, table, __ATOMIC_SEQ_CST);
+
+    __atomic_fetch_add(&reg->num_retired, 1, __ATOMIC_RELAXED);
+    event_cb_push_retired(reg, old, old);
+    event_cb_reclaim(reg);
+}
+
+/* Queue a handler behind the one an exclusive key has, or update the
+ * queued one with the same arg; writer side. Readers never look at the
+ * waiting list, so it is changed in place.
+ */
+static int event_cb_wait(cb_info *cbi, nl_recvmsg_msg_cb_t func, void *arg)
+{
+    cb_waiter **pos;
+    cb_waiter *waiter;
+
+    for (pos = &cbi->waiting; *pos; pos = &(*pos)->next) {
+        if ((*pos)->cb_arg == arg) {
+            (*pos)->cb_func = func;
+            return 0;
+        }
+    }
+
+    waiter = (cb_waiter *)malloc(sizeof(cb_waiter));
+    if (waiter == NULL)
+        return -ENOMEM;
+    waiter->cb_func = func;
+    waiter->cb_arg = arg;
+    waiter->next = NULL;
+    *pos = waiter;
+    return 0;
+}
+
+int event_cb_init(event_cb_registry *reg, int alloc)
+{
+    memset(reg, 0, sizeof(*reg));
+    reg->table = event_cb_alloc(alloc);
+    return reg->table ? 0 : -ENOMEM;
+}
+
+void event_cb_deinit(event_cb_registry *reg)
+{
+    event_cb_table *table = reg->table;
+
+    if (table) {
+        for (int i = 0; i < table->alloc; i++) {
+            cb_waiter *waiter;
+
+            free(table->slots[i].hits);
+            while ((waiter = table->slots[i].waiting) != NULL) {
+                table->slots[i].waiting = waiter->next;
+                free(waiter);
+            }
+        }
+        free(table);
+        reg->table = NULL;
+    }
+    event_cb_free_list(reg->retired);
+    reg->retired = NULL;
+    reg->num_retired = 0;
+}
+
+int event_cb_add(event_cb_registry *reg, int cmd, uint32_t vendor_id,
+                 int subcmd, nl_recvmsg_msg_cb_t func, void *arg,
+                 bool exclusive)
+{
+    event_cb_table *table;
+    cb_info *cbi;
+
+    if (reg->table == NULL)
+        return -EINVAL;
+
+    cbi = event_cb_lookup(reg->table, cmd, vendor_id, subcmd);
+    if (exclusive && cbi && cbi->cb_func && cbi->cb_arg != arg)
+        return event_cb_wait(cbi, func, arg);
+
+    table = event_cb_copy(reg);
+    if (table == NULL)
+        return -ENOMEM;
+
+    cbi = &table->slots[event_cb_probe(table, cmd, vendor_id, subcmd)];
+    if (!cbi->in_use) {
+        cbi->hits = (uint32_t *)calloc(1, sizeof(uint32_t));
+        if (cbi->hits == NULL) {
+            free(table);
+            return -ENOMEM;
+        }
+        cbi->nl_cmd = cmd;
+        cbi->vendor_id = vendor_id;
+        cbi->vendor_subcmd = subcmd;
+        cbi->in_use = true;
+        table->num++;
+    }
+    if (cbi->cb_func == NULL)
+        table->num_active++;
+    cbi->cb_func = func;
+    cbi->cb_arg = arg;
+
+    event_cb_publish(reg, table);
+    return 0;
+}
+
+bool event_cb_remove(event_cb_registry *reg, int cmd, uint32_t vendor_id,
+                     int subcmd)
+{
+    event_cb_table *table;
+    cb_info *cbi = event_cb_lookup(reg->table, cmd, vendor_id, subcmd);
+    cb_waiter *waiter;
+
+    if (cbi == NULL || cbi->cb_func == NULL)
+        return false;
+
+    table = event_cb_copy(reg);
+    if (table == NULL)
+        return false;
+
+    cbi = event_cb_lookup(table, cmd, vendor_id, subcmd);
+    waiter = cbi->waiting;
+    if (waiter) {
+        cbi->cb_func = waiter->cb_func;
+        cbi->cb_arg = waiter->cb_arg;
+        cbi->waiting = waiter->next;
+    } else {
+        cbi->cb_func = NULL;
+        cbi->cb_arg = NULL;
+        table->num_active--;
+    }
+
+    event_cb_publish(reg, table);
+    free(waiter);
+    return true;
+}
+
+bool event_cb_get(event_cb_registry *reg, int cmd, uint32_t vendor_id,
+                  int subcmd, nl_recvmsg_msg_cb_t *func, void **arg)
+{
+    event_cb_table *table;
+    cb_info *cbi;
+    bool found = false;
+
+    __atomic_fetch_add(&reg->readers, 1, __ATOMIC_SEQ_CST);
+    table = __atomic_load_n(&reg->table, __ATOMIC_SEQ_CST);
+
+    cbi = event_cb_lookup(table, cmd, vendor_id, subcmd);
+    if (cbi && cbi->cb_func) {
+        *func = cbi->cb_func;
+        *arg = cbi->cb_arg;
+        __atomic_fetch_add(cbi->hits, 1, __ATOMIC_RELAXED);
+        found = true;
+    }
+
+    if (__atomic_sub_fetch(&reg->readers, 1, __ATOMIC_SEQ_CST) == 0 &&
+        __atomic_load_n(&reg->retired, __ATOMIC_SEQ_CST))
+        event_cb_reclaim(reg);
+    return found;
+}
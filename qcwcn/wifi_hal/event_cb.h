@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __WIFI_HAL_EVENT_CB_H
+#define __WIFI_HAL_EVENT_CB_H
+
+#include <stdint.h>
+#include <netlink/handlers.h>
+
+/* Handler of an exclusive key registered while another one is */
+typedef struct cb_waiter_s {
+    nl_recvmsg_msg_cb_t cb_func;
+    void *cb_arg;
+    struct cb_waiter_s *next;
+} cb_waiter;
+
+typedef struct {
+    int nl_cmd;
+    uint32_t vendor_id;
+    int vendor_subcmd;
+    nl_recvmsg_msg_cb_t cb_func;
+    void *cb_arg;
+    uint32_t *hits;                                 // events dispatched for this key,
+                                                    // shared by all table snapshots
+    cb_waiter *waiting;                             // later handlers of the key, in
+                                                    // registration order; writers only
+    bool in_use;                                    // slot holds a key
+} cb_info;
+
+/* Open addressing table of event handlers keyed by (nl_cmd, vendor_id,
+ * vendor_subcmd), linear probing, kept at most half full. A key keeps its
+ * slot after the handler is unregistered (cb_func == NULL) so the hit
+ * counters cover the whole lifetime of the HAL.
+ *
+ * A published table is never modified. Writers, serialized by the caller,
+ * copy it, change the copy and swap the table pointer; readers look up the
+ * current table without a lock. Replaced tables are kept on a retired list
+ * until no reader is active, and freed by the writer or the last reader to
+ * leave.
+ */
+typedef struct event_cb_table_s {
+    int alloc;                                      // number of slots, power of two
+    int num;                                        // number of slots in use
+    int num_active;                                 // number of registered handlers
+    struct event_cb_table_s *next_retired;          // link in the retired list
+    cb_info slots[];
+} event_cb_table;
+
+/* The event handlers of a HAL instance */
+typedef struct {
+    event_cb_table *table;                          // current snapshot
+    event_cb_table *retired;                        // replaced snapshots not yet freed
+    uint32_t num_retired;                           // length of the retired list
+    uint32_t readers;                               // readers using a snapshot
+} event_cb_registry;
+
+/* Sets up an empty registry of alloc slots, a power of two. Returns 0 or
+ * -ENOMEM.
+ */
+int event_cb_init(event_cb_registry *reg, int alloc);
+
+/* Frees all tables, handlers and counters; no reader may be active */
+void event_cb_deinit(event_cb_registry *reg);
+
+/* Adds or updates the handler of a key; writers serialized. The first handler of an
+ * exclusive key keeps its events and handlers added after it with another
+ * arg wait for it to be removed. Returns 0, -ENOMEM, or -EINVAL without a
+ * table.
+ */
+int event_cb_add(event_cb_registry *reg, int cmd, uint32_t vendor_id,
+                 int subcmd, nl_recvmsg_msg_cb_t func, void *arg,
+                 bool exclusive);
+
+/* Removes the handler of a key, keeping its counters; writers serialized. The next
+ * waiting handler of the key, if any, takes over. Returns false if the key
+ * had no handler.
+ */
+bool event_cb_remove(event_cb_registry *reg, int cmd, uint32_t vendor_id,
+                     int subcmd);
+
+/* Looks up the handler of an event without a lock and counts the event.
+ * The last reader to leave frees the retired tables. Returns false if no handler is registered for the key.
+ */
+bool event_cb_get(event_cb_registry *reg, int cmd, uint32_t vendor_id,
+                  int subcmd, nl_recvmsg_msg_cb_t *func, void **arg);
+
+#endif /* __WIFI_HAL_EVENT_CB_H */
@@ -217,7 +217,7 @@ wifi_error GScanCommandEventHandler::gscan_parse_hotlist_ap_results(
                                             u32 num_results,
                                             wifi_scan_result *results,
                                             u32 starting_index,
-                                            struct nlattr **tb_vendor)
+                                            const gscan_attr_view &tb_vendor)
 {
     u32 i = starting_index;
     struct nlattr *scanResultsInfo;
@@ -348,7 +348,7 @@ wifi_error GScanCommandEventHandler::gscan_parse_hotlist_ap_results(
 static wifi_error gscan_get_significant_change_results(u32 num_results,
                                     wifi_significant_change_result **results,
                                     u32 starting_index,
-                                    struct nlattr **tb_vendor)
+                                    const gscan_attr_view &tb_vendor)
 {
     u32 i = starting_index;
     int j;
@@ -457,7 +457,7 @@ wifi_error GScanCommandEventHandler::gscan_parse_hotlist_ssid_results(
                                             u32 num_results,
                                             wifi_scan_result *results,
                                             u32 starting_index,
-                                            struct nlattr **tb_vendor)
+                                            const gscan_attr_view &tb_vendor)
 {
     u32 i = starting_index;
     struct nlattr *scanResultsInfo;
@@ -586,7 +586,7 @@ wifi_error GScanCommandEventHandler::gscan_parse_hotlist_ssid_results(
 }
 
 wifi_error GScanCommandEventHandler::gscan_parse_passpoint_network_result(
-            struct nlattr **tb_vendor)
+            const gscan_attr_view &tb_vendor)
 {
     struct nlattr *scanResultsInfo, *wifiScanResultsInfo;
     u32 resultsBufSize = 0;
@@ -778,7 +778,7 @@ wifi_error GScanCommandEventHandler::gscan_parse_pno_network_results(
                                             u32 num_results,
                                             wifi_scan_result *results,
                                             u32 starting_index,
-                                            struct nlattr **tb_vendor)
+                                            const gscan_attr_view &tb_vendor)
 {
     u32 i = starting_index;
     struct nlattr *scanResultsInfo;
@@ -942,7 +942,7 @@ int GScanCommandEventHandler::handleEvent(WifiEvent &event)
     unsigned i=0;
     int ret = WIFI_SUCCESS;
     wifi_scan_result *result = NULL;
-    struct nlattr *tbVendor[QCA_WLAN_VENDOR_ATTR_GSCAN_RESULTS_MAX + 1];
+    gscan_attr_view tbVendor;
 
     if (mEventHandlingEnabled == false)
     {
@@ -953,9 +953,7 @@ int GScanCommandEventHandler::handleEvent(WifiEvent &event)
 
     WifiVendorCommand::handleEvent(event);
 
-    nla_parse(tbVendor, QCA_WLAN_VENDOR_ATTR_GSCAN_RESULTS_MAX,
-                        (struct nlattr *)mVendorData,
-                        mDataLen, NULL);
+    tbVendor.init((struct nlattr *)mVendorData, mDataLen);
 
     switch(mSubcmd)
     {
@@ -21,6 +21,9 @@
 #include "cpp_bindings.h"
 #include "gscancommand.h"
 
+/* Vendor data of the GScan result events */
+typedef nl_attr_view<QCA_WLAN_VENDOR_ATTR_GSCAN_RESULTS_MAX> gscan_attr_view;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -78,19 +81,19 @@ public:
             u32 num_results,
             wifi_scan_result *results,
             u32 starting_index,
-            struct nlattr **tb_vendor);
+            const gscan_attr_view &tb_vendor);
     wifi_error gscan_parse_hotlist_ssid_results(
             u32 num_results,
             wifi_scan_result *results,
             u32 starting_index,
-            struct nlattr **tb_vendor);
+            const gscan_attr_view &tb_vendor);
     wifi_error gscan_parse_passpoint_network_result(
-            struct nlattr **tb_vendor);
+            const gscan_attr_view &tb_vendor);
     wifi_error gscan_parse_pno_network_results(
             u32 numResults,
             wifi_scan_result *mPnoNetworkFoundResults,
             u32 startingIndex,
-            struct nlattr **tbVendor);
+            const gscan_attr_view &tbVendor);
 };
 
 #ifdef __cplusplus
@@ -29,6 +29,7 @@
 #include "common.h"
 #include "cpp_bindings.h"
 #include "llstatscommand.h"
+#include "pkt_rates.h"
 
 //Singleton Static Instance
 LLStatsCommand* LLStatsCommand::mLLStatsCommandInstance  = NULL;
@@ -398,6 +399,14 @@ static wifi_error get_wifi_rate_stat(wifi_rate_stat *stats,
         return WIFI_ERROR_INVALID_ARGS;
     }
     stats->rate.bitrate         = nla_get_u32(tb_vendor[QCA_WLAN_VENDOR_ATTR_LL_STATS_RATE_BIT_RATE]);
+    /* Rate HE/EHT entries reported without a bit rate from the tables,
+     * assuming the 0.8 us guard interval */
+    if (!stats->rate.bitrate)
+        stats->rate.bitrate = get_rate_he_eht(stats->rate.preamble,
+                                              stats->rate.nss,
+                                              stats->rate.rateMcsIdx,
+                                              stats->rate.bw,
+                                              HE_EHT_GI_0_8US);
 
     if (!tb_vendor[QCA_WLAN_VENDOR_ATTR_LL_STATS_RATE_TX_MPDU])
     {
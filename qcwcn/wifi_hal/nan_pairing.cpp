@@ -1016,8 +1016,10 @@ static int nan_send_nl_msg(hal_info *info, struct nl_msg *msg)
 {
     int res = 0;
     struct nl_cb * cb = NULL;
+    cmd_sock_info *cs;
+    u64 send_us;
 
-    pthread_mutex_lock(&info->cb_lock);
+    cs = wifi_get_cmd_sock(info);
 
     cb = nl_cb_alloc(NL_CB_DEFAULT);
     if (!cb) {
@@ -1026,14 +1028,15 @@ static int nan_send_nl_msg(hal_info *info, struct nl_msg *msg)
         goto out;
     }
 
-    if (!info->cmd_sock) {
+    if (!cs) {
         ALOGE("%s: Command socket is null",__func__);
         res = -1;
         goto out;
     }
 
     /* send message */
-    res = nl_send_auto_complete(info->cmd_sock, msg);
+    send_us = wifi_monotonic_us();
+    res = nl_send_auto_complete(cs->sock, msg);
     if (res < 0) {
         ALOGE("%s: send msg failed. err = %d",__func__, res);
         goto out;
@@ -1047,11 +1050,12 @@ static int nan_send_nl_msg(hal_info *info, struct nl_msg *msg)
 
     // err is populated as part of finish_handler
     while (res > 0)
-        nl_recvmsgs(info->cmd_sock, cb);
+        nl_recvmsgs(cs->sock, cb);
 
+    wifi_record_msg_latency(info, msg, send_us, 0, 0, res < 0);
 out:
     nl_cb_put(cb);
-    pthread_mutex_unlock(&info->cb_lock);
+    wifi_put_cmd_sock(cs);
     return res;
 }
 
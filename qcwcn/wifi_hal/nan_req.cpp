@@ -2378,8 +2378,10 @@ wifi_error NanCommand::requestEvent()
     wifi_error res;
     int status;
     struct nl_cb * cb = NULL;
+    cmd_sock_info *cs;
+    u64 send_us;
 
-    pthread_mutex_lock(&mInfo->cb_lock);
+    cs = wifi_get_cmd_sock(mInfo);
 
     cb = nl_cb_alloc(NL_CB_DEFAULT);
     if (!cb) {
@@ -2388,15 +2390,16 @@ wifi_error NanCommand::requestEvent()
         goto out;
     }
 
-    if (!mInfo->cmd_sock) {
+    if (!cs) {
         ALOGE("%s: Command socket is null",__func__);
         res = WIFI_ERROR_OUT_OF_MEMORY;
         goto out;
     }
 
     /* send message */
-    ALOGV("%s:Handle:%p Socket Value:%p", __func__, mInfo, mInfo->cmd_sock);
-    status = nl_send_auto_complete(mInfo->cmd_sock, mMsg.getMessage());
+    ALOGV("%s:Handle:%p Socket Value:%p", __func__, mInfo, cs->sock);
+    send_us = wifi_monotonic_us();
+    status = nl_send_auto_complete(cs->sock, mMsg.getMessage());
     if (status < 0) {
         res = mapKernelErrortoWifiHalError(status);
         goto out;
@@ -2410,8 +2413,10 @@ wifi_error NanCommand::requestEvent()
 
     // err is populated as part of finish_handler
     while (status > 0)
-        nl_recvmsgs(mInfo->cmd_sock, cb);
+        nl_recvmsgs(cs->sock, cb);
 
+    wifi_record_msg_latency(mInfo, mMsg.getMessage(), send_us, 0, 0,
+                            status < 0);
     res = mapKernelErrortoWifiHalError(status);
 out:
     nl_cb_put(cb);
@@ -2422,7 +2427,7 @@ out:
     mVendorData = NULL;
     //cleanup the mMsg
     mMsg.destroy();
-    pthread_mutex_unlock(&mInfo->cb_lock);
+    wifi_put_cmd_sock(cs);
     return res;
 }
 
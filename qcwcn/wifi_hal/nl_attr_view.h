@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __WIFI_HAL_NL_ATTR_VIEW_H
+#define __WIFI_HAL_NL_ATTR_VIEW_H
+
+#include <stdint.h>
+#include <string.h>
+#include <netlink/attr.h>
+
+/* Index of a netlink attribute stream for the attribute types 1..MAX_TYPE
+ * of its attribute set. Nothing is done until the first lookup, which
+ * walks the stream once and records the attributes present (a bitmap plus
+ * their offsets), so a message whose attributes are never looked at costs
+ * nothing. Unlike nla_parse() into a MAX-sized table, nothing proportional
+ * to the attribute space is zeroed. As with nla_parse(), the last instance
+ * of a repeated attribute wins and type 0 or types above MAX_TYPE are
+ * ignored.
+ */
+template <int MAX_TYPE>
+class nl_attr_view
+{
+public:
+    nl_attr_view() {
+        init(NULL, 0);
+    }
+
+    nl_attr_view(struct nlattr *head, int len) {
+        init(head, len);
+    }
+
+    void init(struct nlattr *head, int len) {
+        mHead = (char *)head;
+        mLen = len;
+        mIndexed = false;
+    }
+
+    struct nlattr *get(int type) const {
+        if (type <= 0 || type > MAX_TYPE)
+            return NULL;
+        if (!mIndexed)
+            index();
+        if (!(mPresent[type / 64] & (1ULL << (type % 64))))
+            return NULL;
+        return (struct nlattr *)(mHead + mOffset[type]);
+    }
+
+    struct nlattr *operator[](int type) const {
+        return get(type);
+    }
+
+private:
+    void index() const {
+        struct nlattr *nla;
+        int rem, type;
+
+        memset(mPresent, 0, sizeof(mPresent));
+        mIndexed = true;
+        if (mHead == NULL)
+            return;
+
+        nla_for_each_attr(nla, (struct nlattr *)mHead, mLen, rem) {
+            type = nla_type(nla);
+            if (type == 0 || type > MAX_TYPE)
+                continue;
+            mPresent[type / 64] |= 1ULL << (type % 64);
+            mOffset[type] = (uint32_t)((char *)nla - mHead);
+        }
+    }
+
+    char *mHead;
+    int mLen;
+    mutable bool mIndexed;
+    mutable uint64_t mPresent[MAX_TYPE / 64 + 1];
+    mutable uint32_t mOffset[MAX_TYPE + 1];    // valid only for present types
+};
+
+#endif /* __WIFI_HAL_NL_ATTR_VIEW_H */
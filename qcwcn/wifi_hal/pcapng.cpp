@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_TAG  "WifiHAL"
+
+#include <utils/Log.h>
+
+#include "pcapng.h"
+
+typedef unsigned char u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define PCAPNG_BT_SHB 0x0A0D0D0A
+#define PCAPNG_BT_IDB 0x00000001
+#define PCAPNG_BT_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_EPB_FLAGS 2
+
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_IEEE802_11_RADIOTAP 127
+
+/* Largest datagram handed to a socket sink at once */
+#define PCAPNG_SOCK_CHUNK 16384
+
+#define PCAPNG_PAD4(len) (((len) + 3) & ~(size_t)3)
+
+struct pcapng_writer {
+    int fd;
+    struct sockaddr_storage dest;
+    socklen_t dest_len;         // 0 for a file sink
+    u8 *buf;
+    size_t size;
+    size_t head;                // first byte not yet taken by the sink
+    size_t tail;                // end of the buffered blocks
+    u64 last_flush_us;
+    struct pcapng_stats stats;
+};
+
+static u64 pcapng_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline u8 *pcapng_put32(u8 *p, u32 v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static inline u8 *pcapng_put16(u8 *p, u16 v)
+{
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static u8 *pcapng_put_opt(u8 *p, u16 code, const void *val, size_t len)
+{
+    p = pcapng_put16(p, code);
+    p = pcapng_put16(p, (u16)len);
+    memcpy(p, val, len);
+    memset(p + len, 0, PCAPNG_PAD4(len) - len);
+    return p + PCAPNG_PAD4(len);
+}
+
+/* Makes room for a block of len bytes; NULL if the sink is too far behind */
+static u8 *pcapng_reserve(struct pcapng_writer *w, size_t len)
+{
+    if (w->size - w->tail < len && w->head) {
+        memmove(w->buf, w->buf + w->head, w->tail - w->head);
+        w->tail -= w->head;
+        w->head = 0;
+    }
+    if (w->size - w->tail < len)
+        return NULL;
+    return w->buf + w->tail;
+}
+
+static void pcapng_put_idb(struct pcapng_writer *w, u16 link_type)
+{
+    u8 *p = w->buf + w->tail;
+
+    p = pcapng_put32(p, PCAPNG_BT_IDB);
+    p = pcapng_put32(p, 20);
+    p = pcapng_put16(p, link_type);
+    p = pcapng_put16(p, 0);
+    p = pcapng_put32(p, 0);     // no snaplen; timestamps in microseconds
+    p = pcapng_put32(p, 20);
+    w->tail += 20;
+}
+
+struct pcapng_writer *pcapng_open(int fd, const struct sockaddr *dest,
+                                  socklen_t dest_len, size_t buf_size)
+{
+    struct pcapng_writer *w;
+    u64 section_len = (u64)-1;
+    u8 *p;
+
+    if (dest_len > sizeof(w->dest) || buf_size < 128)
+        return NULL;
+
+    w = (struct pcapng_writer *)calloc(1, sizeof(struct pcapng_writer));
+    if (w == NULL) {
+        ALOGE("Failed to alloc pcapng writer");
+        return NULL;
+    }
+    w->buf = (u8 *)malloc(buf_size);
+    if (w->buf == NULL) {
+        ALOGE("Failed to alloc pcapng buffer of %zu bytes", buf_size);
+        free(w);
+        return NULL;
+    }
+    w->fd = fd;
+    w->size = buf_size;
+    if (dest) {
+        memcpy(&w->dest, dest, dest_len);
+        w->dest_len = dest_len;
+    }
+    w->last_flush_us = pcapng_now_us();
+
+    p = w->buf;
+    p = pcapng_put32(p, PCAPNG_BT_SHB);
+    p = pcapng_put32(p, 28);
+    p = pcapng_put32(p, PCAPNG_BYTE_ORDER_MAGIC);
+    p = pcapng_put16(p, 1);
+    p = pcapng_put16(p, 0);
+    memcpy(p, &section_len, sizeof(section_len));
+    p += sizeof(section_len);
+    p = pcapng_put32(p, 28);
+    w->tail = 28;
+
+    pcapng_put_idb(w, LINKTYPE_ETHERNET);
+    pcapng_put_idb(w, LINKTYPE_IEEE802_11_RADIOTAP);
+
+    return w;
+}
+
+int pcapng_flush(struct pcapng_writer *w)
+{
+    size_t len;
+    ssize_t ret;
+
+    w->last_flush_us = pcapng_now_us();
+    while (w->head < w->tail) {
+        len = w->tail - w->head;
+        if (w->dest_len) {
+            if (len > PCAPNG_SOCK_CHUNK)
+                len = PCAPNG_SOCK_CHUNK;
+            ret = sendto(w->fd, w->buf + w->head, len,
+                         MSG_DONTWAIT | MSG_NOSIGNAL,
+                         (struct sockaddr *)&w->dest, w->dest_len);
+        } else {
+            ret = write(w->fd, w->buf + w->head, len);
+        }
+
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                w->stats.stalls++;
+                return PCAPNG_OK;
+            }
+            ALOGE("%s: pcapng sink failed: %s", __FUNCTION__, strerror(errno));
+            return PCAPNG_SINK_FAILED;
+        }
+        w->head += ret;
+        w->stats.bytes += ret;
+    }
+    w->head = w->tail = 0;
+    return PCAPNG_OK;
+}
+
+int pcapng_write_packet(struct pcapng_writer *w, uint32_t if_id,
+                        uint64_t ts_us, uint32_t epb_flags,
+                        const void *hdr, size_t hdr_len,
+                        const void *data, size_t data_len,
+                        const char *comment)
+{
+    size_t cap_len = hdr_len + data_len;
+    size_t comment_len = comment ? strlen(comment) : 0;
+    size_t opt_len = 0, blen;
+    u8 *block, *p;
+    int ret;
+
+    if (comment_len > 0xFFFF)
+        comment_len = 0xFFFF;
+    if (epb_flags)
+        opt_len += 8;
+    if (comment_len)
+        opt_len += 4 + PCAPNG_PAD4(comment_len);
+    if (opt_len)
+        opt_len += 4;
+    blen = 28 + PCAPNG_PAD4(cap_len) + opt_len + 4;
+
+    block = pcapng_reserve(w, blen);
+    if (block == NULL) {
+        /* Give the sink a chance before dropping */
+        ret = pcapng_flush(w);
+        if (ret != PCAPNG_OK)
+            return ret;
+        block = pcapng_reserve(w, blen);
+        if (block == NULL) {
+            w->stats.dropped++;
+            return PCAPNG_DROPPED;
+        }
+    }
+
+    p = pcapng_put32(block, PCAPNG_BT_EPB);
+    p = pcapng_put32(p, (u32)blen);
+    p = pcapng_put32(p, if_id);
+    p = pcapng_put32(p, (u32)(ts_us >> 32));
+    p = pcapng_put32(p, (u32)ts_us);
+    p = pcapng_put32(p, (u32)cap_len);
+    p = pcapng_put32(p, (u32)cap_len);
+    if (hdr_len)
+        memcpy(p, hdr, hdr_len);
+    if (data_len)
+        memcpy(p + hdr_len, data, data_len);
+    memset(p + cap_len, 0, PCAPNG_PAD4(cap_len) - cap_len);
+    p += PCAPNG_PAD4(cap_len);
+    if (epb_flags)
+        p = pcapng_put_opt(p, PCAPNG_OPT_EPB_FLAGS, &epb_flags,
+                           sizeof(epb_flags));
+    if (comment_len)
+        p = pcapng_put_opt(p, PCAPNG_OPT_COMMENT, comment, comment_len);
+    if (opt_len)
+        p = pcapng_put32(p, PCAPNG_OPT_END);
+    pcapng_put32(p, (u32)blen);
+
+    w->tail += blen;
+    w->stats.packets++;
+
+    if (w->tail - w->head >= w->size / 2 ||
+        pcapng_now_us() - w->last_flush_us >= PCAPNG_FLUSH_INTERVAL_US)
+        return pcapng_flush(w);
+    return PCAPNG_OK;
+}
+
+int pcapng_flush_due(struct pcapng_writer *w)
+{
+    if (w->head == w->tail ||
+        pcapng_now_us() - w->last_flush_us < PCAPNG_FLUSH_INTERVAL_US)
+        return PCAPNG_OK;
+    return pcapng_flush(w);
+}
+
+bool pcapng_pending(struct pcapng_writer *w)
+{
+    return w->head != w->tail;
+}
+
+void pcapng_get_stats(struct pcapng_writer *w, struct pcapng_stats *stats)
+{
+    *stats = w->stats;
+}
+
+void pcapng_close(struct pcapng_writer *w)
+{
+    if (w == NULL)
+        return;
+    pcapng_flush(w);
+    if (!w->dest_len)
+        close(w->fd);
+    free(w->buf);
+    free(w);
+}
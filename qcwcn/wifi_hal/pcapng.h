@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __PCAPNG_H
+#define __PCAPNG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Streaming pcapng writer. Blocks are built in a bounded buffer and
+ * drained to a file, or as datagrams to a unix socket whose reader
+ * concatenates them, without ever blocking: while the sink cannot keep up
+ * the buffer fills and further packets are dropped and counted.
+ *
+ * The section carries two interfaces, by index:
+ */
+#define PCAPNG_IF_ETHERNET 0 /* LINKTYPE_ETHERNET */
+#define PCAPNG_IF_RADIOTAP 1 /* LINKTYPE_IEEE802_11_RADIOTAP */
+
+/* epb_flags direction */
+#define PCAPNG_EPB_INBOUND  1
+#define PCAPNG_EPB_OUTBOUND 2
+
+/* Buffered blocks are flushed at half the buffer or after this long */
+#define PCAPNG_FLUSH_INTERVAL_US 1000000
+
+#define PCAPNG_OK           0
+#define PCAPNG_DROPPED      -1 /* buffer full, packet not written */
+#define PCAPNG_SINK_FAILED  -2 /* sink gone, writer must be closed */
+
+struct pcapng_stats {
+    uint64_t packets;   /* packets queued */
+    uint64_t bytes;     /* bytes handed to the sink */
+    uint64_t dropped;   /* packets dropped on a full buffer */
+    uint64_t stalls;    /* flushes the sink could not take in full */
+};
+
+struct pcapng_writer;
+
+/* Starts a section on fd, buffering up to buf_size bytes. With dest set,
+ * fd is a datagram socket the blocks are sent on to dest; otherwise fd is
+ * written to and owned by the writer, which closes it.
+ */
+struct pcapng_writer *pcapng_open(int fd, const struct sockaddr *dest,
+                                  socklen_t dest_len, size_t buf_size);
+
+/* Queues an enhanced packet block of hdr followed by data, both optional;
+ * epb_flags and comment are left out when 0/NULL. Returns PCAPNG_*.
+ */
+int pcapng_write_packet(struct pcapng_writer *w, uint32_t if_id,
+                        uint64_t ts_us, uint32_t epb_flags,
+                        const void *hdr, size_t hdr_len,
+                        const void *data, size_t data_len,
+                        const char *comment);
+
+/* Hands buffered blocks to the sink, as far as it takes them */
+int pcapng_flush(struct pcapng_writer *w);
+
+/* Flushes once PCAPNG_FLUSH_INTERVAL_US passed since the last flush, for
+ * callers that poll while no packets come in. Returns PCAPNG_*.
+ */
+int pcapng_flush_due(struct pcapng_writer *w);
+
+/* Whether blocks are buffered that the sink has not taken yet */
+bool pcapng_pending(struct pcapng_writer *w);
+
+void pcapng_get_stats(struct pcapng_writer *w, struct pcapng_stats *stats);
+
+/* Flushes what the sink takes and frees the writer */
+void pcapng_close(struct pcapng_writer *w);
+
+#endif /* __PCAPNG_H */
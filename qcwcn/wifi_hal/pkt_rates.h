@@ -0,0 +1,440 @@
+/* Copyright (c) 2015, The Linux Foundation. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ *    copyright notice, this list of conditions and the following
+ *    disclaimer in the documentation and/or other materials provided
+ *    with the distribution.
+ *  * Neither the name of The Linux Foundation nor the names of its
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+ * Changes from Qualcomm Innovation Center are provided under the following license:
+ *
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* PHY rate tables of the per-packet stats. Everything here is constexpr and
+ * depends only on <stdint.h>, so the tables can be checked on the host
+ * (see rb_bench/rate_check.cpp).
+ */
+#ifndef _PKT_RATES_H_
+#define _PKT_RATES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* MAX HT/VHT mcs index */
+#define MAX_VHT_MCS_IDX 10
+#define MAX_HT_MCS_IDX 8
+
+/* MAX CCK/OFDM rate index */
+#define MAX_CCK_MCS_IDX 4
+#define MAX_OFDM_MCS_IDX 8
+
+/* Wifi Logger preamble */
+#define WL_PREAMBLE_CCK  0
+#define WL_PREAMBLE_OFDM 1
+#define WL_PREAMBLE_HT   2
+#define WL_PREAMBLE_VHT  3
+
+/* bandwidht type*/
+typedef enum {
+    BW_20MHZ,
+    BW_40MHZ,
+    BW_80MHZ,
+    BW_160MHZ,
+    BW_320MHZ,                  /* HE/EHT rates only */
+} bandwidth;
+
+/* Preamble type*/
+typedef enum {
+    WIFI_HW_RATECODE_PREAM_OFDM = 0,
+    WIFI_HW_RATECODE_PREAM_CCK  = 1,
+    WIFI_HW_RATECODE_PREAM_HT   = 2,
+    WIFI_HW_RATECODE_PREAM_VHT  = 3,
+    WIFI_HW_RATECODE_PREAM_COUNT,
+} WIFI_HW_RATECODE_PREAM_TYPE;
+
+/**
+ * struct index_data_rate_type - non vht data rate type
+ * @rate_index: cck  rate index
+ * @cck_rate: CCK supported rate table
+ */
+struct index_data_rate_cck_type {
+    uint8_t  rate_index;
+    uint16_t cck_rate[2];
+};
+
+/**
+ * struct index_data_rate_type - non vht data rate type
+ * @rate_index: ofdm  rate index
+ * @ofdm__rate: OFDM supported rate table
+ */
+struct index_data_rate_ofdm_type {
+    uint8_t  rate_index;
+    uint16_t ofdm_rate[2];
+};
+
+/*Below CCK/OFDM table refer from firmware Arch */
+/* Rate Table Based on CCK */
+static constexpr struct index_data_rate_cck_type cck_mcs_nss1[] = {
+    /*RC     LKbps   SKbps */
+    {0x40,  {11000,  11000} },
+    {0x41,  {5500,   5500} },
+    {0x42,  {2000,   2000} },
+    {0x43,  {1000,   1000} }
+};
+
+/* Rate Table Based on OFDM */
+static constexpr struct index_data_rate_ofdm_type ofdm_mcs_nss1[] = {
+    /*RC     LKbps   SKbps */
+    {0x00,  {48000,  48000} },
+    {0x01,  {34000,  24000} },
+    {0x02,  {12000,  12000} },
+    {0x03,  {6000,   6000} },
+    {0x04,  {54000,  54000} },
+    {0x05,  {36000,  36000} },
+    {0x06,  {18000,  18000} },
+    {0x07,  {9000,   9000} }
+};
+
+/**
+ * struct index_data_rate_type - non vht data rate type
+ * @mcs_index: mcs rate index
+ * @ht20_rate: HT20 supported rate table
+ * @ht40_rate: HT40 supported rate table
+ */
+struct index_data_rate_type {
+    uint8_t  mcs_index;
+    uint16_t ht20_rate[2];
+    uint16_t ht40_rate[2];
+};
+
+/**
+ * struct index_vht_data_rate_type - vht data rate type
+ * @mcs_index: mcs rate index
+ * @ht20_rate: VHT20 supported rate table
+ * @ht40_rate: VHT40 supported rate table
+ * @ht80_rate: VHT80 supported rate table
+ */
+struct index_vht_data_rate_type {
+    uint8_t mcs_index;
+    uint16_t ht20_rate[2];
+    uint16_t ht40_rate[2];
+    uint16_t ht80_rate[2];
+};
+
+/*Below HT/VHT table refer from Host Driver
+ * MCS Based rate table
+ * HT MCS parameters with Nss = 1
+ */
+static constexpr struct index_data_rate_type mcs_nss1[] = {
+    /* MCS L20  S20   L40   S40 */
+    {0,  {65,  72},  {135,  150 } },
+    {1,  {130, 144}, {270,  300 } },
+    {2,  {195, 217}, {405,  450 } },
+    {3,  {260, 289}, {540,  600 } },
+    {4,  {390, 433}, {815,  900 } },
+    {5,  {520, 578}, {1080, 1200} },
+    {6,  {585, 650}, {1215, 1350} },
+    {7,  {650, 722}, {1350, 1500} }
+};
+
+/* HT MCS parameters with Nss = 2 */
+static constexpr struct index_data_rate_type mcs_nss2[] = {
+    /* MCS L20  S20    L40   S40 */
+    {0,  {130,  144},  {270,  300 } },
+    {1,  {260,  289},  {540,  600 } },
+    {2,  {390,  433},  {810,  900 } },
+    {3,  {520,  578},  {1080, 1200} },
+    {4,  {780,  867},  {1620, 1800} },
+    {5,  {1040, 1156}, {2160, 2400} },
+    {6,  {1170, 1300}, {2430, 2700} },
+    {7,  {1300, 1440}, {2700, 3000} }
+};
+
+/* MCS Based VHT rate table
+ * MCS parameters with Nss = 1
+ */
+static constexpr struct index_vht_data_rate_type vht_mcs_nss1[] = {
+    /* MCS L20  S20    L40   S40    L80   S80 */
+    {0,  {65,   72 }, {135,  150},  {293,  325} },
+    {1,  {130,  144}, {270,  300},  {585,  650} },
+    {2,  {195,  217}, {405,  450},  {878,  975} },
+    {3,  {260,  289}, {540,  600},  {1170, 1300} },
+    {4,  {390,  433}, {810,  900},  {1755, 1950} },
+    {5,  {520,  578}, {1080, 1200}, {2340, 2600} },
+    {6,  {585,  650}, {1215, 1350}, {2633, 2925} },
+    {7,  {650,  722}, {1350, 1500}, {2925, 3250} },
+    {8,  {780,  867}, {1620, 1800}, {3510, 3900} },
+    {9,  {865,  960}, {1800, 2000}, {3900, 4333} }
+};
+
+/*MCS parameters with Nss = 2*/
+static constexpr struct index_vht_data_rate_type vht_mcs_nss2[] = {
+    /* MCS L20  S20    L40    S40    L80    S80 */
+    {0,  {130,  144},  {270,  300},  { 585,  650} },
+    {1,  {260,  289},  {540,  600},  {1170, 1300} },
+    {2,  {390,  433},  {810,  900},  {1755, 1950} },
+    {3,  {520,  578},  {1080, 1200}, {2340, 2600} },
+    {4,  {780,  867},  {1620, 1800}, {3510, 3900} },
+    {5,  {1040, 1156}, {2160, 2400}, {4680, 5200} },
+    {6,  {1170, 1300}, {2430, 2700}, {5265, 5850} },
+    {7,  {1300, 1444}, {2700, 3000}, {5850, 6500} },
+    {8,  {1560, 1733}, {3240, 3600}, {7020, 7800} },
+    {9,  {1730, 1920}, {3600, 4000}, {7800, 8667} }
+};
+
+/* L-SIG rate of a CCK PPDU to the CCK rate code */
+static constexpr uint8_t cck_ratecode[16] = {
+    0x0, 0x3, 0x2, 0x1, 0x0, 0x2, 0x1, 0x0
+};
+
+static constexpr uint16_t rate_lookup[][8] = {{96, 48, 24, 12, 108, 72, 36, 18},
+                                         {22, 11,  4,  2,  22, 11,  4,  0}};
+static constexpr uint16_t MCS_rate_lookup_ht[][8] =
+                              {{ 13,  14,  27,  30,  59,  65,  117,  130},
+                               { 26,  29,  54,  60, 117, 130,  234,  260},
+                               { 39,  43,  81,  90, 176, 195,  351,  390},
+                               { 52,  58, 108, 120, 234, 260,  468,  520},
+                               { 78,  87, 162, 180, 351, 390,  702,  780},
+                               {104, 116, 216, 240, 468, 520,  936, 1040},
+                               {117, 130, 243, 270, 527, 585, 1053, 1170},
+                               {130, 144, 270, 300, 585, 650, 1170, 1300},
+                               {156, 173, 324, 360, 702, 780, 1404, 1560},
+                               {  0,   0, 360, 400, 780, 867, 1560, 1733},
+                               { 26,  29,  54,  60, 117, 130,  234,  260},
+                               { 52,  58, 108, 120, 234, 260,  468,  520},
+                               { 78,  87, 162, 180, 351, 390,  702,  780},
+                               {104, 116, 216, 240, 468, 520,  936, 1040},
+                               {156, 173, 324, 360, 702, 780, 1404, 1560},
+                               {208, 231, 432, 480, 936,1040, 1872, 2080},
+                               {234, 261, 486, 540,1053,1170, 2106, 2340},
+                               {260, 289, 540, 600,1170,1300, 2340, 2600},
+                               {312, 347, 648, 720,1404,1560, 2808, 3120},
+                               {  0,   0, 720, 800,1560,1733, 3120, 3467}};
+
+/* Rate in 500 Kbps units for pktlog v2 rate codes (WIFI_HW_RATECODE_PREAM_*),
+ * 0 for combinations the firmware tables do not cover.
+ */
+static constexpr uint16_t calc_rate_v1(uint8_t rate, uint8_t nss, uint8_t preamble, uint8_t bw,
+                                  uint8_t short_gi)
+{
+    const struct index_data_rate_type *ht = NULL;
+    const struct index_vht_data_rate_type *vht = NULL;
+
+    switch (preamble) {
+      case WIFI_HW_RATECODE_PREAM_OFDM:
+           if (rate >= MAX_OFDM_MCS_IDX)
+               return 0;
+           return ofdm_mcs_nss1[rate].ofdm_rate[short_gi] / 1000;
+      case WIFI_HW_RATECODE_PREAM_CCK:
+           if (rate >= MAX_CCK_MCS_IDX)
+               return 0;
+           return cck_mcs_nss1[rate].cck_rate[short_gi] / 1000;
+      case WIFI_HW_RATECODE_PREAM_HT:
+           if (rate >= MAX_HT_MCS_IDX || nss > 1)
+               return 0;
+           ht = nss ? &mcs_nss2[rate] : &mcs_nss1[rate];
+           if (bw == BW_20MHZ)
+               return ht->ht20_rate[short_gi] / 10;
+           if (bw == BW_40MHZ)
+               return ht->ht40_rate[short_gi] / 10;
+           return 0;
+      case WIFI_HW_RATECODE_PREAM_VHT:
+           if (rate >= MAX_VHT_MCS_IDX || nss > 1)
+               return 0;
+           vht = nss ? &vht_mcs_nss2[rate] : &vht_mcs_nss1[rate];
+           if (bw == BW_20MHZ)
+               return vht->ht20_rate[short_gi] / 10;
+           /* 80 MHz has always been reported with the 40 MHz rate */
+           if (bw == BW_40MHZ || bw == BW_80MHZ)
+               return vht->ht40_rate[short_gi] / 10;
+           return 0;
+    }
+    return 0;
+}
+
+/* Rate in 500 Kbps units for pktlog v1 rate codes (WL_PREAMBLE_*) */
+static constexpr uint16_t calc_rate(uint8_t rate, uint8_t nss, uint8_t preamble, uint8_t bw,
+                               uint8_t short_gi)
+{
+    uint8_t row = (nss ? 10 : 0) + rate;
+
+    if (rate >= 10)
+        return 0;
+
+    switch (preamble) {
+        case WL_PREAMBLE_CCK:
+        case WL_PREAMBLE_OFDM:
+            if (rate >= 8)
+                return 0;
+            return rate_lookup[preamble][rate] * (nss ? 2 : 1);
+        case WL_PREAMBLE_HT:
+            if (rate >= 8)
+                return 0;
+            return MCS_rate_lookup_ht[row][2 * bw + short_gi];
+        case WL_PREAMBLE_VHT:
+            return MCS_rate_lookup_ht[row][2 * bw + short_gi];
+    }
+    return 0;
+}
+
+/* The rate of an MCS depends only on its rate, nss, preamble, bw and
+ * short_gi fields, 11 bits in all, so both conversions are tabulated at
+ * compile time and cost a single load per PPDU.
+ */
+#define MCS_RATE_IDX_BITS 11
+
+static constexpr uint16_t mcs_rate_idx(uint8_t rate, uint8_t nss, uint8_t preamble, uint8_t bw,
+                                  uint8_t short_gi)
+{
+    return rate | nss << 4 | preamble << 6 | bw << 8 | short_gi << 10;
+}
+
+struct mcs_rate_table {
+    uint16_t rate[1 << MCS_RATE_IDX_BITS];
+    uint16_t rate_v1[1 << MCS_RATE_IDX_BITS];
+
+    constexpr mcs_rate_table() : rate(), rate_v1()
+    {
+        for (uint16_t i = 0; i < (1 << MCS_RATE_IDX_BITS); i++) {
+            uint8_t r = i & 0xF, nss = (i >> 4) & 0x3, pre = (i >> 6) & 0x3;
+            uint8_t bw = (i >> 8) & 0x3, sgi = (i >> 10) & 0x1;
+
+            rate[i] = calc_rate(r, nss, pre, bw, sgi);
+            rate_v1[i] = calc_rate_v1(r, nss, pre, bw, sgi);
+        }
+    }
+};
+
+static constexpr mcs_rate_table mcs_rates;
+
+static_assert(mcs_rates.rate[mcs_rate_idx(9, 1, WL_PREAMBLE_VHT,
+                                          BW_160MHZ, 1)] == 3467,
+              "VHT160 nss2 MCS9 SGI rate");
+static_assert(mcs_rates.rate[mcs_rate_idx(3, 1, WL_PREAMBLE_CCK,
+                                          BW_20MHZ, 0)] == 24,
+              "legacy rate doubles with nss");
+static_assert(mcs_rates.rate[mcs_rate_idx(8, 0, WL_PREAMBLE_HT,
+                                          BW_20MHZ, 0)] == 0,
+              "HT MCS8 is not a valid rate");
+static_assert(mcs_rates.rate_v1[mcs_rate_idx(7, 1, WIFI_HW_RATECODE_PREAM_HT,
+                                             BW_40MHZ, 1)] == 300,
+              "HT40 nss2 MCS7 SGI rate");
+static_assert(mcs_rates.rate_v1[mcs_rate_idx(0, 0, WIFI_HW_RATECODE_PREAM_CCK,
+                                             BW_20MHZ, 0)] == 11,
+              "CCK 11 Mbps rate");
+static_assert(mcs_rates.rate_v1[mcs_rate_idx(9, 2, WIFI_HW_RATECODE_PREAM_VHT,
+                                             BW_20MHZ, 0)] == 0,
+              "VHT nss3 is not in the rate tables");
+
+/* HE (802.11ax) and EHT (802.11be) rates. The per-packet MCS word has a 2-bit
+ * preamble and cannot carry these, so they are keyed by the wifi_rate fields
+ * (preamble, nss, rateMcsIdx, bw) plus the guard interval, and given in
+ * 100 Kbps units like wifi_rate.bitrate.
+ */
+#define RATE_PREAMBLE_HE  4
+#define RATE_PREAMBLE_EHT 5
+
+#define MAX_HE_MCS_IDX  12
+#define MAX_EHT_MCS_IDX 14
+#define MAX_HE_EHT_NSS  4
+
+enum he_eht_gi {
+    HE_EHT_GI_0_8US,
+    HE_EHT_GI_1_6US,
+    HE_EHT_GI_3_2US,
+};
+
+/* Data subcarriers of the full bandwidth RU, BW_20MHZ to BW_320MHZ */
+static constexpr uint16_t he_eht_data_subcarriers[] = {
+    234, 468, 980, 1960, 3920
+};
+
+/* Coded bits per subcarrier times 12 (modulation x coding rate), by MCS */
+static constexpr uint8_t he_eht_bits_x12[] = {
+    6, 12, 18, 24, 36, 48, 54, 60, 72, 80, 90, 100, 108, 120
+};
+
+/* 12.8 us symbol plus guard interval, in 100 ns units */
+static constexpr uint8_t he_eht_symbol_100ns[] = { 136, 144, 160 };
+
+static constexpr uint32_t calc_rate_he_eht(uint8_t eht, uint8_t nss,
+                                           uint8_t mcs, uint8_t bw, uint8_t gi)
+{
+    if (mcs >= (eht ? MAX_EHT_MCS_IDX : MAX_HE_MCS_IDX) ||
+        bw > (eht ? BW_320MHZ : BW_160MHZ) || gi > HE_EHT_GI_3_2US)
+        return 0;
+    return (uint32_t)he_eht_data_subcarriers[bw] * he_eht_bits_x12[mcs] *
+           (nss + 1) * 100 / (12 * he_eht_symbol_100ns[gi]);
+}
+
+#define HE_EHT_RATE_IDX_BITS 12
+
+static constexpr uint16_t he_eht_rate_idx(uint8_t eht, uint8_t nss,
+                                          uint8_t mcs, uint8_t bw, uint8_t gi)
+{
+    return eht | nss << 1 | mcs << 3 | bw << 7 | gi << 10;
+}
+
+struct he_eht_rate_table {
+    uint32_t rate[1 << HE_EHT_RATE_IDX_BITS];
+
+    constexpr he_eht_rate_table() : rate()
+    {
+        for (uint16_t i = 0; i < (1 << HE_EHT_RATE_IDX_BITS); i++)
+            rate[i] = calc_rate_he_eht(i & 0x1, (i >> 1) & 0x3,
+                                       (i >> 3) & 0xF, (i >> 7) & 0x7,
+                                       (i >> 10) & 0x3);
+    }
+};
+
+static constexpr he_eht_rate_table he_eht_rates;
+
+static_assert(he_eht_rates.rate[he_eht_rate_idx(0, 1, 11, BW_80MHZ,
+                                                HE_EHT_GI_0_8US)] == 12009,
+              "HE80 nss2 MCS11 rate");
+static_assert(he_eht_rates.rate[he_eht_rate_idx(0, 0, 0, BW_20MHZ,
+                                                HE_EHT_GI_3_2US)] == 73,
+              "HE20 MCS0 3.2 us GI rate");
+static_assert(he_eht_rates.rate[he_eht_rate_idx(1, 0, 13, BW_320MHZ,
+                                                HE_EHT_GI_0_8US)] == 28823,
+              "EHT320 MCS13 rate");
+static_assert(he_eht_rates.rate[he_eht_rate_idx(0, 0, 12, BW_20MHZ,
+                                                HE_EHT_GI_0_8US)] == 0,
+              "HE has no MCS12");
+static_assert(he_eht_rates.rate[he_eht_rate_idx(0, 0, 0, BW_320MHZ,
+                                                HE_EHT_GI_0_8US)] == 0,
+              "HE has no 320 MHz");
+
+/* Rate of an HE or EHT PPDU in 100 Kbps units, 0 if not covered */
+static inline uint32_t get_rate_he_eht(uint8_t preamble, uint8_t nss,
+                                       uint8_t mcs, uint8_t bw, uint8_t gi)
+{
+    if ((preamble != RATE_PREAMBLE_HE && preamble != RATE_PREAMBLE_EHT) ||
+        nss >= MAX_HE_EHT_NSS || mcs > 0xF || bw > 0x7 || gi > 0x3)
+        return 0;
+    return he_eht_rates.rate[he_eht_rate_idx(preamble == RATE_PREAMBLE_EHT,
+                                             nss, mcs, bw, gi)];
+}
+
+#endif /* _PKT_RATES_H_ */
@@ -29,6 +29,8 @@
 #ifndef _PKT_STATS_H_
 #define _PKT_STATS_H_
 
+#include "pkt_rates.h"
+
 /* Types of packet log events.
  * Tx stats will be sent from driver with the help of multiple events.
  * Need to parse the events PKTLOG_TYPE_TX_CTRL and PKTLOG_TYPE_TX_STAT
@@ -87,14 +89,6 @@
 #define FRAME_CTRL_OFFSET 216
 #define QOS_CTRL_OFFSET 218
 
-/* MAX HT/VHT mcs index */
-#define MAX_VHT_MCS_IDX 10
-#define MAX_HT_MCS_IDX 8
-
-/* MAX CCK/OFDM rate index */
-#define MAX_CCK_MCS_IDX 4
-#define MAX_OFDM_MCS_IDX 8
-
 /* MASK value of flags based on RX_STAT content.
  * These are the events that carry Rx decriptor
  */
@@ -213,12 +207,6 @@ struct rx_msdu_end_v1 {
 #define PREAMBLE_VHT_SIG_A_1    0x08
 #define PREAMBLE_VHT_SIG_A_2    0x0c
 
-/* Wifi Logger preamble */
-#define WL_PREAMBLE_CCK  0
-#define WL_PREAMBLE_OFDM 1
-#define WL_PREAMBLE_HT   2
-#define WL_PREAMBLE_VHT  3
-
 #define BITMASK(x) ((1<<(x)) - 1 )
 #define MAX_BA_WINDOW_SIZE 64
 #define SEQ_NUM_RANGE 4096
@@ -414,156 +402,21 @@ typedef struct {
     u8 flags;
 } RATE_CODE;
 
-/* bandwidht type*/
-typedef enum {
-    BW_20MHZ,
-    BW_40MHZ,
-    BW_80MHZ,
-    BW_160MHZ,
-} bandwidth;
-
-/* Preamble type*/
-typedef enum {
-    WIFI_HW_RATECODE_PREAM_OFDM = 0,
-    WIFI_HW_RATECODE_PREAM_CCK  = 1,
-    WIFI_HW_RATECODE_PREAM_HT   = 2,
-    WIFI_HW_RATECODE_PREAM_VHT  = 3,
-    WIFI_HW_RATECODE_PREAM_COUNT,
-} WIFI_HW_RATECODE_PREAM_TYPE;
-
-/**
- * struct index_data_rate_type - non vht data rate type
- * @rate_index: cck  rate index
- * @cck_rate: CCK supported rate table
- */
-struct index_data_rate_cck_type {
-    uint8_t  rate_index;
-    uint16_t cck_rate[2];
-};
-
-/**
- * struct index_data_rate_type - non vht data rate type
- * @rate_index: ofdm  rate index
- * @ofdm__rate: OFDM supported rate table
- */
-struct index_data_rate_ofdm_type {
-    uint8_t  rate_index;
-    uint16_t ofdm_rate[2];
-};
-
-/*Below CCK/OFDM table refer from firmware Arch */
-/* Rate Table Based on CCK */
-static struct index_data_rate_cck_type cck_mcs_nss1[] = {
-    /*RC     LKbps   SKbps */
-    {0x40,  {11000,  11000} },
-    {0x41,  {5500,   5500} },
-    {0x42,  {2000,   2000} },
-    {0x43,  {1000,   1000} }
-};
-
-/* Rate Table Based on OFDM */
-static struct index_data_rate_ofdm_type ofdm_mcs_nss1[] = {
-    /*RC     LKbps   SKbps */
-    {0x00,  {48000,  48000} },
-    {0x01,  {34000,  24000} },
-    {0x02,  {12000,  12000} },
-    {0x03,  {6000,   6000} },
-    {0x04,  {54000,  54000} },
-    {0x05,  {36000,  36000} },
-    {0x06,  {18000,  18000} },
-    {0x07,  {9000,   9000} }
-};
-
-/**
- * struct index_data_rate_type - non vht data rate type
- * @mcs_index: mcs rate index
- * @ht20_rate: HT20 supported rate table
- * @ht40_rate: HT40 supported rate table
- */
-struct index_data_rate_type {
-    uint8_t  mcs_index;
-    uint16_t ht20_rate[2];
-    uint16_t ht40_rate[2];
-};
-
-/**
- * struct index_vht_data_rate_type - vht data rate type
- * @mcs_index: mcs rate index
- * @ht20_rate: VHT20 supported rate table
- * @ht40_rate: VHT40 supported rate table
- * @ht80_rate: VHT80 supported rate table
- */
-struct index_vht_data_rate_type {
-    uint8_t mcs_index;
-    uint16_t ht20_rate[2];
-    uint16_t ht40_rate[2];
-    uint16_t ht80_rate[2];
-};
-
-/*Below HT/VHT table refer from Host Driver
- * MCS Based rate table
- * HT MCS parameters with Nss = 1
- */
-static struct index_data_rate_type mcs_nss1[] = {
-    /* MCS L20  S20   L40   S40 */
-    {0,  {65,  72},  {135,  150 } },
-    {1,  {130, 144}, {270,  300 } },
-    {2,  {195, 217}, {405,  450 } },
-    {3,  {260, 289}, {540,  600 } },
-    {4,  {390, 433}, {815,  900 } },
-    {5,  {520, 578}, {1080, 1200} },
-    {6,  {585, 650}, {1215, 1350} },
-    {7,  {650, 722}, {1350, 1500} }
-};
-
-/* HT MCS parameters with Nss = 2 */
-static struct index_data_rate_type mcs_nss2[] = {
-    /* MCS L20  S20    L40   S40 */
-    {0,  {130,  144},  {270,  300 } },
-    {1,  {260,  289},  {540,  600 } },
-    {2,  {390,  433},  {810,  900 } },
-    {3,  {520,  578},  {1080, 1200} },
-    {4,  {780,  867},  {1620, 1800} },
-    {5,  {1040, 1156}, {2160, 2400} },
-    {6,  {1170, 1300}, {2430, 2700} },
-    {7,  {1300, 1440}, {2700, 3000} }
-};
-
-/* MCS Based VHT rate table
- * MCS parameters with Nss = 1
- */
-static struct index_vht_data_rate_type vht_mcs_nss1[] = {
-    /* MCS L20  S20    L40   S40    L80   S80 */
-    {0,  {65,   72 }, {135,  150},  {293,  325} },
-    {1,  {130,  144}, {270,  300},  {585,  650} },
-    {2,  {195,  217}, {405,  450},  {878,  975} },
-    {3,  {260,  289}, {540,  600},  {1170, 1300} },
-    {4,  {390,  433}, {810,  900},  {1755, 1950} },
-    {5,  {520,  578}, {1080, 1200}, {2340, 2600} },
-    {6,  {585,  650}, {1215, 1350}, {2633, 2925} },
-    {7,  {650,  722}, {1350, 1500}, {2925, 3250} },
-    {8,  {780,  867}, {1620, 1800}, {3510, 3900} },
-    {9,  {865,  960}, {1800, 2000}, {3900, 4333} }
-};
+#define RING_BUF_ENTRY_SIZE 512
+#define PKT_STATS_BUF_SIZE 128
 
-/*MCS parameters with Nss = 2*/
-static struct index_vht_data_rate_type vht_mcs_nss2[] = {
-    /* MCS L20  S20    L40    S40    L80    S80 */
-    {0,  {130,  144},  {270,  300},  { 585,  650} },
-    {1,  {260,  289},  {540,  600},  {1170, 1300} },
-    {2,  {390,  433},  {810,  900},  {1755, 1950} },
-    {3,  {520,  578},  {1080, 1200}, {2340, 2600} },
-    {4,  {780,  867},  {1620, 1800}, {3510, 3900} },
-    {5,  {1040, 1156}, {2160, 2400}, {4680, 5200} },
-    {6,  {1170, 1300}, {2430, 2700}, {5265, 5850} },
-    {7,  {1300, 1444}, {2700, 3000}, {5850, 6500} },
-    {8,  {1560, 1733}, {3240, 3600}, {7020, 7800} },
-    {9,  {1730, 1920}, {3600, 4000}, {7800, 8667} }
+/* Pkt stats ring entries decoded from one pktlog buffer by parse_stats(),
+ * written to the ring together once the buffer is done or this is full */
+#define PKT_STATS_BATCH_SIZE 16384
+#define PKT_STATS_BATCH_MAX_RECS 128
+struct pkt_stats_batch {
+    bool active;
+    int num_recs;
+    u32 len;
+    size_t rec_len[PKT_STATS_BATCH_MAX_RECS];
+    u8 buf[PKT_STATS_BATCH_SIZE];
 };
-/*********************************************************/
 
-#define RING_BUF_ENTRY_SIZE 512
-#define PKT_STATS_BUF_SIZE 128
 struct pkt_stats_s {
     u8 tx_stats_events;
     /* TODO: Need to handle the case if size of the stats are more
@@ -583,6 +436,7 @@ struct pkt_stats_s {
     bool isBlockAck;
     u8 tx_bandwidth;
     u8 series;
+    struct pkt_stats_batch batch;
 };
 
 typedef union {
@@ -664,11 +518,56 @@ typedef struct {
     frame_info_i frame_inf;
 } wifi_rx_report_i;
 
+/* Property overriding the number of frame bytes kept per fate entry */
+#define PKT_FATE_FRAME_LEN_PROP "persist.vendor.wifi.hal.fate_frame_len"
+
+/* Property holding the fate capture filter, space separated terms of
+ *   class=<eapol,dhcp,arp,mgmt,data>  classes of frames to keep
+ *   tx_fate=<mask> rx_fate=<mask>     wifi_{tx,rx}_packet_fate bits to keep
+ *   mgmt=<mask>                       mgmt frame subtype bits to keep
+ *   mac=<xx:xx:xx:xx:xx:xx>           keep frames from or to this address
+ *   sample=<class>:<n>,...            keep one in n frames of the class
+ * Terms left out keep everything; e.g. "class=eapol,dhcp,arp,mgmt".
+ */
+#define PKT_FATE_FILTER_PROP "persist.vendor.wifi.hal.fate_filter"
+
+enum pkt_fate_class {
+    PKT_FATE_CLASS_EAPOL,
+    PKT_FATE_CLASS_DHCP,
+    PKT_FATE_CLASS_ARP,
+    PKT_FATE_CLASS_MGMT,
+    PKT_FATE_CLASS_DATA,    // any other data frame
+    PKT_FATE_CLASS_MAX
+};
+
+typedef struct {
+    u32 class_mask;
+    u32 tx_fate_mask;
+    u32 rx_fate_mask;
+    u16 mgmt_subtype_mask;
+    bool match_mac;
+    u8 mac[6];
+    u32 sample[PKT_FATE_CLASS_MAX]; // 0 or 1 keeps every frame
+} pkt_fate_filter;
+
+/* Circular capture of the latest MAX_FATE_LOG_LEN fates per direction.
+ * Entry n of a direction lives in slot n % MAX_FATE_LOG_LEN, and its
+ * frame_content points at that slot's fixed frame_len_max bytes in
+ * frame_slab, so recording a fate never allocates.
+ */
 typedef struct {
     wifi_tx_report_i tx_fate_stats[MAX_FATE_LOG_LEN];
-    size_t n_tx_stats_collected;
+    u64 tx_seq;         // tx fates recorded since monitoring started
+    u64 tx_first_seq;   // tx_seq when the current capture was started
     wifi_rx_report_i rx_fate_stats[MAX_FATE_LOG_LEN];
-    size_t n_rx_stats_collected;
+    u64 rx_seq;
+    u64 rx_first_seq;
+    size_t frame_len_max;
+    char *frame_slab;
+    pkt_fate_filter filter;
+    u64 sample_seen[PKT_FATE_CLASS_MAX];
+    u64 n_matched;      // pktdump events that passed the filter
+    u64 n_dropped;      // pktdump events the filter dropped
 } packet_fate_monitor_info;
 
 #endif
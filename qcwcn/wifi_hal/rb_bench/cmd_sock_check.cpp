@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Contention of the command socket pool (cmd_sock_pool.cpp).
+ *
+ * Threads issue synchronous commands as the request loops of
+ * cpp_bindings.cpp do: check out a socket, send, wait for the reply with
+ * the socket held and give it back. The send is a short busy loop and the
+ * reply a sleep of 20 to 200 us, the usual round trip of a vendor command
+ * through the driver. An event thread meanwhile dispatches an event every
+ * 100 us. With a shared lock it takes the lock of the only socket first,
+ * as wifi_event_loop() took cb_lock while commands held it for their
+ * whole exchange; otherwise it only measures its own wakeup delay. The
+ * runs compare that, a pool of one socket, and pools of 2 and
+ * DEFAULT_CMD_SOCK_POOL_SIZE sockets, for 4 and 8 command threads. A
+ * socket checked out by two commands at once is a failure.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cmd_sock_pool.h"
+#include "cmd_sock_check.h"
+
+#define CSB_MAX_SOCKS       4       // DEFAULT_CMD_SOCK_POOL_SIZE of common.h
+#define CSB_SEND_NS         2000
+#define CSB_REPLY_MIN_NS    20000
+#define CSB_REPLY_SPAN_NS   180000
+#define CSB_EVENT_NS        100000
+#define CSB_MAX_EVENTS      65536
+
+typedef struct {
+    cmd_sock_info socks[CSB_MAX_SOCKS];
+    uint32_t in_use[CSB_MAX_SOCKS];
+    int num_socks;
+    uint32_t next;
+    bool shared_lock;
+    int cmds;
+    uint32_t seed;
+    uint64_t *waits;                /* cmds per thread */
+    uint64_t *dispatch;             /* CSB_MAX_EVENTS */
+    uint64_t events;
+    uint32_t done;
+    uint32_t failures;
+} csb_state;
+
+typedef struct {
+    csb_state *st;
+    int id;
+} csb_thread;
+
+/* xorshift32, as in rb_bench.cpp */
+static uint32_t csb_rnd(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static uint64_t csb_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void csb_sleep_ns(uint64_t ns)
+{
+    struct timespec ts = { (time_t)(ns / 1000000000ULL),
+                           (long)(ns % 1000000000ULL) };
+
+    nanosleep(&ts, NULL);
+}
+
+static void *csb_cmd_thread(void *arg)
+{
+    csb_thread *t = (csb_thread *)arg;
+    csb_state *st = t->st;
+    uint32_t rnd = st->seed * 2654435761U + t->id;
+    cmd_sock_info *cs;
+    uint64_t start;
+    int i, idx;
+
+    if (!rnd)
+        rnd = 1;
+    for (i = 0; i < st->cmds; i++) {
+        start = csb_now_ns();
+        cs = cmd_sock_pool_get(st->socks, st->num_socks, &st->next);
+        st->waits[t->id * st->cmds + i] = csb_now_ns() - start;
+
+        idx = cs - st->socks;
+        if (__atomic_exchange_n(&st->in_use[idx], 1, __ATOMIC_ACQ_REL))
+            __atomic_fetch_add(&st->failures, 1, __ATOMIC_RELAXED);
+
+        start = csb_now_ns();
+        while (csb_now_ns() - start < CSB_SEND_NS)
+            ;
+        csb_sleep_ns(CSB_REPLY_MIN_NS + csb_rnd(&rnd) % CSB_REPLY_SPAN_NS);
+
+        __atomic_store_n(&st->in_use[idx], 0, __ATOMIC_RELEASE);
+        cmd_sock_pool_put(cs);
+    }
+    return NULL;
+}
+
+static void *csb_event_thread(void *arg)
+{
+    csb_state *st = (csb_state *)arg;
+    uint64_t due = csb_now_ns() + CSB_EVENT_NS, now;
+
+    while (!__atomic_load_n(&st->done, __ATOMIC_ACQUIRE) &&
+           st->events < CSB_MAX_EVENTS) {
+        now = csb_now_ns();
+        if (now < due)
+            csb_sleep_ns(due - now);
+        if (st->shared_lock) {
+            pthread_mutex_lock(&st->socks[0].lock);
+            pthread_mutex_unlock(&st->socks[0].lock);
+        }
+        now = csb_now_ns();
+        st->dispatch[st->events++] = now - due;
+        due = now + CSB_EVENT_NS;
+    }
+    return NULL;
+}
+
+static int csb_cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t csb_pct(const uint64_t *sorted, uint64_t n, int pct)
+{
+    return n ? sorted[(n - 1) * pct / 100] : 0;
+}
+
+static void csb_run(uint32_t seed, int cmds, int num_socks, int threads,
+                    bool shared_lock, cmd_sock_bench_result *res)
+{
+    csb_state *st;
+    csb_thread t[8];
+    pthread_t tid[8], ev;
+    uint64_t start, n;
+    int i, started;
+
+    memset(res, 0, sizeof(*res));
+    res->pool_size = num_socks;
+    res->threads = threads;
+    res->shared_lock = shared_lock;
+
+    st = (csb_state *)calloc(1, sizeof(*st));
+    if (st == NULL) {
+        res->failures++;
+        return;
+    }
+    st->waits = (uint64_t *)calloc((size_t)threads * cmds, sizeof(uint64_t));
+    st->dispatch = (uint64_t *)calloc(CSB_MAX_EVENTS, sizeof(uint64_t));
+    if (st->waits == NULL || st->dispatch == NULL) {
+        res->failures++;
+        goto cleanup;
+    }
+    st->num_socks = num_socks;
+    st->shared_lock = shared_lock;
+    st->cmds = cmds;
+    st->seed = seed;
+    for (i = 0; i < num_socks; i++)
+        pthread_mutex_init(&st->socks[i].lock, NULL);
+
+    if (pthread_create(&ev, NULL, csb_event_thread, st)) {
+        res->failures++;
+        goto destroy;
+    }
+    start = csb_now_ns();
+    for (started = 0; started < threads; started++) {
+        t[started].st = st;
+        t[started].id = started;
+        if (pthread_create(&tid[started], NULL, csb_cmd_thread,
+                           &t[started])) {
+            res->failures++;
+            break;
+        }
+    }
+    for (i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    res->seconds = (csb_now_ns() - start) / 1e9;
+    __atomic_store_n(&st->done, 1, __ATOMIC_RELEASE);
+    pthread_join(ev, NULL);
+
+    n = (uint64_t)started * cmds;
+    qsort(st->waits, n, sizeof(uint64_t), csb_cmp_u64);
+    res->cmds = n;
+    res->wait_p50_ns = csb_pct(st->waits, n, 50);
+    res->wait_p99_ns = csb_pct(st->waits, n, 99);
+    res->wait_max_ns = n ? st->waits[n - 1] : 0;
+
+    qsort(st->dispatch, st->events, sizeof(uint64_t), csb_cmp_u64);
+    res->events = st->events;
+    res->dispatch_p99_ns = csb_pct(st->dispatch, st->events, 99);
+    res->dispatch_max_ns = st->events ? st->dispatch[st->events - 1] : 0;
+    res->failures += st->failures;
+
+destroy:
+    for (i = 0; i < num_socks; i++)
+        pthread_mutex_destroy(&st->socks[i].lock);
+cleanup:
+    free(st->waits);
+    free(st->dispatch);
+    free(st);
+}
+
+void cmd_sock_bench(uint32_t seed, int cmds, cmd_sock_bench_result *res)
+{
+    static const int threads[] = { 4, 8 };
+    int n = 0;
+
+    for (int i = 0; i < 2; i++) {
+        csb_run(seed, cmds, 1, threads[i], true, &res[n++]);
+        csb_run(seed, cmds, 1, threads[i], false, &res[n++]);
+        csb_run(seed, cmds, 2, threads[i], false, &res[n++]);
+        csb_run(seed, cmds, CSB_MAX_SOCKS, threads[i], false, &res[n++]);
+    }
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __CMD_SOCK_CHECK_H
+#define __CMD_SOCK_CHECK_H
+
+#include <stdint.h>
+
+typedef struct {
+    int pool_size;
+    int threads;                /* issuing commands concurrently */
+    bool shared_lock;           /* events dispatched under the command lock,
+                                   as with cb_lock before the pool */
+    uint64_t cmds;
+    double seconds;
+    uint64_t wait_p50_ns;       /* cmd_sock_pool_get() latency */
+    uint64_t wait_p99_ns;
+    uint64_t wait_max_ns;
+    uint64_t events;
+    uint64_t dispatch_p99_ns;   /* delay of an event behind the commands */
+    uint64_t dispatch_max_ns;
+    uint32_t failures;          /* socket checked out twice at once */
+} cmd_sock_bench_result;
+
+#define CMD_SOCK_BENCH_RESULTS 8
+
+/* Commands issued by each thread of a run */
+#define CMD_SOCK_BENCH_CMDS    200
+
+/* Runs concurrent commands against the command socket pool of
+ * cmd_sock_pool.cpp, see cmd_sock_check.cpp; res holds 8 results */
+void cmd_sock_bench(uint32_t seed, int cmds, cmd_sock_bench_result *res);
+
+#endif /* __CMD_SOCK_CHECK_H */
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Stress test of the event handler table (event_cb.cpp).
+ *
+ * Reader threads look up random keys without a lock, as the event loop
+ * does, while writer threads add and remove the handlers of their own keys
+ * under a writer lock. Some keys are registered for the whole run and must
+ * always be found; every handler found must be one registered for its key,
+ * and the hit counters must match the handlers the readers found. One more
+ * reader stalls on a snapshot, as a reader preempted in event_cb_get()
+ * would, across several updates and then checks it still holds the
+ * permanent keys. The host target builds event_cb.cpp with EVENT_CB_DEBUG,
+ * which clears a table before freeing it, so a reader still on a freed
+ * table misses the keys it holds. The retired list must not outgrow the
+ * updates made during the longest stall by more than the few made while
+ * the other readers overlap, and be empty once the readers are gone.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "event_cb.h"
+#include "event_cb_check.h"
+
+#define ECB_READERS       4
+#define ECB_WRITERS       2
+#define ECB_PERM_KEYS     8
+#define ECB_DYN_KEYS      32
+#define ECB_NUM_KEYS      (ECB_PERM_KEYS + ECB_DYN_KEYS)
+#define ECB_INIT_SLOTS    4
+#define ECB_STALL_UPDATES 16
+#define ECB_VENDOR_CMD    103
+
+typedef struct ecb_key_s ecb_key;
+
+/* Argument of a handler; a key has two so that exclusive keys have a
+ * waiting handler */
+typedef struct {
+    ecb_key *key;
+} ecb_owner;
+
+struct ecb_key_s {
+    int idx;
+    int cmd;
+    uint32_t vendor_id;
+    int subcmd;
+    bool exclusive;
+    ecb_owner owners[2];
+    uint64_t found;                 // handlers found by all readers
+};
+
+typedef struct {
+    event_cb_registry reg;
+    pthread_mutex_t lock;           // writer lock
+    ecb_key keys[ECB_NUM_KEYS];
+    uint32_t seed;
+    int ops;
+    bool stop;
+    uint64_t lookups;
+    uint32_t updates;
+    uint32_t stalls;
+    uint32_t max_stall_updates;
+    uint32_t max_retired;
+    uint32_t failures;
+} ecb_state;
+
+typedef struct {
+    ecb_state *st;
+    int id;
+} ecb_thread;
+
+/* xorshift32, as in rb_bench.cpp */
+static uint32_t ecb_rnd(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int ecb_handler_a(struct nl_msg *msg, void *arg)
+{
+    return ((ecb_owner *)arg)->key->idx;
+}
+
+static int ecb_handler_b(struct nl_msg *msg, void *arg)
+{
+    return ((ecb_owner *)arg)->key->idx;
+}
+
+static void ecb_fail(ecb_state *st, const char *what, int idx)
+{
+    if (__atomic_fetch_add(&st->failures, 1, __ATOMIC_RELAXED) >= 8)
+        return;
+    if (idx < 0)
+        fprintf(stderr, "event_cb_check: %s\n", what);
+    else
+        fprintf(stderr, "event_cb_check: key %d: %s\n", idx, what);
+}
+
+static void *ecb_reader(void *arg)
+{
+    ecb_thread *t = (ecb_thread *)arg;
+    ecb_state *st = t->st;
+    uint32_t rnd = st->seed * 2654435761U + t->id * 97 + 1;
+    uint64_t found[ECB_NUM_KEYS] = { 0 };
+    uint64_t lookups = 0;
+
+    while (!__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE)) {
+        ecb_key *key = &st->keys[ecb_rnd(&rnd) % ECB_NUM_KEYS];
+        nl_recvmsg_msg_cb_t func = NULL;
+        void *cb_arg = NULL;
+
+        lookups++;
+        if (!event_cb_get(&st->reg, key->cmd, key->vendor_id, key->subcmd,
+                          &func, &cb_arg)) {
+            if (key->idx < ECB_PERM_KEYS)
+                ecb_fail(st, "registered handler not found", key->idx);
+            continue;
+        }
+        found[key->idx]++;
+        if ((func != ecb_handler_a && func != ecb_handler_b) ||
+            (cb_arg != &key->owners[0] && cb_arg != &key->owners[1]) ||
+            func(NULL, cb_arg) != key->idx)
+            ecb_fail(st, "handler of another key", key->idx);
+
+        /* Wait for the next burst of events now and then, as the event
+         * loop does */
+        if ((lookups & 63) == 0) {
+            struct timespec ts = { 0, 1000 };
+
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    for (int i = 0; i < ECB_NUM_KEYS; i++)
+        __atomic_fetch_add(&st->keys[i].found, found[i], __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->lookups, lookups, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* Holds a snapshot as a reader would inside event_cb_get() */
+static void *ecb_staller(void *arg)
+{
+    ecb_state *st = ((ecb_thread *)arg)->st;
+    nl_recvmsg_msg_cb_t func;
+    void *cb_arg;
+
+    while (!__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE)) {
+        event_cb_table *table;
+        uint32_t start;
+        int perm = 0;
+
+        __atomic_fetch_add(&st->reg.readers, 1, __ATOMIC_SEQ_CST);
+        table = __atomic_load_n(&st->reg.table, __ATOMIC_SEQ_CST);
+
+        start = __atomic_load_n(&st->updates, __ATOMIC_RELAXED);
+        while (__atomic_load_n(&st->updates, __ATOMIC_RELAXED) - start <
+               ECB_STALL_UPDATES &&
+               !__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE))
+            sched_yield();
+
+        for (int i = 0; i < table->alloc; i++) {
+            cb_info *cbi = &table->slots[i];
+
+            if (cbi->in_use && cbi->cb_func && cbi->vendor_id == 0 &&
+                cbi->nl_cmd >= 1 && cbi->nl_cmd <= ECB_PERM_KEYS)
+                perm++;
+        }
+        if (perm != ECB_PERM_KEYS)
+            ecb_fail(st, "stalled snapshot lost its keys", -1);
+        start = __atomic_load_n(&st->updates, __ATOMIC_RELAXED) - start;
+        __atomic_fetch_sub(&st->reg.readers, 1, __ATOMIC_SEQ_CST);
+        if (start > st->max_stall_updates)
+            st->max_stall_updates = start;
+        st->stalls++;
+
+        /* Leave through a lookup of key 0, so the last reader reclaims */
+        if (event_cb_get(&st->reg, 1, 0, 0, &func, &cb_arg))
+            __atomic_fetch_add(&st->keys[0].found, 1, __ATOMIC_RELAXED);
+        else
+            ecb_fail(st, "registered handler not found", 0);
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void *ecb_writer(void *arg)
+{
+    ecb_thread *t = (ecb_thread *)arg;
+    ecb_state *st = t->st;
+    uint32_t rnd = st->seed * 40503U + t->id * 7919 + 1;
+
+    for (int op = 0; op < st->ops; op++) {
+        /* Writers own the dynamic keys round robin */
+        int k = ECB_PERM_KEYS + t->id +
+                (ecb_rnd(&rnd) % (ECB_DYN_KEYS / ECB_WRITERS)) * ECB_WRITERS;
+        ecb_key *key = &st->keys[k];
+        uint32_t r = ecb_rnd(&rnd);
+        uint32_t retired;
+
+        pthread_mutex_lock(&st->lock);
+        if (r & 1) {
+            if (event_cb_add(&st->reg, key->cmd, key->vendor_id, key->subcmd,
+                             (r & 2) ? ecb_handler_a : ecb_handler_b,
+                             &key->owners[(r >> 2) & 1], key->exclusive))
+                ecb_fail(st, "add failed", k);
+        } else {
+            event_cb_remove(&st->reg, key->cmd, key->vendor_id, key->subcmd);
+        }
+        retired = __atomic_load_n(&st->reg.num_retired, __ATOMIC_RELAXED);
+        if (retired > st->max_retired)
+            st->max_retired = retired;
+        __atomic_fetch_add(&st->updates, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&st->lock);
+
+        if ((op & 7) == 0)
+            sched_yield();
+    }
+    return NULL;
+}
+
+void event_cb_check(uint32_t seed, int ops, event_cb_check_result *res)
+{
+    static ecb_state st;
+    pthread_t readers[ECB_READERS], writers[ECB_WRITERS], staller;
+    ecb_thread rt[ECB_READERS], wt[ECB_WRITERS], stt;
+    event_cb_table *table;
+    int i;
+
+    memset(&st, 0, sizeof(st));
+    memset(res, 0, sizeof(*res));
+    pthread_mutex_init(&st.lock, NULL);
+    st.seed = seed;
+    st.ops = ops;
+    if (event_cb_init(&st.reg, ECB_INIT_SLOTS)) {
+        res->failures = 1;
+        return;
+    }
+
+    /* Permanent non-vendor keys, then dynamic keys alternating between
+     * exclusive non-vendor commands and vendor subcommands */
+    for (i = 0; i < ECB_NUM_KEYS; i++) {
+        ecb_key *key = &st.keys[i];
+
+        key->idx = i;
+        key->exclusive = i < ECB_PERM_KEYS || (i & 1);
+        key->cmd = key->exclusive ? i + 1 : ECB_VENDOR_CMD;
+        key->vendor_id = key->exclusive ? 0 : 0x1374;
+        key->subcmd = key->exclusive ? 0 : i;
+        key->owners[0].key = key;
+        key->owners[1].key = key;
+        if (i < ECB_PERM_KEYS &&
+            event_cb_add(&st.reg, key->cmd, key->vendor_id, key->subcmd,
+                         ecb_handler_a, &key->owners[0], true))
+            st.failures++;
+    }
+
+    for (i = 0; i < ECB_READERS; i++) {
+        rt[i].st = &st;
+        rt[i].id = i;
+        pthread_create(&readers[i], NULL, ecb_reader, &rt[i]);
+    }
+    stt.st = &st;
+    stt.id = ECB_READERS;
+    pthread_create(&staller, NULL, ecb_staller, &stt);
+    for (i = 0; i < ECB_WRITERS; i++) {
+        wt[i].st = &st;
+        wt[i].id = i;
+        pthread_create(&writers[i], NULL, ecb_writer, &wt[i]);
+    }
+    for (i = 0; i < ECB_WRITERS; i++)
+        pthread_join(writers[i], NULL);
+    __atomic_store_n(&st.stop, true, __ATOMIC_RELEASE);
+    for (i = 0; i < ECB_READERS; i++)
+        pthread_join(readers[i], NULL);
+    pthread_join(staller, NULL);
+
+    res->lookups = st.lookups;
+    res->updates = st.updates;
+    res->stalls = st.stalls;
+    res->max_stall_updates = st.max_stall_updates;
+    res->max_retired = st.max_retired;
+    res->left_retired = st.reg.num_retired;
+    if (st.reg.retired != NULL || res->left_retired)
+        ecb_fail(&st, "retired tables left after the readers", -1);
+    if (res->max_retired > st.max_stall_updates + ECB_STALL_UPDATES)
+        ecb_fail(&st, "retired list grew too long", -1);
+
+    /* Hit counters are shared by all snapshots and count every handler
+     * found */
+    table = st.reg.table;
+    for (i = 0; i < ECB_NUM_KEYS; i++) {
+        ecb_key *key = &st.keys[i];
+        nl_recvmsg_msg_cb_t func;
+        void *arg;
+        uint64_t hits = 0;
+
+        for (int s = 0; s < table->alloc; s++) {
+            cb_info *cbi = &table->slots[s];
+
+            if (cbi->in_use && cbi->nl_cmd == key->cmd &&
+                cbi->vendor_id == key->vendor_id &&
+                cbi->vendor_subcmd == key->subcmd)
+                hits = *cbi->hits;
+        }
+        if (hits != key->found)
+            ecb_fail(&st, "hit counter does not match lookups", i);
+        if (i < ECB_PERM_KEYS &&
+            !event_cb_get(&st.reg, key->cmd, key->vendor_id, key->subcmd,
+                          &func, &arg))
+            ecb_fail(&st, "registered handler lost", i);
+    }
+
+    event_cb_deinit(&st.reg);
+    pthread_mutex_destroy(&st.lock);
+    res->failures = st.failures;
+}
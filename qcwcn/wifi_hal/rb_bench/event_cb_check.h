@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __EVENT_CB_CHECK_H
+#define __EVENT_CB_CHECK_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t lookups;           /* event_cb_get calls of all readers */
+    uint32_t updates;           /* handlers added and removed by the writers */
+    uint32_t stalls;            /* snapshots held across updates */
+    uint32_t max_stall_updates; /* updates made during the longest stall */
+    uint32_t max_retired;       /* longest retired list seen by a writer */
+    uint32_t left_retired;      /* retired tables left once all are done */
+    uint32_t failures;
+} event_cb_check_result;
+
+/* Stress test of the event handler table of event_cb.cpp, see
+ * event_cb_check.cpp. Each writer makes ops updates.
+ */
+void event_cb_check(uint32_t seed, int ops, event_cb_check_result *res);
+
+#endif /* __EVENT_CB_CHECK_H */
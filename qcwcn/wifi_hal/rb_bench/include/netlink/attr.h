@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Stand-in for the libnl attribute helpers used by nl_attr_view.h, so the
+ * attribute index builds for the host without libnl. nla_parse() follows
+ * lib/attr.c of libnl 3 for the NULL policy the HAL passes: clear the
+ * table, then store every attribute up to maxtype, the last instance of a
+ * type winning.
+ */
+#ifndef __RB_BENCH_NETLINK_ATTR_H
+#define __RB_BENCH_NETLINK_ATTR_H
+
+#include <stdint.h>
+#include <string.h>
+#include <linux/netlink.h>
+
+struct nla_policy;
+
+static inline int nla_type(const struct nlattr *nla)
+{
+    return nla->nla_type & NLA_TYPE_MASK;
+}
+
+static inline void *nla_data(const struct nlattr *nla)
+{
+    return (char *)nla + NLA_HDRLEN;
+}
+
+static inline int nla_len(const struct nlattr *nla)
+{
+    return nla->nla_len - NLA_HDRLEN;
+}
+
+static inline int nla_ok(const struct nlattr *nla, int remaining)
+{
+    return remaining >= (int)sizeof(*nla) &&
+           nla->nla_len >= sizeof(*nla) &&
+           nla->nla_len <= remaining;
+}
+
+static inline struct nlattr *nla_next(const struct nlattr *nla,
+                                      int *remaining)
+{
+    int totlen = NLA_ALIGN(nla->nla_len);
+
+    *remaining -= totlen;
+    return (struct nlattr *)((char *)nla + totlen);
+}
+
+#define nla_for_each_attr(pos, head, len, rem) \
+    for (pos = head, rem = len; \
+         nla_ok(pos, rem); \
+         pos = nla_next(pos, &(rem)))
+
+static inline uint8_t nla_get_u8(const struct nlattr *nla)
+{
+    return *(const uint8_t *)nla_data(nla);
+}
+
+static inline uint16_t nla_get_u16(const struct nlattr *nla)
+{
+    return *(const uint16_t *)nla_data(nla);
+}
+
+static inline uint32_t nla_get_u32(const struct nlattr *nla)
+{
+    return *(const uint32_t *)nla_data(nla);
+}
+
+static inline uint64_t nla_get_u64(const struct nlattr *nla)
+{
+    uint64_t tmp = 0;
+
+    if (nla && nla_len(nla) >= (int)sizeof(tmp))
+        memcpy(&tmp, nla_data(nla), sizeof(tmp));
+    return tmp;
+}
+
+int nla_parse(struct nlattr *tb[], int maxtype, struct nlattr *head, int len,
+              const struct nla_policy *policy);
+
+#endif /* __RB_BENCH_NETLINK_ATTR_H */
@@ -0,0 +1,16 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Stand-in for the libnl handler type used by event_cb.h, so the event
+ * handler table builds for the host without libnl.
+ */
+#ifndef __RB_BENCH_NETLINK_HANDLERS_H
+#define __RB_BENCH_NETLINK_HANDLERS_H
+
+struct nl_msg;
+
+typedef int (*nl_recvmsg_msg_cb_t)(struct nl_msg *msg, void *arg);
+
+#endif /* __RB_BENCH_NETLINK_HANDLERS_H */
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Stand-in for the liblog macros used by ring_buffer.cpp, so the ring code
+ * builds for the host without liblog. Errors are counted by rb_bench.
+ */
+#ifndef __RB_BENCH_LOG_H
+#define __RB_BENCH_LOG_H
+
+#define RB_BENCH_LOG_INFO  4
+#define RB_BENCH_LOG_WARN  5
+#define RB_BENCH_LOG_ERROR 6
+
+void rb_bench_log(int prio, const char *tag, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define ALOGV(...) ((void)0)
+#define ALOGD(...) ((void)0)
+#define ALOGI(...) rb_bench_log(RB_BENCH_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define ALOGW(...) rb_bench_log(RB_BENCH_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define ALOGE(...) rb_bench_log(RB_BENCH_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+#endif /* __RB_BENCH_LOG_H */
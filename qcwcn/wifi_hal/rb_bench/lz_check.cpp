@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Round trip check and benchmark of the ring compression (rb_compress.cpp).
+ *
+ * The check frames random, highly repetitive, text and incompressible
+ * inputs of the edge lengths of the block format, random lengths and the
+ * maximum chunk size, and expands every LZ block back with lz_decompress()
+ * into a buffer of exactly the original length. Stored frames must hold the
+ * input as is, a chunk over the maximum must be refused, an output buffer
+ * one byte short must be refused, and damaged blocks must decode within
+ * their buffer (which the ASan build verifies).
+ *
+ * The benchmark feeds each logger ring's chunk size with data shaped like
+ * its records and reports ratio and compression and expansion speed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rb_compress.h"
+#include "lz_check.h"
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define LZ_CHECK_RANDOM_LENS   64
+#define LZ_CHECK_CORRUPTIONS   8
+#define LZ_BENCH_SAMPLE        (1 << 20)
+
+/* Chunk sizes of the logger rings, as in wifiloggercmd.h, and one with
+ * matches beyond the 16 bit offset */
+static const u32 chunk_sizes[] = { 2048, 4096, 32768, 131072 };
+
+enum lz_input {
+    LZ_IN_RANDOM,           /* random bytes of a small alphabet */
+    LZ_IN_RUNS,             /* long runs of one byte */
+    LZ_IN_PERIODIC,         /* short repeating patterns */
+    LZ_IN_TEXT,             /* driver log lines */
+    LZ_IN_INCOMPRESSIBLE,   /* uniformly random bytes */
+    LZ_IN_FAR,              /* one random block repeated far apart */
+    LZ_IN_MAX,
+};
+
+static const char *input_names[] = { "random", "runs", "periodic", "text",
+                                     "incompressible", "far" };
+
+/* xorshift32, as in rb_bench.cpp */
+static u32 lz_rnd(u32 *state)
+{
+    u32 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static size_t put_text(u8 *buf, size_t len, u32 *rnd)
+{
+    static const char *mods[] = { "HDD", "SME", "PE", "WMA", "DP", "TXRX" };
+    static const char *funcs[] = { "hdd_hostapd_sap_event_cb",
+                                   "csr_roam_process_command",
+                                   "lim_process_assoc_rsp_frame",
+                                   "wma_peer_sta_kickout_event_handler",
+                                   "dp_rx_process", "ol_tx_completion" };
+    char line[160];
+    size_t n = 0;
+    int l;
+
+    while (n < len) {
+        u32 r = lz_rnd(rnd);
+
+        l = snprintf(line, sizeof(line),
+                     "[%5u.%06u] wlan: [%u:%c:%s] %s: %d: vdev %u peer "
+                     "%02x:%02x:%02x:%02x:%02x:%02x status %u\n",
+                     r % 4000, lz_rnd(rnd) % 1000000, 1000 + r % 8,
+                     "IWE"[r % 3], mods[(r >> 4) % 6], funcs[(r >> 8) % 6],
+                     (r >> 12) % 3000, (r >> 20) % 4, 0, 3, 0x7f, 0x1c,
+                     (r >> 24) & 0xf, (r >> 28), (r >> 16) % 40);
+        if ((size_t)l > len - n)
+            l = len - n;
+        memcpy(buf + n, line, l);
+        n += l;
+    }
+    return n;
+}
+
+static void fill_input(u8 *buf, size_t len, enum lz_input kind, u32 *rnd)
+{
+    size_t i, n;
+
+    switch (kind) {
+    case LZ_IN_RANDOM:
+        for (i = 0; i < len; i++)
+            buf[i] = 'a' + lz_rnd(rnd) % 8;
+        break;
+    case LZ_IN_RUNS:
+        for (i = 0; i < len; i += n) {
+            n = 1 + lz_rnd(rnd) % 2000;
+            memset(buf + i, lz_rnd(rnd) & 3, n < len - i ? n : len - i);
+        }
+        break;
+    case LZ_IN_PERIODIC:
+        n = 1 + lz_rnd(rnd) % 7;
+        for (i = 0; i < len; i++)
+            buf[i] = (u8)(i % n);
+        break;
+    case LZ_IN_TEXT:
+        put_text(buf, len, rnd);
+        break;
+    case LZ_IN_INCOMPRESSIBLE:
+        for (i = 0; i < len; i++)
+            buf[i] = (u8)lz_rnd(rnd);
+        break;
+    case LZ_IN_FAR:
+        /* 64 random bytes every 40000: the repeats beyond 0xFFFF bytes
+         * must not be referenced */
+        for (i = 0; i < len; i++)
+            buf[i] = (u8)lz_rnd(rnd);
+        for (i = 40000; i + 64 <= len; i += 40000)
+            memcpy(buf + i, buf, 64);
+        break;
+    default:
+        break;
+    }
+}
+
+static void lz_fail(lz_check_result *res, const char *what,
+                    enum lz_input kind, size_t len)
+{
+    if (res->failures++ < 8)
+        fprintf(stderr, "lz check: %s input of %zu bytes: %s\n",
+                input_names[kind], len, what);
+}
+
+/* Damaged copies of a block must decode into at most dst_len bytes */
+static void check_corrupted(const u8 *data, size_t data_len, size_t dst_len,
+                            u32 *rnd, lz_check_result *res)
+{
+    u8 *bad = (u8 *)malloc(data_len);
+    u8 *dst = (u8 *)malloc(dst_len ? dst_len : 1);
+
+    if (bad == NULL || dst == NULL) {
+        res->failures++;
+        goto out;
+    }
+    for (int i = 0; i < LZ_CHECK_CORRUPTIONS; i++) {
+        size_t len = data_len;
+
+        memcpy(bad, data, data_len);
+        bad[lz_rnd(rnd) % data_len] ^= 1 << (lz_rnd(rnd) % 8);
+        if (i & 1)
+            len = lz_rnd(rnd) % data_len;
+        if (lz_decompress(bad, len, dst, dst_len) > dst_len)
+            res->failures++;
+        res->corrupted++;
+    }
+out:
+    free(bad);
+    free(dst);
+}
+
+static void check_frame(struct rb_compress *cz, const u8 *buf, size_t len,
+                        enum lz_input kind, u32 *rnd, lz_check_result *res)
+{
+    const struct rb_lz_frame_hdr *hdr;
+    const u8 *data;
+    u8 *frame, *out;
+    size_t frame_len;
+
+    frame = rb_compress_frame(cz, buf, len, &frame_len);
+    if (frame == NULL) {
+        lz_fail(res, "not framed", kind, len);
+        return;
+    }
+    hdr = (const struct rb_lz_frame_hdr *)frame;
+    data = frame + sizeof(*hdr);
+    res->frames++;
+    res->in_bytes += len;
+    res->out_bytes += frame_len;
+
+    if (hdr->magic != RB_LZ_FRAME_MAGIC || hdr->orig_len != len ||
+        frame_len != sizeof(*hdr) + hdr->data_len) {
+        lz_fail(res, "bad frame header", kind, len);
+        return;
+    }
+    if (!(hdr->flags & RB_LZ_FRAME_COMPRESSED)) {
+        if (hdr->data_len != len || memcmp(data, buf, len))
+            lz_fail(res, "stored frame differs", kind, len);
+        return;
+    }
+    res->compressed++;
+    if (hdr->data_len >= len)
+        lz_fail(res, "compressed frame did not shrink", kind, len);
+
+    /* Exactly sized, so that ASan catches a write past the end */
+    out = (u8 *)malloc(len);
+    if (out == NULL) {
+        res->failures++;
+        return;
+    }
+    if (lz_decompress(data, hdr->data_len, out, len) != len ||
+        memcmp(out, buf, len))
+        lz_fail(res, "round trip differs", kind, len);
+    if (lz_decompress(data, hdr->data_len, out, len - 1) != 0)
+        lz_fail(res, "expanded into a short buffer", kind, len);
+    free(out);
+
+    check_corrupted(data, hdr->data_len, len, rnd, res);
+}
+
+void lz_check(uint32_t seed, lz_check_result *res)
+{
+    /* Edges of the literal and match length encoding */
+    static const size_t edge_lens[] = { 0, 1, 3, 4, 5, 8, 14, 15, 16, 19, 20,
+                                        269, 270, 271, 524, 525, 1023 };
+    u32 rnd = seed * 2654435761U + 7;
+    size_t frame_len;
+
+    memset(res, 0, sizeof(*res));
+    if (!rnd)
+        rnd = 1;
+
+    for (size_t c = 0; c < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]);
+         c++) {
+        size_t max_chunk = chunk_sizes[c];
+        struct rb_compress *cz = rb_compress_init(max_chunk);
+        u8 *buf = (u8 *)malloc(max_chunk + 1);
+
+        if (cz == NULL || buf == NULL) {
+            res->failures++;
+            rb_compress_deinit(cz);
+            free(buf);
+            continue;
+        }
+        for (int k = 0; k < LZ_IN_MAX; k++) {
+            enum lz_input kind = (enum lz_input)k;
+            size_t len;
+
+            for (size_t e = 0; e < sizeof(edge_lens) / sizeof(edge_lens[0]);
+                 e++) {
+                len = edge_lens[e];
+                if (len > max_chunk)
+                    continue;
+                fill_input(buf, len, kind, &rnd);
+                check_frame(cz, buf, len, kind, &rnd, res);
+            }
+            for (int i = 0; i < LZ_CHECK_RANDOM_LENS; i++) {
+                len = 1 + lz_rnd(&rnd) % max_chunk;
+                fill_input(buf, len, kind, &rnd);
+                check_frame(cz, buf, len, kind, &rnd, res);
+            }
+            fill_input(buf, max_chunk, kind, &rnd);
+            check_frame(cz, buf, max_chunk, kind, &rnd, res);
+            res->max_frames++;
+        }
+
+        if (rb_compress_frame(cz, buf, max_chunk + 1, &frame_len) != NULL)
+            lz_fail(res, "chunk over the maximum framed",
+                    LZ_IN_INCOMPRESSIBLE, max_chunk + 1);
+        rb_compress_deinit(cz);
+        free(buf);
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+/* Per ring benchmark                                                     */
+/* ---------------------------------------------------------------------- */
+
+/* Binary event records: id, length, timestamp and a few small fields */
+static void fill_events(u8 *buf, size_t len, u32 *rnd, bool connectivity)
+{
+    u32 ts = 0;
+    size_t n = 0;
+
+    while (n < len) {
+        u8 rec[64];
+        u32 r = lz_rnd(rnd);
+        size_t rec_len = connectivity ? 24 + r % 32 : 12 + r % 12;
+
+        memset(rec, 0, sizeof(rec));
+        ts += 1 + r % 5000;
+        rec[0] = connectivity ? 0x10 + r % 12 : 0x40 + r % 4;
+        rec[2] = (u8)rec_len;
+        memcpy(rec + 4, &ts, sizeof(ts));
+        if (connectivity) {
+            /* BSSID of one of a few APs, then channel, RSSI and status */
+            static const u8 bssid[4][6] = {
+                { 0x00, 0x03, 0x7f, 0x12, 0x34, 0x56 },
+                { 0x00, 0x03, 0x7f, 0x12, 0x34, 0x57 },
+                { 0x3c, 0x52, 0x82, 0xaa, 0x01, 0x02 },
+                { 0x3c, 0x52, 0x82, 0xaa, 0x01, 0x03 },
+            };
+
+            memcpy(rec + 8, bssid[(r >> 8) & 3], 6);
+            rec[14] = (r >> 12) & 1 ? 36 : 6;
+            rec[15] = (u8)(-40 - (int)((r >> 16) % 40));
+            rec[16] = (r >> 24) % 3;
+        } else {
+            rec[8] = (r >> 8) & 1;
+            rec[9] = (r >> 12) % 3;
+        }
+        if (rec_len > len - n)
+            rec_len = len - n;
+        memcpy(buf + n, rec, rec_len);
+        n += rec_len;
+    }
+}
+
+/* Packet fate records: a header and the first bytes of the frame */
+static void fill_pkt_stats(u8 *buf, size_t len, u32 *rnd)
+{
+    size_t n = 0;
+
+    while (n < len) {
+        u8 rec[128];
+        u32 r = lz_rnd(rnd);
+        size_t rec_len = 32 + r % 96;
+
+        memset(rec, 0, 32);
+        rec[0] = 1 + (r & 1);
+        rec[2] = (u8)rec_len;
+        rec[4] = r % 8;
+        memcpy(rec + 8, &r, sizeof(r));
+        for (size_t i = 32; i < rec_len; i++)
+            rec[i] = (u8)lz_rnd(rnd);
+        if (rec_len > len - n)
+            rec_len = len - n;
+        memcpy(buf + n, rec, rec_len);
+        n += rec_len;
+    }
+}
+
+static void fill_fw_prints(u8 *buf, size_t len, u32 *rnd)
+{
+    static const char *ids[] = { "BEACON_RX", "STA_PS", "RX_REORDER",
+                                 "TX_COMPLETE", "ROAM_SCAN", "PDEV_STATS" };
+    char line[128];
+    size_t n = 0;
+    int l;
+
+    while (n < len) {
+        u32 r = lz_rnd(rnd);
+
+        l = snprintf(line, sizeof(line),
+                     "[%010u] FWLOG: [%u] WAL_DBGID_%s ( 0x%x, 0x%x, %u )\n",
+                     r >> 4, r % 64, ids[(r >> 6) % 6], (r >> 9) & 0xff,
+                     lz_rnd(rnd), (r >> 20) % 100);
+        if ((size_t)l > len - n)
+            l = len - n;
+        memcpy(buf + n, line, l);
+        n += l;
+    }
+}
+
+static u64 lz_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void lz_bench(uint32_t seed, uint64_t bytes,
+              lz_bench_result res[LZ_BENCH_RINGS])
+{
+    /* Ring names and buffer sizes of wifilogger.cpp and wifiloggercmd.h */
+    static const struct {
+        const char *name;
+        u32 buf_size;
+    } rings[LZ_BENCH_RINGS] = {
+        { "power_events_rb", 2048 },
+        { "connectivity_events_rb", 4096 },
+        { "pkt_stats_rb", 4096 },
+        { "driver_prints_rb", 4096 },
+        { "firmware_prints_rb", 32768 },
+    };
+    u8 *sample = (u8 *)malloc(LZ_BENCH_SAMPLE);
+    u8 *out = (u8 *)malloc(rings[LZ_BENCH_RINGS - 1].buf_size);
+    u32 rnd = seed * 2654435761U + 11;
+
+    memset(res, 0, sizeof(*res) * LZ_BENCH_RINGS);
+    if (!rnd)
+        rnd = 1;
+
+    for (int i = 0; i < LZ_BENCH_RINGS && sample && out; i++) {
+        struct rb_compress *cz = rb_compress_init(rings[i].buf_size);
+        struct rb_compress_stats stats;
+        size_t chunk = rings[i].buf_size, off, frame_len;
+        u64 done, start, dstart, dec_ns = 0;
+
+        res[i].ring = rings[i].name;
+        res[i].chunk_size = chunk;
+        if (cz == NULL)
+            continue;
+
+        switch (i) {
+        case 0:
+            fill_events(sample, LZ_BENCH_SAMPLE, &rnd, false);
+            break;
+        case 1:
+            fill_events(sample, LZ_BENCH_SAMPLE, &rnd, true);
+            break;
+        case 2:
+            fill_pkt_stats(sample, LZ_BENCH_SAMPLE, &rnd);
+            break;
+        case 3:
+            put_text(sample, LZ_BENCH_SAMPLE, &rnd);
+            break;
+        default:
+            fill_fw_prints(sample, LZ_BENCH_SAMPLE, &rnd);
+            break;
+        }
+
+        start = lz_now_ns();
+        for (done = 0, off = 0; done < bytes; done += chunk) {
+            const struct rb_lz_frame_hdr *hdr;
+            u8 *frame;
+
+            if (off + chunk > LZ_BENCH_SAMPLE)
+                off = 0;
+            frame = rb_compress_frame(cz, sample + off, chunk, &frame_len);
+            off += chunk;
+            if (frame == NULL)
+                break;
+
+            /* Expand one chunk in 16 to time the framework side */
+            hdr = (const struct rb_lz_frame_hdr *)frame;
+            if ((done / chunk) % 16 == 0 &&
+                (hdr->flags & RB_LZ_FRAME_COMPRESSED)) {
+                dstart = lz_now_ns();
+                res[i].decompress_bytes += lz_decompress(
+                        frame + sizeof(*hdr), hdr->data_len, out, chunk);
+                dec_ns += lz_now_ns() - dstart;
+            }
+        }
+        res[i].compress_seconds = (lz_now_ns() - start - dec_ns) / 1e9;
+        res[i].decompress_seconds = dec_ns / 1e9;
+
+        rb_compress_get_stats(cz, &stats);
+        res[i].chunks = stats.chunks;
+        res[i].stored_chunks = stats.stored_chunks;
+        res[i].in_bytes = stats.in_bytes;
+        res[i].out_bytes = stats.out_bytes;
+        res[i].cpu_us = stats.cpu_us;
+        rb_compress_deinit(cz);
+    }
+    free(sample);
+    free(out);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __LZ_CHECK_H
+#define __LZ_CHECK_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t frames;        /* frames decoded and compared */
+    uint32_t compressed;    /* of which LZ blocks, the others stored */
+    uint32_t max_frames;    /* frames of exactly the maximum chunk size */
+    uint32_t corrupted;     /* damaged blocks decoded within bounds */
+    uint64_t in_bytes;
+    uint64_t out_bytes;     /* frame bytes, headers included */
+    uint32_t failures;
+} lz_check_result;
+
+/* The rings of wifilogger.cpp */
+#define LZ_BENCH_RINGS 5
+
+typedef struct {
+    const char *ring;
+    uint32_t chunk_size;    /* the ring's buffer size */
+    uint64_t chunks;
+    uint64_t stored_chunks;
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    uint64_t cpu_us;        /* thread CPU time in rb_compress_frame() */
+    double compress_seconds;
+    uint64_t decompress_bytes; /* expanded by lz_decompress(), 1 chunk in 16 */
+    double decompress_seconds;
+} lz_bench_result;
+
+/* Round trips rb_compress_frame() through lz_decompress(), see
+ * lz_check.cpp */
+void lz_check(uint32_t seed, lz_check_result *res);
+
+/* Compresses bytes of data shaped like each ring's records in chunks of
+ * the ring's buffer size */
+void lz_bench(uint32_t seed, uint64_t bytes,
+              lz_bench_result res[LZ_BENCH_RINGS]);
+
+#endif /* __LZ_CHECK_H */
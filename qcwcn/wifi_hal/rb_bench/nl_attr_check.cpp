@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Attribute lookups of nl_attr_view (nl_attr_view.h) against nla_parse().
+ *
+ * Three message shapes of the event path are timed with both parsers:
+ *  - vendor_event: the top level attributes of an nl80211 vendor event
+ *    (wiphy, ifindex, wdev, vendor id and subcmd, vendor data), looked up
+ *    as wifi_event_loop() and WifiVendorCommand do: vendor id, subcmd and
+ *    data, in the NL80211_ATTR_MAX_INTERNAL space of WifiEvent;
+ *  - other_event: the same stream for an event nothing looks into, which
+ *    WifiEvent::parse() used to nla_parse() all the same;
+ *  - gscan_result: 16 attributes of the GSCAN results set, of which 12
+ *    present or absent ones are looked up, as the gscan event handlers do.
+ * nla_parse() clears a table of max_type + 1 pointers and stores every
+ * attribute; the view indexes the stream on the first lookup. Before
+ * timing, every type of every message is looked up with both and the
+ * results must agree.
+ *
+ * Unless built against libnl, nla_parse() is the stand-in below, which
+ * follows lib/attr.c of libnl 3 for a NULL policy.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/nl80211.h>
+
+#include "qca-vendor_copy.h"
+#include "nl_attr_view.h"
+#include "nl_attr_check.h"
+
+/* gcc does not see that the first lookup of a fresh view clears mPresent */
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+#define NLB_NL80211_MAX     256     // WifiEvent::NL80211_ATTR_MAX_INTERNAL
+#define NLB_GSCAN_MAX       QCA_WLAN_VENDOR_ATTR_GSCAN_RESULTS_MAX
+#define NLB_MSGS            64      // messages cycled through
+#define NLB_MSG_LEN         1024
+#define NLB_GSCAN_ATTRS     16
+#define NLB_GSCAN_LOOKUPS   12
+
+#ifdef __RB_BENCH_NETLINK_ATTR_H
+int nla_parse(struct nlattr *tb[], int maxtype, struct nlattr *head, int len,
+              const struct nla_policy *policy)
+{
+    struct nlattr *nla;
+    int rem, type;
+
+    memset(tb, 0, sizeof(struct nlattr *) * (maxtype + 1));
+
+    nla_for_each_attr(nla, head, len, rem) {
+        type = nla_type(nla);
+        if (type > maxtype)
+            continue;
+        tb[type] = nla;
+    }
+    return 0;
+}
+#endif
+
+typedef struct {
+    uint32_t buf[NLB_MSG_LEN / 4];
+    int len;
+    int lookups[NLB_GSCAN_LOOKUPS];
+    int num_lookups;
+    int attrs;
+} nlb_msg;
+
+/* xorshift32, as in rb_bench.cpp */
+static uint32_t nlb_rnd(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static uint64_t nlb_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void nlb_put(nlb_msg *m, int type, int len, uint32_t *rnd)
+{
+    struct nlattr *nla = (struct nlattr *)((char *)m->buf + m->len);
+    int i;
+
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    for (i = 0; i < len; i++)
+        ((uint8_t *)nla_data(nla))[i] = (uint8_t)nlb_rnd(rnd);
+    m->len += NLA_ALIGN(nla->nla_len);
+    m->attrs++;
+}
+
+static void nlb_build_event(nlb_msg *m, bool vendor, uint32_t *rnd)
+{
+    memset(m, 0, sizeof(*m));
+    nlb_put(m, NL80211_ATTR_WIPHY, 4, rnd);
+    nlb_put(m, NL80211_ATTR_IFINDEX, 4, rnd);
+    nlb_put(m, NL80211_ATTR_WDEV, 8, rnd);
+    nlb_put(m, NL80211_ATTR_VENDOR_ID, 4, rnd);
+    nlb_put(m, NL80211_ATTR_VENDOR_SUBCMD, 4, rnd);
+    nlb_put(m, NL80211_ATTR_VENDOR_DATA, 32 + nlb_rnd(rnd) % 256, rnd);
+    if (vendor) {
+        m->lookups[m->num_lookups++] = NL80211_ATTR_VENDOR_ID;
+        m->lookups[m->num_lookups++] = NL80211_ATTR_VENDOR_SUBCMD;
+        m->lookups[m->num_lookups++] = NL80211_ATTR_VENDOR_DATA;
+    }
+}
+
+static void nlb_build_gscan(nlb_msg *m, uint32_t *rnd)
+{
+    bool used[NLB_GSCAN_MAX + 1];
+    int type, i;
+
+    memset(m, 0, sizeof(*m));
+    memset(used, 0, sizeof(used));
+    while (m->attrs < NLB_GSCAN_ATTRS) {
+        type = 1 + nlb_rnd(rnd) % NLB_GSCAN_MAX;
+        if (used[type])
+            continue;
+        used[type] = true;
+        nlb_put(m, type, 4 * (1 + nlb_rnd(rnd) % 4), rnd);
+    }
+    for (i = 0; i < NLB_GSCAN_LOOKUPS; i++)
+        m->lookups[m->num_lookups++] = 1 + nlb_rnd(rnd) % NLB_GSCAN_MAX;
+}
+
+template <int MAX_TYPE>
+static uint32_t nlb_compare(nlb_msg *msgs)
+{
+    struct nlattr *tb[MAX_TYPE + 1];
+    uint32_t failures = 0;
+
+    for (int i = 0; i < NLB_MSGS; i++) {
+        nl_attr_view<MAX_TYPE> view((struct nlattr *)msgs[i].buf,
+                                    msgs[i].len);
+
+        nla_parse(tb, MAX_TYPE, (struct nlattr *)msgs[i].buf, msgs[i].len,
+                  NULL);
+        for (int type = 1; type <= MAX_TYPE; type++)
+            failures += view[type] != tb[type];
+    }
+    return failures;
+}
+
+/* Sum of the first word of the attributes found, so no lookup is dropped */
+template <int MAX_TYPE>
+static uint32_t nlb_time(nlb_msg *msgs, enum nl_attr_parser parser,
+                         uint64_t num, nl_attr_bench_result *res)
+{
+    struct nlattr *tb[MAX_TYPE + 1];
+    struct nlattr *nla;
+    uint32_t sum = 0;
+    uint64_t start, n;
+    nlb_msg *m;
+    int i;
+
+    start = nlb_now_ns();
+    for (n = 0; n < num; n++) {
+        m = &msgs[n % NLB_MSGS];
+        if (parser == NL_ATTR_NLA_PARSE) {
+            nla_parse(tb, MAX_TYPE, (struct nlattr *)m->buf, m->len, NULL);
+            for (i = 0; i < m->num_lookups; i++) {
+                nla = tb[m->lookups[i]];
+                sum += nla ? nla_get_u32(nla) : 0;
+            }
+        } else {
+            nl_attr_view<MAX_TYPE> view((struct nlattr *)m->buf, m->len);
+
+            for (i = 0; i < m->num_lookups; i++) {
+                nla = view[m->lookups[i]];
+                sum += nla ? nla_get_u32(nla) : 0;
+            }
+        }
+    }
+    res->seconds = (nlb_now_ns() - start) / 1e9;
+    res->msgs = num;
+    return sum;
+}
+
+template <int MAX_TYPE>
+static void nlb_run(const char *name, nlb_msg *msgs, uint64_t num,
+                    nl_attr_bench_result *res, uint32_t *sink)
+{
+    uint32_t failures = nlb_compare<MAX_TYPE>(msgs);
+
+    for (int p = 0; p < 2; p++) {
+        memset(&res[p], 0, sizeof(res[p]));
+        res[p].msg = name;
+        res[p].parser = (enum nl_attr_parser)p;
+        res[p].max_type = MAX_TYPE;
+        res[p].attrs = msgs[0].attrs;
+        res[p].lookups = msgs[0].num_lookups;
+        res[p].failures = failures;
+        *sink += nlb_time<MAX_TYPE>(msgs, res[p].parser, num, &res[p]);
+    }
+}
+
+const char *nl_attr_parser_name(enum nl_attr_parser parser)
+{
+    return parser == NL_ATTR_VIEW ? "nl_attr_view" : "nla_parse";
+}
+
+void nl_attr_bench(uint32_t seed, uint64_t num, nl_attr_bench_result *res)
+{
+    static volatile uint32_t sink;
+    uint32_t rnd = seed * 2246822519U + 7, sum = 0;
+    nlb_msg *msgs;
+    int i;
+
+    if (!rnd)
+        rnd = 1;
+    msgs = (nlb_msg *)malloc(sizeof(nlb_msg) * NLB_MSGS);
+    if (msgs == NULL) {
+        for (i = 0; i < NL_ATTR_BENCH_RESULTS; i++) {
+            memset(&res[i], 0, sizeof(res[i]));
+            res[i].msg = "none";
+            res[i].failures = 1;
+        }
+        return;
+    }
+
+    for (i = 0; i < NLB_MSGS; i++)
+        nlb_build_event(&msgs[i], true, &rnd);
+    nlb_run<NLB_NL80211_MAX>("vendor_event", msgs, num, &res[0], &sum);
+
+    for (i = 0; i < NLB_MSGS; i++)
+        nlb_build_event(&msgs[i], false, &rnd);
+    nlb_run<NLB_NL80211_MAX>("other_event", msgs, num, &res[2], &sum);
+
+    for (i = 0; i < NLB_MSGS; i++)
+        nlb_build_gscan(&msgs[i], &rnd);
+    nlb_run<NLB_GSCAN_MAX>("gscan_result", msgs, num, &res[4], &sum);
+
+    sink = sum;
+    (void)sink;
+    free(msgs);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __NL_ATTR_CHECK_H
+#define __NL_ATTR_CHECK_H
+
+#include <stdint.h>
+
+enum nl_attr_parser {
+    NL_ATTR_NLA_PARSE,
+    NL_ATTR_VIEW,
+};
+
+typedef struct {
+    const char *msg;            /* message shape, see nl_attr_check.cpp */
+    enum nl_attr_parser parser;
+    int max_type;               /* of the attribute set */
+    uint32_t attrs;             /* attributes per message */
+    uint32_t lookups;           /* looked up per message */
+    uint64_t msgs;
+    double seconds;
+    uint32_t failures;          /* lookups where the two parsers differ */
+} nl_attr_bench_result;
+
+#define NL_ATTR_BENCH_RESULTS 6
+
+/* Times nla_parse() into a table against nl_attr_view for the attribute
+ * streams of a few HAL events, see nl_attr_check.cpp; res holds 6
+ * results */
+void nl_attr_bench(uint32_t seed, uint64_t msgs, nl_attr_bench_result *res);
+
+const char *nl_attr_parser_name(enum nl_attr_parser parser);
+
+#endif /* __NL_ATTR_CHECK_H */
@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Replays of the pkt stats paths of wifilogger_diag.cpp: the staging of
+ * RX MPDU entries, and the ring writes of a parse_stats() pass.
+ *
+ * wifilogger_diag.cpp itself does not build for the host: it needs
+ * hardware_legacy/wifi_logger.h for the ring entry and packet fate types
+ * (also pulled in by pkt_stats.h), libnl and cld80211_lib.h for the netlink
+ * path, and hal_info from common.h; it links against rb_wrapper.cpp, which
+ * needs hal_info too. The replays therefore repeat the memory and ring
+ * operations of those paths on ring_buffer.cpp with the sizes of those
+ * headers, copied below.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#include "ring_buffer.h"
+#include "pktlog_replay.h"
+
+/* wifi_ring_buffer_entry and wifi_ring_per_packet_status_entry of
+ * hardware_legacy/wifi_logger.h */
+#define REPLAY_RB_ENTRY_LEN        12
+#define REPLAY_PPS_LEN             38
+
+/* pkt_stats.h */
+#define REPLAY_MAX_RXMPDUS         64      // MAX_RXMPDUS_PER_AMPDU
+#define REPLAY_MAX_MSDUS           3       // MAX_MSDUS_PER_MPDU
+#define REPLAY_RX_HDR_LEN          64      // RX_HTT_HDR_STATUS_LEN
+#define REPLAY_RX_HDR_LEN_V1       256     // RX_HTT_HDR_STATUS_LEN_V1
+#define REPLAY_OLD_ENTRY_LEN       128     // PKT_STATS_BUF_SIZE, the old
+                                           // arena sizing
+#define REPLAY_BATCH_SIZE          16384   // PKT_STATS_BATCH_SIZE
+#define REPLAY_BATCH_MAX_RECS      128     // PKT_STATS_BATCH_MAX_RECS
+
+/* wifiloggercmd.h */
+#define REPLAY_RB_BUF_SIZE         4096    // PKT_STATS_RB_BUF_SIZE
+#define REPLAY_RB_NUM_BUFS         32      // PKT_STATS_NUM_BUFS
+
+/* wifilogger_diag.cpp */
+#define REPLAY_PKTLOG_INDEX_LEN    64      // PKTLOG_INDEX_LEN
+
+#define REPLAY_MAX_ENTRIES (REPLAY_MAX_RXMPDUS * REPLAY_MAX_MSDUS)
+
+/* xorshift32, as in rb_bench.cpp */
+static u32 replay_rnd(u32 *state)
+{
+    u32 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static u64 replay_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+const char *rx_aggr_stager_name(enum rx_aggr_stager stager)
+{
+    return stager == RX_AGGR_ARENA ? "arena" : "realloc";
+}
+
+const char *pkt_stats_writer_name(enum pkt_stats_writer writer)
+{
+    return writer == PKT_STATS_BATCH ? "rb_write_batch" : "rb_writev";
+}
+
+/* ---------------------------------------------------------------------- */
+/* RX aggregation staging                                                 */
+/* ---------------------------------------------------------------------- */
+
+typedef struct {
+    enum rx_aggr_stager stager;
+    u8 *arena;
+    u32 allocated;
+    u32 occupied;
+    u64 reallocs;
+    u64 sum;                // entry sizes read back by the flush
+} rx_aggr_ctx;
+
+/* populate_rx_aggr_stats(): walks the staged entries, which would be
+ * written to the ring, and resets the arena */
+static void rx_aggr_flush(rx_aggr_ctx *ctx)
+{
+    u32 index = 0;
+    u16 size;
+
+    while (index < ctx->occupied) {
+        memcpy(&size, ctx->arena + index, sizeof(size));
+        ctx->sum += size;
+        index += size;
+    }
+    /* The realloc stager cleared what it staged, the arena does not */
+    if (ctx->stager == RX_AGGR_REALLOC)
+        memset(ctx->arena, 0, ctx->occupied);
+    ctx->occupied = 0;
+}
+
+/* Stages one MPDU entry the way parse_rx_stats() does */
+static int rx_aggr_stage(rx_aggr_ctx *ctx, u32 len, const u8 *rx_hdr)
+{
+    u16 size = len;
+    u8 *entry, *temp;
+
+    if (len + ctx->occupied > ctx->allocated) {
+        if (ctx->stager == RX_AGGR_ARENA) {
+            rx_aggr_flush(ctx);
+        } else {
+            temp = (u8 *)realloc(ctx->arena, len + ctx->occupied);
+            if (temp == NULL)
+                return -1;
+            ctx->arena = temp;
+            memset(ctx->arena + ctx->allocated, 0,
+                   len + ctx->occupied - ctx->allocated);
+            ctx->allocated = len + ctx->occupied;
+            ctx->reallocs++;
+        }
+    }
+
+    entry = ctx->arena + ctx->occupied;
+    ctx->occupied += len;
+    memcpy(entry, &size, sizeof(size));
+    memset(entry + REPLAY_RB_ENTRY_LEN, 0, REPLAY_PPS_LEN);
+    memcpy(entry + REPLAY_RB_ENTRY_LEN + REPLAY_PPS_LEN, rx_hdr,
+           len - REPLAY_RB_ENTRY_LEN - REPLAY_PPS_LEN);
+    return 0;
+}
+
+static void rx_aggr_run(enum rx_aggr_stager stager, int pktlog_ver,
+                        u32 seed, u64 entries, rx_aggr_replay_result *res)
+{
+    u32 hdr_len = pktlog_ver == 2 ? REPLAY_RX_HDR_LEN_V1 : REPLAY_RX_HDR_LEN;
+    u32 len = REPLAY_RB_ENTRY_LEN + REPLAY_PPS_LEN + hdr_len;
+    u8 rx_hdr[REPLAY_RX_HDR_LEN_V1];
+    rx_aggr_ctx ctx;
+    u32 rnd = seed * 2654435761U + pktlog_ver;
+    u64 start, done = 0;
+
+    memset(res, 0, sizeof(*res));
+    memset(&ctx, 0, sizeof(ctx));
+    res->stager = stager;
+    res->pktlog_ver = pktlog_ver;
+    res->entry_len = len;
+    if (!rnd)
+        rnd = 1;
+    for (u32 i = 0; i < sizeof(rx_hdr); i++)
+        rx_hdr[i] = (u8)replay_rnd(&rnd);
+
+    /* wifi_initialize() sizing, before and after the arena */
+    ctx.stager = stager;
+    ctx.allocated = REPLAY_MAX_ENTRIES *
+                    (stager == RX_AGGR_ARENA ? len : REPLAY_OLD_ENTRY_LEN);
+    ctx.arena = (u8 *)malloc(ctx.allocated);
+    if (ctx.arena == NULL)
+        return;
+    if (stager == RX_AGGR_ARENA)
+        memset(ctx.arena, 0, ctx.allocated);
+
+    start = replay_now_ns();
+    while (done < entries) {
+        /* Half bulk A-MPDUs up to the largest, half short ones */
+        u32 r = replay_rnd(&rnd);
+        u32 num = (r & 1) ? REPLAY_MAX_ENTRIES / 4 +
+                            (r >> 1) % (REPLAY_MAX_ENTRIES * 3 / 4)
+                          : 1 + (r >> 1) % 8;
+
+        for (u32 i = 0; i < num; i++) {
+            if (rx_aggr_stage(&ctx, len, rx_hdr))
+                goto out;
+        }
+        rx_aggr_flush(&ctx);
+        done += num;
+        res->ppdus++;
+    }
+out:
+    res->seconds = (replay_now_ns() - start) / 1e9;
+    res->entries = done;
+    res->reallocs = ctx.reallocs;
+    res->arena_len = ctx.allocated;
+    free(ctx.arena);
+}
+
+void rx_aggr_replay(uint32_t seed, uint64_t entries,
+                    rx_aggr_replay_result *res)
+{
+    int n = 0;
+
+    for (int ver = 1; ver <= 2; ver++) {
+        rx_aggr_run(RX_AGGR_REALLOC, ver, seed, entries, &res[n++]);
+        rx_aggr_run(RX_AGGR_ARENA, ver, seed, entries, &res[n++]);
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+/* Pkt stats ring writes                                                  */
+/* ---------------------------------------------------------------------- */
+
+typedef struct {
+    void *rb;
+    u32 done;
+    u64 bytes_read;
+} pkt_stats_reader;
+
+/* Drains the ring as the push out path of rb_wrapper.cpp does */
+static void *pkt_stats_reader_thread(void *arg)
+{
+    pkt_stats_reader *rd = (pkt_stats_reader *)arg;
+    struct iovec iov[RB_MAX_READ_SEGS];
+    size_t len;
+    int i, num_segs;
+
+    for (;;) {
+        num_segs = rb_borrow(rd->rb, iov, RB_MAX_READ_SEGS);
+        for (i = 0, len = 0; i < num_segs; i++)
+            len += iov[i].iov_len;
+        if (len) {
+            rb_consume(rd->rb, len);
+            rd->bytes_read += len;
+            continue;
+        }
+        if (__atomic_load_n(&rd->done, __ATOMIC_ACQUIRE)) {
+            if (rb_borrow(rd->rb, iov, RB_MAX_READ_SEGS) > 0)
+                continue;
+            break;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+typedef struct {
+    enum pkt_stats_writer writer;
+    void *rb;
+    u8 buf[REPLAY_BATCH_SIZE];
+    size_t rec_len[REPLAY_BATCH_MAX_RECS];
+    size_t len;
+    int num_recs;
+    pkt_stats_replay_result *res;
+} pkt_stats_batch_ctx;
+
+static void pkt_stats_flush(pkt_stats_batch_ctx *ctx)
+{
+    const u8 *buf = ctx->buf;
+    size_t *rec_len = ctx->rec_len;
+    int num = ctx->num_recs, written, i;
+    enum rb_status status;
+
+    while (num) {
+        status = rb_write_batch(ctx->rb, buf, rec_len, num, &written);
+        ctx->res->ring_calls++;
+        for (i = 0; i < written; i++)
+            buf += rec_len[i];
+        rec_len += written;
+        num -= written;
+        if (status != RB_SUCCESS) {
+            ctx->res->full_retries++;
+            sched_yield();
+        }
+    }
+    ctx->num_recs = 0;
+    ctx->len = 0;
+}
+
+/* pkt_stats_write_entry(): an entry of hdr and data */
+static void pkt_stats_write(pkt_stats_batch_ctx *ctx, const u8 *hdr,
+                            size_t hdr_len, const u8 *data, size_t data_len)
+{
+    size_t len = hdr_len + data_len;
+    struct iovec iov[2];
+
+    ctx->res->records++;
+    ctx->res->bytes += len;
+    if (ctx->writer == PKT_STATS_PER_RECORD) {
+        iov[0].iov_base = (void *)hdr;
+        iov[0].iov_len = hdr_len;
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = data_len;
+        for (;;) {
+            ctx->res->ring_calls++;
+            if (rb_writev(ctx->rb, iov, data_len ? 2 : 1, len) == RB_SUCCESS)
+                return;
+            ctx->res->full_retries++;
+            sched_yield();
+        }
+    }
+
+    if (len > sizeof(ctx->buf) - ctx->len ||
+        ctx->num_recs == REPLAY_BATCH_MAX_RECS)
+        pkt_stats_flush(ctx);
+    memcpy(ctx->buf + ctx->len, hdr, hdr_len);
+    if (data_len)
+        memcpy(ctx->buf + ctx->len + hdr_len, data, data_len);
+    ctx->rec_len[ctx->num_recs++] = len;
+    ctx->len += len;
+}
+
+static u64 replay_thread_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pkt_stats_run(enum pkt_stats_writer writer, int pktlog_ver,
+                          u32 seed, u64 bytes, pkt_stats_replay_result *res)
+{
+    static pkt_stats_batch_ctx ctx;
+    u32 rx_len = REPLAY_RB_ENTRY_LEN + REPLAY_PPS_LEN +
+                 (pktlog_ver == 2 ? REPLAY_RX_HDR_LEN_V1 : REPLAY_RX_HDR_LEN);
+    u8 entry[REPLAY_RB_ENTRY_LEN + REPLAY_PPS_LEN + REPLAY_RX_HDR_LEN_V1];
+    u8 payload[128];
+    pkt_stats_reader rd;
+    pthread_t reader;
+    u32 rnd = seed * 2246822519U + pktlog_ver;
+    u64 start, cpu_start;
+
+    memset(res, 0, sizeof(*res));
+    memset(&rd, 0, sizeof(rd));
+    res->writer = writer;
+    res->pktlog_ver = pktlog_ver;
+    if (!rnd)
+        rnd = 1;
+    for (u32 i = 0; i < sizeof(entry); i++)
+        entry[i] = (u8)replay_rnd(&rnd);
+    memcpy(payload, entry, sizeof(payload));
+
+    rd.rb = ring_buffer_init(REPLAY_RB_BUF_SIZE, REPLAY_RB_NUM_BUFS,
+                             RB_ENGINE_SPSC);
+    if (rd.rb == NULL)
+        return;
+    if (pthread_create(&reader, NULL, pkt_stats_reader_thread, &rd)) {
+        ring_buffer_deinit(rd.rb);
+        return;
+    }
+    ctx.writer = writer;
+    ctx.rb = rd.rb;
+    ctx.len = 0;
+    ctx.num_recs = 0;
+    ctx.res = res;
+
+    start = replay_now_ns();
+    cpu_start = replay_thread_ns();
+    while (res->bytes < bytes) {
+        /* One parse_stats() pass: up to PKTLOG_INDEX_LEN records, mostly
+         * RX MPDU entries flushed per PPDU, TX entries with an 802.11
+         * header, and on v1 per packet stats as header and payload */
+        u32 num = 4 + replay_rnd(&rnd) % (REPLAY_PKTLOG_INDEX_LEN - 3);
+
+        for (u32 i = 0; i < num; i++) {
+            u32 r = replay_rnd(&rnd);
+
+            if (r % 10 < 6)
+                pkt_stats_write(&ctx, entry, rx_len, NULL, 0);
+            else if (r % 10 < 9 || pktlog_ver == 2)
+                pkt_stats_write(&ctx, entry, REPLAY_RB_ENTRY_LEN +
+                                REPLAY_PPS_LEN + 24 + (r >> 8) % 13, NULL, 0);
+            else
+                pkt_stats_write(&ctx, entry, REPLAY_RB_ENTRY_LEN, payload,
+                                32 + (r >> 8) % 96);
+        }
+        if (writer == PKT_STATS_BATCH)
+            pkt_stats_flush(&ctx);
+        res->buffers++;
+    }
+    res->seconds = (replay_now_ns() - start) / 1e9;
+    res->cpu_seconds = (replay_thread_ns() - cpu_start) / 1e9;
+
+    __atomic_store_n(&rd.done, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    res->bytes_read = rd.bytes_read;
+    res->lost = rd.bytes_read != res->bytes;
+    ring_buffer_deinit(rd.rb);
+}
+
+void pkt_stats_replay(uint32_t seed, uint64_t bytes,
+                      pkt_stats_replay_result *res)
+{
+    int n = 0;
+
+    for (int ver = 1; ver <= 2; ver++) {
+        pkt_stats_run(PKT_STATS_PER_RECORD, ver, seed, bytes, &res[n++]);
+        pkt_stats_run(PKT_STATS_BATCH, ver, seed, bytes, &res[n++]);
+    }
+}
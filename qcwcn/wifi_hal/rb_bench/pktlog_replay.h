@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __PKTLOG_REPLAY_H
+#define __PKTLOG_REPLAY_H
+
+#include <stdint.h>
+
+/* Staging of RX MPDU entries: the realloc growth parse_rx_stats() had
+ * before the fixed arena, and the arena of rx_aggr_stage_entry() */
+enum rx_aggr_stager {
+    RX_AGGR_REALLOC,
+    RX_AGGR_ARENA,
+};
+
+typedef struct {
+    enum rx_aggr_stager stager;
+    int pktlog_ver;         /* 1 or 2, which sets the entry length */
+    uint32_t entry_len;
+    uint64_t ppdus;
+    uint64_t entries;
+    uint64_t reallocs;
+    uint32_t arena_len;     /* bytes at the end of the replay */
+    double seconds;
+} rx_aggr_replay_result;
+
+/* Replays seeded A-MPDUs of up to the largest size through both stagers
+ * and both pktlog versions; res holds 4 results */
+void rx_aggr_replay(uint32_t seed, uint64_t entries,
+                    rx_aggr_replay_result *res);
+
+#define RX_AGGR_REPLAY_RESULTS 4
+
+const char *rx_aggr_stager_name(enum rx_aggr_stager stager);
+
+/* Pkt stats ring writes of one pktlog buffer: one rb_writev() per entry as
+ * pkt_stats_write_entry() did before parse_stats() batched them, or the
+ * batch buffer flushed with rb_write_batch() */
+enum pkt_stats_writer {
+    PKT_STATS_PER_RECORD,
+    PKT_STATS_BATCH,
+};
+
+typedef struct {
+    enum pkt_stats_writer writer;
+    int pktlog_ver;
+    uint64_t buffers;       /* pktlog buffers replayed */
+    uint64_t records;       /* ring entries written */
+    uint64_t bytes;
+    uint64_t ring_calls;    /* rb_writev() or rb_write_batch() calls */
+    uint64_t full_retries;
+    uint64_t bytes_read;    /* by the concurrent ring reader */
+    double seconds;         /* writer side */
+    double cpu_seconds;     /* of the writer thread */
+    bool lost;
+} pkt_stats_replay_result;
+
+#define PKT_STATS_REPLAY_RESULTS 4
+
+/* Replays seeded pktlog buffers of about bytes of ring entries into a pkt
+ * stats ring drained by a reader thread, per record and batched, for both
+ * pktlog versions; res holds 4 results */
+void pkt_stats_replay(uint32_t seed, uint64_t bytes,
+                      pkt_stats_replay_result *res);
+
+const char *pkt_stats_writer_name(enum pkt_stats_writer writer);
+
+#endif /* __PKTLOG_REPLAY_H */
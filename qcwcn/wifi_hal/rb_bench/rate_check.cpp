@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Exhaustive check of the PHY rate tables of pkt_rates.h.
+ *
+ * Every 16-bit MCS word is converted by the tables and by the branchy
+ * get_rate(), get_rate_v1() and cck_ratecode_mapping() that
+ * wifilogger_diag.cpp used before the tables, kept here as the reference.
+ * The HE/EHT table is checked against the rate formula of 802.11ax/be for
+ * every key.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pkt_rates.h"
+#include "rate_check.h"
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+typedef union {
+    struct {
+        u16 rate                            :  4;
+        u16 nss                             :  2;
+        u16 preamble                        :  2;
+        u16 bw                              :  2;
+        u16 short_gi                        :  1;
+        u16 reserved                        :  5;
+    } mcs_s;
+    u16 mcs;
+} MCS;
+
+/* Rate tables of pkt_stats.h before the constexpr tables, as reference data */
+
+/*Below CCK/OFDM table refer from firmware Arch */
+/* Rate Table Based on CCK */
+static const struct index_data_rate_cck_type ref_cck_mcs_nss1[] = {
+    /*RC     LKbps   SKbps */
+    {0x40,  {11000,  11000} },
+    {0x41,  {5500,   5500} },
+    {0x42,  {2000,   2000} },
+    {0x43,  {1000,   1000} }
+};
+
+/* Rate Table Based on OFDM */
+static const struct index_data_rate_ofdm_type ref_ofdm_mcs_nss1[] = {
+    /*RC     LKbps   SKbps */
+    {0x00,  {48000,  48000} },
+    {0x01,  {34000,  24000} },
+    {0x02,  {12000,  12000} },
+    {0x03,  {6000,   6000} },
+    {0x04,  {54000,  54000} },
+    {0x05,  {36000,  36000} },
+    {0x06,  {18000,  18000} },
+    {0x07,  {9000,   9000} }
+};
+
+/*Below HT/VHT table refer from Host Driver
+ * MCS Based rate table
+ * HT MCS parameters with Nss = 1
+ */
+static const struct index_data_rate_type ref_mcs_nss1[] = {
+    /* MCS L20  S20   L40   S40 */
+    {0,  {65,  72},  {135,  150 } },
+    {1,  {130, 144}, {270,  300 } },
+    {2,  {195, 217}, {405,  450 } },
+    {3,  {260, 289}, {540,  600 } },
+    {4,  {390, 433}, {815,  900 } },
+    {5,  {520, 578}, {1080, 1200} },
+    {6,  {585, 650}, {1215, 1350} },
+    {7,  {650, 722}, {1350, 1500} }
+};
+
+/* HT MCS parameters with Nss = 2 */
+static const struct index_data_rate_type ref_mcs_nss2[] = {
+    /* MCS L20  S20    L40   S40 */
+    {0,  {130,  144},  {270,  300 } },
+    {1,  {260,  289},  {540,  600 } },
+    {2,  {390,  433},  {810,  900 } },
+    {3,  {520,  578},  {1080, 1200} },
+    {4,  {780,  867},  {1620, 1800} },
+    {5,  {1040, 1156}, {2160, 2400} },
+    {6,  {1170, 1300}, {2430, 2700} },
+    {7,  {1300, 1440}, {2700, 3000} }
+};
+
+/* MCS Based VHT rate table
+ * MCS parameters with Nss = 1
+ */
+static const struct index_vht_data_rate_type ref_vht_mcs_nss1[] = {
+    /* MCS L20  S20    L40   S40    L80   S80 */
+    {0,  {65,   72 }, {135,  150},  {293,  325} },
+    {1,  {130,  144}, {270,  300},  {585,  650} },
+    {2,  {195,  217}, {405,  450},  {878,  975} },
+    {3,  {260,  289}, {540,  600},  {1170, 1300} },
+    {4,  {390,  433}, {810,  900},  {1755, 1950} },
+    {5,  {520,  578}, {1080, 1200}, {2340, 2600} },
+    {6,  {585,  650}, {1215, 1350}, {2633, 2925} },
+    {7,  {650,  722}, {1350, 1500}, {2925, 3250} },
+    {8,  {780,  867}, {1620, 1800}, {3510, 3900} },
+    {9,  {865,  960}, {1800, 2000}, {3900, 4333} }
+};
+
+/*MCS parameters with Nss = 2*/
+static const struct index_vht_data_rate_type ref_vht_mcs_nss2[] = {
+    /* MCS L20  S20    L40    S40    L80    S80 */
+    {0,  {130,  144},  {270,  300},  { 585,  650} },
+    {1,  {260,  289},  {540,  600},  {1170, 1300} },
+    {2,  {390,  433},  {810,  900},  {1755, 1950} },
+    {3,  {520,  578},  {1080, 1200}, {2340, 2600} },
+    {4,  {780,  867},  {1620, 1800}, {3510, 3900} },
+    {5,  {1040, 1156}, {2160, 2400}, {4680, 5200} },
+    {6,  {1170, 1300}, {2430, 2700}, {5265, 5850} },
+    {7,  {1300, 1444}, {2700, 3000}, {5850, 6500} },
+    {8,  {1560, 1733}, {3240, 3600}, {7020, 7800} },
+    {9,  {1730, 1920}, {3600, 4000}, {7800, 8667} }
+};
+
+static u8 ref_cck_ratecode_mapping(u8 rate)
+{
+   u8 rate_code = 0;
+
+   switch (rate) {
+      case 0x1:
+           rate_code = 0x3;
+           break;
+      case 0x2:
+      case 0x5:
+           rate_code = 0x2;
+           break;
+      case 0x3:
+      case 0x6:
+           rate_code = 0x1;
+           break;
+      case 0x4:
+      case 0x7:
+           rate_code = 0x0;
+           break;
+   }
+   return rate_code;
+}
+
+/* get_rate_v1() before the tables, less its logs */
+static u16 ref_get_rate_v1(u16 mcs_r)
+{
+    MCS mcs;
+    int index = 0;
+    u16 tx_rate = 0;
+    u8 nss;
+
+    mcs.mcs = mcs_r;
+    nss = mcs.mcs_s.nss + 1;
+
+    switch (mcs.mcs_s.preamble) {
+      case WIFI_HW_RATECODE_PREAM_OFDM:
+           for (index = 0; index < MAX_OFDM_MCS_IDX; index++) {
+               if ((mcs.mcs_s.rate & 0xF) == index)
+                  tx_rate = (u16) ref_ofdm_mcs_nss1[index].ofdm_rate[mcs.mcs_s.short_gi] / 1000;
+           }
+           break;
+      case WIFI_HW_RATECODE_PREAM_CCK:
+           for (index = 0; index < MAX_CCK_MCS_IDX; index++) {
+               if ((mcs.mcs_s.rate & 0xF) == index)
+                  tx_rate = (u16) ref_cck_mcs_nss1[index].cck_rate[mcs.mcs_s.short_gi] / 1000;
+           }
+           break;
+      case WIFI_HW_RATECODE_PREAM_HT:
+           if (nss == 1) {
+              for (index = 0; index < MAX_HT_MCS_IDX; index++) {
+                  if (mcs.mcs_s.rate == index) {
+                     if (mcs.mcs_s.bw == BW_20MHZ)
+                        tx_rate = (u16) ref_mcs_nss1[index].ht20_rate[mcs.mcs_s.short_gi] / 10;
+                     if (mcs.mcs_s.bw == BW_40MHZ)
+                        tx_rate = (u16) ref_mcs_nss1[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
+                  }
+              }
+           } else if (nss == 2) {
+               for (index = 0; index < MAX_HT_MCS_IDX; index++) {
+                   if (mcs.mcs_s.rate == index) {
+                      if (mcs.mcs_s.bw == BW_20MHZ)
+                         tx_rate = (u16) ref_mcs_nss2[index].ht20_rate[mcs.mcs_s.short_gi] / 10;
+                      if (mcs.mcs_s.bw == BW_40MHZ)
+                         tx_rate = (u16) ref_mcs_nss2[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
+                   }
+               }
+           }
+           break;
+      case WIFI_HW_RATECODE_PREAM_VHT:
+           if (nss == 1) {
+              for (index = 0; index < MAX_VHT_MCS_IDX; index++) {
+                  if (mcs.mcs_s.rate == index) {
+                     if (mcs.mcs_s.bw == BW_20MHZ)
+                        tx_rate = (u16) ref_vht_mcs_nss1[index].ht20_rate[mcs.mcs_s.short_gi] / 10;
+                     if (mcs.mcs_s.bw == BW_40MHZ)
+                        tx_rate = (u16) ref_vht_mcs_nss1[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
+                     if (mcs.mcs_s.bw == BW_80MHZ)
+                        tx_rate = (u16) ref_vht_mcs_nss1[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
+                  }
+              }
+           } else if (nss == 2) {
+               for (index = 0; index < MAX_VHT_MCS_IDX; index++) {
+                   if (mcs.mcs_s.rate == index) {
+                      if (mcs.mcs_s.bw == BW_20MHZ)
+                          tx_rate = (u16) ref_vht_mcs_nss2[index].ht20_rate[mcs.mcs_s.short_gi] / 10;
+                      if (mcs.mcs_s.bw == BW_40MHZ)
+                          tx_rate = (u16) ref_vht_mcs_nss2[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
+                      if (mcs.mcs_s.bw == BW_80MHZ)
+                          tx_rate = (u16) ref_vht_mcs_nss2[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
+                   }
+               }
+           }
+           break;
+    }
+    return tx_rate;
+}
+
+/* get_rate() before the tables, less its logs */
+static u16 ref_get_rate(u16 mcs_r)
+{
+    u16 tx_rate = 0;
+    MCS mcs;
+    static u16 rate_lookup[][8] = {{96, 48, 24, 12, 108, 72, 36, 18},
+                            {22, 11,  4,  2,  22, 11,  4,  0}};
+    static u16 MCS_rate_lookup_ht[][8] =
+                                  {{ 13,  14,  27,  30,  59,  65,  117,  130},
+                                   { 26,  29,  54,  60, 117, 130,  234,  260},
+                                   { 39,  43,  81,  90, 176, 195,  351,  390},
+                                   { 52,  58, 108, 120, 234, 260,  468,  520},
+                                   { 78,  87, 162, 180, 351, 390,  702,  780},
+                                   {104, 116, 216, 240, 468, 520,  936, 1040},
+                                   {117, 130, 243, 270, 527, 585, 1053, 1170},
+                                   {130, 144, 270, 300, 585, 650, 1170, 1300},
+                                   {156, 173, 324, 360, 702, 780, 1404, 1560},
+                                   {  0,   0, 360, 400, 780, 867, 1560, 1733},
+                                   { 26,  29,  54,  60, 117, 130,  234,  260},
+                                   { 52,  58, 108, 120, 234, 260,  468,  520},
+                                   { 78,  87, 162, 180, 351, 390,  702,  780},
+                                   {104, 116, 216, 240, 468, 520,  936, 1040},
+                                   {156, 173, 324, 360, 702, 780, 1404, 1560},
+                                   {208, 231, 432, 480, 936,1040, 1872, 2080},
+                                   {234, 261, 486, 540,1053,1170, 2106, 2340},
+                                   {260, 289, 540, 600,1170,1300, 2340, 2600},
+                                   {312, 347, 648, 720,1404,1560, 2808, 3120},
+                                   {  0,   0, 720, 800,1560,1733, 3120, 3467}};
+
+    mcs.mcs = mcs_r;
+    if ((mcs.mcs_s.preamble <= WL_PREAMBLE_VHT) && (mcs.mcs_s.rate < 10)) {
+        switch(mcs.mcs_s.preamble)
+        {
+            case WL_PREAMBLE_CCK:
+            case WL_PREAMBLE_OFDM:
+                if(mcs.mcs_s.rate<8) {
+                    tx_rate = rate_lookup [mcs.mcs_s.preamble][mcs.mcs_s.rate];
+                    if (mcs.mcs_s.nss)
+                        tx_rate *=2;
+                }
+            break;
+            case WL_PREAMBLE_HT:
+                if(mcs.mcs_s.rate<8) {
+                    if (!mcs.mcs_s.nss)
+                        tx_rate = MCS_rate_lookup_ht[mcs.mcs_s.rate]
+                                        [2*mcs.mcs_s.bw+mcs.mcs_s.short_gi];
+                    else
+                        tx_rate = MCS_rate_lookup_ht[10+mcs.mcs_s.rate]
+                                        [2*mcs.mcs_s.bw+mcs.mcs_s.short_gi];
+                }
+            break;
+            case WL_PREAMBLE_VHT:
+                if (!mcs.mcs_s.nss)
+                    tx_rate = MCS_rate_lookup_ht[mcs.mcs_s.rate]
+                                        [2*mcs.mcs_s.bw+mcs.mcs_s.short_gi];
+                else
+                    tx_rate = MCS_rate_lookup_ht[10+mcs.mcs_s.rate]
+                                        [2*mcs.mcs_s.bw+mcs.mcs_s.short_gi];
+            break;
+        }
+    }
+    return tx_rate;
+}
+
+/* 802.11ax/be rate in 100 Kbps units: data subcarriers x bits per
+ * subcarrier x coding rate x streams / (12.8 us + guard interval)
+ */
+static uint32_t ref_rate_he_eht(bool eht, int nss, int mcs, int bw, int gi)
+{
+    static const int nsd[] = { 234, 468, 980, 1960, 3920 };
+    static const int bits[] = { 1, 2, 2, 4, 4, 6, 6, 6, 8, 8, 10, 10, 12, 12 };
+    static const double coding[] = { 1.0 / 2, 1.0 / 2, 3.0 / 4, 1.0 / 2,
+                                     3.0 / 4, 2.0 / 3, 3.0 / 4, 5.0 / 6,
+                                     3.0 / 4, 5.0 / 6, 3.0 / 4, 5.0 / 6,
+                                     3.0 / 4, 5.0 / 6 };
+    static const double gi_us[] = { 0.8, 1.6, 3.2 };
+
+    if (mcs >= (eht ? 14 : 12) || bw > (eht ? 4 : 3) || gi > 2)
+        return 0;
+    /* Round away the error of the double coding rates before truncating */
+    return (uint32_t)(nsd[bw] * bits[mcs] * coding[mcs] * (nss + 1) /
+                      (12.8 + gi_us[gi]) * 10 + 1e-6);
+}
+
+void rate_check(rate_check_result *res)
+{
+    MCS mcs;
+    u16 idx;
+    u32 i;
+
+    res->mcs_words = 0;
+    res->he_eht_keys = 0;
+    res->mismatches = 0;
+
+    for (i = 0; i <= 0xFFFF; i++) {
+        mcs.mcs = i;
+        idx = mcs_rate_idx(mcs.mcs_s.rate, mcs.mcs_s.nss, mcs.mcs_s.preamble,
+                           mcs.mcs_s.bw, mcs.mcs_s.short_gi);
+        if (mcs_rates.rate[idx] != ref_get_rate(i) ||
+            mcs_rates.rate_v1[idx] != ref_get_rate_v1(i)) {
+            if (res->mismatches++ < 8)
+                fprintf(stderr, "rate: MCS 0x%04x: %u/%u, was %u/%u\n", i,
+                        mcs_rates.rate[idx], mcs_rates.rate_v1[idx],
+                        ref_get_rate(i), ref_get_rate_v1(i));
+        }
+        res->mcs_words++;
+    }
+
+    /* Callers pass the 4-bit L-SIG rate */
+    for (i = 0; i < 16; i++) {
+        if (cck_ratecode[i] != ref_cck_ratecode_mapping(i)) {
+            fprintf(stderr, "rate: L-SIG rate %u: code %u, was %u\n", i,
+                    cck_ratecode[i], ref_cck_ratecode_mapping(i));
+            res->mismatches++;
+        }
+    }
+
+    for (int pre = RATE_PREAMBLE_HE; pre <= RATE_PREAMBLE_EHT; pre++) {
+        for (int nss = 0; nss < MAX_HE_EHT_NSS; nss++) {
+            for (int m = 0; m < 16; m++) {
+                for (int bw = 0; bw < 8; bw++) {
+                    for (int gi = 0; gi < 4; gi++) {
+                        u32 want = ref_rate_he_eht(pre == RATE_PREAMBLE_EHT,
+                                                   nss, m, bw, gi);
+                        u32 got = get_rate_he_eht(pre, nss, m, bw, gi);
+
+                        if (got != want && res->mismatches++ < 8)
+                            fprintf(stderr, "rate: %s nss %d MCS %d bw %d "
+                                    "gi %d: %u, want %u\n",
+                                    pre == RATE_PREAMBLE_EHT ? "EHT" : "HE",
+                                    nss + 1, m, bw, gi, got, want);
+                        res->he_eht_keys++;
+                    }
+                }
+            }
+        }
+    }
+}
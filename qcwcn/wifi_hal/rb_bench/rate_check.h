@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __RATE_CHECK_H
+#define __RATE_CHECK_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t mcs_words;     /* MCS words compared with the old functions */
+    uint32_t he_eht_keys;   /* HE/EHT keys compared with the rate formula */
+    uint32_t mismatches;
+} rate_check_result;
+
+/* Checks the rate tables of pkt_rates.h, see rate_check.cpp */
+void rate_check(rate_check_result *res);
+
+#endif /* __RATE_CHECK_H */
@@ -0,0 +1,1136 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+/* Host benchmark and stress test of the logger ring buffer (ring_buffer.cpp).
+ *
+ * The model check drives both engines with random writes (rb_write,
+ * rb_writev, rb_write_batch), reads (rb_read, rb_get_read_buf,
+ * rb_borrow/rb_consume) and resizes, and compares every byte read and the
+ * valid byte count against a reference deque. File backed rings of the
+ * lock-free engine are closed and reopened instead of resized, and must
+ * come back with exactly the bytes that were not read yet. The benchmark runs one
+ * producer and one concurrent consumer per record size, writer, reader and
+ * overwrite mode and reports throughput and call latency percentiles.
+ * Along with the model check, the per-packet PHY rate tables are checked
+ * exhaustively (rate_check.cpp), the event handler table is stress tested
+ * with concurrent readers and writers (event_cb_check.cpp) and the ring
+ * compression is round tripped through lz_decompress() (lz_check.cpp); the
+ * benchmark also reports the compression cost for each logger ring and
+ * replays the RX aggregation staging and the batched ring writes of the
+ * pkt stats path (pktlog_replay.cpp), measures the contention of the
+ * command socket pool under concurrent commands (cmd_sock_check.cpp) and
+ * times netlink attribute lookups through nl_attr_view against
+ * nla_parse() (nl_attr_check.cpp). Results are written as JSON; the exit
+ * status is non-zero if any check failed.
+ *
+ * Built by the wifi_hal_rb_bench host target of Android.mk, or directly:
+ *   g++ -O2 -DEVENT_CB_DEBUG -Irb_bench/include -I. ring_buffer.cpp \
+ *       event_cb.cpp rb_compress.cpp cmd_sock_pool.cpp \
+ *       rb_bench/rb_bench.cpp rb_bench/rate_check.cpp \
+ *       rb_bench/event_cb_check.cpp rb_bench/lz_check.cpp \
+ *       rb_bench/pktlog_replay.cpp rb_bench/cmd_sock_check.cpp \
+ *       rb_bench/nl_attr_check.cpp -lpthread -o rb_bench
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+
+#define LOG_TAG "rb_bench"
+
+#include <utils/Log.h>
+
+typedef unsigned char u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#include "ring_buffer.h"
+#include "rate_check.h"
+#include "event_cb_check.h"
+#include "lz_check.h"
+#include "pktlog_replay.h"
+#include "cmd_sock_check.h"
+#include "nl_attr_check.h"
+
+#define RB_BENCH_DEF_SEED      1
+#define RB_BENCH_DEF_RINGS     200
+#define RB_BENCH_DEF_OPS       2000
+#define RB_BENCH_DEF_MB        16
+
+#define RB_BENCH_BUF_SIZE      32768
+#define RB_BENCH_NUM_BUFS      16
+#define RB_BENCH_BATCH_RECS    16
+#define RB_BENCH_MAX_SAMPLES   (1 << 22)
+#define RB_BENCH_READ_LEN      4096
+#define RB_BENCH_REPLAY_ENTRIES_PER_MB 16384
+#define RB_BENCH_ATTR_MSGS_PER_MB 65536
+
+static u32 log_errors;
+static int verbose;
+
+void rb_bench_log(int prio, const char *tag, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (prio >= RB_BENCH_LOG_ERROR)
+        __atomic_add_fetch(&log_errors, 1, __ATOMIC_RELAXED);
+    if (prio < RB_BENCH_LOG_WARN && !verbose)
+        return;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "%s: ", tag);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+
+static const char *engine_name(enum rb_engine engine)
+{
+    return engine == RB_ENGINE_SPSC ? "spsc" : "locked";
+}
+
+/* xorshift32, so that a seed replays the same run on any libc */
+static u32 rnd_next(u32 *state)
+{
+    u32 x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static u32 rnd_range(u32 *state, u32 lo, u32 hi)
+{
+    return lo + rnd_next(state) % (hi - lo + 1);
+}
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Model check                                                            */
+/* ---------------------------------------------------------------------- */
+
+typedef struct {
+    enum rb_engine engine;
+    const char *path;       // backing file, NULL for a heap ring
+    void *rb;
+    size_t buf_size;
+    int num_bufs;
+    std::deque<u8> model;
+    u32 rnd;
+    u8 pattern;             // next byte value written
+    int op;                 // index of the op being run
+    char failure[256];
+} model_run;
+
+static int model_fail(model_run *run, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static int model_fail(model_run *run, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    len = snprintf(run->failure, sizeof(run->failure),
+                   "%s ring %zux%d op %d: ", engine_name(run->engine),
+                   run->buf_size, run->num_bufs, run->op);
+    va_start(ap, fmt);
+    vsnprintf(run->failure + len, sizeof(run->failure) - len, fmt, ap);
+    va_end(ap);
+    return -1;
+}
+
+static void model_fill(model_run *run, u8 *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = run->pattern++;
+}
+
+static void model_rewind(model_run *run, size_t len)
+{
+    run->pattern -= len;
+}
+
+/* Bytes handed out by the ring must be the oldest ones of the model */
+static int model_take(model_run *run, const u8 *buf, size_t len,
+                      const char *what)
+{
+    size_t i;
+
+    if (len > run->model.size())
+        return model_fail(run, "%s returned %zu bytes, %zu valid", what, len,
+                          run->model.size());
+    for (i = 0; i < len; i++) {
+        if (buf[i] != run->model[i])
+            return model_fail(run, "%s byte %zu is 0x%02x, expected 0x%02x",
+                              what, i, buf[i], run->model[i]);
+    }
+    return 0;
+}
+
+/* A write into an empty ring must not fail for lack of room */
+static int model_check_write(model_run *run, enum rb_status status,
+                             bool was_empty, const char *what)
+{
+    if (status == RB_SUCCESS || (status == RB_FULL && !was_empty))
+        return 0;
+    return model_fail(run, "%s into %s ring returned %d", what,
+                      was_empty ? "an empty" : "a", status);
+}
+
+static int model_op_write(model_run *run)
+{
+    u8 buf[RB_BENCH_BUF_SIZE];
+    size_t len = rnd_range(&run->rnd, 1, run->buf_size);
+    bool was_empty = run->model.empty();
+    enum rb_status status;
+
+    model_fill(run, buf, len);
+    status = rb_write(run->rb, buf, len, 0, len);
+    if (status != RB_SUCCESS)
+        model_rewind(run, len);
+    else
+        run->model.insert(run->model.end(), buf, buf + len);
+    return model_check_write(run, status, was_empty, "rb_write");
+}
+
+static int model_op_writev(model_run *run)
+{
+    u8 buf[RB_BENCH_BUF_SIZE];
+    struct iovec iov[3];
+    size_t len = rnd_range(&run->rnd, 1, run->buf_size);
+    size_t off = 0, seg;
+    bool was_empty = run->model.empty();
+    enum rb_status status;
+    int iovcnt = 0;
+
+    model_fill(run, buf, len);
+    while (off < len && iovcnt < 3) {
+        seg = iovcnt == 2 ? len - off : rnd_range(&run->rnd, 0, len - off);
+        iov[iovcnt].iov_base = buf + off;
+        iov[iovcnt].iov_len = seg;
+        iovcnt++;
+        off += seg;
+    }
+
+    status = rb_writev(run->rb, iov, iovcnt, len);
+    if (status != RB_SUCCESS)
+        model_rewind(run, len);
+    else
+        run->model.insert(run->model.end(), buf, buf + len);
+    return model_check_write(run, status, was_empty, "rb_writev");
+}
+
+static int model_op_write_batch(model_run *run)
+{
+    u8 buf[RB_BENCH_BATCH_RECS * 512];
+    size_t rec_len[RB_BENCH_BATCH_RECS];
+    size_t max_len = run->buf_size < 512 ? run->buf_size : 512;
+    size_t len = 0, written = 0;
+    bool was_empty = run->model.empty();
+    int num_recs = rnd_range(&run->rnd, 1, RB_BENCH_BATCH_RECS);
+    int num_written = -1;
+    enum rb_status status;
+    int i;
+
+    for (i = 0; i < num_recs; i++) {
+        rec_len[i] = rnd_range(&run->rnd, 1, max_len);
+        len += rec_len[i];
+    }
+    model_fill(run, buf, len);
+
+    status = rb_write_batch(run->rb, buf, rec_len, num_recs, &num_written);
+    if (num_written < 0 || num_written > num_recs)
+        return model_fail(run, "rb_write_batch wrote %d of %d records",
+                          num_written, num_recs);
+    if (status == RB_SUCCESS && num_written != num_recs)
+        return model_fail(run, "rb_write_batch succeeded with %d of %d "
+                          "records", num_written, num_recs);
+    for (i = 0; i < num_written; i++)
+        written += rec_len[i];
+    model_rewind(run, len - written);
+    run->model.insert(run->model.end(), buf, buf + written);
+
+    /* The first record goes in just like a single rb_write */
+    if (num_written == 0)
+        return model_check_write(run, status, was_empty, "rb_write_batch");
+    return status == RB_SUCCESS || status == RB_FULL ? 0 :
+           model_fail(run, "rb_write_batch returned %d", status);
+}
+
+static int model_op_read(model_run *run)
+{
+    u8 buf[2 * RB_BENCH_BUF_SIZE];
+    size_t max_len = rnd_range(&run->rnd, 1, 2 * run->buf_size);
+    size_t len, expected;
+
+    expected = run->model.size() < max_len ? run->model.size() : max_len;
+    len = rb_read(run->rb, buf, max_len);
+    if (model_take(run, buf, len, "rb_read"))
+        return -1;
+    /* rb_read goes on to the next buffer until max_len is read */
+    if (len != expected)
+        return model_fail(run, "rb_read returned %zu of %zu readable bytes",
+                          len, expected);
+    run->model.erase(run->model.begin(), run->model.begin() + len);
+    return 0;
+}
+
+static int model_op_get_read_buf(model_run *run)
+{
+    size_t len = 0;
+    u8 *buf;
+    int ret;
+
+    buf = rb_get_read_buf(run->rb, &len);
+    if (buf == NULL) {
+        if (len)
+            return model_fail(run, "rb_get_read_buf: NULL with length %zu",
+                              len);
+        if (!run->model.empty())
+            return model_fail(run, "rb_get_read_buf: nothing out of %zu "
+                              "valid bytes", run->model.size());
+        return 0;
+    }
+    ret = model_take(run, buf, len, "rb_get_read_buf");
+    free(buf);
+    if (ret)
+        return ret;
+    if (len == 0)
+        return model_fail(run, "rb_get_read_buf: empty buffer");
+    run->model.erase(run->model.begin(), run->model.begin() + len);
+    return 0;
+}
+
+static int model_op_borrow(model_run *run)
+{
+    struct iovec iov[RB_MAX_READ_SEGS];
+    size_t total = 0, len;
+    int num_segs, i;
+
+    num_segs = rb_borrow(run->rb, iov, RB_MAX_READ_SEGS);
+    if (num_segs < 0 || num_segs > RB_MAX_READ_SEGS)
+        return model_fail(run, "rb_borrow returned %d spans", num_segs);
+    if (num_segs == 0) {
+        if (!run->model.empty())
+            return model_fail(run, "rb_borrow: nothing out of %zu valid "
+                              "bytes", run->model.size());
+        return 0;
+    }
+
+    for (i = 0; i < num_segs; i++) {
+        if (iov[i].iov_len == 0)
+            return model_fail(run, "rb_borrow: empty span %d", i);
+        if (iov[i].iov_len + total > run->model.size())
+            return model_fail(run, "rb_borrow lent %zu bytes, %zu valid",
+                              iov[i].iov_len + total, run->model.size());
+        for (len = 0; len < iov[i].iov_len; len++) {
+            if (((u8 *)iov[i].iov_base)[len] != run->model[total + len])
+                return model_fail(run, "rb_borrow span %d byte %zu is "
+                                  "0x%02x, expected 0x%02x", i, len,
+                                  ((u8 *)iov[i].iov_base)[len],
+                                  run->model[total + len]);
+        }
+        total += iov[i].iov_len;
+    }
+
+    /* Release all, a part or none of what was lent */
+    len = rnd_range(&run->rnd, 0, total);
+    rb_consume(run->rb, len);
+    run->model.erase(run->model.begin(), run->model.begin() + len);
+    return 0;
+}
+
+static int model_op_resize(model_run *run)
+{
+    int num_bufs = rnd_range(&run->rnd, 2, 8);
+    enum rb_status status;
+
+    status = rb_resize(run->rb, num_bufs);
+    if (run->engine != RB_ENGINE_SPSC) {
+        if (status != RB_FAILURE)
+            return model_fail(run, "rb_resize of a locked ring returned %d",
+                              status);
+        return 0;
+    }
+    if (run->model.empty() && status != RB_SUCCESS)
+        return model_fail(run, "rb_resize of an empty ring returned %d",
+                          status);
+    if (!run->model.empty() && status != RB_RETRY)
+        return model_fail(run, "rb_resize with %zu valid bytes returned %d",
+                          run->model.size(), status);
+    if (status == RB_SUCCESS)
+        run->num_bufs = num_bufs;
+    return 0;
+}
+
+/* Closes a file backed ring and maps it again, as a new session would */
+static int model_op_reopen(model_run *run)
+{
+    int recovered;
+
+    ring_buffer_deinit(run->rb);
+    run->rb = ring_buffer_init_file(run->buf_size, run->num_bufs, run->path,
+                                    &recovered);
+    if (run->rb == NULL)
+        return model_fail(run, "ring_buffer_init_file failed on reopen");
+    if (!recovered)
+        return model_fail(run, "reopened ring was not recovered");
+    return 0;
+}
+
+static int model_check_stats(model_run *run)
+{
+    struct rb_stats stats;
+
+    rb_get_stats(run->rb, &stats);
+    if (stats.cur_valid_bytes != run->model.size())
+        return model_fail(run, "cur_valid_bytes %u, expected %zu",
+                          stats.cur_valid_bytes, run->model.size());
+    if (stats.max_num_bufs != (unsigned int)run->num_bufs)
+        return model_fail(run, "max_num_bufs %u, expected %d",
+                          stats.max_num_bufs, run->num_bufs);
+    return 0;
+}
+
+static int model_run_ring(model_run *run, int num_ops)
+{
+    static const size_t buf_sizes[] = { 16, 64, 256, 1024, 4096 };
+    u32 r;
+    int ret;
+
+    run->buf_size = buf_sizes[rnd_next(&run->rnd) %
+                              (sizeof(buf_sizes) / sizeof(buf_sizes[0]))];
+    run->num_bufs = rnd_range(&run->rnd, 2, 8);
+    if (run->path) {
+        int recovered;
+
+        unlink(run->path);
+        run->rb = ring_buffer_init_file(run->buf_size, run->num_bufs,
+                                        run->path, &recovered);
+    } else {
+        run->rb = ring_buffer_init(run->buf_size, run->num_bufs, run->engine);
+    }
+    if (run->rb == NULL)
+        return model_fail(run, "ring_buffer_init failed");
+
+    for (run->op = 0; run->op < num_ops; run->op++) {
+        /* Lean towards writes so that the ring fills up and wraps */
+        r = rnd_next(&run->rnd) % 100;
+        if (r < 30)
+            ret = model_op_write(run);
+        else if (r < 40)
+            ret = model_op_writev(run);
+        else if (r < 50)
+            ret = model_op_write_batch(run);
+        else if (r < 65)
+            ret = model_op_read(run);
+        else if (r < 75)
+            ret = model_op_get_read_buf(run);
+        else if (r < 97)
+            ret = model_op_borrow(run);
+        else if (run->path)
+            ret = model_op_reopen(run);
+        else
+            ret = model_op_resize(run);
+        if (ret == 0)
+            ret = model_check_stats(run);
+        if (ret)
+            break;
+    }
+
+    if (run->rb)
+        ring_buffer_deinit(run->rb);
+    if (run->path)
+        unlink(run->path);
+    return ret;
+}
+
+typedef struct {
+    enum rb_engine engine;
+    bool file;
+    int rings;
+    u64 ops;
+    int failures;
+    char failure[256];
+} model_result;
+
+static void model_check(enum rb_engine engine, const char *path, u32 seed,
+                        int num_rings, int num_ops, model_result *res)
+{
+    int i;
+
+    memset(res, 0, sizeof(*res));
+    res->engine = engine;
+    res->file = path != NULL;
+    for (i = 0; i < num_rings; i++) {
+        model_run run;
+
+        run.engine = engine;
+        run.path = path;
+        run.rnd = seed * 2654435761U + i + 1;
+        if (!run.rnd)
+            run.rnd = 1;
+        run.pattern = 0;
+        run.failure[0] = '\0';
+        if (model_run_ring(&run, num_ops)) {
+            if (!res->failures)
+                snprintf(res->failure, sizeof(res->failure), "ring %d: %s",
+                         i, run.failure);
+            fprintf(stderr, "model check: ring %d: %s\n", i, run.failure);
+            res->failures++;
+        }
+        res->ops += run.op;
+        res->rings++;
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+/* Producer/consumer benchmark                                            */
+/* ---------------------------------------------------------------------- */
+
+enum bench_writer {
+    BENCH_WR_WRITE,
+    BENCH_WR_WRITEV,
+    BENCH_WR_BATCH,
+};
+
+enum bench_reader {
+    BENCH_RD_READ,
+    BENCH_RD_GET_READ_BUF,
+    BENCH_RD_BORROW,
+};
+
+static const char *writer_names[] = { "rb_write", "rb_writev",
+                                      "rb_write_batch" };
+static const char *reader_names[] = { "rb_read", "rb_get_read_buf",
+                                      "rb_borrow" };
+
+typedef struct {
+    enum rb_engine engine;
+    size_t rec_size;
+    int overwrite;
+    enum bench_writer writer;
+    enum bench_reader reader;
+} bench_case;
+
+typedef struct {
+    u32 *samples;
+    u64 num;                // calls, also those past the sample array
+    u64 cap;
+} lat_samples;
+
+typedef struct {
+    const bench_case *bc;
+    void *rb;
+    u32 done;
+    u64 bytes_read;
+    lat_samples rd_lat;
+} bench_reader_ctx;
+
+typedef struct {
+    u64 p50, p99, p999, max;
+} lat_summary;
+
+typedef struct {
+    bench_case bc;
+    u64 records;
+    u64 bytes_written;
+    u64 bytes_read;
+    u64 bytes_overwritten;
+    u64 full_retries;
+    double seconds;
+    lat_summary wr, rd;
+    u64 wr_calls, rd_calls;
+    u32 log_errors;         // errors logged by the ring code
+    bool lost;              // fewer bytes read than written without overwrite
+} bench_result;
+
+static int lat_init(lat_samples *lat)
+{
+    lat->num = 0;
+    lat->cap = RB_BENCH_MAX_SAMPLES;
+    lat->samples = (u32 *)malloc(lat->cap * sizeof(u32));
+    return lat->samples ? 0 : -1;
+}
+
+static inline void lat_add(lat_samples *lat, u64 ns)
+{
+    if (lat->num < lat->cap)
+        lat->samples[lat->num] = ns > UINT32_MAX ? UINT32_MAX : (u32)ns;
+    lat->num++;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void lat_summarize(lat_samples *lat, lat_summary *sum)
+{
+    u64 n = lat->num < lat->cap ? lat->num : lat->cap;
+
+    memset(sum, 0, sizeof(*sum));
+    if (n == 0)
+        return;
+    qsort(lat->samples, n, sizeof(u32), cmp_u32);
+    sum->p50 = lat->samples[n * 50 / 100];
+    sum->p99 = lat->samples[n * 99 / 100];
+    sum->p999 = lat->samples[n * 999 / 1000];
+    sum->max = lat->samples[n - 1];
+}
+
+static size_t bench_read_once(bench_reader_ctx *rc)
+{
+    static u8 buf[RB_BENCH_READ_LEN];
+    struct iovec iov[RB_MAX_READ_SEGS];
+    size_t len = 0;
+    u8 *rbuf;
+    int i, num_segs;
+
+    switch (rc->bc->reader) {
+    case BENCH_RD_READ:
+        len = rb_read(rc->rb, buf, sizeof(buf));
+        break;
+    case BENCH_RD_GET_READ_BUF:
+        rbuf = rb_get_read_buf(rc->rb, &len);
+        free(rbuf);
+        break;
+    case BENCH_RD_BORROW:
+        num_segs = rb_borrow(rc->rb, iov, RB_MAX_READ_SEGS);
+        for (i = 0; i < num_segs; i++)
+            len += iov[i].iov_len;
+        if (len)
+            rb_consume(rc->rb, len);
+        break;
+    }
+    return len;
+}
+
+static void *bench_reader_thread(void *arg)
+{
+    bench_reader_ctx *rc = (bench_reader_ctx *)arg;
+    u64 start;
+    size_t len;
+
+    for (;;) {
+        start = now_ns();
+        len = bench_read_once(rc);
+        if (len) {
+            lat_add(&rc->rd_lat, now_ns() - start);
+            rc->bytes_read += len;
+            continue;
+        }
+        /* Drain what the writer left before it said it was done */
+        if (__atomic_load_n(&rc->done, __ATOMIC_ACQUIRE)) {
+            while ((len = bench_read_once(rc)) != 0)
+                rc->bytes_read += len;
+            break;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+/* Writes one record or, for rb_write_batch, up to RB_BENCH_BATCH_RECS of
+ * them; returns the number of records taken by the ring */
+static int bench_write_once(const bench_case *bc, void *rb, u8 *buf,
+                            int num_recs, enum rb_status *status)
+{
+    size_t rec_len[RB_BENCH_BATCH_RECS];
+    struct iovec iov[2];
+    int i, num_written = 0;
+
+    switch (bc->writer) {
+    case BENCH_WR_WRITE:
+        *status = rb_write(rb, buf, bc->rec_size, bc->overwrite,
+                           bc->rec_size);
+        return *status == RB_SUCCESS;
+    case BENCH_WR_WRITEV:
+        /* A fixed header and the payload, as the logger rings write them */
+        iov[0].iov_base = buf;
+        iov[0].iov_len = bc->rec_size < 16 ? bc->rec_size : 16;
+        iov[1].iov_base = buf + iov[0].iov_len;
+        iov[1].iov_len = bc->rec_size - iov[0].iov_len;
+        *status = rb_writev(rb, iov, 2, bc->rec_size);
+        return *status == RB_SUCCESS;
+    case BENCH_WR_BATCH:
+        for (i = 0; i < num_recs; i++)
+            rec_len[i] = bc->rec_size;
+        *status = rb_write_batch(rb, buf, rec_len, num_recs, &num_written);
+        return num_written;
+    }
+    *status = RB_FAILURE;
+    return 0;
+}
+
+static int bench_run(const bench_case *bc, u64 total_bytes, bench_result *res)
+{
+    bench_reader_ctx rc;
+    lat_samples wr_lat;
+    struct rb_stats stats;
+    pthread_t reader;
+    enum rb_status status;
+    u64 records, start, call_start, done_recs = 0;
+    u32 errors = __atomic_load_n(&log_errors, __ATOMIC_RELAXED);
+    int batch, num, ret = -1;
+    u8 *buf;
+
+    memset(res, 0, sizeof(*res));
+    memset(&rc, 0, sizeof(rc));
+    res->bc = *bc;
+    records = total_bytes / bc->rec_size;
+    batch = bc->writer == BENCH_WR_BATCH ? RB_BENCH_BATCH_RECS : 1;
+
+    buf = (u8 *)malloc(bc->rec_size * RB_BENCH_BATCH_RECS);
+    if (buf == NULL)
+        return -1;
+    memset(buf, 0xa5, bc->rec_size * RB_BENCH_BATCH_RECS);
+    if (lat_init(&wr_lat))
+        goto free_buf;
+    if (lat_init(&rc.rd_lat))
+        goto free_wr_lat;
+
+    rc.bc = bc;
+    rc.rb = ring_buffer_init(RB_BENCH_BUF_SIZE, RB_BENCH_NUM_BUFS,
+                             bc->engine);
+    if (rc.rb == NULL)
+        goto free_rd_lat;
+    if (pthread_create(&reader, NULL, bench_reader_thread, &rc))
+        goto deinit;
+
+    start = now_ns();
+    while (done_recs < records) {
+        num = records - done_recs < (u64)batch ? records - done_recs : batch;
+        call_start = now_ns();
+        num = bench_write_once(bc, rc.rb, buf, num, &status);
+        if (num)
+            lat_add(&wr_lat, now_ns() - call_start);
+        done_recs += num;
+        if (status == RB_FULL) {
+            res->full_retries++;
+            sched_yield();
+        } else if (status != RB_SUCCESS) {
+            fprintf(stderr, "bench: %s returned %d\n",
+                    writer_names[bc->writer], status);
+            break;
+        }
+    }
+    __atomic_store_n(&rc.done, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    res->seconds = (now_ns() - start) / 1e9;
+
+    rb_get_stats(rc.rb, &stats);
+    res->records = done_recs;
+    res->bytes_written = done_recs * bc->rec_size;
+    res->bytes_read = rc.bytes_read;
+    res->bytes_overwritten = res->bytes_written - rc.bytes_read;
+    res->lost = !bc->overwrite && rc.bytes_read != res->bytes_written;
+    res->log_errors = __atomic_load_n(&log_errors, __ATOMIC_RELAXED) - errors;
+    res->wr_calls = wr_lat.num;
+    res->rd_calls = rc.rd_lat.num;
+    lat_summarize(&wr_lat, &res->wr);
+    lat_summarize(&rc.rd_lat, &res->rd);
+    ret = done_recs == records ? 0 : -1;
+
+deinit:
+    ring_buffer_deinit(rc.rb);
+free_rd_lat:
+    free(rc.rd_lat.samples);
+free_wr_lat:
+    free(wr_lat.samples);
+free_buf:
+    free(buf);
+    return ret;
+}
+
+/* ---------------------------------------------------------------------- */
+/* JSON output                                                            */
+/* ---------------------------------------------------------------------- */
+
+static void json_lat(FILE *out, const char *name, const lat_summary *sum,
+                     u64 calls)
+{
+    fprintf(out, "\"%s\": {\"calls\": %llu, \"p50\": %llu, \"p99\": %llu, "
+            "\"p999\": %llu, \"max\": %llu}", name,
+            (unsigned long long)calls, (unsigned long long)sum->p50,
+            (unsigned long long)sum->p99, (unsigned long long)sum->p999,
+            (unsigned long long)sum->max);
+}
+
+static void json_model(FILE *out, const model_result *res, bool last)
+{
+    fprintf(out, "    {\"engine\": \"%s\", \"file\": %s, \"rings\": %d, "
+            "\"ops\": %llu, \"failures\": %d", engine_name(res->engine),
+            res->file ? "true" : "false", res->rings,
+            (unsigned long long)res->ops, res->failures);
+    if (res->failures)
+        fprintf(out, ", \"first_failure\": \"%s\"", res->failure);
+    fprintf(out, "}%s\n", last ? "" : ",");
+}
+
+static void json_bench(FILE *out, const bench_result *res, bool last)
+{
+    double mb = res->bytes_written / (1024.0 * 1024.0);
+
+    fprintf(out, "    {\"engine\": \"%s\", \"record_size\": %zu, "
+            "\"overwrite\": %d, \"writer\": \"%s\", \"reader\": \"%s\", "
+            "\"records\": %llu, \"bytes_written\": %llu, "
+            "\"bytes_read\": %llu, \"bytes_overwritten\": %llu, "
+            "\"full_retries\": %llu, \"seconds\": %.6f, "
+            "\"mb_per_sec\": %.1f, \"records_per_sec\": %.0f, "
+            "\"log_errors\": %u, \"lost\": %s,\n      ",
+            engine_name(res->bc.engine), res->bc.rec_size, res->bc.overwrite,
+            writer_names[res->bc.writer], reader_names[res->bc.reader],
+            (unsigned long long)res->records,
+            (unsigned long long)res->bytes_written,
+            (unsigned long long)res->bytes_read,
+            (unsigned long long)res->bytes_overwritten,
+            (unsigned long long)res->full_retries, res->seconds,
+            res->seconds > 0 ? mb / res->seconds : 0.0,
+            res->seconds > 0 ? res->records / res->seconds : 0.0,
+            res->log_errors, res->lost ? "true" : "false");
+    json_lat(out, "write_ns", &res->wr, res->wr_calls);
+    fprintf(out, ",\n      ");
+    json_lat(out, "read_ns", &res->rd, res->rd_calls);
+    fprintf(out, "}%s\n", last ? "" : ",");
+}
+
+static void json_lz_bench(FILE *out, const lz_bench_result *res, bool last)
+{
+    double mb = res->in_bytes / (1024.0 * 1024.0);
+    double dec_mb = res->decompress_bytes / (1024.0 * 1024.0);
+
+    fprintf(out, "    {\"ring\": \"%s\", \"chunk_size\": %u, "
+            "\"chunks\": %llu, \"stored_chunks\": %llu, "
+            "\"in_bytes\": %llu, \"out_bytes\": %llu, \"ratio\": %.3f, "
+            "\"cpu_ns_per_byte\": %.2f, \"compress_mb_per_sec\": %.1f, "
+            "\"decompress_mb_per_sec\": %.1f}%s\n", res->ring,
+            res->chunk_size, (unsigned long long)res->chunks,
+            (unsigned long long)res->stored_chunks,
+            (unsigned long long)res->in_bytes,
+            (unsigned long long)res->out_bytes,
+            res->in_bytes ? (double)res->out_bytes / res->in_bytes : 0.0,
+            res->in_bytes ? res->cpu_us * 1000.0 / res->in_bytes : 0.0,
+            res->compress_seconds > 0 ? mb / res->compress_seconds : 0.0,
+            res->decompress_seconds > 0 ? dec_mb / res->decompress_seconds
+                                        : 0.0,
+            last ? "" : ",");
+}
+
+static void json_rx_aggr(FILE *out, const rx_aggr_replay_result *res,
+                         bool last)
+{
+    fprintf(out, "    {\"stager\": \"%s\", \"pktlog_ver\": %d, "
+            "\"entry_len\": %u, \"ppdus\": %llu, \"entries\": %llu, "
+            "\"reallocs\": %llu, \"arena_len\": %u, \"seconds\": %.6f, "
+            "\"ns_per_entry\": %.1f}%s\n",
+            rx_aggr_stager_name(res->stager), res->pktlog_ver,
+            res->entry_len, (unsigned long long)res->ppdus,
+            (unsigned long long)res->entries,
+            (unsigned long long)res->reallocs, res->arena_len, res->seconds,
+            res->entries ? res->seconds * 1e9 / res->entries : 0.0,
+            last ? "" : ",");
+}
+
+static void json_pkt_stats(FILE *out, const pkt_stats_replay_result *res,
+                           bool last)
+{
+    double mb = res->bytes / (1024.0 * 1024.0);
+
+    fprintf(out, "    {\"writer\": \"%s\", \"pktlog_ver\": %d, "
+            "\"buffers\": %llu, \"records\": %llu, \"bytes\": %llu, "
+            "\"ring_calls\": %llu, \"full_retries\": %llu, "
+            "\"seconds\": %.6f, \"mb_per_sec\": %.1f, "
+            "\"ns_per_record\": %.1f, \"cpu_ns_per_record\": %.1f, "
+            "\"lost\": %s}%s\n",
+            pkt_stats_writer_name(res->writer), res->pktlog_ver,
+            (unsigned long long)res->buffers,
+            (unsigned long long)res->records, (unsigned long long)res->bytes,
+            (unsigned long long)res->ring_calls,
+            (unsigned long long)res->full_retries, res->seconds,
+            res->seconds > 0 ? mb / res->seconds : 0.0,
+            res->records ? res->seconds * 1e9 / res->records : 0.0,
+            res->records ? res->cpu_seconds * 1e9 / res->records : 0.0,
+            res->lost ? "true" : "false", last ? "" : ",");
+}
+
+static void json_cmd_sock(FILE *out, const cmd_sock_bench_result *res,
+                          bool last)
+{
+    fprintf(out, "    {\"pool_size\": %d, \"threads\": %d, "
+            "\"shared_lock\": %s, \"cmds\": %llu, \"seconds\": %.6f, "
+            "\"cmds_per_sec\": %.1f, \"wait_p50_ns\": %llu, "
+            "\"wait_p99_ns\": %llu, \"wait_max_ns\": %llu, "
+            "\"events\": %llu, \"dispatch_p99_ns\": %llu, "
+            "\"dispatch_max_ns\": %llu, \"failures\": %u}%s\n",
+            res->pool_size, res->threads,
+            res->shared_lock ? "true" : "false",
+            (unsigned long long)res->cmds, res->seconds,
+            res->seconds > 0 ? res->cmds / res->seconds : 0.0,
+            (unsigned long long)res->wait_p50_ns,
+            (unsigned long long)res->wait_p99_ns,
+            (unsigned long long)res->wait_max_ns,
+            (unsigned long long)res->events,
+            (unsigned long long)res->dispatch_p99_ns,
+            (unsigned long long)res->dispatch_max_ns, res->failures,
+            last ? "" : ",");
+}
+
+static void json_nl_attr(FILE *out, const nl_attr_bench_result *res,
+                         bool last)
+{
+    fprintf(out, "    {\"msg\": \"%s\", \"parser\": \"%s\", "
+            "\"max_type\": %d, \"attrs\": %u, \"lookups\": %u, "
+            "\"msgs\": %llu, \"seconds\": %.6f, \"ns_per_msg\": %.1f, "
+            "\"failures\": %u}%s\n",
+            res->msg, nl_attr_parser_name(res->parser), res->max_type,
+            res->attrs, res->lookups, (unsigned long long)res->msgs,
+            res->seconds, res->msgs ? res->seconds * 1e9 / res->msgs : 0.0,
+            res->failures, last ? "" : ",");
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-s seed] [-r rings] [-n ops] [-m MB] [-o file] "
+            "[-M | -B] [-v]\n"
+            "  -s seed   seed of the model check (default %d)\n"
+            "  -r rings  rings per engine in the model check (default %d)\n"
+            "  -n ops    operations per ring (default %d)\n"
+            "  -m MB     data written per benchmark case (default %d)\n"
+            "  -o file   write the JSON report to file instead of stdout\n"
+            "  -M        model, rate table, handler table and LZ checks only\n"
+            "  -B        benchmark only\n"
+            "  -v        also print info logs of the ring code\n",
+            prog, RB_BENCH_DEF_SEED, RB_BENCH_DEF_RINGS, RB_BENCH_DEF_OPS,
+            RB_BENCH_DEF_MB);
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t rec_sizes[] = { 32, 128, 512, 2048 };
+    static const enum rb_engine engines[] = { RB_ENGINE_LOCKED,
+                                              RB_ENGINE_SPSC };
+    bench_case cases[64];
+    bench_result *results = NULL;
+    model_result models[3];
+    rate_check_result rates;
+    event_cb_check_result cbs;
+    lz_check_result lz;
+    lz_bench_result lzb[LZ_BENCH_RINGS];
+    rx_aggr_replay_result rxr[RX_AGGR_REPLAY_RESULTS];
+    pkt_stats_replay_result psr[PKT_STATS_REPLAY_RESULTS];
+    cmd_sock_bench_result csr[CMD_SOCK_BENCH_RESULTS];
+    nl_attr_bench_result nar[NL_ATTR_BENCH_RESULTS];
+    char path[64];
+    int num_cases = 0, num_results = 0;
+    u32 seed = RB_BENCH_DEF_SEED;
+    int rings = RB_BENCH_DEF_RINGS, ops = RB_BENCH_DEF_OPS;
+    int mb = RB_BENCH_DEF_MB;
+    bool run_model = true, run_bench = true;
+    const char *out_path = NULL;
+    FILE *out = stdout;
+    int failed = 0;
+    int opt, e, s, i;
+
+    while ((opt = getopt(argc, argv, "s:r:n:m:o:MBvh")) != -1) {
+        switch (opt) {
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rings = atoi(optarg);
+            break;
+        case 'n':
+            ops = atoi(optarg);
+            break;
+        case 'm':
+            mb = atoi(optarg);
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'M':
+            run_bench = false;
+            break;
+        case 'B':
+            run_model = false;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (rings < 1 || ops < 1 || mb < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (run_model) {
+        for (e = 0; e < 2; e++) {
+            model_check(engines[e], NULL, seed, rings, ops, &models[e]);
+            failed |= models[e].failures != 0;
+        }
+        snprintf(path, sizeof(path), "/tmp/rb_bench.%d.ring", (int)getpid());
+        model_check(RB_ENGINE_SPSC, path, seed, rings, ops, &models[2]);
+        failed |= models[2].failures != 0;
+
+        rate_check(&rates);
+        failed |= rates.mismatches != 0;
+
+        event_cb_check(seed, ops, &cbs);
+        failed |= cbs.failures != 0;
+
+        lz_check(seed, &lz);
+        failed |= lz.failures != 0;
+    }
+
+    if (run_bench) {
+        /* Every reader behind rb_write, every writer in front of rb_read,
+         * and the overwriting writer of the locked engine */
+        for (e = 0; e < 2; e++) {
+            for (s = 0; s < (int)(sizeof(rec_sizes) / sizeof(rec_sizes[0]));
+                 s++) {
+                bench_case bc = { engines[e], rec_sizes[s], 0, BENCH_WR_WRITE,
+                                  BENCH_RD_READ };
+
+                cases[num_cases++] = bc;
+                bc.reader = BENCH_RD_GET_READ_BUF;
+                cases[num_cases++] = bc;
+                bc.reader = BENCH_RD_BORROW;
+                cases[num_cases++] = bc;
+                bc.reader = BENCH_RD_READ;
+                bc.writer = BENCH_WR_WRITEV;
+                cases[num_cases++] = bc;
+                bc.writer = BENCH_WR_BATCH;
+                cases[num_cases++] = bc;
+                if (engines[e] == RB_ENGINE_LOCKED) {
+                    bc.writer = BENCH_WR_WRITE;
+                    bc.overwrite = 1;
+                    cases[num_cases++] = bc;
+                }
+            }
+        }
+
+        results = (bench_result *)calloc(num_cases, sizeof(bench_result));
+        if (results == NULL) {
+            fprintf(stderr, "Failed to alloc results\n");
+            return 1;
+        }
+        for (i = 0; i < num_cases; i++) {
+            if (bench_run(&cases[i], (u64)mb * 1024 * 1024,
+                          &results[num_results])) {
+                fprintf(stderr, "bench: case %d did not complete\n", i);
+                failed = 1;
+                continue;
+            }
+            failed |= results[num_results].lost;
+            num_results++;
+        }
+
+        lz_bench(seed, (u64)mb * 1024 * 1024, lzb);
+        rx_aggr_replay(seed, (u64)mb * RB_BENCH_REPLAY_ENTRIES_PER_MB, rxr);
+        pkt_stats_replay(seed, (u64)mb * 1024 * 1024, psr);
+        for (i = 0; i < PKT_STATS_REPLAY_RESULTS; i++)
+            failed |= psr[i].lost;
+        cmd_sock_bench(seed, CMD_SOCK_BENCH_CMDS, csr);
+        for (i = 0; i < CMD_SOCK_BENCH_RESULTS; i++)
+            failed |= csr[i].failures != 0;
+        nl_attr_bench(seed, (u64)mb * RB_BENCH_ATTR_MSGS_PER_MB, nar);
+        for (i = 0; i < NL_ATTR_BENCH_RESULTS; i++)
+            failed |= nar[i].failures != 0;
+    }
+
+    if (out_path) {
+        out = fopen(out_path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Failed to open %s: %s\n", out_path,
+                    strerror(errno));
+            free(results);
+            return 1;
+        }
+    }
+
+    fprintf(out, "{\n  \"seed\": %u,\n", seed);
+    fprintf(out, "  \"ring_buf_size\": %d,\n  \"ring_num_bufs\": %d,\n",
+            RB_BENCH_BUF_SIZE, RB_BENCH_NUM_BUFS);
+    fprintf(out, "  \"model_check\": [\n");
+    for (e = 0; run_model && e < 3; e++)
+        json_model(out, &models[e], e == 2);
+    fprintf(out, "  ],\n");
+    if (run_model)
+        fprintf(out, "  \"rate_check\": {\"mcs_words\": %u, "
+                "\"he_eht_keys\": %u, \"mismatches\": %u},\n",
+                rates.mcs_words, rates.he_eht_keys, rates.mismatches);
+    if (run_model)
+        fprintf(out, "  \"event_cb_check\": {\"lookups\": %" PRIu64 ", "
+                "\"updates\": %u, \"stalls\": %u, "
+                "\"max_stall_updates\": %u, \"max_retired\": %u, "
+                "\"left_retired\": %u, \"failures\": %u},\n",
+                cbs.lookups, cbs.updates, cbs.stalls, cbs.max_stall_updates,
+                cbs.max_retired, cbs.left_retired, cbs.failures);
+    if (run_model)
+        fprintf(out, "  \"lz_check\": {\"frames\": %u, \"compressed\": %u, "
+                "\"max_frames\": %u, \"corrupted\": %u, "
+                "\"in_bytes\": %" PRIu64 ", \"out_bytes\": %" PRIu64 ", "
+                "\"failures\": %u},\n", lz.frames, lz.compressed,
+                lz.max_frames, lz.corrupted, lz.in_bytes, lz.out_bytes,
+                lz.failures);
+    fprintf(out, "  \"bench\": [\n");
+    for (i = 0; i < num_results; i++)
+        json_bench(out, &results[i], i == num_results - 1);
+    fprintf(out, "  ],\n  \"lz_bench\": [\n");
+    for (i = 0; run_bench && i < LZ_BENCH_RINGS; i++)
+        json_lz_bench(out, &lzb[i], i == LZ_BENCH_RINGS - 1);
+    fprintf(out, "  ],\n  \"rx_aggr_replay\": [\n");
+    for (i = 0; run_bench && i < RX_AGGR_REPLAY_RESULTS; i++)
+        json_rx_aggr(out, &rxr[i], i == RX_AGGR_REPLAY_RESULTS - 1);
+    fprintf(out, "  ],\n  \"pkt_stats_replay\": [\n");
+    for (i = 0; run_bench && i < PKT_STATS_REPLAY_RESULTS; i++)
+        json_pkt_stats(out, &psr[i], i == PKT_STATS_REPLAY_RESULTS - 1);
+    fprintf(out, "  ],\n  \"cmd_sock_bench\": [\n");
+    for (i = 0; run_bench && i < CMD_SOCK_BENCH_RESULTS; i++)
+        json_cmd_sock(out, &csr[i], i == CMD_SOCK_BENCH_RESULTS - 1);
+    fprintf(out, "  ],\n  \"nl_attr_bench\": [\n");
+    for (i = 0; run_bench && i < NL_ATTR_BENCH_RESULTS; i++)
+        json_nl_attr(out, &nar[i], i == NL_ATTR_BENCH_RESULTS - 1);
+    fprintf(out, "  ],\n  \"log_errors\": %u,\n  \"passed\": %s\n}\n",
+            log_errors, failed ? "false" : "true");
+
+    if (out != stdout)
+        fclose(out);
+    free(results);
+    return failed ? 1 : 0;
+}
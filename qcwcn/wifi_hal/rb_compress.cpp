@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOG_TAG  "WifiHAL"
+
+#include <utils/Log.h>
+
+#include "rb_compress.h"
+
+typedef unsigned char u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_RUN_MASK 15
+
+struct rb_compress {
+    size_t max_chunk;
+    u8 *frame; // rb_lz_frame_hdr + lz_compress_bound(max_chunk)
+    u32 table[1 << LZ_HASH_BITS]; // 1 based positions of 4 byte sequences
+    struct rb_compress_stats stats;
+};
+
+static inline size_t lz_compress_bound(size_t len)
+{
+    return len + len / 255 + 16;
+}
+
+static inline u32 lz_read32(const u8 *p)
+{
+    u32 v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 lz_hash(u32 v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static u8 *lz_put_len(u8 *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (u8)len;
+    return op;
+}
+
+/* Emits one sequence; match_len 0 marks the last, literals only one */
+static u8 *lz_put_seq(u8 *op, const u8 *lit, size_t lit_len, u32 offset,
+                      size_t match_len)
+{
+    u8 *token = op++;
+    size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+    *token = (u8)((lit_len >= LZ_RUN_MASK ? LZ_RUN_MASK : lit_len) << 4);
+    if (lit_len >= LZ_RUN_MASK)
+        op = lz_put_len(op, lit_len - LZ_RUN_MASK);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (!match_len)
+        return op;
+
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+    *token |= ml >= LZ_RUN_MASK ? LZ_RUN_MASK : ml;
+    if (ml >= LZ_RUN_MASK)
+        op = lz_put_len(op, ml - LZ_RUN_MASK);
+    return op;
+}
+
+/* Greedy single pass LZ77; dst must hold lz_compress_bound(len) bytes */
+static size_t lz_compress(struct rb_compress *cz, const u8 *src, size_t len,
+                          u8 *dst)
+{
+    const u8 *ip = src, *anchor = src, *end = src + len;
+    const u8 *ref, *mp, *rp;
+    u8 *op = dst;
+    u32 h;
+
+    memset(cz->table, 0, sizeof(cz->table));
+    while (ip + LZ_MIN_MATCH <= end) {
+        h = lz_hash(lz_read32(ip));
+        ref = cz->table[h] ? src + cz->table[h] - 1 : NULL;
+        cz->table[h] = (u32)(ip - src) + 1;
+        if (ref == NULL || ip - ref > LZ_MAX_OFFSET ||
+            lz_read32(ref) != lz_read32(ip)) {
+            ip++;
+            continue;
+        }
+
+        mp = ip + LZ_MIN_MATCH;
+        rp = ref + LZ_MIN_MATCH;
+        while (mp < end && *mp == *rp) {
+            mp++;
+            rp++;
+        }
+        op = lz_put_seq(op, anchor, ip - anchor, (u32)(ip - ref), mp - ip);
+        ip = anchor = mp;
+    }
+    op = lz_put_seq(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+static int lz_get_len(const u8 **ip, const u8 *end, size_t *len)
+{
+    u8 b;
+
+    do {
+        if (*ip >= end)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+size_t lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst,
+                     size_t dst_len)
+{
+    const u8 *ip = src, *end = src + src_len;
+    u8 *op = dst, *oend = dst + dst_len;
+    size_t lit_len, match_len, offset;
+    u8 token;
+
+    while (ip < end) {
+        token = *ip++;
+        lit_len = token >> 4;
+        if (lit_len == LZ_RUN_MASK && lz_get_len(&ip, end, &lit_len))
+            return 0;
+        if (lit_len > (size_t)(end - ip) || lit_len > (size_t)(oend - op))
+            return 0;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return 0;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        match_len = token & LZ_RUN_MASK;
+        if (match_len == LZ_RUN_MASK && lz_get_len(&ip, end, &match_len))
+            return 0;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) ||
+            match_len > (size_t)(oend - op))
+            return 0;
+        /* Byte wise, matches may overlap their own output */
+        while (match_len--) {
+            *op = *(op - offset);
+            op++;
+        }
+    }
+    return op - dst;
+}
+
+static u64 rb_compress_cpu_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct rb_compress *rb_compress_init(size_t max_chunk)
+{
+    struct rb_compress *cz;
+
+    cz = (struct rb_compress *)calloc(1, sizeof(struct rb_compress));
+    if (cz == NULL) {
+        ALOGE("Failed to alloc rb compress state");
+        return NULL;
+    }
+    cz->frame = (u8 *)malloc(sizeof(struct rb_lz_frame_hdr) +
+                             lz_compress_bound(max_chunk));
+    if (cz->frame == NULL) {
+        ALOGE("Failed to alloc rb compress frame");
+        free(cz);
+        return NULL;
+    }
+    cz->max_chunk = max_chunk;
+    return cz;
+}
+
+void rb_compress_deinit(struct rb_compress *cz)
+{
+    if (cz == NULL)
+        return;
+    free(cz->frame);
+    free(cz);
+}
+
+uint8_t *rb_compress_frame(struct rb_compress *cz, const uint8_t *buf,
+                           size_t len, size_t *frame_len)
+{
+    struct rb_lz_frame_hdr *hdr = (struct rb_lz_frame_hdr *)cz->frame;
+    u8 *data = cz->frame + sizeof(struct rb_lz_frame_hdr);
+    u64 start;
+    size_t out_len;
+
+    if (len > cz->max_chunk)
+        return NULL;
+
+    start = rb_compress_cpu_us();
+    out_len = lz_compress(cz, buf, len, data);
+    hdr->flags = RB_LZ_FRAME_COMPRESSED;
+    if (out_len >= len) {
+        /* Incompressible chunk, store it */
+        memcpy(data, buf, len);
+        out_len = len;
+        hdr->flags = 0;
+        cz->stats.stored_chunks++;
+    }
+    cz->stats.cpu_us += rb_compress_cpu_us() - start;
+
+    hdr->magic = RB_LZ_FRAME_MAGIC;
+    hdr->reserved = 0;
+    hdr->orig_len = len;
+    hdr->data_len = out_len;
+
+    *frame_len = sizeof(struct rb_lz_frame_hdr) + out_len;
+    cz->stats.chunks++;
+    cz->stats.in_bytes += len;
+    cz->stats.out_bytes += *frame_len;
+    return cz->frame;
+}
+
+void rb_compress_get_stats(struct rb_compress *cz,
+                           struct rb_compress_stats *stats)
+{
+    if (cz == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = cz->stats;
+}
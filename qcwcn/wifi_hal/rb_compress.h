@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2024 Qualcomm Innovation Center, Inc. All rights reserved.
+ * SPDX-License-Identifier: BSD-3-Clause-Clear
+ */
+
+#ifndef __RB_COMPRESS_H
+#define __RB_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Chunks of a compressing ring are handed to on_ring_buffer_data() as
+ * frames: an rb_lz_frame_hdr followed by data_len bytes. With
+ * RB_LZ_FRAME_COMPRESSED set the data is an LZ block that lz_decompress()
+ * expands back to orig_len bytes, otherwise it is the chunk as is.
+ *
+ * LZ block: a series of sequences, each a token byte (literal count in the
+ * high nibble, match length - 4 in the low nibble; 15 means more length
+ * bytes follow, each adding up to 255), the literals, a little endian
+ * 16 bit match offset and the extra match length bytes. The last sequence
+ * carries literals only.
+ */
+#define RB_LZ_FRAME_MAGIC 0x315A4C57 /* "WLZ1" */
+#define RB_LZ_FRAME_COMPRESSED 0x0001
+
+struct rb_lz_frame_hdr {
+    uint32_t magic;
+    uint16_t flags;
+    uint16_t reserved;
+    uint32_t orig_len;
+    uint32_t data_len;
+} __attribute__((packed));
+
+struct rb_compress_stats {
+    uint64_t chunks;        /* chunks framed */
+    uint64_t stored_chunks; /* chunks that did not shrink and went as is */
+    uint64_t in_bytes;      /* ring bytes framed */
+    uint64_t out_bytes;     /* frame bytes handed out, headers included */
+    uint64_t cpu_us;        /* thread CPU time spent compressing */
+};
+
+struct rb_compress;
+
+/* Allocates the state for compressing chunks of up to max_chunk bytes */
+struct rb_compress *rb_compress_init(size_t max_chunk);
+
+void rb_compress_deinit(struct rb_compress *cz);
+
+/* Frames len bytes of buf, compressed if that makes them smaller. Returns
+ * the frame, valid until the next call, and its length in *frame_len;
+ * NULL if len exceeds max_chunk.
+ */
+uint8_t *rb_compress_frame(struct rb_compress *cz, const uint8_t *buf,
+                           size_t len, size_t *frame_len);
+
+void rb_compress_get_stats(struct rb_compress *cz,
+                           struct rb_compress_stats *stats);
+
+/* Expands an LZ block into dst; returns the expanded length, 0 if the
+ * block is malformed or does not fit in dst_len bytes
+ */
+size_t lz_decompress(const uint8_t *src, size_t src_len, uint8_t *dst,
+                     size_t dst_len);
+
+#endif /* __RB_COMPRESS_H */
@@ -27,7 +27,13 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 #include "sync.h"
 #include <hardware_legacy/wifi_hal.h>
@@ -39,19 +45,63 @@
 #define LOG_TAG  "WifiHAL"
 
 wifi_error rb_init(hal_info *info, struct rb_info *rb_info, int id,
-                   size_t size_of_buf, int num_bufs, char *name)
+                   size_t size_of_buf, int num_bufs, enum rb_engine engine,
+                   char *name, const char *persist_dir)
 {
-    rb_info->rb_ctx = ring_buffer_init(size_of_buf, num_bufs);
+    rb_info->recovered = 0;
+    rb_info->compress = NULL;
+    rb_info->rb_ctx = NULL;
+    /* Lock-free rings can be kept in a file across HAL restarts */
+    if (persist_dir && persist_dir[0] && engine == RB_ENGINE_SPSC) {
+        char path[PATH_MAX];
+
+        snprintf(path, sizeof(path), "%s/%s.rb", persist_dir, name);
+        rb_info->rb_ctx = ring_buffer_init_file(size_of_buf, num_bufs, path,
+                                                &rb_info->recovered);
+        if (rb_info->rb_ctx == NULL)
+            ALOGE("Failed to init persistent rb %s, keeping it in memory",
+                  name);
+        else if (rb_info->recovered)
+            ALOGI("Recovered previous session data of rb %s", name);
+    }
+    rb_info->buf_size = size_of_buf;
+    rb_info->num_bufs = num_bufs;
+    rb_info->min_num_bufs = 0;
+    rb_info->max_num_bufs = num_bufs;
+    if (rb_info->rb_ctx == NULL) {
+        rb_info->rb_ctx = ring_buffer_init(size_of_buf, num_bufs, engine);
+        /* Only in-memory lock-free rings can be resized */
+        if (engine == RB_ENGINE_SPSC) {
+            rb_info->min_num_bufs = num_bufs / RB_ADAPT_MIN_DIV;
+            if (rb_info->min_num_bufs < 2)
+                rb_info->min_num_bufs = 2;
+            rb_info->max_num_bufs = num_bufs * RB_ADAPT_MAX_MUL;
+        }
+    }
     if (rb_info->rb_ctx == NULL) {
         ALOGE("Failed to init ring buffer");
         return WIFI_ERROR_OUT_OF_MEMORY;
     }
+    rb_info->full_events = 0;
+    rb_info->retry_events = 0;
+    rb_info->last_events = 0;
+    rb_info->last_written = 0;
+    rb_info->last_overwritten = 0;
+    rb_info->write_rate = 0;
+    rb_info->last_adapt_us = wifi_monotonic_us();
     strlcpy(rb_info->name, name, MAX_RB_NAME_SIZE);
     rb_info->ctx = info;
     rb_info->id = id;
 
     /* Initialize last_push_time */
     gettimeofday(&rb_info->last_push_time, NULL);
+
+    /* Timer for max_interval_sec flushes, watched by wifi_event_loop */
+    rb_info->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                       TFD_NONBLOCK | TFD_CLOEXEC);
+    if (rb_info->timer_fd < 0)
+        ALOGE("Failed to create flush timer for rb %s: %s", name,
+              strerror(errno));
     return WIFI_SUCCESS;
 }
 
@@ -60,10 +110,55 @@ void rb_deinit(struct rb_info *rb_info)
     if (rb_info->rb_ctx) {
         ring_buffer_deinit(rb_info->rb_ctx);
         rb_info->rb_ctx = NULL;
+        if (rb_info->timer_fd >= 0)
+            close(rb_info->timer_fd);
+        rb_info->timer_fd = -1;
+    }
+    if (rb_info->compress) {
+        struct rb_compress_stats stats;
+
+        rb_compress_get_stats(rb_info->compress, &stats);
+        ALOGI("rb %s compressed %" PRIu64 " chunks %" PRIu64 " -> %" PRIu64
+              " bytes (%" PRIu64 " stored) in %" PRIu64 " us",
+              rb_info->name, stats.chunks, stats.in_bytes, stats.out_bytes,
+              stats.stored_chunks, stats.cpu_us);
+        rb_compress_deinit(rb_info->compress);
+        rb_info->compress = NULL;
     }
     rb_info->name[0] = '\0';
 }
 
+/* Arm the flush timer to expire when rb_check_for_timeout() will find the
+ * ring due, i.e. at the start of second last_push_time + max_interval_sec.
+ * The timer is disarmed when periodic flushing is off.
+ */
+static void rb_arm_timer(struct rb_info *rb_info, struct timeval *now)
+{
+    struct itimerspec its;
+    long long remaining_ms;
+
+    if (rb_info->timer_fd < 0)
+        return;
+
+    memset(&its, 0, sizeof(its));
+    if (rb_info->recovered) {
+        /* Hand the previous session's data out right away */
+        its.it_value.tv_nsec = 1000000;
+    } else if (rb_info->max_interval_sec) {
+        remaining_ms = ((long long)rb_info->last_push_time.tv_sec +
+                        rb_info->max_interval_sec - now->tv_sec) * 1000 -
+                       now->tv_usec / 1000;
+        if (remaining_ms <= 0)
+            remaining_ms = 1;
+        its.it_value.tv_sec = remaining_ms / 1000;
+        its.it_value.tv_nsec = (remaining_ms % 1000) * 1000000;
+    }
+
+    if (timerfd_settime(rb_info->timer_fd, 0, &its, NULL) < 0)
+        ALOGE("Failed to arm flush timer for rb %s: %s", rb_info->name,
+              strerror(errno));
+}
+
 void get_rb_status(struct rb_info *rb_info, wifi_ring_buffer_status *rbs)
 {
     struct rb_stats rb_stats;
@@ -80,11 +175,39 @@ void get_rb_status(struct rb_info *rb_info, wifi_ring_buffer_status *rbs)
     rbs->written_records = rb_info->written_records;
 }
 
+/* Frame and LZ compress every chunk of this ring handed to
+ * on_ring_buffer_data(); max_chunk is the ring's buffer size.
+ */
+wifi_error rb_enable_compression(struct rb_info *rb_info, size_t max_chunk)
+{
+    if (rb_info->compress)
+        return WIFI_SUCCESS;
+    rb_info->compress = rb_compress_init(max_chunk);
+    if (rb_info->compress == NULL)
+        return WIFI_ERROR_OUT_OF_MEMORY;
+    return WIFI_SUCCESS;
+}
+
+void get_rb_compress_stats(struct rb_info *rb_info,
+                           struct rb_compress_stats *stats)
+{
+    rb_compress_get_stats(rb_info->compress, stats);
+}
+
 int is_rb_name_match(struct rb_info *rb_info, char *name)
 {
     return (strncmp(rb_info->name, name, MAX_RB_NAME_SIZE) == 0);
 }
 
+static void rb_count_write_event(struct rb_info *rb_info,
+                                 enum rb_status status)
+{
+    if (status == RB_FULL)
+        rb_info->full_events++;
+    else
+        rb_info->retry_events++;
+}
+
 wifi_error ring_buffer_write(struct rb_info *rb_info, u8 *buf, size_t length,
                              int no_of_records, size_t record_length)
 {
@@ -92,6 +215,7 @@ wifi_error ring_buffer_write(struct rb_info *rb_info, u8 *buf, size_t length,
 
     status = rb_write(rb_info->rb_ctx, buf, length, 0, record_length);
     if ((status == RB_FULL) || (status == RB_RETRY)) {
+        rb_count_write_event(rb_info, status);
          push_out_rb_data(rb_info);
          /* Try writing the data after reading it out */
         status = rb_write(rb_info->rb_ctx, buf, length, 0, record_length);
@@ -114,34 +238,220 @@ wifi_error ring_buffer_write(struct rb_info *rb_info, u8 *buf, size_t length,
     return WIFI_SUCCESS;
 }
 
-void push_out_rb_data(void *cb_ctx)
+wifi_error ring_buffer_writev(struct rb_info *rb_info, const struct iovec *iov,
+                              int iovcnt, int no_of_records)
+{
+    enum rb_status status;
+    size_t length = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        length += iov[i].iov_len;
+
+    status = rb_writev(rb_info->rb_ctx, iov, iovcnt, length);
+    if ((status == RB_FULL) || (status == RB_RETRY)) {
+        rb_count_write_event(rb_info, status);
+         push_out_rb_data(rb_info);
+         /* Try writing the data after reading it out */
+        status = rb_writev(rb_info->rb_ctx, iov, iovcnt, length);
+        if (status != RB_SUCCESS) {
+            ALOGE("Failed to rewrite %zu bytes to rb %s with error %d", length,
+                  rb_info->name, status);
+            return WIFI_ERROR_UNKNOWN;
+        }
+    } else if (status == RB_FAILURE) {
+        ALOGE("Failed to write %zu bytes to rb %s with error %d", length,
+              rb_info->name, status);
+        return WIFI_ERROR_UNKNOWN;
+    }
+
+    if (rb_info->written_records < (UINT_MAX - 1))
+        rb_info->written_records += no_of_records;
+    else
+        rb_info->written_records = 0;
+
+    return WIFI_SUCCESS;
+}
+
+/* Writes a batch of records (see rb_write_batch), pushing the ring out and
+ * retrying the rest once if it runs full */
+wifi_error ring_buffer_write_batch(struct rb_info *rb_info, const u8 *buf,
+                                   const size_t *rec_len, int num_recs)
+{
+    enum rb_status status;
+    int total = num_recs;
+    int written, i;
+
+    status = rb_write_batch(rb_info->rb_ctx, buf, rec_len, num_recs,
+                            &written);
+    if ((status == RB_FULL) || (status == RB_RETRY)) {
+        rb_count_write_event(rb_info, status);
+        push_out_rb_data(rb_info);
+        for (i = 0; i < written; i++)
+            buf += rec_len[i];
+        rec_len += written;
+        num_recs -= written;
+        status = rb_write_batch(rb_info->rb_ctx, buf, rec_len, num_recs,
+                                &written);
+        if (status != RB_SUCCESS) {
+            ALOGE("Failed to rewrite %d of %d records to rb %s with error %d",
+                  num_recs - written, num_recs, rb_info->name, status);
+            return WIFI_ERROR_UNKNOWN;
+        }
+    } else if (status == RB_FAILURE) {
+        ALOGE("Failed to write %d of %d records to rb %s with error %d",
+              num_recs - written, num_recs, rb_info->name, status);
+        return WIFI_ERROR_UNKNOWN;
+    }
+
+    if (rb_info->written_records < (UINT_MAX - total))
+        rb_info->written_records += total;
+    else
+        rb_info->written_records = 0;
+
+    return WIFI_SUCCESS;
+}
+
+/* Memory used by all rings of this HAL instance */
+static size_t rb_mem_used(hal_info *info)
+{
+    size_t used = 0;
+    int i;
+
+    for (i = 0; i < NUM_RING_BUFS; i++)
+        if (info->rb_infos[i].rb_ctx)
+            used += info->rb_infos[i].num_bufs * info->rb_infos[i].buf_size;
+    return used;
+}
+
+/* Grows a ring that ran full or whose write rate no longer fits its size
+ * and shrinks one that stays well below it. Called with diag_lock held
+ * right after the ring was drained, which is when it can be resized:
+ * rb_resize() frees the storage, and every ring write and read runs under
+ * diag_lock.
+ */
+static void rb_adapt_size(struct rb_info *rb_info, hal_info *info)
+{
+    u64 now = wifi_monotonic_us();
+    u64 elapsed = now - rb_info->last_adapt_us;
+    u64 rate, hold, capacity;
+    struct rb_stats stats;
+    int pressure, num_bufs;
+    size_t used, others;
+
+    if (rb_info->min_num_bufs == 0 || elapsed < RB_ADAPT_INTERVAL_US)
+        return;
+
+    rb_get_stats(rb_info->rb_ctx, &stats);
+    rate = (u64)(stats.total_bytes_written - rb_info->last_written) *
+           1000000 / elapsed;
+    rb_info->write_rate = rb_info->write_rate ?
+                          (rb_info->write_rate * 7 + rate) / 8 : rate;
+    pressure = (rb_info->full_events + rb_info->retry_events !=
+                rb_info->last_events) ||
+               (stats.total_bytes_overwritten != rb_info->last_overwritten);
+    rb_info->last_events = rb_info->full_events + rb_info->retry_events;
+    rb_info->last_written = stats.total_bytes_written;
+    rb_info->last_overwritten = stats.total_bytes_overwritten;
+    rb_info->last_adapt_us = now;
+
+    hold = rb_info->write_rate *
+           (rb_info->max_interval_sec ? rb_info->max_interval_sec :
+                                        RB_ADAPT_HOLD_SEC);
+    capacity = (u64)rb_info->num_bufs * rb_info->buf_size;
+    num_bufs = rb_info->num_bufs;
+    if (pressure || hold > capacity * 3 / 4) {
+        num_bufs = rb_info->num_bufs * 2;
+        if (num_bufs > rb_info->max_num_bufs)
+            num_bufs = rb_info->max_num_bufs;
+        used = rb_mem_used(info);
+        others = used - (size_t)capacity;
+        if (others + num_bufs * rb_info->buf_size > info->rb_mem_budget) {
+            num_bufs = info->rb_mem_budget > others ?
+                       (info->rb_mem_budget - others) / rb_info->buf_size : 0;
+        }
+        if (num_bufs <= rb_info->num_bufs)
+            return;
+    } else if (hold < capacity / 4) {
+        num_bufs = rb_info->num_bufs / 2;
+        if (num_bufs < rb_info->min_num_bufs)
+            num_bufs = rb_info->min_num_bufs;
+    }
+    if (num_bufs == rb_info->num_bufs)
+        return;
+
+    if (rb_resize(rb_info->rb_ctx, num_bufs) != RB_SUCCESS)
+        return;
+    ALOGI("Resized rb %s from %d to %d buffers (rate %" PRIu64 " B/s%s)",
+          rb_info->name, rb_info->num_bufs, num_bufs, rb_info->write_rate,
+          pressure ? ", ran full" : "");
+    rb_info->num_bufs = num_bufs;
+}
+
+static void rb_push_out(struct rb_info *rb_info, bool diag_locked)
 {
-    struct rb_info *rb_info = (struct rb_info *)cb_ctx;
     hal_info *info = (hal_info *)rb_info->ctx;
     wifi_ring_buffer_status rbs;
     wifi_ring_buffer_data_handler handler;
 
     while (info && !info->clean_up) {
+        struct iovec iov[RB_MAX_READ_SEGS];
         size_t length = 0;
-        u8 *buf;
+        int num_segs, i;
 
-        buf = rb_get_read_buf(rb_info->rb_ctx, &length);
-        if (buf == NULL) {
+        /* Hand the data to the framework straight out of the ring and
+         * release it only once the callback has returned */
+        num_segs = rb_borrow(rb_info->rb_ctx, iov, RB_MAX_READ_SEGS);
+        if (num_segs <= 0) {
             break;
         }
+        for (i = 0; i < num_segs; i++)
+            length += iov[i].iov_len;
         get_rb_status(rb_info, &rbs);
+        /* Report the status as of after this read */
+        rbs.read_bytes += length;
         pthread_mutex_lock(&info->lh_lock);
         handler.on_ring_buffer_data = info->on_ring_buffer_data;
         pthread_mutex_unlock(&info->lh_lock);
         if (handler.on_ring_buffer_data) {
-            handler.on_ring_buffer_data(rb_info->name, (char *)buf,
-                                        length, &rbs);
+            for (i = 0; i < num_segs; i++) {
+                u8 *data = (u8 *)iov[i].iov_base;
+                size_t data_len = iov[i].iov_len;
+
+                if (rb_info->compress) {
+                    data = rb_compress_frame(rb_info->compress, data,
+                                             data_len, &data_len);
+                    if (data == NULL) {
+                        ALOGE("Failed to frame %zu bytes of rb %s",
+                              iov[i].iov_len, rb_info->name);
+                        continue;
+                    }
+                }
+                handler.on_ring_buffer_data(rb_info->name, (char *)data,
+                                            data_len, &rbs);
+            }
         }
-        free(buf);
+        rb_consume(rb_info->rb_ctx, length);
     };
+    if (diag_locked && info && !info->clean_up)
+        rb_adapt_size(rb_info, info);
     gettimeofday(&rb_info->last_push_time, NULL);
 }
 
+/* Threshold callback and push out of a full ring on the write path. These
+ * run inside or around an rb_write, so the ring is never resized here */
+void push_out_rb_data(void *cb_ctx)
+{
+    rb_push_out((struct rb_info *)cb_ctx, false);
+}
+
+/* Pushes out a ring with diag_lock held, and resizes it if its write rate
+ * asks for it */
+void push_out_rb_data_locked(struct rb_info *rb_info)
+{
+    rb_push_out(rb_info, true);
+}
+
 wifi_error rb_start_logging(struct rb_info *rb_info, u32 verbose_level,
                             u32 flags, u32 max_interval_sec, u32 min_data_size)
 {
@@ -150,17 +460,54 @@ wifi_error rb_start_logging(struct rb_info *rb_info, u32 verbose_level,
     rb_info->max_interval_sec = max_interval_sec;
 
     rb_config_threshold(rb_info->rb_ctx, min_data_size, push_out_rb_data, rb_info);
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    rb_arm_timer(rb_info, &now);
     return WIFI_SUCCESS;
 }
 
+/* Called with diag_lock held */
 void rb_check_for_timeout(struct rb_info *rb_info, struct timeval *now)
 {
-    if (rb_info->max_interval_sec == 0) {
+    if (rb_info->recovered) {
+        rb_info->recovered = 0;
+        push_out_rb_data_locked(rb_info);
+    } else if (rb_info->max_interval_sec == 0) {
         return;
+    } else if (now->tv_sec >=
+               (rb_info->last_push_time.tv_sec +
+                (__kernel_time_t)rb_info->max_interval_sec)) {
+        push_out_rb_data_locked(rb_info);
+    } else if (rb_info->min_num_bufs &&
+               wifi_monotonic_us() - rb_info->last_adapt_us >=
+               RB_ADAPT_INTERVAL_US) {
+        /* Threshold pushes keep a busy ring from ever being due, and they
+         * cannot resize it; drain it here so that it still adapts */
+        push_out_rb_data_locked(rb_info);
     }
-    if (now->tv_sec >=
-        (rb_info->last_push_time.tv_sec +
-         (__kernel_time_t)rb_info->max_interval_sec)) {
-        push_out_rb_data(rb_info);
-    }
+    /* Threshold pushes move last_push_time, so the deadline is recomputed
+     * on every expiry rather than using a periodic timer. */
+    rb_arm_timer(rb_info, now);
+}
+
+/* Clears a fired flush timer so the event loop stops reporting it */
+void rb_timer_ack(struct rb_info *rb_info)
+{
+    uint64_t expirations;
+
+    if (read(rb_info->timer_fd, &expirations, sizeof(expirations)) < 0 &&
+        errno != EAGAIN)
+        ALOGE("Failed to read flush timer of rb %s: %s", rb_info->name,
+              strerror(errno));
+}
+
+/* Called from the event loop when the ring's flush timer fires */
+void rb_timer_expired(struct rb_info *rb_info)
+{
+    struct timeval now;
+
+    rb_timer_ack(rb_info);
+    gettimeofday(&now, NULL);
+    rb_check_for_timeout(rb_info, &now);
 }
@@ -29,6 +29,9 @@
 #ifndef __RB_WRAPPER_H
 #define __RB_WRAPPER_H
 
+#include "ring_buffer.h"
+#include "rb_compress.h"
+
 #define MAX_RB_NAME_SIZE 32
 
 struct rb_info {
@@ -41,17 +44,54 @@ struct rb_info {
     int id;
     void *ctx;
     struct timeval last_push_time;
+    int timer_fd;           /* fires at last_push_time + max_interval_sec */
+    int recovered;          /* holds data of a previous session to push out */
+    struct rb_compress *compress; /* frames flushed chunks when set */
+
+    /* Adaptive sizing, see rb_adapt_size() */
+    size_t buf_size;
+    int num_bufs;           /* current number of buffers */
+    int min_num_bufs;       /* 0 if the ring has a fixed size */
+    int max_num_bufs;
+    u32 full_events;        /* RB_FULL seen by ring_buffer_write(v) */
+    u32 retry_events;       /* RB_RETRY seen by ring_buffer_write(v) */
+    u32 last_events;        /* full + retry events at the last evaluation */
+    u32 last_written;       /* total_bytes_written at the last evaluation */
+    u32 last_overwritten;   /* total_bytes_overwritten at the last evaluation */
+    u64 last_adapt_us;
+    u64 write_rate;         /* EWMA of the write rate in bytes per second */
 };
+
+/* Adaptive rings move between a quarter and four times their initial
+ * number of buffers, all rings together within RB_MEM_BUDGET_FACTOR times
+ * their initial memory. */
+#define RB_ADAPT_MIN_DIV       4
+#define RB_ADAPT_MAX_MUL       4
+#define RB_MEM_BUDGET_FACTOR   2
+#define RB_ADAPT_INTERVAL_US   (5 * 1000 * 1000)
+/* Data a ring should hold without flushing when no interval is set */
+#define RB_ADAPT_HOLD_SEC      10
 struct hal_info_s;
 wifi_error rb_init(struct hal_info_s *info, struct rb_info *rb_info, int id,
-                   size_t size_of_buf, int num_bufs, char *name);
+                   size_t size_of_buf, int num_bufs, enum rb_engine engine,
+                   char *name, const char *persist_dir);
 void rb_deinit(struct rb_info *rb_info);
+wifi_error rb_enable_compression(struct rb_info *rb_info, size_t max_chunk);
+void get_rb_compress_stats(struct rb_info *rb_info,
+                           struct rb_compress_stats *stats);
 void get_rb_status(struct rb_info *rb_info, wifi_ring_buffer_status *rbs);
 void rb_check_for_timeout(struct rb_info *rb_info, struct timeval *now);
+void rb_timer_ack(struct rb_info *rb_info);
+void rb_timer_expired(struct rb_info *rb_info);
 wifi_error rb_start_logging(struct rb_info *rb_info, u32 verbose_level,
                             u32 flags, u32 max_interval_sec, u32 min_data_size);
 int is_rb_name_match(struct rb_info *rb_info, char *name);
 wifi_error ring_buffer_write(struct rb_info *rb_info, u8 *buf, size_t length,
                              int no_of_records, size_t record_length);
+wifi_error ring_buffer_writev(struct rb_info *rb_info, const struct iovec *iov,
+                              int iovcnt, int no_of_records);
+wifi_error ring_buffer_write_batch(struct rb_info *rb_info, const u8 *buf,
+                                   const size_t *rec_len, int num_recs);
 void push_out_rb_data(void *cb_ctx);
+void push_out_rb_data_locked(struct rb_info *rb_info);
 #endif /* __RB_WRAPPER_H */
@@ -26,10 +26,16 @@
  * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define LOG_TAG  "WifiHAL"
 
@@ -54,6 +60,7 @@ typedef struct rb_entry_s {
 } rb_entry_t;
 
 typedef struct ring_buf_cb {
+    enum rb_engine engine; // RB_ENGINE_LOCKED
     unsigned int rd_buf_no; // Current buffer number to be read from
     unsigned int wr_buf_no; // Current buffer number to be written into
     unsigned int cur_rd_buf_idx; // Read index within the current read buffer
@@ -78,6 +85,66 @@ typedef struct ring_buf_cb {
 } rbc_t;
 
 
+/* Lock-free single producer / single consumer ring.
+ *
+ * The preallocated region is split in max_num_bufs slots of each_buf_size
+ * bytes and keeps the record rule of the locked engine: a record never
+ * straddles two slots. Slots are addressed by a running sequence number;
+ * the writer fills slot wr_seq and the reader drains slot rd_seq. A slot
+ * is sealed once wr_seq has moved past it, so its fill is final, and it is
+ * free for the writer again once rd_seq has moved past it.
+ *
+ * wr_seq and fill[] are only stored by the writer, rd_seq and rd_idx only
+ * by the reader. Their release stores and the acquire loads on the other
+ * side order the data copies, so no lock is taken.
+ *
+ * Sequences, the read index, fill counters and data live in one region
+ * laid out as [rb_region_hdr][u32 fill[max_num_bufs]][data], which is
+ * either heap memory or a shared mapping of a file (see
+ * ring_buffer_init_file).
+ */
+#define RB_REGION_MAGIC 0x31425257 /* "WRB1" */
+#define RB_REGION_VERSION 2
+#define RB_REGION_ALIGN 64
+
+struct rb_region_hdr {
+    u32 magic;
+    u32 version;
+    u32 each_buf_size;
+    u32 max_num_bufs;
+    u32 crc; // crc32 of the fields above
+    u32 wr_seq; // Slot being written
+    u32 rd_seq; // Slot being read
+    u32 rd_idx; // Read index within the slot being read
+};
+
+typedef struct ring_buf_spsc {
+    enum rb_engine engine; // RB_ENGINE_SPSC
+    struct rb_region_hdr *hdr; // Start of the region
+    u8 *data; // max_num_bufs * each_buf_size bytes
+    u32 *fill; // Bytes written into each slot
+
+    unsigned int max_num_bufs;
+    size_t each_buf_size;
+
+    int fd; // Backing file, -1 for a heap region
+    size_t region_len;
+
+    /* Threshold vars */
+    unsigned int num_min_bytes;
+    void (*threshold_cb)(void *);
+    void *cb_ctx;
+    u32 threshold_reached;
+
+    u64 total_bytes_written;
+    u64 total_bytes_read;
+} rbs_t;
+
+static inline enum rb_engine rb_get_engine(void *ctx)
+{
+    return *(enum rb_engine *)ctx;
+}
+
 #define RB_MIN(x, y) ((x) < (y)?(x):(y))
 inline void rb_lock(pthread_mutex_t *lock)
 {
@@ -97,7 +164,469 @@ inline void rb_unlock(pthread_mutex_t *lock)
     // TODO Handle the unlock failure
 }
 
-void * ring_buffer_init(size_t size_of_buf, int num_bufs)
+static u32 rb_crc32(const u8 *buf, size_t len)
+{
+    u32 crc = 0xFFFFFFFF;
+    int bit;
+
+    while (len--) {
+        crc ^= *buf++;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static u32 rb_region_crc(struct rb_region_hdr *hdr)
+{
+    return rb_crc32((const u8 *)hdr, offsetof(struct rb_region_hdr, crc));
+}
+
+static size_t rb_region_data_off(int num_bufs)
+{
+    size_t off = sizeof(struct rb_region_hdr) + num_bufs * sizeof(u32);
+
+    return (off + RB_REGION_ALIGN - 1) & ~((size_t)RB_REGION_ALIGN - 1);
+}
+
+static rbs_t *spsc_alloc(size_t size_of_buf, int num_bufs)
+{
+    rbs_t *rbs;
+
+    rbs = (rbs_t *)calloc(1, sizeof(rbs_t));
+    if (rbs == NULL) {
+        ALOGE("Failed to alloc rbs");
+        return NULL;
+    }
+    rbs->engine = RB_ENGINE_SPSC;
+    rbs->each_buf_size = size_of_buf;
+    rbs->max_num_bufs = num_bufs;
+    rbs->fd = -1;
+    rbs->region_len = rb_region_data_off(num_bufs) + size_of_buf * num_bufs;
+    return rbs;
+}
+
+/* Points the ring at its region; a fresh region is stamped with the header */
+static void spsc_attach(rbs_t *rbs, void *region, int fresh)
+{
+    rbs->hdr = (struct rb_region_hdr *)region;
+    rbs->fill = (u32 *)(rbs->hdr + 1);
+    rbs->data = (u8 *)region + rb_region_data_off(rbs->max_num_bufs);
+    if (fresh) {
+        memset(rbs->hdr, 0, sizeof(struct rb_region_hdr));
+        rbs->hdr->magic = RB_REGION_MAGIC;
+        rbs->hdr->version = RB_REGION_VERSION;
+        rbs->hdr->each_buf_size = rbs->each_buf_size;
+        rbs->hdr->max_num_bufs = rbs->max_num_bufs;
+        rbs->hdr->crc = rb_region_crc(rbs->hdr);
+    }
+}
+
+static void *spsc_init(size_t size_of_buf, int num_bufs)
+{
+    rbs_t *rbs;
+    void *region;
+
+    rbs = spsc_alloc(size_of_buf, num_bufs);
+    if (rbs == NULL)
+        return NULL;
+
+    /* Pages of the region are only backed once written to */
+    region = calloc(1, rbs->region_len);
+    if (region == NULL) {
+        ALOGE("Failed to alloc rbs storage");
+        free(rbs);
+        return NULL;
+    }
+    spsc_attach(rbs, region, 1);
+    return rbs;
+}
+
+/* Validates a region left by an earlier session; the reader resumes where
+ * it stopped, so data read out before is not delivered again. Returns 0 if
+ * the region can be reused.
+ */
+static int spsc_recover(rbs_t *rbs)
+{
+    struct rb_region_hdr *hdr = rbs->hdr;
+    u32 n = rbs->max_num_bufs;
+    u32 seq;
+    u64 bytes = 0;
+
+    if (hdr->magic != RB_REGION_MAGIC || hdr->version != RB_REGION_VERSION ||
+        hdr->each_buf_size != rbs->each_buf_size ||
+        hdr->max_num_bufs != n || hdr->crc != rb_region_crc(hdr))
+        return -1;
+    if (hdr->wr_seq - hdr->rd_seq >= n)
+        return -1;
+
+    for (seq = hdr->rd_seq; seq != hdr->wr_seq + 1; seq++) {
+        if (rbs->fill[seq % n] > rbs->each_buf_size)
+            return -1;
+        bytes += rbs->fill[seq % n];
+    }
+    if (hdr->rd_idx > rbs->fill[hdr->rd_seq % n])
+        return -1;
+    rbs->total_bytes_written = bytes - hdr->rd_idx;
+    return 0;
+}
+
+void * ring_buffer_init_file(size_t size_of_buf, int num_bufs,
+                             const char *path, int *recovered)
+{
+    struct stat st;
+    void *region;
+    rbs_t *rbs;
+    int fresh;
+
+    *recovered = 0;
+    rbs = spsc_alloc(size_of_buf, num_bufs);
+    if (rbs == NULL)
+        return NULL;
+
+    rbs->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    if (rbs->fd < 0) {
+        ALOGE("Failed to open ring file %s: %s", path, strerror(errno));
+        goto cleanup;
+    }
+    if (fstat(rbs->fd, &st) < 0) {
+        ALOGE("Failed to stat ring file %s: %s", path, strerror(errno));
+        goto cleanup;
+    }
+    fresh = (size_t)st.st_size != rbs->region_len;
+    if (fresh && ftruncate(rbs->fd, rbs->region_len) < 0) {
+        ALOGE("Failed to size ring file %s: %s", path, strerror(errno));
+        goto cleanup;
+    }
+
+    region = mmap(NULL, rbs->region_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  rbs->fd, 0);
+    if (region == MAP_FAILED) {
+        ALOGE("Failed to map ring file %s: %s", path, strerror(errno));
+        goto cleanup;
+    }
+
+    spsc_attach(rbs, region, 0);
+    if (!fresh && spsc_recover(rbs) == 0) {
+        *recovered = 1;
+    } else {
+        if (!fresh)
+            ALOGI("Discarding stale ring file %s", path);
+        memset(rbs->fill, 0, num_bufs * sizeof(u32));
+        spsc_attach(rbs, region, 1);
+        rbs->total_bytes_written = 0;
+    }
+    return rbs;
+
+cleanup:
+    if (rbs->fd >= 0)
+        close(rbs->fd);
+    free(rbs);
+    return NULL;
+}
+
+static void spsc_deinit(rbs_t *rbs)
+{
+    if (rbs->fd >= 0) {
+        /* The file keeps the contents for the next session */
+        munmap(rbs->hdr, rbs->region_len);
+        close(rbs->fd);
+    } else {
+        free(rbs->hdr);
+    }
+    free(rbs);
+}
+
+/* Writer side: seal the current slot and start filling the next one */
+static void spsc_next_slot(rbs_t *rbs, u32 *wr_seq)
+{
+    (*wr_seq)++;
+    __atomic_store_n(&rbs->fill[*wr_seq % rbs->max_num_bufs], 0,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&rbs->hdr->wr_seq, *wr_seq, __ATOMIC_RELEASE);
+}
+
+/* Writer side: account length written bytes and fire the threshold */
+static void spsc_written(rbs_t *rbs, size_t length, size_t record_length)
+{
+    u64 valid;
+
+    valid = __atomic_add_fetch(&rbs->total_bytes_written, length,
+                               __ATOMIC_RELAXED) -
+            __atomic_load_n(&rbs->total_bytes_read, __ATOMIC_RELAXED);
+
+    /* check if valid bytes is going more than threshold */
+    if (!__atomic_load_n(&rbs->threshold_reached, __ATOMIC_RELAXED) &&
+        (valid >= rbs->num_min_bytes) &&
+        ((length == record_length) || !record_length) &&
+        rbs->threshold_cb) {
+        __atomic_store_n(&rbs->threshold_reached, 1, __ATOMIC_RELAXED);
+        rbs->threshold_cb(rbs->cb_ctx);
+    }
+}
+
+static enum rb_status spsc_write(rbs_t *rbs, u8 *buf, size_t length,
+                                 size_t record_length)
+{
+    size_t size = rbs->each_buf_size;
+    u32 wr_seq = rbs->hdr->wr_seq;
+    u32 rd_seq = __atomic_load_n(&rbs->hdr->rd_seq, __ATOMIC_ACQUIRE);
+    size_t wr_idx = rbs->fill[wr_seq % rbs->max_num_bufs];
+    size_t space = size - wr_idx;
+    size_t written = 0;
+    u32 slots_needed = 0;
+
+    if (record_length > size || length > size)
+        return RB_FAILURE;
+
+    /* Work out the slots this write moves through up front, so that a full
+     * ring rejects the whole write instead of a part of it */
+    if (record_length > space) {
+        slots_needed = 1;
+        space = size;
+    }
+    if (length > space)
+        slots_needed++;
+    if (wr_seq + slots_needed - rd_seq >= rbs->max_num_bufs)
+        return RB_FULL;
+
+    if (record_length > size - wr_idx) {
+        spsc_next_slot(rbs, &wr_seq);
+        wr_idx = 0;
+    }
+
+    while (written < length) {
+        size_t cur_copy_len;
+
+        if (wr_idx == size) {
+            spsc_next_slot(rbs, &wr_seq);
+            wr_idx = 0;
+        }
+        cur_copy_len = RB_MIN(size - wr_idx, length - written);
+        memcpy(rbs->data + (wr_seq % rbs->max_num_bufs) * size + wr_idx,
+               buf + written, cur_copy_len);
+        wr_idx += cur_copy_len;
+        written += cur_copy_len;
+        __atomic_store_n(&rbs->fill[wr_seq % rbs->max_num_bufs], wr_idx,
+                         __ATOMIC_RELEASE);
+    }
+
+    spsc_written(rbs, length, record_length);
+    return RB_SUCCESS;
+}
+
+static enum rb_status spsc_writev(rbs_t *rbs, const struct iovec *iov,
+                                  int iovcnt, size_t length)
+{
+    size_t size = rbs->each_buf_size;
+    u32 wr_seq = rbs->hdr->wr_seq;
+    u32 rd_seq = __atomic_load_n(&rbs->hdr->rd_seq, __ATOMIC_ACQUIRE);
+    size_t wr_idx = rbs->fill[wr_seq % rbs->max_num_bufs];
+    u8 *dst;
+    int i;
+
+    /* The whole record goes into one slot */
+    if (length > size - wr_idx) {
+        if (wr_seq + 1 - rd_seq >= rbs->max_num_bufs)
+            return RB_FULL;
+        spsc_next_slot(rbs, &wr_seq);
+        wr_idx = 0;
+    }
+
+    dst = rbs->data + (wr_seq % rbs->max_num_bufs) * size + wr_idx;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    __atomic_store_n(&rbs->fill[wr_seq % rbs->max_num_bufs], wr_idx + length,
+                     __ATOMIC_RELEASE);
+
+    spsc_written(rbs, length, length);
+    return RB_SUCCESS;
+}
+
+/* Packs records into slots like spsc_writev, but checks the ring once per
+ * slot moved to, publishes each slot's fill once and fires the threshold
+ * once for the whole batch */
+static enum rb_status spsc_write_batch(rbs_t *rbs, const u8 *buf,
+                                       const size_t *rec_len, int num_recs,
+                                       int *num_written)
+{
+    size_t size = rbs->each_buf_size;
+    u32 wr_seq = rbs->hdr->wr_seq;
+    u32 rd_seq = __atomic_load_n(&rbs->hdr->rd_seq, __ATOMIC_ACQUIRE);
+    size_t wr_idx = rbs->fill[wr_seq % rbs->max_num_bufs];
+    u8 *slot = rbs->data + (wr_seq % rbs->max_num_bufs) * size;
+    enum rb_status status = RB_SUCCESS;
+    size_t length = 0;
+    int i;
+
+    for (i = 0; i < num_recs; i++) {
+        if (rec_len[i] > size) {
+            status = RB_FAILURE;
+            break;
+        }
+        if (rec_len[i] > size - wr_idx) {
+            if (wr_seq + 1 - rd_seq >= rbs->max_num_bufs) {
+                rd_seq = __atomic_load_n(&rbs->hdr->rd_seq, __ATOMIC_ACQUIRE);
+                if (wr_seq + 1 - rd_seq >= rbs->max_num_bufs) {
+                    status = RB_FULL;
+                    break;
+                }
+            }
+            __atomic_store_n(&rbs->fill[wr_seq % rbs->max_num_bufs], wr_idx,
+                             __ATOMIC_RELEASE);
+            spsc_next_slot(rbs, &wr_seq);
+            wr_idx = 0;
+            slot = rbs->data + (wr_seq % rbs->max_num_bufs) * size;
+        }
+        memcpy(slot + wr_idx, buf, rec_len[i]);
+        buf += rec_len[i];
+        wr_idx += rec_len[i];
+        length += rec_len[i];
+    }
+    __atomic_store_n(&rbs->fill[wr_seq % rbs->max_num_bufs], wr_idx,
+                     __ATOMIC_RELEASE);
+
+    *num_written = i;
+    if (length)
+        spsc_written(rbs, length, length);
+    return status;
+}
+
+/* Reader side: returns the readable bytes of the current slot, releasing
+ * drained sealed slots to the writer on the way; 0 if the ring is empty.
+ */
+static size_t spsc_readable(rbs_t *rbs, u8 **src)
+{
+    u32 wr_seq, fill;
+
+    for (;;) {
+        wr_seq = __atomic_load_n(&rbs->hdr->wr_seq, __ATOMIC_ACQUIRE);
+        fill = __atomic_load_n(&rbs->fill[rbs->hdr->rd_seq % rbs->max_num_bufs],
+                               __ATOMIC_ACQUIRE);
+        if (rbs->hdr->rd_idx < fill)
+            break;
+        if (rbs->hdr->rd_seq == wr_seq)
+            return 0;
+        rbs->hdr->rd_idx = 0;
+        __atomic_store_n(&rbs->hdr->rd_seq, rbs->hdr->rd_seq + 1, __ATOMIC_RELEASE);
+    }
+
+    *src = rbs->data + (rbs->hdr->rd_seq % rbs->max_num_bufs) * rbs->each_buf_size +
+           rbs->hdr->rd_idx;
+    return fill - rbs->hdr->rd_idx;
+}
+
+/* Reader side: account len consumed bytes of the current slot */
+static void spsc_consumed(rbs_t *rbs, size_t len)
+{
+    u64 valid;
+
+    rbs->hdr->rd_idx += len;
+    /* Give a sealed slot back as soon as it is drained. A slot the writer
+     * filled exactly is still its current one until it moves on, so the
+     * reader stays at its end and spsc_readable() advances it later */
+    if (rbs->hdr->rd_idx == rbs->each_buf_size &&
+        rbs->hdr->rd_seq != __atomic_load_n(&rbs->hdr->wr_seq, __ATOMIC_ACQUIRE)) {
+        rbs->hdr->rd_idx = 0;
+        __atomic_store_n(&rbs->hdr->rd_seq, rbs->hdr->rd_seq + 1, __ATOMIC_RELEASE);
+    }
+
+    valid = __atomic_load_n(&rbs->total_bytes_written, __ATOMIC_RELAXED) -
+            __atomic_add_fetch(&rbs->total_bytes_read, len, __ATOMIC_RELAXED);
+
+    /* check if valid bytes is going less than threshold */
+    if (__atomic_load_n(&rbs->threshold_reached, __ATOMIC_RELAXED) &&
+        valid < rbs->num_min_bytes)
+        __atomic_store_n(&rbs->threshold_reached, 0, __ATOMIC_RELAXED);
+}
+
+static size_t spsc_read(rbs_t *rbs, u8 *buf, size_t max_length)
+{
+    size_t bytes_read = 0;
+    size_t cur_cpy_len;
+    u8 *src;
+
+    while (bytes_read < max_length) {
+        cur_cpy_len = RB_MIN(spsc_readable(rbs, &src),
+                             max_length - bytes_read);
+        if (cur_cpy_len == 0)
+            break;
+        memcpy(buf + bytes_read, src, cur_cpy_len);
+        spsc_consumed(rbs, cur_cpy_len);
+        bytes_read += cur_cpy_len;
+    }
+    return bytes_read;
+}
+
+static u8 *spsc_get_read_buf(rbs_t *rbs, size_t *length)
+{
+    size_t len;
+    u8 *src, *buf;
+
+    len = spsc_readable(rbs, &src);
+    if (len == 0) {
+        *length = 0;
+        return NULL;
+    }
+
+    buf = (u8 *)malloc(len);
+    if (buf == NULL) {
+        ALOGE("Failed to alloc buffer for read");
+        *length = 0;
+        return NULL;
+    }
+    memcpy(buf, src, len);
+    spsc_consumed(rbs, len);
+
+    *length = len;
+    return buf;
+}
+
+static int spsc_borrow(rbs_t *rbs, struct iovec *iov, int iovcnt)
+{
+    u32 next_seq;
+    size_t len;
+    u8 *src;
+
+    len = spsc_readable(rbs, &src);
+    if (len == 0 || iovcnt < 1)
+        return 0;
+    iov[0].iov_base = src;
+    iov[0].iov_len = len;
+
+    /* The current slot is sealed and its remainder is handed out above, so
+     * the next slot can be lent too */
+    next_seq = rbs->hdr->rd_seq + 1;
+    if (iovcnt < 2 || rbs->hdr->rd_seq == __atomic_load_n(&rbs->hdr->wr_seq,
+                                                     __ATOMIC_ACQUIRE))
+        return 1;
+    len = __atomic_load_n(&rbs->fill[next_seq % rbs->max_num_bufs],
+                          __ATOMIC_ACQUIRE);
+    if (len == 0)
+        return 1;
+    iov[1].iov_base = rbs->data +
+                      (next_seq % rbs->max_num_bufs) * rbs->each_buf_size;
+    iov[1].iov_len = len;
+    return 2;
+}
+
+static void spsc_consume(rbs_t *rbs, size_t len)
+{
+    size_t cur_len;
+    u8 *src;
+
+    while (len) {
+        cur_len = RB_MIN(spsc_readable(rbs, &src), len);
+        if (cur_len == 0)
+            break;
+        spsc_consumed(rbs, cur_len);
+        len -= cur_len;
+    }
+}
+
+static void *locked_init(size_t size_of_buf, int num_bufs)
 {
     struct ring_buf_cb *rbc;
     int status;
@@ -129,12 +658,25 @@ void * ring_buffer_init(size_t size_of_buf, int num_bufs)
     return rbc;
 }
 
+void * ring_buffer_init(size_t size_of_buf, int num_bufs,
+                        enum rb_engine engine)
+{
+    if (engine == RB_ENGINE_SPSC)
+        return spsc_init(size_of_buf, num_bufs);
+    return locked_init(size_of_buf, num_bufs);
+}
+
 void ring_buffer_deinit(void *ctx)
 {
     rbc_t *rbc = (rbc_t *)ctx;
     int status;
     unsigned int buf_no;
 
+    if (rb_get_engine(ctx) == RB_ENGINE_SPSC) {
+        spsc_deinit((rbs_t *)ctx);
+        return;
+    }
+
     status = pthread_mutex_destroy(&rbc->rb_rw_lock);
     if (status != 0) {
         ALOGE("Failed to destroy rb_rw_lock");
@@ -151,6 +693,56 @@ void ring_buffer_deinit(void *ctx)
  * record_length : 0  - byte boundary
  *               : >0 - Ensures to write record_length no.of bytes to the same buffer.
  */
+/* Checks, without overwriting, whether a record_length record fits into
+ * the ring */
+static enum rb_status locked_check_room(rbc_t *rbc, size_t record_length)
+{
+    /* Check if the complete RB is full. If the current wr_buf is also
+     * full, it indicates that the complete RB is full
+     */
+    if (rbc->bufs[rbc->wr_buf_no].full == 1)
+        return RB_FULL;
+    /* Check whether record fits in current buffer */
+    if (rbc->wr_buf_no == rbc->rd_buf_no) {
+        if ((rbc->cur_wr_buf_idx == rbc->cur_rd_buf_idx) &&
+            rbc->cur_valid_bytes) {
+            return RB_FULL;
+        } else if (rbc->cur_wr_buf_idx < rbc->cur_rd_buf_idx) {
+            if (record_length >
+                (rbc->cur_rd_buf_idx - rbc->cur_wr_buf_idx)) {
+                return RB_FULL;
+            }
+        } else {
+            if (record_length > (rbc->each_buf_size - rbc->cur_wr_buf_idx)) {
+                /* Check if the next buffer is not full to write this record into
+                 * next buffer
+                 */
+                unsigned int next_buf_no = rbc->wr_buf_no + 1;
+
+                if (next_buf_no >= rbc->max_num_bufs) {
+                    next_buf_no = 0;
+                }
+                if (rbc->bufs[next_buf_no].full == 1) {
+                    return RB_FULL;
+                }
+            }
+        }
+    } else if (record_length > (rbc->each_buf_size - rbc->cur_wr_buf_idx)) {
+        /* Check if the next buffer is not full to write this record into
+         * next buffer
+         */
+        unsigned int next_buf_no = rbc->wr_buf_no + 1;
+
+        if (next_buf_no >= rbc->max_num_bufs) {
+            next_buf_no = 0;
+        }
+        if (rbc->bufs[next_buf_no].full == 1) {
+            return RB_FULL;
+        }
+    }
+    return RB_SUCCESS;
+}
+
 enum rb_status rb_write (void *ctx, u8 *buf, size_t length, int overwrite,
                          size_t record_length)
 {
@@ -160,54 +752,16 @@ enum rb_status rb_write (void *ctx, u8 *buf, size_t length, int overwrite,
                                      // write in current buffer
     unsigned int total_push_in_rd_ptr = 0; // Total amount of push in read pointer in this write
 
+    if (rb_get_engine(ctx) == RB_ENGINE_SPSC)
+        return spsc_write((rbs_t *)ctx, buf, length, record_length);
+
     if (record_length > rbc->each_buf_size || length > rbc->each_buf_size) {
         return RB_FAILURE;
     }
 
-    if (overwrite == 0) {
-        /* Check if the complete RB is full. If the current wr_buf is also
-         * full, it indicates that the complete RB is full
-         */
-        if (rbc->bufs[rbc->wr_buf_no].full == 1)
-            return RB_FULL;
-        /* Check whether record fits in current buffer */
-        if (rbc->wr_buf_no == rbc->rd_buf_no) {
-            if ((rbc->cur_wr_buf_idx == rbc->cur_rd_buf_idx) &&
-                rbc->cur_valid_bytes) {
-                return RB_FULL;
-            } else if (rbc->cur_wr_buf_idx < rbc->cur_rd_buf_idx) {
-                if (record_length >
-                    (rbc->cur_rd_buf_idx - rbc->cur_wr_buf_idx)) {
-                    return RB_FULL;
-                }
-            } else {
-                if (record_length > (rbc->each_buf_size - rbc->cur_wr_buf_idx)) {
-                    /* Check if the next buffer is not full to write this record into
-                     * next buffer
-                     */
-                    unsigned int next_buf_no = rbc->wr_buf_no + 1;
-
-                    if (next_buf_no >= rbc->max_num_bufs) {
-                        next_buf_no = 0;
-                    }
-                    if (rbc->bufs[next_buf_no].full == 1) {
-                        return RB_FULL;
-                    }
-                }
-            }
-        } else if (record_length > (rbc->each_buf_size - rbc->cur_wr_buf_idx)) {
-            /* Check if the next buffer is not full to write this record into
-             * next buffer
-             */
-            unsigned int next_buf_no = rbc->wr_buf_no + 1;
-
-            if (next_buf_no >= rbc->max_num_bufs) {
-                next_buf_no = 0;
-            }
-            if (rbc->bufs[next_buf_no].full == 1) {
-                return RB_FULL;
-            }
-        }
+    if (overwrite == 0 &&
+        locked_check_room(rbc, record_length) == RB_FULL) {
+        return RB_FULL;
     }
 
     /* Go to next buffer if the current buffer is not enough to write the
@@ -351,19 +905,182 @@ enum rb_status rb_write (void *ctx, u8 *buf, size_t length, int overwrite,
     return RB_SUCCESS;
 }
 
+static enum rb_status locked_writev(rbc_t *rbc, const struct iovec *iov,
+                                    int iovcnt, size_t length)
+{
+    u8 *dst;
+    int i;
+
+    if (locked_check_room(rbc, length) == RB_FULL)
+        return RB_FULL;
+
+    rb_lock(&rbc->rb_rw_lock);
+    /* Go to next buffer if the current buffer is not enough to write the
+     * complete record
+     */
+    if (length > (rbc->each_buf_size - rbc->cur_wr_buf_idx)) {
+        rbc->bufs[rbc->wr_buf_no].full = 1;
+        rbc->bufs[rbc->wr_buf_no].last_wr_index = rbc->cur_wr_buf_idx;
+        rbc->wr_buf_no++;
+        if (rbc->wr_buf_no == rbc->max_num_bufs) {
+            rbc->wr_buf_no = 0;
+        }
+        rbc->cur_wr_buf_idx = 0;
+    }
+    rb_unlock(&rbc->rb_rw_lock);
+
+    /* Allocate a buffer if no buf available @ wr_buf_no */
+    if (rbc->bufs[rbc->wr_buf_no].data == NULL) {
+        rbc->bufs[rbc->wr_buf_no].data = (u8 *)malloc(rbc->each_buf_size);
+        if (rbc->bufs[rbc->wr_buf_no].data == NULL) {
+            ALOGE("Failed to alloc write buffer");
+            return RB_RETRY;
+        }
+    }
+
+    /* The space is reserved above; copy all segments without the lock */
+    dst = rbc->bufs[rbc->wr_buf_no].data + rbc->cur_wr_buf_idx;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+
+    rb_lock(&rbc->rb_rw_lock);
+    rbc->cur_wr_buf_idx += length;
+    if (rbc->cur_wr_buf_idx == rbc->each_buf_size) {
+        /* Increment the wr_buf_no as the current buffer is full */
+        rbc->bufs[rbc->wr_buf_no].full = 1;
+        rbc->bufs[rbc->wr_buf_no].last_wr_index = rbc->cur_wr_buf_idx;
+        rbc->wr_buf_no++;
+        if (rbc->wr_buf_no == rbc->max_num_bufs) {
+            rbc->wr_buf_no = 0;
+        }
+        rbc->cur_wr_buf_idx = 0;
+    }
+    rbc->cur_valid_bytes += length;
+    rbc->total_bytes_written += length;
+
+    /* check if valid bytes is going more than threshold */
+    if ((rbc->threshold_reached == RB_FALSE) &&
+        (rbc->cur_valid_bytes >= rbc->num_min_bytes) &&
+        rbc->threshold_cb) {
+        /* Release the lock before calling threshold_cb as it might call rb_read
+         * in this same context in order to avoid dead lock
+         */
+        rbc->threshold_reached = RB_TRUE;
+        rb_unlock(&rbc->rb_rw_lock);
+        rbc->threshold_cb(rbc->cb_ctx);
+    } else {
+        rb_unlock(&rbc->rb_rw_lock);
+    }
+    return RB_SUCCESS;
+}
+
+enum rb_status rb_writev(void *ctx, const struct iovec *iov, int iovcnt,
+                         size_t record_length)
+{
+    size_t length = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+        length += iov[i].iov_len;
+
+    /* A writev is always one complete record */
+    if (length != record_length)
+        return RB_FAILURE;
+
+    if (rb_get_engine(ctx) == RB_ENGINE_SPSC) {
+        rbs_t *rbs = (rbs_t *)ctx;
+
+        if (length > rbs->each_buf_size)
+            return RB_FAILURE;
+        return spsc_writev(rbs, iov, iovcnt, length);
+    }
+
+    if (length > ((rbc_t *)ctx)->each_buf_size)
+        return RB_FAILURE;
+    return locked_writev((rbc_t *)ctx, iov, iovcnt, length);
+}
+
+enum rb_status rb_write_batch(void *ctx, const u8 *buf,
+                              const size_t *rec_len, int num_recs,
+                              int *num_written)
+{
+    enum rb_status status = RB_SUCCESS;
+    int i;
+
+    if (rb_get_engine(ctx) == RB_ENGINE_SPSC)
+        return spsc_write_batch((rbs_t *)ctx, buf, rec_len, num_recs,
+                                num_written);
+
+    for (i = 0; i < num_recs; i++) {
+        status = rb_write(ctx, (u8 *)buf, rec_len[i], 0, rec_len[i]);
+        if (status != RB_SUCCESS)
+            break;
+        buf += rec_len[i];
+    }
+    *num_written = i;
+    return status;
+}
+
+/* Bytes readable in place in buffer buf_no from rd_idx on; lock held */
+static unsigned int locked_span(rbc_t *rbc, unsigned int buf_no,
+                                unsigned int rd_idx)
+{
+    rb_entry_t *entry = &rbc->bufs[buf_no];
+
+    if (entry->data == NULL)
+        return 0;
+    if (entry->full == 1)
+        return entry->last_wr_index > rd_idx ?
+               entry->last_wr_index - rd_idx : 0;
+    if (buf_no == rbc->wr_buf_no && rbc->cur_wr_buf_idx > rd_idx)
+        return rbc->cur_wr_buf_idx - rd_idx;
+    return 0;
+}
+
+/* Moves the reader past a completely read full buffer; lock held */
+static void locked_release_read_buf(rbc_t *rbc)
+{
+    if ((rbc->bufs[rbc->rd_buf_no].full == 1) &&
+        (rbc->cur_rd_buf_idx == rbc->bufs[rbc->rd_buf_no].last_wr_index)) {
+        if (rbc->wr_buf_no != rbc->rd_buf_no) {
+            free(rbc->bufs[rbc->rd_buf_no].data);
+            rbc->bufs[rbc->rd_buf_no].data = NULL;
+        }
+        rbc->bufs[rbc->rd_buf_no].full = 0;
+        rbc->rd_buf_no++;
+        if (rbc->rd_buf_no == rbc->max_num_bufs) {
+            rbc->rd_buf_no = 0;
+        }
+        rbc->cur_rd_buf_idx = 0;
+    }
+}
+
 size_t rb_read (void *ctx, u8 *buf, size_t max_length)
 {
     rbc_t *rbc = (rbc_t *)ctx;
     unsigned int bytes_read = 0;
     unsigned int no_more_bytes_available = 0;
 
+    if (rb_get_engine(ctx) == RB_ENGINE_SPSC)
+        return spsc_read((rbs_t *)ctx, buf, max_length);
+
     rb_lock(&rbc->rb_rw_lock);
     while (bytes_read < max_length) {
         unsigned int cur_cpy_len;
+        unsigned int buf_end;
 
+        /* A buffer sealed early may have been read up to its last record
+         * before it was sealed */
+        locked_release_read_buf(rbc);
         if (rbc->bufs[rbc->rd_buf_no].data == NULL) {
             break;
         }
+        /* A buffer the writer sealed early ends with its last record */
+        buf_end = rbc->bufs[rbc->rd_buf_no].full == 1 ?
+                  rbc->bufs[rbc->rd_buf_no].last_wr_index :
+                  rbc->each_buf_size;
 
         /* if read and write are on same buffer, work with rd, wr indices */
         if (rbc->rd_buf_no == rbc->wr_buf_no) {
@@ -388,7 +1105,7 @@ size_t rb_read (void *ctx, u8 *buf, size_t max_length)
                     cur_cpy_len = 0;
                     break;
                 }
-                cur_cpy_len = RB_MIN((rbc->each_buf_size - rbc->cur_rd_buf_idx),
+                cur_cpy_len = RB_MIN((buf_end - rbc->cur_rd_buf_idx),
                                      (max_length - bytes_read));
             }
         } else {
@@ -396,7 +1113,7 @@ size_t rb_read (void *ctx, u8 *buf, size_t max_length)
              * buffer, if not read only the available bytes in the current
              * buffer and go to next buffer using the while loop.
              */
-            cur_cpy_len = RB_MIN((rbc->each_buf_size - rbc->cur_rd_buf_idx),
+            cur_cpy_len = RB_MIN((buf_end - rbc->cur_rd_buf_idx),
                                  (max_length - bytes_read));
         }
 
@@ -406,12 +1123,14 @@ size_t rb_read (void *ctx, u8 *buf, size_t max_length)
 
         /* Update the read index */
         rbc->cur_rd_buf_idx += cur_cpy_len;
-        if (rbc->cur_rd_buf_idx == rbc->each_buf_size) {
+        if (rbc->cur_rd_buf_idx == buf_end) {
             /* Increment rd_buf_no as the current buffer is completely read */
             if (rbc->rd_buf_no != rbc->wr_buf_no) {
                 free(rbc->bufs[rbc->rd_buf_no].data);
                 rbc->bufs[rbc->rd_buf_no].data = NULL;
             }
+            /* and hand it back to the writer */
+            rbc->bufs[rbc->rd_buf_no].full = 0;
             rbc->rd_buf_no++;
             if (rbc->rd_buf_no == rbc->max_num_bufs) {
                 ALOGV("Read rolling over to the start of ring buffer");
@@ -452,6 +1171,9 @@ u8 *rb_get_read_buf(void *ctx, size_t *length)
     unsigned int cur_read_len = 0;
     u8 *buf;
 
+    if (rbc && rb_get_engine(ctx) == RB_ENGINE_SPSC)
+        return spsc_get_read_buf((rbs_t *)ctx, length);
+
     /* If no buffer is available for reading */
     if (!rbc || rbc->bufs[rbc->rd_buf_no].data == NULL) {
         *length = 0;
@@ -583,6 +1305,95 @@ u8 *rb_get_read_buf(void *ctx, size_t *length)
     return buf;
 }
 
+int rb_borrow(void *ctx, struct iovec *iov, int iovcnt)
+{
+    rbc_t *rbc = (rbc_t *)ctx;
+    unsigned int next_buf_no;
+    unsigned int len;
+    int num_segs = 0;
+
+    if (!rbc || iovcnt < 1)
+        return 0;
+
+    if (rb_get_engine(ctx) == RB_ENGINE_SPSC)
+        return spsc_borrow((rbs_t *)ctx, iov, iovcnt);
+
+    rb_lock(&rbc->rb_rw_lock);
+    locked_release_read_buf(rbc);
+
+    len = locked_span(rbc, rbc->rd_buf_no, rbc->cur_rd_buf_idx);
+    if (len == 0)
+        goto out;
+    iov[num_segs].iov_base = rbc->bufs[rbc->rd_buf_no].data +
+                             rbc->cur_rd_buf_idx;
+    iov[num_segs++].iov_len = len;
+
+    /* Data continues in the next buffer only once this one is full */
+    if (iovcnt < 2 || rbc->bufs[rbc->rd_buf_no].full != 1)
+        goto out;
+    next_buf_no = rbc->rd_buf_no + 1;
+    if (next_buf_no == rbc->max_num_bufs)
+        next_buf_no = 0;
+    if (next_buf_no == rbc->rd_buf_no)
+        goto out;
+    len = locked_span(rbc, next_buf_no, 0);
+    if (len == 0)
+        goto out;
+    iov[num_segs].iov_base = rbc->bufs[next_buf_no].data;
+    iov[num_segs++].iov_len = len;
+
+out:
+    rb_unlock(&rbc->rb_rw_lock);
+    return num_segs;
+}
+
+void rb_consume(void *ctx, size_t len)
+{
+    rbc_t *rbc = (rbc_t *)ctx;
+    unsigned int cur_len;
+    size_t consumed = 0;
+
+    if (!rbc)
+        return;
+
+    if (rb_get_engine(ctx) == RB_ENGINE_SPSC) {
+        spsc_consume((rbs_t *)ctx, len);
+        return;
+    }
+
+    rb_lock(&rbc->rb_rw_lock);
+    while (consumed < len) {
+        locked_release_read_buf(rbc);
+        cur_len = RB_MIN(locked_span(rbc, rbc->rd_buf_no,
+                                     rbc->cur_rd_buf_idx),
+                         len - consumed);
+        if (cur_len == 0)
+            break;
+        rbc->cur_rd_buf_idx += cur_len;
+        consumed += cur_len;
+    }
+    /* Hand a drained buffer back to the writer right away */
+    locked_release_read_buf(rbc);
+
+    rbc->total_bytes_read += consumed;
+    if (rbc->cur_valid_bytes < consumed) {
+        /* The below is only a precautionary print and ideally should never
+         * come */
+        ALOGE("Something going wrong in ring buffer");
+        rbc->cur_valid_bytes = 0;
+    } else {
+        rbc->cur_valid_bytes -= consumed;
+    }
+
+    /* check if valid bytes is going less than threshold */
+    if (rbc->threshold_reached == RB_TRUE) {
+        if (rbc->cur_valid_bytes < rbc->num_min_bytes) {
+            rbc->threshold_reached = RB_FALSE;
+        }
+    }
+    rb_unlock(&rbc->rb_rw_lock);
+}
+
 void rb_config_threshold(void *ctx,
                          unsigned int num_min_bytes,
                          threshold_call_back callback,
@@ -590,18 +1401,77 @@ void rb_config_threshold(void *ctx,
 {
     rbc_t *rbc = (rbc_t *)ctx;
 
+    if (rb_get_engine(ctx) == RB_ENGINE_SPSC) {
+        rbs_t *rbs = (rbs_t *)ctx;
+
+        rbs->num_min_bytes = num_min_bytes;
+        rbs->threshold_cb = callback;
+        rbs->cb_ctx = cb_ctx;
+        return;
+    }
+
     rbc->num_min_bytes = num_min_bytes;
     rbc->threshold_cb = callback;
     rbc->cb_ctx = cb_ctx;
 }
 
+enum rb_status rb_resize(void *ctx, int num_bufs)
+{
+    rbs_t *rbs = (rbs_t *)ctx;
+    u32 cur_fill;
+    void *region;
+
+    /* Locked rings hand buffers around without holding the lock for the
+     * copies and file backed rings have a fixed size */
+    if (rb_get_engine(ctx) != RB_ENGINE_SPSC || rbs->fd >= 0 || num_bufs < 1)
+        return RB_FAILURE;
+
+    /* Only the reader resizes, so the ring can only get fuller meanwhile;
+     * a writer on another thread must not run concurrently */
+    cur_fill = __atomic_load_n(&rbs->fill[rbs->hdr->rd_seq % rbs->max_num_bufs],
+                               __ATOMIC_ACQUIRE);
+    if (rbs->hdr->rd_seq != __atomic_load_n(&rbs->hdr->wr_seq,
+                                            __ATOMIC_ACQUIRE) ||
+        rbs->hdr->rd_idx != cur_fill)
+        return RB_RETRY;
+
+    region = calloc(1, rb_region_data_off(num_bufs) +
+                       rbs->each_buf_size * num_bufs);
+    if (region == NULL) {
+        ALOGE("Failed to alloc resized rbs storage");
+        return RB_FAILURE;
+    }
+    free(rbs->hdr);
+    rbs->max_num_bufs = num_bufs;
+    rbs->region_len = rb_region_data_off(num_bufs) +
+                      rbs->each_buf_size * num_bufs;
+    spsc_attach(rbs, region, 1);
+    return RB_SUCCESS;
+}
+
 void rb_get_stats(void *ctx, struct rb_stats *rbs)
 {
     rbc_t *rbc = (rbc_t *)ctx;
 
+    if (rb_get_engine(ctx) == RB_ENGINE_SPSC) {
+        rbs_t *spsc = (rbs_t *)ctx;
+        u64 written = __atomic_load_n(&spsc->total_bytes_written,
+                                      __ATOMIC_RELAXED);
+        u64 read = __atomic_load_n(&spsc->total_bytes_read, __ATOMIC_RELAXED);
+
+        rbs->total_bytes_written = written;
+        rbs->total_bytes_read = read;
+        rbs->cur_valid_bytes = written - read;
+        rbs->total_bytes_overwritten = 0;
+        rbs->each_buf_size = spsc->each_buf_size;
+        rbs->max_num_bufs = spsc->max_num_bufs;
+        return;
+    }
+
     rbs->total_bytes_written = rbc->total_bytes_written;
     rbs->total_bytes_read = rbc->total_bytes_read;
     rbs->cur_valid_bytes = rbc->cur_valid_bytes;
+    rbs->total_bytes_overwritten = rbc->total_bytes_overwritten;
     rbs->each_buf_size = rbc->each_buf_size;
     rbs->max_num_bufs = rbc->max_num_bufs;
 }
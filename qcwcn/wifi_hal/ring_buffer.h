@@ -29,6 +29,8 @@
 #ifndef __RING_BUFFER_H
 #define __RING_BUFFER_H
 
+#include <sys/uio.h>
+
 /* Ring buffer status codes */
 enum rb_status {
     RB_SUCCESS = 0,
@@ -41,14 +43,37 @@ struct rb_stats {
     u32 total_bytes_written;
     u32 total_bytes_read;
     u32 cur_valid_bytes;
+    u32 total_bytes_overwritten;
     unsigned int max_num_bufs;
     size_t each_buf_size;
 };
 
 typedef void (*threshold_call_back) (void *cb_ctx);
 
+/* Ring buffer implementations.
+ * RB_ENGINE_LOCKED: sub-buffers are allocated on demand by the writer and
+ *                   handed over to the reader; any number of threads.
+ * RB_ENGINE_SPSC:   one preallocated region, lock-free for a single writer
+ *                   thread and a single reader thread. Writes never
+ *                   overwrite unread data (overwrite is ignored).
+ * Both keep records of record_length bytes within one sub-buffer.
+ */
+enum rb_engine {
+    RB_ENGINE_LOCKED = 0,
+    RB_ENGINE_SPSC = 1,
+};
+
 /* intiitalizes the ring buffer and returns the context to it */
-void * ring_buffer_init(size_t size_of_buf, int num_bufs);
+void * ring_buffer_init(size_t size_of_buf, int num_bufs,
+                        enum rb_engine engine);
+
+/* Same as ring_buffer_init with RB_ENGINE_SPSC, but the ring lives in a
+ * shared mapping of the file at path, so its contents survive a restart of
+ * the process. Unread data of a previous session found in a matching file
+ * is kept and *recovered is set; otherwise the file is (re)initialized.
+ */
+void * ring_buffer_init_file(size_t size_of_buf, int num_bufs,
+                             const char *path, int *recovered);
 
 /* Frees up the mem allocated for this ring buffer operation */
 void ring_buffer_deinit(void *ctx);
@@ -57,6 +82,25 @@ void ring_buffer_deinit(void *ctx);
 enum rb_status rb_write(void *ctx, u8 *buf, size_t length, int overwrite,
                         size_t record_length);
 
+/* Writes the iovcnt segments of iov as one record of record_length bytes.
+ * Space for the complete record is reserved once, so the segments always
+ * end up next to each other and are never split by a read. Never
+ * overwrites; returns RB_FULL if the record does not fit.
+ */
+enum rb_status rb_writev(void *ctx, const struct iovec *iov, int iovcnt,
+                         size_t record_length);
+
+/* Writes num_recs records, the rec_len[i] bytes of each following the
+ * previous one in buf. Records never straddle two buffers, as with
+ * rb_write; the RB_ENGINE_SPSC ring checks for room only when a record
+ * needs the next buffer and runs the threshold check once for the batch.
+ * Never overwrites. *num_written is set to the number of leading records
+ * written, also when the ring runs full part way.
+ */
+enum rb_status rb_write_batch(void *ctx, const u8 *buf,
+                              const size_t *rec_len, int num_recs,
+                              int *num_written);
+
 /* Tries to read max_length of bytes from ring buffer to buf
  * and returns actual length of bytes read from ring buffer
  */
@@ -69,6 +113,21 @@ size_t rb_read(void *ctx, u8 *buf, size_t max_length);
  */
 u8 *rb_get_read_buf(void *ctx, size_t *length);
 
+/* Maximum number of spans handed out by rb_borrow: the rest of the current
+ * buffer and the start of the next one when the readable data wraps
+ */
+#define RB_MAX_READ_SEGS 2
+
+/* Borrows the readable bytes in place, without copying, as up to iovcnt
+ * spans in iov. Returns the number of spans filled, 0 if nothing is
+ * readable. The spans stay valid until they are released by rb_consume;
+ * only one reader may borrow at a time and writers must not overwrite.
+ */
+int rb_borrow(void *ctx, struct iovec *iov, int iovcnt);
+
+/* Releases the first len bytes handed out by rb_borrow */
+void rb_consume(void *ctx, size_t len);
+
 /* calls callback whenever ring_buffer reaches percent percentage of it'ss
  * full size
  */
@@ -77,6 +136,14 @@ void rb_config_threshold(void *ctx,
                          threshold_call_back callback,
                          void *cb_ctx);
 
+/* Changes the number of buffers of an empty RB_ENGINE_SPSC ring in place;
+ * the context and threshold settings stay valid. Returns RB_RETRY if the
+ * ring holds unread data and RB_FAILURE if it cannot be resized. The
+ * storage of the ring is replaced, so the caller must make sure no writer
+ * or reader runs concurrently.
+ */
+enum rb_status rb_resize(void *ctx, int num_bufs);
+
 /* Get the current status of ring buffer */
 void rb_get_stats(void *ctx, struct rb_stats *rbs);
 
@@ -61,9 +61,12 @@ wifi_error RoamCommand::requestResponse()
     return WifiCommand::requestResponse(mMsg);
 }
 
-wifi_error wifi_set_bssid_blacklist(wifi_request_id id,
-                                    wifi_interface_handle iface,
-                                    wifi_bssid_params params)
+/* Builds the command that sets the bssid blacklist; the caller sends and
+ * deletes it. */
+static wifi_error create_blacklist_cmd(wifi_request_id id,
+                                       wifi_interface_handle iface,
+                                       wifi_bssid_params *params,
+                                       RoamCommand **cmd)
 {
     wifi_error ret;
     int i;
@@ -79,8 +82,8 @@ wifi_error wifi_set_bssid_blacklist(wifi_request_id id,
         return WIFI_ERROR_NOT_SUPPORTED;
     }
 
-    for (i = 0; i < params.num_bssid; i++) {
-        ALOGV("BSSID: %d : " MACSTR, i, MAC2STR(params.bssids[i]));
+    for (i = 0; i < params->num_bssid; i++) {
+        ALOGV("BSSID: %d : " MACSTR, i, MAC2STR(params->bssids[i]));
     }
 
     roamCommand =
@@ -121,18 +124,18 @@ wifi_error wifi_set_bssid_blacklist(wifi_request_id id,
 
     ret = roamCommand->put_u32(
                   QCA_WLAN_VENDOR_ATTR_ROAMING_PARAM_SET_BSSID_PARAMS_NUM_BSSID,
-                  params.num_bssid);
+                  params->num_bssid);
     if (ret != WIFI_SUCCESS)
         goto cleanup;
 
     nlBssids = roamCommand->attr_start(
             QCA_WLAN_VENDOR_ATTR_ROAMING_PARAM_SET_BSSID_PARAMS);
-    for (i = 0; i < params.num_bssid; i++) {
+    for (i = 0; i < params->num_bssid; i++) {
         struct nlattr *nl_ssid = roamCommand->attr_start(i);
 
         ret = roamCommand->put_addr(
                       QCA_WLAN_VENDOR_ATTR_ROAMING_PARAM_SET_BSSID_PARAMS_BSSID,
-                      (u8 *)params.bssids[i]);
+                      (u8 *)params->bssids[i]);
         if (ret != WIFI_SUCCESS)
             goto cleanup;
 
@@ -142,16 +145,55 @@ wifi_error wifi_set_bssid_blacklist(wifi_request_id id,
 
     roamCommand->attr_end(nlData);
 
+    *cmd = roamCommand;
+    return WIFI_SUCCESS;
+
+cleanup:
+    delete roamCommand;
+    return ret;
+}
+
+wifi_error wifi_set_bssid_blacklist(wifi_request_id id,
+                                    wifi_interface_handle iface,
+                                    wifi_bssid_params params)
+{
+    wifi_error ret;
+    RoamCommand *roamCommand;
+
+    ret = create_blacklist_cmd(id, iface, &params, &roamCommand);
+    if (ret != WIFI_SUCCESS)
+        return ret;
+
     ret = roamCommand->requestResponse();
     if (ret != WIFI_SUCCESS)
         ALOGE("wifi_set_bssid_blacklist(): requestResponse Error:%d", ret);
 
-cleanup:
     delete roamCommand;
     return ret;
 
 }
 
+/* Completion of a blacklist command sent by wifi_configure_roaming() */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    wifi_error result;
+} roam_async_result;
+
+static void blacklist_done_handler(WifiCommand *cmd, wifi_error result,
+                                   void *ctx)
+{
+    roam_async_result *res = (roam_async_result *)ctx;
+
+    delete cmd;
+    pthread_mutex_lock(&res->lock);
+    res->result = result;
+    res->done = true;
+    pthread_cond_signal(&res->cond);
+    pthread_mutex_unlock(&res->lock);
+}
+
 wifi_error wifi_set_ssid_white_list(wifi_request_id id, wifi_interface_handle iface,
                                     int num_networks, ssid_t *ssid_list)
 {
@@ -275,6 +317,9 @@ wifi_error wifi_configure_roaming(wifi_interface_handle iface, wifi_roaming_conf
     wifi_error ret;
     int requestId;
     wifi_bssid_params bssid_params;
+    RoamCommand *roamCommand;
+    roam_async_result blacklist;
+    bool blacklist_pending = false;
     wifi_handle wifiHandle = getWifiHandle(iface);
     hal_info *info = getHalInfo(wifiHandle);
 
@@ -300,7 +345,27 @@ wifi_error wifi_configure_roaming(wifi_interface_handle iface, wifi_roaming_conf
     memcpy(bssid_params.bssids, roaming_config->blacklist_bssid,
            (bssid_params.num_bssid * sizeof(mac_addr)));
 
-    ret = wifi_set_bssid_blacklist(requestId, iface, bssid_params);
+    /* The blacklist is sent on the async socket when there is one, so its
+     * round trip overlaps the one of the whitelist */
+    ret = create_blacklist_cmd(requestId, iface, &bssid_params, &roamCommand);
+    if (ret == WIFI_SUCCESS && info->async_sock) {
+        pthread_mutex_init(&blacklist.lock, NULL);
+        pthread_cond_init(&blacklist.cond, NULL);
+        blacklist.done = false;
+        blacklist.result = WIFI_SUCCESS;
+        ret = roamCommand->requestResponseAsync(blacklist_done_handler,
+                                                &blacklist);
+        if (ret == WIFI_SUCCESS) {
+            blacklist_pending = true;
+        } else {
+            delete roamCommand;
+            pthread_cond_destroy(&blacklist.cond);
+            pthread_mutex_destroy(&blacklist.lock);
+        }
+    } else if (ret == WIFI_SUCCESS) {
+        ret = roamCommand->requestResponse();
+        delete roamCommand;
+    }
     if (ret != WIFI_SUCCESS) {
         ALOGE("%s: Failed to configure blacklist bssids", __FUNCTION__);
         return WIFI_ERROR_UNKNOWN;
@@ -311,7 +376,8 @@ wifi_error wifi_configure_roaming(wifi_interface_handle iface, wifi_roaming_conf
         ALOGE("%s: Number of whitelist ssid(%d) provided is more than maximum whitelist ssids(%d) "
               "supported", __FUNCTION__, roaming_config->num_whitelist_ssid,
               info->capa.roaming_capa.max_whitelist_size);
-        return WIFI_ERROR_NOT_SUPPORTED;
+        ret = WIFI_ERROR_NOT_SUPPORTED;
+        goto out;
     }
 
     // Framework is always sending SSID length as 32 though null terminated lengths
@@ -338,6 +404,21 @@ wifi_error wifi_configure_roaming(wifi_interface_handle iface, wifi_roaming_conf
     if (ret != WIFI_SUCCESS)
         ALOGE("%s: Failed to configure whitelist ssids", __FUNCTION__);
 
+out:
+    if (blacklist_pending) {
+        /* Pending commands are completed with an error at cleanup, so this
+         * does not outlive the event loop */
+        pthread_mutex_lock(&blacklist.lock);
+        while (!blacklist.done)
+            pthread_cond_wait(&blacklist.cond, &blacklist.lock);
+        pthread_mutex_unlock(&blacklist.lock);
+        pthread_cond_destroy(&blacklist.cond);
+        pthread_mutex_destroy(&blacklist.lock);
+        if (blacklist.result != WIFI_SUCCESS) {
+            ALOGE("%s: Failed to configure blacklist bssids", __FUNCTION__);
+            ret = WIFI_ERROR_UNKNOWN;
+        }
+    }
     return ret;
 }
 
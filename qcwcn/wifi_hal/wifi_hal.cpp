@@ -51,6 +51,7 @@
 #include <stdint.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/socket.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/family.h>
@@ -78,6 +79,8 @@
 #include <cld80211_lib.h>
 
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include "wifihal_list.h"
 #include <unistd.h>
 
@@ -106,6 +109,9 @@
 
 #define WIFI_HAL_CMD_SOCK_PORT       644
 #define WIFI_HAL_EVENT_SOCK_PORT     645
+#define WIFI_HAL_ASYNC_SOCK_PORT     647
+/* Additional command sockets of the pool use ports starting from here */
+#define WIFI_HAL_CMD_POOL_SOCK_PORT_BASE  650
 
 #define MAX_HW_VER_LENGTH 100
 /*
@@ -115,6 +121,12 @@
 #define POLL_DRIVER_DURATION_US (100000)
 #define POLL_DRIVER_MAX_TIME_MS (10000)
 
+/* Max number of ready fds handled per wakeup of wifi_event_loop() */
+#define MAX_LOOP_EVENTS (16)
+
+/* Min interval between two overflow alerts of the same socket */
+#define NL_OVERFLOW_ALERT_INTERVAL_SEC (5)
+
 static int attach_monitor_sock(wifi_handle handle, wifihal_ctrl_req_t *ctrl_msg);
 
 static int dettach_monitor_sock(wifi_handle handle, wifihal_ctrl_req_t *ctrl_msg);
@@ -125,6 +137,8 @@ static int send_nl_data(wifi_handle handle, wifihal_ctrl_req_t *ctrl_msg);
 
 static int internal_pollin_handler(wifi_handle handle, struct nl_sock *sock);
 
+static void nl_sock_overflow_handler(hal_info *info, nl_overflow_info *overflow);
+
 static void internal_event_handler_app(wifi_handle handle, int events,
                                        struct ctrl_sock *sock);
 
@@ -132,6 +146,8 @@ static void internal_event_handler(wifi_handle handle, int events,
                                    struct nl_sock *sock);
 static int internal_valid_message_handler(nl_msg *msg, void *arg);
 static int user_sock_message_handler(nl_msg *msg, void *arg);
+static wifi_error wifi_init_event_loop(hal_info *info);
+static void wifi_cleanup_event_loop(hal_info *info);
 static int wifi_get_multicast_id(wifi_handle handle, const char *name,
         const char *group);
 static int wifi_add_membership(wifi_handle handle, const char *group);
@@ -142,6 +158,8 @@ static wifi_error wifi_get_packet_filter_capabilities(wifi_interface_handle hand
                                               u32 *version, u32 *max_len);
 static wifi_error wifi_read_packet_filter(wifi_interface_handle handle,
                                    u32 src_offset, u8 *host_dst, u32 length);
+wifi_error wifi_enable_packet_filter(wifi_interface_handle handle,
+                                     u32 enable);
 static wifi_error wifi_configure_nd_offload(wifi_interface_handle iface,
                                             u8 enable);
 wifi_error wifi_get_wake_reason_stats(wifi_interface_handle iface,
@@ -209,6 +227,66 @@ static nl_sock * wifi_create_nl_socket(int port, int protocol)
     return sock;
 }
 
+static void wifi_cleanup_cmd_sock_pool(hal_info *info)
+{
+    int i;
+
+    if (!info->cmd_socks)
+        return;
+
+    for (i = 0; i < info->num_cmd_socks; i++) {
+        if (info->cmd_socks[i].sock)
+            nl_socket_free(info->cmd_socks[i].sock);
+        pthread_mutex_destroy(&info->cmd_socks[i].lock);
+    }
+    free(info->cmd_socks);
+    info->cmd_socks = NULL;
+    info->num_cmd_socks = 0;
+    info->cmd_sock = NULL;
+}
+
+/* Create the pool of command sockets. Each socket carries one command/reply
+ * exchange at a time under its own lock, so concurrent callers only serialize
+ * when all sockets are busy and never contend with event dispatch.
+ */
+static wifi_error wifi_init_cmd_sock_pool(hal_info *info, int num_socks)
+{
+    int i, port;
+
+    info->cmd_socks = (cmd_sock_info *)malloc(sizeof(cmd_sock_info) * num_socks);
+    if (info->cmd_socks == NULL) {
+        ALOGE("Could not allocate command socket pool");
+        return WIFI_ERROR_OUT_OF_MEMORY;
+    }
+    memset(info->cmd_socks, 0, sizeof(cmd_sock_info) * num_socks);
+
+    for (i = 0; i < num_socks; i++) {
+        port = i ? (WIFI_HAL_CMD_POOL_SOCK_PORT_BASE + i - 1) :
+                   WIFI_HAL_CMD_SOCK_PORT;
+        info->cmd_socks[i].sock = wifi_create_nl_socket(port, NETLINK_GENERIC);
+        if (info->cmd_socks[i].sock == NULL) {
+            ALOGE("Failed to create command socket port %d", port);
+            info->num_cmd_socks = i;
+            wifi_cleanup_cmd_sock_pool(info);
+            return WIFI_ERROR_UNKNOWN;
+        }
+
+        /* Set the socket buffer size */
+        if (nl_socket_set_buffer_size(info->cmd_socks[i].sock,
+                                      (256*1024), 0) < 0) {
+            ALOGE("Could not set nl_socket RX buffer size for cmd_sock: %s",
+                       strerror(errno));
+            /* continue anyway with the default (smaller) buffer */
+        }
+        pthread_mutex_init(&info->cmd_socks[i].lock, NULL);
+    }
+    info->num_cmd_socks = num_socks;
+    info->next_cmd_sock = 0;
+    info->cmd_sock = info->cmd_socks[0].sock;
+
+    return WIFI_SUCCESS;
+}
+
 void wifi_create_ctrl_socket(hal_info *info)
 {
 #ifdef ANDROID
@@ -336,69 +414,124 @@ static int no_seq_check(struct nl_msg *msg, void *arg)
     return NL_OK;
 }
 
-static wifi_error acquire_supported_features(wifi_interface_handle iface,
-        feature_set *set)
+/* Handlers of the async command socket. Completions never stop the parsing
+ * so all replies received in one read are dispatched.
+ */
+static int async_valid_handler(struct nl_msg *msg, void *arg)
 {
-    wifi_error ret;
-    interface_info *iinfo = getIfaceInfo(iface);
-    wifi_handle handle = getWifiHandle(iface);
-    *set = 0;
+    return wifi_async_cmd_reply((hal_info *)arg, msg);
+}
 
-    WifihalGeneric supportedFeatures(handle, 0,
-            OUI_QCA,
-            QCA_NL80211_VENDOR_SUBCMD_GET_SUPPORTED_FEATURES);
+static int async_finish_handler(struct nl_msg *msg, void *arg)
+{
+    wifi_async_cmd_done((hal_info *)arg, nlmsg_hdr(msg)->nlmsg_seq, 0);
+    return NL_SKIP;
+}
 
-    /* create the message */
-    ret = supportedFeatures.create();
-    if (ret != WIFI_SUCCESS)
-        goto cleanup;
+static int async_error_handler(struct sockaddr_nl *nla,
+                               struct nlmsgerr *err, void *arg)
+{
+    ALOGV("%s invoked with error: %d", __func__, err->error);
+    wifi_async_cmd_done((hal_info *)arg, err->msg.nlmsg_seq, err->error);
+    return NL_SKIP;
+}
 
-    ret = supportedFeatures.set_iface_id(iinfo->name);
-    if (ret != WIFI_SUCCESS)
-        goto cleanup;
+static void wifi_init_async_sock(hal_info *info)
+{
+    struct nl_cb *cb;
 
-    ret = supportedFeatures.requestResponse();
-    if (ret != WIFI_SUCCESS) {
-        ALOGE("%s: requestResponse Error:%d",__func__, ret);
+    pthread_mutex_init(&info->async_lock, NULL);
+    info->async_inited = true;
+
+    info->async_sock =
+        wifi_create_nl_socket(WIFI_HAL_ASYNC_SOCK_PORT, NETLINK_GENERIC);
+    if (info->async_sock == NULL) {
+        ALOGE("Failed to create async command socket, async commands disabled");
+        return;
+    }
+
+    if (nl_socket_set_buffer_size(info->async_sock, (256*1024), 0) < 0) {
+        ALOGE("Could not set nl_socket RX buffer size for async_sock: %s",
+                   strerror(errno));
+        /* continue anyway with the default (smaller) buffer */
+    }
+
+    cb = nl_socket_get_cb(info->async_sock);
+    if (cb == NULL) {
+        ALOGE("Failed to get NL control block for async socket");
         goto cleanup;
     }
+    nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, NULL);
+    nl_cb_err(cb, NL_CB_CUSTOM, async_error_handler, info);
+    nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, async_finish_handler, info);
+    nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, async_finish_handler, info);
+    nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, async_valid_handler, info);
+    nl_cb_put(cb);
 
-    supportedFeatures.getResponseparams(set);
+    info->async_cmds =
+        (async_cmd_info *)malloc(sizeof(async_cmd_info) * DEFAULT_ASYNC_CMD_SIZE);
+    if (info->async_cmds == NULL) {
+        ALOGE("Could not allocate async_cmds");
+        goto cleanup;
+    }
+    info->alloc_async_cmds = DEFAULT_ASYNC_CMD_SIZE;
+    info->num_async_cmds = 0;
+    return;
 
 cleanup:
-    return ret;
+    nl_socket_free(info->async_sock);
+    info->async_sock = NULL;
+}
+
+static void wifi_cleanup_async_sock(hal_info *info)
+{
+    /* The unload path of wifi_initialize() may come here before the init */
+    if (!info->async_inited)
+        return;
+
+    wifi_cancel_async_cmds(info);
+    if (info->async_sock) {
+        nl_socket_free(info->async_sock);
+        info->async_sock = NULL;
+    }
+    free(info->async_cmds);
+    info->async_cmds = NULL;
+    info->alloc_async_cmds = 0;
+    pthread_mutex_destroy(&info->async_lock);
+    info->async_inited = false;
 }
 
-static wifi_error acquire_driver_supported_features(wifi_interface_handle iface,
-                                          features_info *driver_features)
+static wifi_error acquire_supported_features(wifi_interface_handle iface,
+        feature_set *set)
 {
     wifi_error ret;
     interface_info *iinfo = getIfaceInfo(iface);
     wifi_handle handle = getWifiHandle(iface);
+    *set = 0;
 
-    WifihalGeneric driverFeatures(handle, 0,
+    WifihalGeneric supportedFeatures(handle, 0,
             OUI_QCA,
-            QCA_NL80211_VENDOR_SUBCMD_GET_FEATURES);
+            QCA_NL80211_VENDOR_SUBCMD_GET_SUPPORTED_FEATURES);
 
     /* create the message */
-    ret = driverFeatures.create();
+    ret = supportedFeatures.create();
     if (ret != WIFI_SUCCESS)
         goto cleanup;
 
-    ret = driverFeatures.set_iface_id(iinfo->name);
+    ret = supportedFeatures.set_iface_id(iinfo->name);
     if (ret != WIFI_SUCCESS)
         goto cleanup;
 
-    ret = driverFeatures.requestResponse();
+    ret = supportedFeatures.requestResponse();
     if (ret != WIFI_SUCCESS) {
         ALOGE("%s: requestResponse Error:%d",__func__, ret);
         goto cleanup;
     }
 
-    driverFeatures.getDriverFeatures(driver_features);
+    supportedFeatures.getResponseparams(set);
 
 cleanup:
-    return mapKernelErrortoWifiHalError(ret);
+    return ret;
 }
 
 static wifi_error wifi_get_capabilities(wifi_interface_handle handle)
@@ -458,36 +591,70 @@ static wifi_error wifi_get_sar_version(wifi_interface_handle handle)
 }
 
 
-static wifi_error get_firmware_bus_max_size_supported(
-                                                wifi_interface_handle iface)
+/* Query the supported feature sets and the firmware bus size. The requests
+ * do not depend on each other, so they are sent to the driver in one batch.
+ */
+static void acquire_init_capabilities(wifi_interface_handle iface)
 {
-    wifi_error ret;
+    wifi_error ret = WIFI_SUCCESS;
     interface_info *iinfo = getIfaceInfo(iface);
     wifi_handle handle = getWifiHandle(iface);
-    hal_info *info = (hal_info *)handle;
+    hal_info *info = getHalInfo(handle);
+    WifiRequestBatch batch(info);
 
+    WifihalGeneric supportedFeatures(handle, 0,
+            OUI_QCA,
+            QCA_NL80211_VENDOR_SUBCMD_GET_SUPPORTED_FEATURES);
+    WifihalGeneric driverFeatures(handle, 0,
+            OUI_QCA,
+            QCA_NL80211_VENDOR_SUBCMD_GET_FEATURES);
     WifihalGeneric busSizeSupported(handle, 0,
-                                    OUI_QCA,
-                                    QCA_NL80211_VENDOR_SUBCMD_GET_BUS_SIZE);
+            OUI_QCA,
+            QCA_NL80211_VENDOR_SUBCMD_GET_BUS_SIZE);
+    WifihalGeneric *cmds[] = { &supportedFeatures, &driverFeatures,
+                               &busSizeSupported };
 
-    /* create the message */
-    ret = busSizeSupported.create();
-    if (ret != WIFI_SUCCESS)
-        goto cleanup;
+    info->supported_feature_set = 0;
 
-    ret = busSizeSupported.set_iface_id(iinfo->name);
-    if (ret != WIFI_SUCCESS)
-        goto cleanup;
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        /* create the message */
+        ret = cmds[i]->create();
+        if (ret == WIFI_SUCCESS)
+            ret = cmds[i]->set_iface_id(iinfo->name);
+        if (ret == WIFI_SUCCESS)
+            ret = batch.add(cmds[i]);
+        if (ret != WIFI_SUCCESS) {
+            ALOGE("%s: Failed to prepare request %zu: %d", __func__, i, ret);
+            break;
+        }
+    }
 
-    ret = busSizeSupported.requestResponse();
-    if (ret != WIFI_SUCCESS) {
-        ALOGE("%s: requestResponse Error:%d", __FUNCTION__, ret);
-        goto cleanup;
+    if (ret == WIFI_SUCCESS) {
+        ret = batch.execute();
+        if (ret != WIFI_SUCCESS)
+            ALOGV("%s: batch completed with error: %d", __func__, ret);
     }
-    info->firmware_bus_max_size = busSizeSupported.getBusSize();
 
-cleanup:
-    return ret;
+    if (batch.status(0) == WIFI_SUCCESS) {
+        supportedFeatures.getResponseparams(&info->supported_feature_set);
+    } else {
+        //Failure to get the supported feature set is acceptable condition
+        //as legacy drivers might not support the required vendor command.
+        //So, do not consider it as failure of wifi_initialize
+        ALOGI("Failed to get supported feature set : %d", batch.status(0));
+    }
+
+    if (batch.status(1) == WIFI_SUCCESS)
+        driverFeatures.getDriverFeatures(&info->driver_supported_features);
+    else
+        ALOGI("Failed to get vendor feature set : %d", batch.status(1));
+
+    if (batch.status(2) == WIFI_SUCCESS) {
+        info->firmware_bus_max_size = busSizeSupported.getBusSize();
+    } else {
+        ALOGE("Failed to get supported bus size, error : %d", batch.status(2));
+        info->firmware_bus_max_size = 1520;
+    }
 }
 
 static wifi_error wifi_init_user_sock(hal_info *info)
@@ -500,7 +667,7 @@ static wifi_error wifi_init_user_sock(hal_info *info)
     }
 
     /* Set the socket buffer size */
-    if (nl_socket_set_buffer_size(user_sock, (256*1024), 0) < 0) {
+    if (nl_socket_set_buffer_size(user_sock, NL_RECV_MIN_RCVBUF, 0) < 0) {
         ALOGE("Could not set size for user_sock: %s",
                    strerror(errno));
         /* continue anyway with the default (smaller) buffer */
@@ -1238,7 +1405,6 @@ wifi_error wifi_initialize(wifi_handle *handle)
 {
     wifi_error ret = WIFI_ERROR_UNKNOWN;
     wifi_interface_handle iface_handle;
-    struct nl_sock *cmd_sock = NULL;
     struct nl_sock *event_sock = NULL;
     struct nl_cb *cb = NULL;
     int status = 0;
@@ -1254,23 +1420,18 @@ wifi_error wifi_initialize(wifi_handle *handle)
     }
 
     memset(info, 0, sizeof(*info));
+    info->epoll_fd = -1;
+    info->event_overflow.timer_fd = -1;
+    info->user_overflow.timer_fd = -1;
     info->capa.max_mlo_association_link_count = -1;
     info->capa.max_mlo_str_link_count = -1;
 
-    cmd_sock = wifi_create_nl_socket(WIFI_HAL_CMD_SOCK_PORT,
-                                                     NETLINK_GENERIC);
-    if (cmd_sock == NULL) {
-        ALOGE("Failed to create command socket port");
-        ret = WIFI_ERROR_UNKNOWN;
+    ret = wifi_init_cmd_sock_pool(info, DEFAULT_CMD_SOCK_POOL_SIZE);
+    if (ret != WIFI_SUCCESS) {
+        ALOGE("Failed to create command socket pool");
         goto unload;
     }
-
-    /* Set the socket buffer size */
-    if (nl_socket_set_buffer_size(cmd_sock, (256*1024), 0) < 0) {
-        ALOGE("Could not set nl_socket RX buffer size for cmd_sock: %s",
-                   strerror(errno));
-        /* continue anyway with the default (smaller) buffer */
-    }
+    ret = WIFI_ERROR_UNKNOWN;
 
     event_sock =
         wifi_create_nl_socket(WIFI_HAL_EVENT_SOCK_PORT, NETLINK_GENERIC);
@@ -1281,7 +1442,7 @@ wifi_error wifi_initialize(wifi_handle *handle)
     }
 
     /* Set the socket buffer size */
-    if (nl_socket_set_buffer_size(event_sock, (256*1024), 0) < 0) {
+    if (nl_socket_set_buffer_size(event_sock, NL_RECV_MIN_RCVBUF, 0) < 0) {
         ALOGE("Could not set nl_socket RX buffer size for event_sock: %s",
                    strerror(errno));
         /* continue anyway with the default (smaller) buffer */
@@ -1304,21 +1465,24 @@ wifi_error wifi_initialize(wifi_handle *handle)
             info);
     nl_cb_put(cb);
 
-    info->cmd_sock = cmd_sock;
     info->event_sock = event_sock;
+    wifi_init_async_sock(info);
     info->clean_up = false;
     info->in_event_loop = false;
 
-    info->event_cb = (cb_info *)malloc(sizeof(cb_info) * DEFAULT_EVENT_CB_SIZE);
-    if (info->event_cb == NULL) {
+    if (event_cb_init(&info->event_cbs, DEFAULT_EVENT_CB_SIZE)) {
         ALOGE("Could not allocate event_cb");
         ret = WIFI_ERROR_OUT_OF_MEMORY;
         goto unload;
     }
-    info->alloc_event_cb = DEFAULT_EVENT_CB_SIZE;
-    info->num_event_cb = 0;
 
-    info->nl80211_family_id = genl_ctrl_resolve(cmd_sock, "nl80211");
+    /* Command latency tracking is best effort */
+    info->cmd_latency = (cmd_latency_table *)calloc(1,
+                                                    sizeof(cmd_latency_table));
+    if (info->cmd_latency == NULL)
+        ALOGE("Could not allocate cmd_latency");
+
+    info->nl80211_family_id = genl_ctrl_resolve(info->cmd_sock, "nl80211");
     if (info->nl80211_family_id < 0) {
         ALOGE("Could not resolve nl80211 familty id");
         ret = WIFI_ERROR_UNKNOWN;
@@ -1327,6 +1491,7 @@ wifi_error wifi_initialize(wifi_handle *handle)
 
     pthread_mutex_init(&info->cb_lock, NULL);
     pthread_mutex_init(&info->pkt_fate_stats_lock, NULL);
+    pthread_mutex_init(&info->diag_lock, NULL);
 
     *handle = (wifi_handle) info;
 
@@ -1422,22 +1587,7 @@ wifi_error wifi_initialize(wifi_handle *handle)
     }
     iface_handle = (wifi_interface_handle)info->interfaces[index];
 
-    ret = acquire_supported_features(iface_handle,
-            &info->supported_feature_set);
-    if (ret != WIFI_SUCCESS) {
-        ALOGI("Failed to get supported feature set : %d", ret);
-        //acquire_supported_features failure is acceptable condition as legacy
-        //drivers might not support the required vendor command. So, do not
-        //consider it as failure of wifi_initialize
-        ret = WIFI_SUCCESS;
-    }
-
-    ret = acquire_driver_supported_features(iface_handle,
-                                  &info->driver_supported_features);
-    if (ret != WIFI_SUCCESS) {
-        ALOGI("Failed to get vendor feature set : %d", ret);
-        ret = WIFI_SUCCESS;
-    }
+    acquire_init_capabilities(iface_handle);
 
     ret =  wifi_get_logger_supported_feature_set(iface_handle,
                          &info->supported_logger_feature_set);
@@ -1462,12 +1612,6 @@ wifi_error wifi_initialize(wifi_handle *handle)
         ALOGE("Failed to get firmware version: %d", ret);
     }
 
-    ret = get_firmware_bus_max_size_supported(iface_handle);
-    if (ret != WIFI_SUCCESS) {
-        ALOGE("Failed to get supported bus size, error : %d", ret);
-        info->firmware_bus_max_size = 1520;
-    }
-
     ret = wifi_logger_ring_buffers_init(info);
     if (ret != WIFI_SUCCESS)
         ALOGE("Wifi Logger Ring Initialization Failed");
@@ -1483,9 +1627,18 @@ wifi_error wifi_initialize(wifi_handle *handle)
         ret = WIFI_ERROR_OUT_OF_MEMORY;
         goto unload;
     }
+    memset(info->pkt_stats, 0, sizeof(struct pkt_stats_s));
 
+    /* Staging arena for the MPDUs of one RX PPDU, sized for the largest
+     * A-MPDU with the rx header length of this target's pktlog version.
+     * Touched here once so the RX stats path never grows or faults it in.
+     */
     info->rx_buf_size_allocated = MAX_RXMPDUS_PER_AMPDU * MAX_MSDUS_PER_MPDU
-                                  * PKT_STATS_BUF_SIZE;
+                                  * (sizeof(wifi_ring_buffer_entry)
+                                     + sizeof(wifi_ring_per_packet_status_entry)
+                                     + (info->pkt_log_ver == PKT_LOG_V2 ?
+                                        RX_HTT_HDR_STATUS_LEN_V1 :
+                                        RX_HTT_HDR_STATUS_LEN));
 
     info->rx_aggr_pkts =
         (wifi_ring_buffer_entry  *)malloc(info->rx_buf_size_allocated);
@@ -1498,6 +1651,9 @@ wifi_error wifi_initialize(wifi_handle *handle)
     }
     memset(info->rx_aggr_pkts, 0, info->rx_buf_size_allocated);
 
+    /* Without the worker diag messages are decoded on the event loop */
+    info->diag_worker = diag_worker_start(info);
+
     info->exit_sockets[0] = -1;
     info->exit_sockets[1] = -1;
 
@@ -1507,6 +1663,12 @@ wifi_error wifi_initialize(wifi_handle *handle)
         goto unload;
     }
 
+    ret = wifi_init_event_loop(info);
+    if (ret != WIFI_SUCCESS) {
+        ALOGE("Failed to initialize event loop");
+        goto unload;
+    }
+
     ALOGV("Initializing Gscan Event Handlers");
     ret = initializeGscanHandlers(info);
     if (ret != WIFI_SUCCESS) {
@@ -1580,11 +1742,13 @@ cld80211_cleanup:
     }
 unload:
     if (ret != WIFI_SUCCESS) {
-        if (cmd_sock)
-            nl_socket_free(cmd_sock);
         if (event_sock)
             nl_socket_free(event_sock);
         if (info) {
+            diag_worker_stop(info->diag_worker);
+            wifi_cleanup_event_loop(info);
+            wifi_cleanup_cmd_sock_pool(info);
+            wifi_cleanup_async_sock(info);
             if (info->cldctx) {
                 cld80211lib_cleanup(info);
             } else if (info->user_sock) {
@@ -1598,7 +1762,8 @@ unload:
             cleanupRSSIMonitorHandler(info);
             cleanupRadioHandler(info);
             cleanupTCPParamCommand(info);
-            free(info->event_cb);
+            event_cb_deinit(&info->event_cbs);
+            free(info->cmd_latency);
             if (info->driver_supported_features.flags) {
                 free(info->driver_supported_features.flags);
                 info->driver_supported_features.flags = NULL;
@@ -1694,12 +1859,21 @@ static void internal_cleaned_up_handler(wifi_handle handle)
     wifi_cleaned_up_handler cleaned_up_handler = info->cleaned_up_handler;
     wifihal_mon_sock_t *reg, *tmp;
 
+    wifi_cleanup_event_loop(info);
+
+    /* No diag messages come in anymore; the worker decodes the rest */
+    diag_worker_stop(info->diag_worker);
+    info->diag_worker = NULL;
+
     if (info->cmd_sock != 0) {
-        nl_socket_free(info->cmd_sock);
+        wifi_cleanup_cmd_sock_pool(info);
         nl_socket_free(info->event_sock);
-        info->cmd_sock = NULL;
         info->event_sock = NULL;
     }
+    wifi_cleanup_async_sock(info);
+
+    /* Drain a pcapng export while its ctrl socket sink is still open */
+    wifi_stop_pcapng_export(handle);
 
     if (info->wifihal_ctrl_sock.s != 0) {
         close(info->wifihal_ctrl_sock.s);
@@ -1737,10 +1911,13 @@ static void internal_cleaned_up_handler(wifi_handle handle)
     if (secure_nan_deinit(info))
         ALOGE("%s: secure nan deinit failed", __FUNCTION__);
 
-    if (info->num_event_cb)
+    wifi_log_event_cb_stats(info);
+    if (info->event_cbs.table && info->event_cbs.table->num_active)
         ALOGE("%d events were leftover without being freed",
-              info->num_event_cb);
-    free(info->event_cb);
+              info->event_cbs.table->num_active);
+    event_cb_deinit(&info->event_cbs);
+
+    wifi_log_cmd_latency_stats(info);
 
     if (info->exit_sockets[0] >= 0) {
         close(info->exit_sockets[0]);
@@ -1753,6 +1930,7 @@ static void internal_cleaned_up_handler(wifi_handle handle)
     }
 
     if (info->pkt_fate_stats) {
+        free(info->pkt_fate_stats->frame_slab);
         free(info->pkt_fate_stats);
         info->pkt_fate_stats = NULL;
     }
@@ -1763,8 +1941,12 @@ static void internal_cleaned_up_handler(wifi_handle handle)
     }
 
     (*cleaned_up_handler)(handle);
+    /* Command threads may record latency until the framework is told the
+     * HAL is cleaned up; the table goes away with info. */
+    free(info->cmd_latency);
     pthread_mutex_destroy(&info->cb_lock);
     pthread_mutex_destroy(&info->pkt_fate_stats_lock);
+    pthread_mutex_destroy(&info->diag_lock);
     free(info);
 }
 
@@ -2088,6 +2270,172 @@ static int dettach_monitor_sock(wifi_handle handle, wifihal_ctrl_req_t *ctrl_msg
    return register_monitor_sock(handle, ctrl_msg, 0);
 }
 
+/* Build the WIFIHAL_CTRL_GET_CMD_LATENCY reply, sized to fit a page */
+static wifihal_ctrl_cmd_latency_rsp_t *get_cmd_latency(wifi_handle handle,
+                                                       size_t *len)
+{
+    wifihal_ctrl_cmd_latency_rsp_t *rsp;
+    wifi_cmd_latency_stats *stats;
+    int max_stats, num = 0;
+
+    max_stats = (DEFAULT_PAGE_SIZE - sizeof(*rsp)) /
+                sizeof(wifihal_ctrl_cmd_latency_t);
+    stats = (wifi_cmd_latency_stats *)malloc(max_stats * sizeof(*stats));
+    if (stats == NULL)
+        return NULL;
+
+    if (wifi_get_cmd_latency_stats(handle, stats, max_stats, &num) !=
+        WIFI_SUCCESS) {
+        free(stats);
+        return NULL;
+    }
+
+    *len = sizeof(*rsp) + num * sizeof(wifihal_ctrl_cmd_latency_t);
+    rsp = (wifihal_ctrl_cmd_latency_rsp_t *)calloc(1, *len);
+    if (rsp == NULL) {
+        free(stats);
+        return NULL;
+    }
+
+    for (int i = 0; i < num; i++) {
+        rsp->stats[i].nl_cmd = stats[i].nl_cmd;
+        rsp->stats[i].vendor_id = stats[i].vendor_id;
+        rsp->stats[i].vendor_subcmd = stats[i].vendor_subcmd;
+        rsp->stats[i].count = stats[i].count;
+        rsp->stats[i].errors = stats[i].errors;
+        rsp->stats[i].avg_us = stats[i].avg_us;
+        rsp->stats[i].max_us = stats[i].max_us;
+        rsp->stats[i].first_reply_p50_us = stats[i].first_reply_p50_us;
+        rsp->stats[i].first_reply_p99_us = stats[i].first_reply_p99_us;
+        rsp->stats[i].complete_p50_us = stats[i].complete_p50_us;
+        rsp->stats[i].complete_p90_us = stats[i].complete_p90_us;
+        rsp->stats[i].complete_p99_us = stats[i].complete_p99_us;
+    }
+    free(stats);
+    return rsp;
+}
+
+/* Build the WIFIHAL_CTRL_GET_DIAG_EVENT_STATS reply */
+static wifihal_ctrl_diag_event_stats_rsp_t *get_diag_event_stats(
+                                                wifi_handle handle, size_t *len)
+{
+    wifihal_ctrl_diag_event_stats_rsp_t *rsp;
+    wifi_diag_event_stats stats[DIAG_EVENT_COUNTER_SLOTS];
+    int num = 0;
+
+    if (wifi_get_diag_event_stats(handle, stats, DIAG_EVENT_COUNTER_SLOTS,
+                                  &num) != WIFI_SUCCESS)
+        return NULL;
+
+    *len = sizeof(*rsp) + num * sizeof(wifihal_ctrl_diag_event_stats_t);
+    rsp = (wifihal_ctrl_diag_event_stats_rsp_t *)calloc(1, *len);
+    if (rsp == NULL)
+        return NULL;
+
+    for (int i = 0; i < num; i++) {
+        rsp->stats[i].event_id = stats[i].event_id;
+        rsp->stats[i].events = stats[i].events;
+        rsp->stats[i].bytes = stats[i].bytes;
+        rsp->stats[i].failures = stats[i].failures;
+    }
+    return rsp;
+}
+
+/* Fill the WIFIHAL_CTRL_GET_DIAG_QUEUE_STATS reply */
+static int get_diag_queue_stats(wifi_handle handle,
+                                wifihal_ctrl_diag_queue_stats_rsp_t *rsp)
+{
+    wifi_diag_queue_stats stats;
+
+    if (wifi_get_diag_queue_stats(handle, &stats) != WIFI_SUCCESS)
+        return -1;
+
+    rsp->queued = stats.queued;
+    rsp->decoded = stats.decoded;
+    rsp->dropped = stats.dropped;
+    rsp->oversized = stats.oversized;
+    rsp->depth = stats.depth;
+    rsp->max_depth = stats.max_depth;
+    rsp->queue_len = stats.queue_len;
+    return 0;
+}
+
+/* Build the WIFIHAL_CTRL_GET_RING_COMPRESS_STATS reply */
+static wifihal_ctrl_ring_compress_stats_rsp_t *get_ring_compress_stats(
+                                                wifi_handle handle, size_t *len)
+{
+    wifihal_ctrl_ring_compress_stats_rsp_t *rsp;
+    wifi_ring_compress_stats stats[NUM_RING_BUFS];
+    int num = 0;
+
+    if (wifi_get_ring_compress_stats(handle, stats, NUM_RING_BUFS,
+                                     &num) != WIFI_SUCCESS)
+        return NULL;
+
+    *len = sizeof(*rsp) + num * sizeof(wifihal_ctrl_ring_compress_stats_t);
+    rsp = (wifihal_ctrl_ring_compress_stats_rsp_t *)calloc(1, *len);
+    if (rsp == NULL)
+        return NULL;
+
+    for (int i = 0; i < num; i++) {
+        strlcpy(rsp->stats[i].name, stats[i].name, sizeof(rsp->stats[i].name));
+        rsp->stats[i].chunks = stats[i].stats.chunks;
+        rsp->stats[i].stored_chunks = stats[i].stats.stored_chunks;
+        rsp->stats[i].in_bytes = stats[i].stats.in_bytes;
+        rsp->stats[i].out_bytes = stats[i].stats.out_bytes;
+        rsp->stats[i].cpu_us = stats[i].stats.cpu_us;
+    }
+    return rsp;
+}
+
+/* Start a pcapng export into a new file of CONFIG_CTRL_PCAPNG_DIR named
+ * by the request data, or without data as datagrams to the requester's
+ * monitor socket. Only a file name is taken, and an existing file is never
+ * opened, so a request cannot write anywhere else.
+ */
+static int start_pcapng_export(wifi_handle handle, struct ctrl_sock *sock,
+                               wifihal_ctrl_req_t *ctrl_msg)
+{
+    char path[sizeof(CONFIG_CTRL_PCAPNG_DIR) + NAME_MAX];
+    int fd;
+
+    if (ctrl_msg->data_len) {
+        if (ctrl_msg->data_len > DEFAULT_PAGE_SIZE - sizeof(*ctrl_msg) ||
+            strnlen(ctrl_msg->data, ctrl_msg->data_len) == ctrl_msg->data_len ||
+            ctrl_msg->data[0] == '\0' || strchr(ctrl_msg->data, '/') ||
+            strstr(ctrl_msg->data, "..") ||
+            strlen(ctrl_msg->data) > NAME_MAX) {
+            ALOGE("%s: Invalid pcapng file name", __FUNCTION__);
+            return -1;
+        }
+        snprintf(path, sizeof(path), "%s%s", CONFIG_CTRL_PCAPNG_DIR,
+                 ctrl_msg->data);
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                  0640);
+        if (fd < 0) {
+            ALOGE("%s: Failed to open %s: %s", __FUNCTION__, path,
+                  strerror(errno));
+            return -1;
+        }
+        if (wifi_start_pcapng_export(handle, fd, NULL, 0) != WIFI_SUCCESS) {
+            close(fd);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (ctrl_msg->monsock_len == 0 ||
+        ctrl_msg->monsock_len > sizeof(struct sockaddr_un)) {
+        ALOGE("%s: Invalid monitor socket length", __FUNCTION__);
+        return -1;
+    }
+    if (wifi_start_pcapng_export(handle, sock->s,
+                                 (struct sockaddr *)&ctrl_msg->monsock,
+                                 ctrl_msg->monsock_len) != WIFI_SUCCESS)
+        return -1;
+    return 0;
+}
+
 static int internal_pollin_handler_app(wifi_handle handle,  struct ctrl_sock *sock)
 {
     int retval = -1;
@@ -2096,6 +2444,12 @@ static int internal_pollin_handler_app(wifi_handle handle,  struct ctrl_sock *so
     socklen_t fromlen = sizeof(from);
     wifihal_ctrl_req_t *ctrl_msg;
     wifihal_ctrl_sync_rsp_t ctrl_reply;
+    wifihal_ctrl_cmd_latency_rsp_t *latency_reply = NULL;
+    wifihal_ctrl_diag_event_stats_rsp_t *diag_reply = NULL;
+    wifihal_ctrl_diag_queue_stats_rsp_t queue_reply;
+    wifihal_ctrl_ring_compress_stats_rsp_t *compress_reply = NULL;
+    void *reply = &ctrl_reply;
+    size_t reply_len = sizeof(ctrl_reply);
 
     ctrl_msg = (wifihal_ctrl_req_t *)malloc(DEFAULT_PAGE_SIZE);
     if(ctrl_msg == NULL)
@@ -2127,6 +2481,45 @@ static int internal_pollin_handler_app(wifi_handle handle,  struct ctrl_sock *so
        case WIFIHAL_CTRL_SEND_NL_DATA:
          retval = send_nl_data(handle, ctrl_msg);
        break;
+       case WIFIHAL_CTRL_GET_CMD_LATENCY:
+         latency_reply = get_cmd_latency(handle, &reply_len);
+         if (latency_reply) {
+             retval = (reply_len - sizeof(*latency_reply)) /
+                      sizeof(wifihal_ctrl_cmd_latency_t);
+             reply = latency_reply;
+         }
+       break;
+       case WIFIHAL_CTRL_GET_DIAG_EVENT_STATS:
+         diag_reply = get_diag_event_stats(handle, &reply_len);
+         if (diag_reply) {
+             retval = (reply_len - sizeof(*diag_reply)) /
+                      sizeof(wifihal_ctrl_diag_event_stats_t);
+             reply = diag_reply;
+         }
+       break;
+       case WIFIHAL_CTRL_PCAPNG_START:
+         retval = start_pcapng_export(handle, sock, ctrl_msg);
+       break;
+       case WIFIHAL_CTRL_PCAPNG_STOP:
+         wifi_stop_pcapng_export(handle);
+         retval = 0;
+       break;
+       case WIFIHAL_CTRL_GET_DIAG_QUEUE_STATS:
+         memset(&queue_reply, 0, sizeof(queue_reply));
+         retval = get_diag_queue_stats(handle, &queue_reply);
+         if (retval == 0) {
+             reply = &queue_reply;
+             reply_len = sizeof(queue_reply);
+         }
+       break;
+       case WIFIHAL_CTRL_GET_RING_COMPRESS_STATS:
+         compress_reply = get_ring_compress_stats(handle, &reply_len);
+         if (compress_reply) {
+             retval = (reply_len - sizeof(*compress_reply)) /
+                      sizeof(wifihal_ctrl_ring_compress_stats_t);
+             reply = compress_reply;
+         }
+       break;
        default:
        break;
     }
@@ -2135,12 +2528,27 @@ static int internal_pollin_handler_app(wifi_handle handle,  struct ctrl_sock *so
     ctrl_reply.family_name = ctrl_msg->family_name;
     ctrl_reply.cmd_id = ctrl_msg->cmd_id;
     ctrl_reply.status = retval;
+    if (latency_reply)
+       latency_reply->hdr = ctrl_reply;
+    if (diag_reply)
+       diag_reply->hdr = ctrl_reply;
+    if (reply == &queue_reply)
+       queue_reply.hdr = ctrl_reply;
+    if (compress_reply)
+       compress_reply->hdr = ctrl_reply;
 
     if(ctrl_msg)
        free(ctrl_msg);
 
-    if (sendto(sock->s, (char *)&ctrl_reply, sizeof(ctrl_reply), 0, (struct sockaddr *)&from,
-               fromlen) < 0) {
+    res = sendto(sock->s, (char *)reply, reply_len, 0, (struct sockaddr *)&from,
+                 fromlen);
+    if (latency_reply)
+       free(latency_reply);
+    if (diag_reply)
+       free(diag_reply);
+    if (compress_reply)
+       free(compress_reply);
+    if (res < 0) {
                   int _errno = errno;
                   ALOGE("socket send failed : %d",_errno);
 
@@ -2160,11 +2568,19 @@ static int internal_pollin_handler_app(wifi_handle handle,  struct ctrl_sock *so
 
 static int internal_pollin_handler(wifi_handle handle, struct nl_sock *sock)
 {
+    hal_info *info = getHalInfo(handle);
     struct nl_cb *cb = nl_socket_get_cb(sock);
 
     int res = nl_recvmsgs(sock, cb);
     if(res)
         ALOGE("Error :%d while reading nl msg", res);
+    /* libnl reports a receive buffer overrun as -NLE_NOMEM */
+    if (res == -NLE_NOMEM && errno == ENOBUFS) {
+        if (sock == info->event_sock)
+            nl_sock_overflow_handler(info, &info->event_overflow);
+        else if (sock == info->user_sock)
+            nl_sock_overflow_handler(info, &info->user_overflow);
+    }
     nl_cb_put(cb);
     return res;
 }
@@ -2214,60 +2630,340 @@ static bool exit_event_handler(int fd) {
     return false;
 }
 
-/* Run event handler */
-void wifi_event_loop(wifi_handle handle)
+/* Watch fd in wifi_event_loop; handler runs on the event loop thread. May be
+ * called from any thread, before or while the loop runs. The fd stays
+ * watched until wifi_cleanup_event_loop(), so it must stay open until then.
+ */
+wifi_error wifi_loop_add_fd(hal_info *info, int fd, loop_fd_handler handler,
+                            void *arg)
 {
-    hal_info *info = getHalInfo(handle);
-    if (info->in_event_loop) {
+    loop_fd_info *lfd;
+    struct epoll_event ev;
+
+    if (info->epoll_fd < 0 || fd < 0 || handler == NULL)
+        return WIFI_ERROR_INVALID_ARGS;
+
+    lfd = (loop_fd_info *)malloc(sizeof(loop_fd_info));
+    if (lfd == NULL) {
+        ALOGE("%s: Failed to allocate loop fd", __FUNCTION__);
+        return WIFI_ERROR_OUT_OF_MEMORY;
+    }
+    lfd->fd = fd;
+    lfd->handler = handler;
+    lfd->arg = arg;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = lfd;
+
+    pthread_mutex_lock(&info->loop_fd_lock);
+    if (epoll_ctl(info->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ALOGE("%s: Failed to add fd %d: %s", __FUNCTION__, fd, strerror(errno));
+        pthread_mutex_unlock(&info->loop_fd_lock);
+        free(lfd);
+        return WIFI_ERROR_UNKNOWN;
+    }
+    add_to_list(&lfd->list, &info->loop_fds);
+    pthread_mutex_unlock(&info->loop_fd_lock);
+    return WIFI_SUCCESS;
+}
+
+/* Loop fd handlers; the epoll event bits have the same values as the
+ * poll() ones expected by internal_event_handler().
+ */
+static void nl_sock_fd_handler(hal_info *info, int fd, u32 events, void *arg)
+{
+    internal_event_handler(getWifiHandle(info), events, (struct nl_sock *)arg);
+}
+
+static void nl_batch_fd_handler(hal_info *info, int fd, u32 events, void *arg)
+{
+    if (events & EPOLLERR)
+        ALOGE("Error reading from socket");
+    if (events & (EPOLLIN | EPOLLERR))
+        wifi_recv_batch((nl_recv_batch *)arg);
+    else if (events & EPOLLHUP)
+        ALOGE("Remote side hung up");
+}
+
+/* Alert the framework of the overflows of a socket not alerted yet */
+static void nl_overflow_send_alert(hal_info *info, nl_overflow_info *overflow)
+{
+    char msg[96];
+    int reason_code;
+
+    if (overflow == &info->user_overflow)
+        reason_code = NL_OVERFLOW_USER_SOCK_REASON_CODE;
+    else
+        reason_code = NL_OVERFLOW_EVENT_SOCK_REASON_CODE;
+
+    snprintf(msg, sizeof(msg), "Netlink overflow on %s: %" PRIu64 " drops",
+             overflow->name, overflow->overflows - overflow->overflows_alerted);
+    overflow->overflows_alerted = overflow->overflows;
+    clock_gettime(CLOCK_MONOTONIC, &overflow->last_alert);
+    send_alert_msg(info, msg, reason_code);
+}
+
+/* The kernel dropped messages queued for event_sock or user_sock. Tell the
+ * framework through the alert handler so it can re-query the state it owns,
+ * such as gscan results and NAN sessions. Alerts are rate limited; drops
+ * within NL_OVERFLOW_ALERT_INTERVAL_SEC of the last alert are summed up in
+ * one alert sent when the interval ends. Diag data lost on user_sock leaves
+ * a gap in the rings; push out what is buffered so the gap lines up with
+ * the alert.
+ */
+static void nl_sock_overflow_handler(hal_info *info, nl_overflow_info *overflow)
+{
+    struct itimerspec its;
+
+    if (overflow == NULL)
+        return;
+
+    overflow->overflows++;
+    clock_gettime(CLOCK_MONOTONIC, &overflow->last_overflow);
+    ALOGE("%s: Receive buffer overrun, %" PRIu64 " so far", overflow->name,
+          overflow->overflows);
+
+    if (overflow == &info->user_overflow) {
+        if (info->diag_worker) {
+            diag_worker_post_flush(info->diag_worker);
+        } else {
+            pthread_mutex_lock(&info->diag_lock);
+            push_out_all_ring_buffers(info);
+            pthread_mutex_unlock(&info->diag_lock);
+        }
+    }
+
+    if (!overflow->overflows_alerted ||
+        overflow->last_overflow.tv_sec - overflow->last_alert.tv_sec >=
+            NL_OVERFLOW_ALERT_INTERVAL_SEC) {
+        nl_overflow_send_alert(info, overflow);
+        return;
+    }
+
+    /* Within the interval; alert once it ends */
+    if (overflow->timer_armed || overflow->timer_fd < 0)
+        return;
+    memset(&its, 0, sizeof(its));
+    its.it_value = overflow->last_alert;
+    its.it_value.tv_sec += NL_OVERFLOW_ALERT_INTERVAL_SEC;
+    if (timerfd_settime(overflow->timer_fd, TFD_TIMER_ABSTIME, &its,
+                        NULL) < 0) {
+        ALOGE("Failed to arm overflow alert timer of %s: %s", overflow->name,
+              strerror(errno));
+        return;
+    }
+    overflow->timer_armed = true;
+}
+
+static void nl_overflow_timer_fd_handler(hal_info *info, int fd, u32 events,
+                                         void *arg)
+{
+    nl_overflow_info *overflow = (nl_overflow_info *)arg;
+    u64 expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        ALOGE("Failed to read overflow alert timer of %s: %s",
+              overflow->name, strerror(errno));
+    overflow->timer_armed = false;
+    if (overflow->overflows > overflow->overflows_alerted)
+        nl_overflow_send_alert(info, overflow);
+}
+
+/* Set up the overflow state of an event loop socket and watch its alert
+ * timer; without the timer, drops within the interval wait for the next
+ * overflow after it.
+ */
+static void nl_overflow_init(hal_info *info, nl_overflow_info *overflow,
+                             const char *name)
+{
+    overflow->name = name;
+    overflow->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                        TFD_NONBLOCK | TFD_CLOEXEC);
+    if (overflow->timer_fd < 0) {
+        ALOGE("Failed to create overflow alert timer of %s: %s", name,
+              strerror(errno));
+        return;
+    }
+    if (wifi_loop_add_fd(info, overflow->timer_fd,
+                         nl_overflow_timer_fd_handler, overflow) !=
+            WIFI_SUCCESS) {
+        close(overflow->timer_fd);
+        overflow->timer_fd = -1;
+    }
+}
+
+static void ctrl_sock_fd_handler(hal_info *info, int fd, u32 events, void *arg)
+{
+    internal_event_handler_app(getWifiHandle(info), events,
+                               (struct ctrl_sock *)arg);
+}
+
+static void exit_sock_fd_handler(hal_info *info, int fd, u32 events, void *arg)
+{
+    if (exit_event_handler(fd))
+        info->clean_up = true;
+}
+
+static void rb_timer_fd_handler(hal_info *info, int fd, u32 events, void *arg)
+{
+    struct rb_info *rb_info = (struct rb_info *)arg;
+
+    if (info->diag_worker) {
+        rb_timer_ack(rb_info);
+        diag_worker_post_rb_timeout(info->diag_worker, rb_info->id);
         return;
-    } else {
-        info->in_event_loop = true;
     }
+    pthread_mutex_lock(&info->diag_lock);
+    rb_timer_expired(rb_info);
+    pcapng_export_flush_due(info);
+    pthread_mutex_unlock(&info->diag_lock);
+}
 
-    pollfd pfd[4];
-    memset(&pfd, 0, 4*sizeof(pfd[0]));
+static wifi_error wifi_init_event_loop(hal_info *info)
+{
+    /* Same handlers the libnl callbacks of the sockets run */
+    nl_recv_handlers event_handlers = {
+        internal_valid_message_handler, info, ack_handler, finish_handler,
+        error_handler, &info->event_sock_arg
+    };
+    nl_recv_handlers user_handlers = {
+        user_sock_message_handler, info, ack_handler, finish_handler,
+        error_handler, &info->user_sock_arg
+    };
+    wifi_error ret;
+    int i;
 
-    pfd[0].fd = nl_socket_get_fd(info->event_sock);
-    pfd[0].events = POLLIN;
+    info->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (info->epoll_fd < 0) {
+        ALOGE("Failed to create epoll instance: %s", strerror(errno));
+        return WIFI_ERROR_UNKNOWN;
+    }
+    INITIALISE_LIST(&info->loop_fds);
+    pthread_mutex_init(&info->loop_fd_lock, NULL);
+
+    /* event_sock and user_sock take the event and log bursts; drain them in
+     * batches, falling back to one datagram per wakeup without memory.
+     */
+    nl_overflow_init(info, &info->event_overflow, "event_sock");
+    nl_overflow_init(info, &info->user_overflow, "user_sock");
+
+    info->event_recv_batch = wifi_alloc_recv_batch(info, info->event_sock,
+                                                   "event_sock",
+                                                   &event_handlers);
+    if (info->event_recv_batch) {
+        info->event_recv_batch->on_overflow = nl_sock_overflow_handler;
+        info->event_recv_batch->overflow = &info->event_overflow;
+        ret = wifi_loop_add_fd(info, nl_socket_get_fd(info->event_sock),
+                               nl_batch_fd_handler, info->event_recv_batch);
+    } else
+        ret = wifi_loop_add_fd(info, nl_socket_get_fd(info->event_sock),
+                               nl_sock_fd_handler, info->event_sock);
+    if (ret != WIFI_SUCCESS)
+        return ret;
 
-    pfd[1].fd = nl_socket_get_fd(info->user_sock);
-    pfd[1].events = POLLIN;
+    info->user_recv_batch = wifi_alloc_recv_batch(info, info->user_sock,
+                                                  "user_sock",
+                                                  &user_handlers);
+    if (info->user_recv_batch) {
+        info->user_recv_batch->on_overflow = nl_sock_overflow_handler;
+        info->user_recv_batch->overflow = &info->user_overflow;
+        ret = wifi_loop_add_fd(info, nl_socket_get_fd(info->user_sock),
+                               nl_batch_fd_handler, info->user_recv_batch);
+    } else
+        ret = wifi_loop_add_fd(info, nl_socket_get_fd(info->user_sock),
+                               nl_sock_fd_handler, info->user_sock);
+    if (ret != WIFI_SUCCESS)
+        return ret;
 
-    pfd[2].fd = info->exit_sockets[1];
-    pfd[2].events = POLLIN;
+    ret = wifi_loop_add_fd(info, info->exit_sockets[1], exit_sock_fd_handler,
+                           NULL);
+    if (ret != WIFI_SUCCESS)
+        return ret;
 
-    if(info->wifihal_ctrl_sock.s > 0) {
-      pfd[3].fd = info->wifihal_ctrl_sock.s ;
-      pfd[3].events = POLLIN;
+    if (info->wifihal_ctrl_sock.s > 0) {
+        ret = wifi_loop_add_fd(info, info->wifihal_ctrl_sock.s,
+                               ctrl_sock_fd_handler, &info->wifihal_ctrl_sock);
+        if (ret != WIFI_SUCCESS)
+            return ret;
+    }
+
+    if (info->async_sock) {
+        ret = wifi_loop_add_fd(info, nl_socket_get_fd(info->async_sock),
+                               nl_sock_fd_handler, info->async_sock);
+        if (ret != WIFI_SUCCESS)
+            return ret;
+    }
+
+    /* Ring buffers flush on their own deadline instead of on every wakeup */
+    for (i = 0; i < NUM_RING_BUFS; i++) {
+        struct rb_info *rb_info = &info->rb_infos[i];
+
+        if (rb_info->rb_ctx == NULL || rb_info->timer_fd < 0)
+            continue;
+        if (wifi_loop_add_fd(info, rb_info->timer_fd, rb_timer_fd_handler,
+                             rb_info) != WIFI_SUCCESS)
+            ALOGE("Failed to watch flush timer of rb %s", rb_info->name);
+    }
+
+    return WIFI_SUCCESS;
+}
+
+static void wifi_cleanup_event_loop(hal_info *info)
+{
+    loop_fd_info *lfd, *tmp;
+
+    if (info->epoll_fd < 0)
+        return;
+
+    list_for_each_entry_safe(lfd, tmp, &info->loop_fds, list) {
+        del_from_list(&lfd->list);
+        free(lfd);
+    }
+
+    wifi_log_recv_batch_stats(info->event_recv_batch);
+    wifi_log_recv_batch_stats(info->user_recv_batch);
+    wifi_free_recv_batch(info->event_recv_batch);
+    wifi_free_recv_batch(info->user_recv_batch);
+    info->event_recv_batch = NULL;
+    info->user_recv_batch = NULL;
+    if (info->event_overflow.timer_fd >= 0)
+        close(info->event_overflow.timer_fd);
+    if (info->user_overflow.timer_fd >= 0)
+        close(info->user_overflow.timer_fd);
+    info->event_overflow.timer_fd = -1;
+    info->user_overflow.timer_fd = -1;
+
+    close(info->epoll_fd);
+    info->epoll_fd = -1;
+    pthread_mutex_destroy(&info->loop_fd_lock);
+}
+
+/* Run event handler */
+void wifi_event_loop(wifi_handle handle)
+{
+    hal_info *info = getHalInfo(handle);
+    struct epoll_event events[MAX_LOOP_EVENTS];
+    loop_fd_info *lfd;
+    int i, n;
+
+    if (info->in_event_loop) {
+        return;
+    } else {
+        info->in_event_loop = true;
     }
-    /* TODO: Add support for timeouts */
 
     do {
-        pfd[0].revents = 0;
-        pfd[1].revents = 0;
-        pfd[2].revents = 0;
-        pfd[3].revents = 0;
-        //ALOGI("Polling sockets");
-        int result = poll(pfd, 4, -1);
-        if (result < 0) {
-            ALOGE("Error polling socket");
-        } else {
-            if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
-                internal_event_handler(handle, pfd[0].revents, info->event_sock);
-            }
-            if (pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) {
-                internal_event_handler(handle, pfd[1].revents, info->user_sock);
-            }
-            if ((info->wifihal_ctrl_sock.s > 0) && (pfd[3].revents & (POLLIN | POLLHUP | POLLERR))) {
-                internal_event_handler_app(handle, pfd[3].revents, &info->wifihal_ctrl_sock);
-            }
-            if (pfd[2].revents & POLLIN) {
-                if (exit_event_handler(pfd[2].fd)) {
-                    break;
-                }
-            }
+        n = epoll_wait(info->epoll_fd, events, MAX_LOOP_EVENTS, -1);
+        if (n < 0) {
+            if (errno != EINTR)
+                ALOGE("Error polling socket: %s", strerror(errno));
+            continue;
+        }
+        for (i = 0; i < n && !info->clean_up; i++) {
+            lfd = (loop_fd_info *)events[i].data.ptr;
+            lfd->handler(info, lfd->fd, events[i].events, lfd->arg);
         }
-        rb_timerhandler(info);
     } while (!info->clean_up);
     internal_cleaned_up_handler(handle);
     ALOGI("wifi_event_loop() exits success");
@@ -2413,27 +3109,14 @@ static int internal_valid_message_handler(nl_msg *msg, void *arg)
     // event.log();
 
     bool dispatched = false;
+    nl_recvmsg_msg_cb_t cb_func = NULL;
+    void *cb_arg = NULL;
 
-    pthread_mutex_lock(&info->cb_lock);
-
-    for (int i = 0; i < info->num_event_cb; i++) {
-        if (cmd == info->event_cb[i].nl_cmd) {
-            if (cmd == NL80211_CMD_VENDOR
-                && ((vendor_id != info->event_cb[i].vendor_id)
-                || (subcmd != info->event_cb[i].vendor_subcmd)))
-            {
-                /* event for a different vendor, ignore it */
-                continue;
-            }
-
-            cb_info *cbi = &(info->event_cb[i]);
-            pthread_mutex_unlock(&info->cb_lock);
-            if (cbi->cb_func) {
-                (*(cbi->cb_func))(msg, cbi->cb_arg);
-                dispatched = true;
-            }
-            return NL_OK;
-        }
+    /* Non vendor handlers are keyed with vendor_id and subcmd 0 */
+    if (event_cb_get(&info->event_cbs, cmd, vendor_id, subcmd, &cb_func,
+                     &cb_arg)) {
+        (*cb_func)(msg, cb_arg);
+        dispatched = true;
     }
 
 #ifdef QC_HAL_DEBUG
@@ -2442,7 +3125,6 @@ static int internal_valid_message_handler(nl_msg *msg, void *arg)
     }
 #endif
 
-    pthread_mutex_unlock(&info->cb_lock);
     return NL_OK;
 }
 
@@ -2468,7 +3150,11 @@ public:
     }
 
     virtual wifi_error create() {
-        int nlctrlFamily = genl_ctrl_resolve(mInfo->cmd_sock, "nlctrl");
+        cmd_sock_info *cs = wifi_get_cmd_sock(mInfo);
+        if (!cs)
+            return WIFI_ERROR_UNKNOWN;
+        int nlctrlFamily = genl_ctrl_resolve(cs->sock, "nlctrl");
+        wifi_put_cmd_sock(cs);
         // ALOGI("ctrl family = %d", nlctrlFamily);
         wifi_error ret = mMsg.create(nlctrlFamily, CTRL_CMD_GETFAMILY, 0, 0);
         if (ret != WIFI_SUCCESS)
@@ -2482,7 +3168,7 @@ public:
 
         // ALOGI("handling reponse in %s", __func__);
 
-        struct nlattr **tb = reply.attributes();
+        const WifiEvent::attr_view &tb = reply.attributes();
         struct nlattr *mcgrp = NULL;
         int i;
 
@@ -3208,6 +3894,10 @@ cleanup:
  *
  * @param program_length new length of the program instructions in bytes to pass
  * to the interpreter
+ *
+ * Returns WIFI_ERROR_UNINITIALIZED if a program of several fragments could
+ * not be written completely. APF is then left off, since a partly written
+ * program must not run, and packets are no longer filtered.
  */
 
 wifi_error wifi_write_packet_filter(wifi_interface_handle iface,
@@ -3216,10 +3906,13 @@ wifi_error wifi_write_packet_filter(wifi_interface_handle iface,
 {
     wifi_error ret;
     struct nlattr *nlData;
-    WifiVendorCommand *vCommand = NULL;
-    u32 current_offset = 0;
+    WifiVendorCommand **vCommands = NULL;
+    WifiVendorCommand *vCommand;
+    u32 current_offset = 0, chunk_len, num_chunks, i;
     wifi_handle wifiHandle = getWifiHandle(iface);
     hal_info *info = getHalInfo(wifiHandle);
+    WifiRequestBatch batch(info);
+    u8 apf_locally_disabled = 0;
 
     /* len=0 clears the filters in driver/firmware */
     if (len != 0 && program == NULL) {
@@ -3228,14 +3921,29 @@ wifi_error wifi_write_packet_filter(wifi_interface_handle iface,
         return WIFI_ERROR_INVALID_ARGS;
     }
 
-    do {
+    if (info->firmware_bus_max_size == 0) {
+        ALOGE("%s: Invalid firmware bus size", __func__);
+        return WIFI_ERROR_NOT_AVAILABLE;
+    }
+
+    /* Build one command per fragment and send all of them in one batch */
+    num_chunks = len ? (len + info->firmware_bus_max_size - 1) /
+                       info->firmware_bus_max_size : 1;
+    vCommands = (WifiVendorCommand **)calloc(num_chunks, sizeof(*vCommands));
+    if (vCommands == NULL) {
+        ALOGE("%s: Failed to allocate commands", __func__);
+        return WIFI_ERROR_OUT_OF_MEMORY;
+    }
+
+    for (i = 0; i < num_chunks; i++) {
         ret = initialize_vendor_cmd(iface, get_requestid(),
                                     QCA_NL80211_VENDOR_SUBCMD_PACKET_FILTER,
-                                    &vCommand);
+                                    &vCommands[i]);
         if (ret != WIFI_SUCCESS) {
             ALOGE("%s: Initialization failed", __FUNCTION__);
-            return ret;
+            goto cleanup;
         }
+        vCommand = vCommands[i];
 
         /* Add the vendor specific attributes for the NL command. */
         nlData = vCommand->attr_start(NL80211_ATTR_VENDOR_DATA);
@@ -3267,11 +3975,11 @@ wifi_error wifi_write_packet_filter(wifi_interface_handle iface,
         if (ret != WIFI_SUCCESS)
             goto cleanup;
 
+        chunk_len = min(info->firmware_bus_max_size, len - current_offset);
         ret = vCommand->put_bytes(
                                  QCA_WLAN_VENDOR_ATTR_PACKET_FILTER_PROGRAM,
                                  (char *)&program[current_offset],
-                                 min(info->firmware_bus_max_size,
-                                 len - current_offset));
+                                 chunk_len);
         if (ret!= WIFI_SUCCESS) {
             ALOGE("%s: failed to put program", __FUNCTION__);
             goto cleanup;
@@ -3279,23 +3987,50 @@ wifi_error wifi_write_packet_filter(wifi_interface_handle iface,
 
         vCommand->attr_end(nlData);
 
-        ret = vCommand->requestResponse();
+        ret = batch.add(vCommand);
+        if (ret != WIFI_SUCCESS)
+            goto cleanup;
+
+        current_offset += chunk_len;
+    }
+
+    /* The driver applies each fragment as it comes, also after an earlier
+     * one of the batch failed. Keep APF off while a program of several
+     * fragments is written so that a partly written program never runs; it
+     * is only turned back on once all fragments went through. A single
+     * fragment is applied whole or not at all.
+     */
+    if (info->apf_enabled && num_chunks > 1) {
+        ret = wifi_enable_packet_filter(iface, 0);
         if (ret != WIFI_SUCCESS) {
-            ALOGE("%s: requestResponse Error:%d",__func__, ret);
+            ALOGE("%s: Failed to disable APF", __func__);
             goto cleanup;
         }
+        apf_locally_disabled = 1;
+    }
 
-        /* destroy the object after sending each fragment to driver */
-        delete vCommand;
-        vCommand = NULL;
+    ret = batch.execute();
+    if (ret != WIFI_SUCCESS) {
+        ALOGE("%s: requestResponse Error:%d",__func__, ret);
+        if (apf_locally_disabled) {
+            ALOGE("%s: Leaving APF disabled", __func__);
+            ret = WIFI_ERROR_UNINITIALIZED;
+        }
+        goto cleanup;
+    }
 
-        current_offset += min(info->firmware_bus_max_size,
-                                         len - current_offset);
-    } while (current_offset < len);
+    if (apf_locally_disabled) {
+        ret = wifi_enable_packet_filter(iface, 1);
+        if (ret != WIFI_SUCCESS) {
+            ALOGE("%s: Failed to enable APF", __func__);
+            ret = WIFI_ERROR_UNINITIALIZED;
+        }
+    }
 
 cleanup:
-    if (vCommand)
-        delete vCommand;
+    for (i = 0; i < num_chunks; i++)
+        delete vCommands[i];
+    free(vCommands);
     return ret;
 }
 
@@ -3370,10 +4105,12 @@ static wifi_error wifi_read_packet_filter(wifi_interface_handle handle,
 {
     wifi_error ret = WIFI_ERROR_UNKNOWN;
     struct nlattr *nlData;
-    WifihalGeneric *vCommand = NULL;
+    WifihalGeneric **vCommands = NULL;
+    WifihalGeneric *vCommand;
     interface_info *ifaceInfo = getIfaceInfo(handle);
     wifi_handle wifiHandle = getWifiHandle(handle);
     hal_info *info = getHalInfo(wifiHandle);
+    WifiRequestBatch batch(info);
 
     /* Length to be passed to this function should be non-zero
      * Return invalid argument if length is passed as zero
@@ -3381,15 +4118,28 @@ static wifi_error wifi_read_packet_filter(wifi_interface_handle handle,
     if (length == 0)
         return  WIFI_ERROR_INVALID_ARGS;
 
+    if (info->firmware_bus_max_size == 0) {
+        ALOGE("%s: Invalid firmware bus size", __FUNCTION__);
+        return WIFI_ERROR_NOT_AVAILABLE;
+    }
+
     /*Temporary varibles to support the read complete length in chunks */
     u8 *temp_host_dst;
-    u32 remainingLengthToBeRead, currentLength;
+    u32 remainingLengthToBeRead, currentLength, num_chunks, i;
     u8 apf_locally_disabled = 0;
 
     /*Initializing the temporary variables*/
     temp_host_dst = host_dst;
     remainingLengthToBeRead = length;
 
+    num_chunks = (length + info->firmware_bus_max_size - 1) /
+                 info->firmware_bus_max_size;
+    vCommands = (WifihalGeneric **)calloc(num_chunks, sizeof(*vCommands));
+    if (vCommands == NULL) {
+        ALOGE("%s: Failed to allocate commands", __FUNCTION__);
+        return WIFI_ERROR_OUT_OF_MEMORY;
+    }
+
     if (info->apf_enabled) {
         /* Disable APF only when not disabled by framework before calling
          * wifi_read_packet_filter()
@@ -3397,15 +4147,16 @@ static wifi_error wifi_read_packet_filter(wifi_interface_handle handle,
         ret = wifi_enable_packet_filter(handle, 0);
         if (ret != WIFI_SUCCESS) {
             ALOGE("%s: Failed to disable APF", __FUNCTION__);
+            free(vCommands);
             return ret;
         }
         apf_locally_disabled = 1;
     }
     /**
      * Read the complete length in chunks of size less or equal to firmware bus
-     * max size
+     * max size. All chunk reads are sent to the driver in one batch.
      */
-    while (remainingLengthToBeRead)
+    for (i = 0; i < num_chunks; i++)
     {
         vCommand = new WifihalGeneric(wifiHandle, 0, OUI_QCA,
                                       QCA_NL80211_VENDOR_SUBCMD_PACKET_FILTER);
@@ -3415,6 +4166,7 @@ static wifi_error wifi_read_packet_filter(wifi_interface_handle handle,
             ret = WIFI_ERROR_OUT_OF_MEMORY;
             break;
         }
+        vCommands[i] = vCommand;
 
         /* Create the message */
         ret = vCommand->create();
@@ -3425,8 +4177,10 @@ static wifi_error wifi_read_packet_filter(wifi_interface_handle handle,
             break;
         /* Add the vendor specific attributes for the NL command. */
         nlData = vCommand->attr_start(NL80211_ATTR_VENDOR_DATA);
-        if (!nlData)
+        if (!nlData) {
+            ret = WIFI_ERROR_UNKNOWN;
             break;
+        }
         ret = vCommand->put_u32(QCA_WLAN_VENDOR_ATTR_PACKET_FILTER_SUB_CMD,
                                 QCA_WLAN_READ_PACKET_FILTER);
         if (ret != WIFI_SUCCESS)
@@ -3445,19 +4199,21 @@ static wifi_error wifi_read_packet_filter(wifi_interface_handle handle,
 
         vCommand->setPacketBufferParams(temp_host_dst, currentLength);
         vCommand->attr_end(nlData);
-        ret = vCommand->requestResponse();
 
-        if (ret != WIFI_SUCCESS) {
-            ALOGE("%s: requestResponse() error: %d current_len = %u, src_offset = %u",
-                  __FUNCTION__, ret, currentLength, src_offset);
+        ret = batch.add(vCommand);
+        if (ret != WIFI_SUCCESS)
             break;
-        }
 
         remainingLengthToBeRead -= currentLength;
         temp_host_dst += currentLength;
         src_offset += currentLength;
-        delete vCommand;
-        vCommand = NULL;
+    }
+
+    if (ret == WIFI_SUCCESS) {
+        ret = batch.execute();
+        if (ret != WIFI_SUCCESS)
+            ALOGE("%s: requestResponse() error: %d length = %u",
+                  __FUNCTION__, ret, length);
     }
 
     /* Re enable APF only when disabled above within this API */
@@ -3471,7 +4227,9 @@ static wifi_error wifi_read_packet_filter(wifi_interface_handle handle,
             ret = status;
     }
 
-    delete vCommand;
+    for (i = 0; i < num_chunks; i++)
+        delete vCommands[i];
+    free(vCommands);
     return ret;
 }
 
@@ -3489,7 +4247,7 @@ public:
     }
 
     virtual wifi_error create() {
-        int nl80211_id = genl_ctrl_resolve(mInfo->cmd_sock, "nl80211");
+        int nl80211_id = mInfo->nl80211_family_id;
         wifi_error ret = mMsg.create(nl80211_id, NL80211_CMD_GET_WIPHY, NLM_F_DUMP, 0);
         mMsg.put_flag(NL80211_ATTR_SPLIT_WIPHY_DUMP);
 
@@ -3505,7 +4263,7 @@ public:
     }
 
     virtual int handleResponse(WifiEvent& reply) {
-        struct nlattr **tb = reply.attributes();
+        const WifiEvent::attr_view &tb = reply.attributes();
 
         if (tb[NL80211_ATTR_VENDOR_DATA]) {
             struct nlattr *nl;
@@ -3654,7 +4412,7 @@ public:
                                     halinfo(info) {}
 
     virtual wifi_error create() {
-        int nl80211_id = genl_ctrl_resolve(mInfo->cmd_sock, "nl80211");
+        int nl80211_id = mInfo->nl80211_family_id;
         wifi_error ret = mMsg.create(nl80211_id, NL80211_CMD_GET_WIPHY, NLM_F_DUMP, 0);
         mMsg.put_flag(NL80211_ATTR_SPLIT_WIPHY_DUMP);
 
@@ -3745,7 +4503,7 @@ public:
     }
 
     virtual int handleResponse(WifiEvent& reply) {
-        struct nlattr **tb = reply.attributes();
+        const WifiEvent::attr_view &tb = reply.attributes();
 
         if (tb[NL80211_ATTR_SUPPORTED_IFTYPES]  ||  tb[NL80211_ATTR_INTERFACE_COMBINATIONS]) {
             if (halinfo == NULL) {
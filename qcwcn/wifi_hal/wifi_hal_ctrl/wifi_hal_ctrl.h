@@ -77,6 +77,9 @@ struct wifihal_ctrl {
 #ifndef CONFIG_CTRL_IFACE_CLIENT_PREFIX
 #define CONFIG_CTRL_IFACE_CLIENT_PREFIX "wifihal_ctrl_cli_"
 #endif /* CONFIG_CTRL_IFACE_CLIENT_PREFIX */
+#ifndef CONFIG_CTRL_PCAPNG_DIR
+#define CONFIG_CTRL_PCAPNG_DIR "/data/vendor/wifi/"
+#endif /* CONFIG_CTRL_PCAPNG_DIR */
 
 #define DEFAULT_PAGE_SIZE         4096
 
@@ -97,6 +100,20 @@ enum wifihal_ctrl_cmd
     WIFIHAL_CTRL_MONITOR_DETTACH,
     /** Send data over Netlink Sock */
     WIFIHAL_CTRL_SEND_NL_DATA,
+    /** Get command latency statistics */
+    WIFIHAL_CTRL_GET_CMD_LATENCY,
+    /** Get firmware diag event counters */
+    WIFIHAL_CTRL_GET_DIAG_EVENT_STATS,
+    /** Start pcapng export of packet fates and per packet stats, into a
+     *  new file of CONFIG_CTRL_PCAPNG_DIR named by data, or without data as
+     *  datagrams to monsock whose concatenation is the pcapng stream */
+    WIFIHAL_CTRL_PCAPNG_START,
+    /** Stop pcapng export */
+    WIFIHAL_CTRL_PCAPNG_STOP,
+    /** Get diag worker queue counters */
+    WIFIHAL_CTRL_GET_DIAG_QUEUE_STATS,
+    /** Get compression counters of the compressed rings */
+    WIFIHAL_CTRL_GET_RING_COMPRESS_STATS,
 };
 
 //! WIFIHAL Control Request
@@ -134,6 +151,85 @@ typedef struct wifihal_ctrl_sync_rsp_s {
     uint32_t reserved[4];
 }wifihal_ctrl_sync_rsp_t;
 
+//! Latency of one (nl cmd, vendor id, subcmd) command, in microseconds
+typedef struct wifihal_ctrl_cmd_latency_s {
+    uint32_t nl_cmd;
+    uint32_t vendor_id;
+    uint32_t vendor_subcmd;
+    //! number of commands and failed ones
+    uint32_t count;
+    uint32_t errors;
+    uint32_t avg_us;
+    uint32_t max_us;
+    //! send to first reply
+    uint32_t first_reply_p50_us;
+    uint32_t first_reply_p99_us;
+    //! send to completion
+    uint32_t complete_p50_us;
+    uint32_t complete_p90_us;
+    uint32_t complete_p99_us;
+}wifihal_ctrl_cmd_latency_t;
+
+//! WIFIHAL_CTRL_GET_CMD_LATENCY Response; status holds the number of entries
+typedef struct wifihal_ctrl_cmd_latency_rsp_s {
+    wifihal_ctrl_sync_rsp_t hdr;
+    wifihal_ctrl_cmd_latency_t stats[0];
+}wifihal_ctrl_cmd_latency_rsp_t;
+
+//! Counters of one firmware diag event id, 0 for events without decoder
+typedef struct wifihal_ctrl_diag_event_stats_s {
+    uint32_t event_id;
+    uint32_t reserved;
+    uint64_t events;
+    //! payload bytes
+    uint64_t bytes;
+    //! dropped as too short or failed to decode
+    uint64_t failures;
+}wifihal_ctrl_diag_event_stats_t;
+
+//! WIFIHAL_CTRL_GET_DIAG_EVENT_STATS Response; status holds the number of entries
+typedef struct wifihal_ctrl_diag_event_stats_rsp_s {
+    wifihal_ctrl_sync_rsp_t hdr;
+    wifihal_ctrl_diag_event_stats_t stats[0];
+}wifihal_ctrl_diag_event_stats_rsp_t;
+
+//! WIFIHAL_CTRL_GET_DIAG_QUEUE_STATS Response
+typedef struct wifihal_ctrl_diag_queue_stats_rsp_s {
+    wifihal_ctrl_sync_rsp_t hdr;
+    //! diag messages queued for decoding
+    uint64_t queued;
+    uint64_t decoded;
+    //! oldest messages dropped on a full queue
+    uint64_t dropped;
+    //! messages too large to queue
+    uint64_t oversized;
+    //! messages waiting
+    uint32_t depth;
+    uint32_t max_depth;
+    uint32_t queue_len;
+    uint32_t reserved;
+}wifihal_ctrl_diag_queue_stats_rsp_t;
+
+//! Compression counters of one ring
+typedef struct wifihal_ctrl_ring_compress_stats_s {
+    //! ring name
+    char name[32];
+    //! chunks framed, and those that did not shrink and went as is
+    uint64_t chunks;
+    uint64_t stored_chunks;
+    //! ring bytes framed, and frame bytes handed out with headers
+    uint64_t in_bytes;
+    uint64_t out_bytes;
+    //! thread CPU time spent compressing
+    uint64_t cpu_us;
+}wifihal_ctrl_ring_compress_stats_t;
+
+//! WIFIHAL_CTRL_GET_RING_COMPRESS_STATS Response; status holds the number of entries
+typedef struct wifihal_ctrl_ring_compress_stats_rsp_s {
+    wifihal_ctrl_sync_rsp_t hdr;
+    wifihal_ctrl_ring_compress_stats_t stats[0];
+}wifihal_ctrl_ring_compress_stats_rsp_t;
+
 //! WIFIHAL Async Response
 typedef struct wifihal_ctrl_event_s {
     //! Family name
@@ -1151,6 +1151,8 @@ wifi_error WiFiConfigCommand::requestEvent()
     int status;
     wifi_error res = WIFI_SUCCESS;
     struct nl_cb *cb = NULL;
+    cmd_sock_info *cs = NULL;
+    u64 send_us, reply_us;
 
     if (mInfo == NULL) {
        ALOGE("%s: Wifi is turned off",__FUNCTION__);
@@ -1159,7 +1161,7 @@ wifi_error WiFiConfigCommand::requestEvent()
        return WIFI_ERROR_UNKNOWN;
     }
 
-    pthread_mutex_lock(&mInfo->cb_lock);
+    cs = wifi_get_cmd_sock(mInfo);
 
     cb = nl_cb_alloc(NL_CB_DEFAULT);
     if (!cb) {
@@ -1167,13 +1169,14 @@ wifi_error WiFiConfigCommand::requestEvent()
         res = WIFI_ERROR_OUT_OF_MEMORY;
         goto out;
     }
-    if (mInfo->cmd_sock == NULL) {
+    if (cs == NULL) {
         ALOGE("%s: Socket is Null",__FUNCTION__);
         res = WIFI_ERROR_UNKNOWN;
         goto out;
     }
 
-    status = nl_send_auto_complete(mInfo->cmd_sock, mMsg.getMessage());
+    send_us = wifi_monotonic_us();
+    status = nl_send_auto_complete(cs->sock, mMsg.getMessage());
     if (status < 0) {
         res = mapKernelErrortoWifiHalError(status);
         goto out;
@@ -1187,10 +1190,17 @@ wifi_error WiFiConfigCommand::requestEvent()
 
     /* Err is populated as part of finish_handler. */
     while (status > 0) {
-         nl_recvmsgs(mInfo->cmd_sock, cb);
+         nl_recvmsgs(cs->sock, cb);
     }
+    reply_us = wifi_monotonic_us();
+
+    /* Give the socket back before waiting for the asynchronous response */
+    wifi_put_cmd_sock(cs);
+    cs = NULL;
 
     if (status < 0) {
+        wifi_record_msg_latency(mInfo, mMsg.getMessage(), send_us, reply_us,
+                                reply_us, true);
         res = mapKernelErrortoWifiHalError(status);
         goto out;
     }
@@ -1206,11 +1216,13 @@ wifi_error WiFiConfigCommand::requestEvent()
         ALOGV("%s: Command invoked return value:%d, mWaitForRsp=%d",
             __FUNCTION__, res, mWaitforRsp);
     }
+    wifi_record_msg_latency(mInfo, mMsg.getMessage(), send_us, reply_us, 0,
+                            res != WIFI_SUCCESS);
 out:
     nl_cb_put(cb);
     /* Cleanup the mMsg */
     mMsg.destroy();
-    pthread_mutex_unlock(&mInfo->cb_lock);
+    wifi_put_cmd_sock(cs);
     return res;
 }
 
@@ -1231,7 +1243,7 @@ wifi_error WiFiConfigCommand::requestResponse()
 
 int WiFiConfigCommand::handleResponse(WifiEvent &reply)
 {
-    struct nlattr **tb = reply.attributes();
+    const WifiEvent::attr_view &tb = reply.attributes();
     struct genlmsghdr *gnlh = reply.header();
 
     WifiVendorCommand::handleResponse(reply);
@@ -70,6 +70,7 @@
 #include "wifiloggercmd.h"
 #include "rb_wrapper.h"
 #include <stdlib.h>
+#include <cutils/properties.h>
 
 #define LOGGER_MEMDUMP_FILENAME "/proc/debug/fwdump"
 #define DRIVER_MEMDUMP_FILENAME "/proc/debugdriver/driverdump"
@@ -228,24 +229,58 @@ wifi_error wifi_get_ring_buffers_status(wifi_interface_handle iface,
     return WIFI_SUCCESS;
 }
 
+/* Counters of the rings that hand out compressed frames; the worker updates
+ * them while pushing out, hence diag_lock */
+wifi_error wifi_get_ring_compress_stats(wifi_handle handle,
+            wifi_ring_compress_stats *stats, int max_stats, int *num_stats)
+{
+    hal_info *info = getHalInfo(handle);
+    struct rb_info *rb_info;
+    int rb_id, num = 0;
+
+    if (!info || !stats || !num_stats)
+        return WIFI_ERROR_INVALID_ARGS;
+
+    pthread_mutex_lock(&info->diag_lock);
+    for (rb_id = 0; rb_id < NUM_RING_BUFS && num < max_stats; rb_id++) {
+        rb_info = &info->rb_infos[rb_id];
+        if (!rb_info->rb_ctx || !rb_info->compress)
+            continue;
+        strlcpy(stats[num].name, rb_info->name, sizeof(stats[num].name));
+        get_rb_compress_stats(rb_info, &stats[num].stats);
+        num++;
+    }
+    pthread_mutex_unlock(&info->diag_lock);
+    *num_stats = num;
+    return WIFI_SUCCESS;
+}
+
+/* Called with diag_lock held */
 void push_out_all_ring_buffers(hal_info *info)
 {
     int rb_id;
 
     for (rb_id = 0; rb_id < NUM_RING_BUFS; rb_id++) {
-        push_out_rb_data(&info->rb_infos[rb_id]);
+        push_out_rb_data_locked(&info->rb_infos[rb_id]);
     }
 }
 
 void send_alert(hal_info *info, int reason_code)
+{
+    send_alert_msg(info, "Fatal Event", reason_code);
+}
+
+void send_alert_msg(hal_info *info, const char *msg, int reason_code)
 {
     wifi_alert_handler handler;
-    char alert_msg[20] = "Fatal Event";
+    char alert_msg[128];
+
     pthread_mutex_lock(&info->ah_lock);
     handler.on_alert = info->on_alert;
     pthread_mutex_unlock(&info->ah_lock);
 
     if (handler.on_alert) {
+        strlcpy(alert_msg, msg, sizeof(alert_msg));
         handler.on_alert(0, alert_msg, strlen(alert_msg), reason_code);
     }
 }
@@ -650,6 +685,89 @@ wifi_error wifi_reset_alert_handler(wifi_request_id id,
 }
 
 
+static const char *pkt_fate_class_names[PKT_FATE_CLASS_MAX] = {
+    "eapol", "dhcp", "arp", "mgmt", "data"
+};
+
+static int pkt_fate_class_id(const char *name)
+{
+    int i;
+
+    for (i = 0; i < PKT_FATE_CLASS_MAX; i++) {
+        if (strcmp(name, pkt_fate_class_names[i]) == 0)
+            return i;
+    }
+    ALOGE("Unknown packet fate class %s", name);
+    return -1;
+}
+
+/* Parses a PKT_FATE_FILTER_PROP spec; bad terms are logged and skipped */
+static void pkt_fate_filter_init(pkt_fate_filter *filter, char *spec)
+{
+    char *term, *item, *val, *ratio;
+    char *save = NULL, *item_save = NULL;
+    int cls;
+
+    memset(filter, 0, sizeof(pkt_fate_filter));
+    filter->class_mask = ~0U;
+    filter->tx_fate_mask = ~0U;
+    filter->rx_fate_mask = ~0U;
+    filter->mgmt_subtype_mask = 0xFFFF;
+
+    for (term = strtok_r(spec, " ", &save); term != NULL;
+         term = strtok_r(NULL, " ", &save)) {
+        val = strchr(term, '=');
+        if (val == NULL) {
+            ALOGE("Bad packet fate filter term %s", term);
+            continue;
+        }
+        *val++ = '\0';
+
+        if (strcmp(term, "class") == 0) {
+            filter->class_mask = 0;
+            for (item = strtok_r(val, ",", &item_save); item != NULL;
+                 item = strtok_r(NULL, ",", &item_save)) {
+                cls = pkt_fate_class_id(item);
+                if (cls >= 0)
+                    filter->class_mask |= BIT(cls);
+            }
+        } else if (strcmp(term, "tx_fate") == 0) {
+            filter->tx_fate_mask = strtoul(val, NULL, 0);
+        } else if (strcmp(term, "rx_fate") == 0) {
+            filter->rx_fate_mask = strtoul(val, NULL, 0);
+        } else if (strcmp(term, "mgmt") == 0) {
+            filter->mgmt_subtype_mask = strtoul(val, NULL, 0);
+        } else if (strcmp(term, "mac") == 0) {
+            filter->match_mac = sscanf(val, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                                       &filter->mac[0], &filter->mac[1],
+                                       &filter->mac[2], &filter->mac[3],
+                                       &filter->mac[4], &filter->mac[5]) == 6;
+            if (!filter->match_mac)
+                ALOGE("Bad packet fate filter mac %s", val);
+        } else if (strcmp(term, "sample") == 0) {
+            for (item = strtok_r(val, ",", &item_save); item != NULL;
+                 item = strtok_r(NULL, ",", &item_save)) {
+                ratio = strchr(item, ':');
+                if (ratio == NULL) {
+                    ALOGE("Bad packet fate sample ratio %s", item);
+                    continue;
+                }
+                *ratio++ = '\0';
+                cls = pkt_fate_class_id(item);
+                if (cls >= 0)
+                    filter->sample[cls] = strtoul(ratio, NULL, 0);
+            }
+        } else {
+            ALOGE("Unknown packet fate filter term %s", term);
+        }
+    }
+
+    ALOGI("Packet fate filter: class 0x%x tx_fate 0x%x rx_fate 0x%x mgmt 0x%x"
+          " mac %s", filter->class_mask, filter->tx_fate_mask,
+          filter->rx_fate_mask, filter->mgmt_subtype_mask,
+          filter->match_mac ? "set" : "any");
+}
+
 /**
     API to start packet fate monitoring.
     - Once stared, monitoring should remain active until HAL is unloaded.
@@ -659,6 +777,10 @@ wifi_error wifi_start_pkt_fate_monitoring(wifi_interface_handle iface)
 {
     wifi_handle wifiHandle = getWifiHandle(iface);
     hal_info *info = getHalInfo(wifiHandle);
+    packet_fate_monitor_info *fates;
+    char filter_spec[PROPERTY_VALUE_MAX];
+    int frame_len_max;
+    int i;
 
     /* Check Supported logger capability */
     if (!(info->supported_logger_feature_set &
@@ -681,6 +803,35 @@ wifi_error wifi_start_pkt_fate_monitoring(wifi_interface_handle iface)
         return WIFI_ERROR_OUT_OF_MEMORY;
     }
     memset(info->pkt_fate_stats, 0, sizeof(packet_fate_monitor_info));
+    fates = info->pkt_fate_stats;
+
+    /* Only frames passing the filter are captured, so monitoring can stay
+     * on without copying bulk data traffic */
+    property_get(PKT_FATE_FILTER_PROP, filter_spec, "");
+    pkt_fate_filter_init(&fates->filter, filter_spec);
+
+    /* Frames are truncated to the configured length, by default to the
+     * largest the framework reports */
+    frame_len_max = property_get_int32(PKT_FATE_FRAME_LEN_PROP,
+                                       MAX_FRAME_LEN_80211_MGMT);
+    if (frame_len_max <= 0 || frame_len_max > MAX_FRAME_LEN_80211_MGMT)
+        frame_len_max = MAX_FRAME_LEN_80211_MGMT;
+
+    fates->frame_len_max = frame_len_max;
+    fates->frame_slab = (char *)malloc(2 * MAX_FATE_LOG_LEN * frame_len_max);
+    if (fates->frame_slab == NULL) {
+        ALOGE("Failed to allocate memory for : %zu bytes",
+              2 * MAX_FATE_LOG_LEN * fates->frame_len_max);
+        free(info->pkt_fate_stats);
+        info->pkt_fate_stats = NULL;
+        return WIFI_ERROR_OUT_OF_MEMORY;
+    }
+    for (i = 0; i < MAX_FATE_LOG_LEN; i++) {
+        fates->tx_fate_stats[i].frame_inf.frame_content =
+            fates->frame_slab + i * frame_len_max;
+        fates->rx_fate_stats[i].frame_inf.frame_content =
+            fates->frame_slab + (MAX_FATE_LOG_LEN + i) * frame_len_max;
+    }
 
     pthread_mutex_lock(&info->pkt_fate_stats_lock);
     info->fate_monitoring_enabled = true;
@@ -690,6 +841,46 @@ wifi_error wifi_start_pkt_fate_monitoring(wifi_interface_handle iface)
 }
 
 
+/* Picks the latest min(n_requested, captured) fates of a direction;
+ * returns their count and the sequence number of the oldest in *first
+ */
+static size_t pkt_fate_window(u64 seq, u64 first_seq, size_t n_requested,
+                              u64 *first)
+{
+    size_t n;
+
+    if (seq - first_seq > MAX_FATE_LOG_LEN)
+        first_seq = seq - MAX_FATE_LOG_LEN;
+    n = min(n_requested, (size_t)(seq - first_seq));
+    *first = seq - n;
+    return n;
+}
+
+/* Number of leading fates of a snapshot starting at first that the capture
+ * wrapped over, reaching seq, while their frames were copied unlocked
+ */
+static size_t pkt_fate_stale(u64 first, size_t n, u64 seq)
+{
+    if (seq <= first + MAX_FATE_LOG_LEN)
+        return 0;
+    return min(n, (size_t)(seq - MAX_FATE_LOG_LEN - first));
+}
+
+static void pkt_fate_copy_frame(frame_info *frame_inf, const char *frame)
+{
+    if (frame_inf->payload_type == FRAME_TYPE_ETHERNET_II)
+        memcpy(frame_inf->frame_content.ethernet_ii_bytes, frame,
+               min(frame_inf->frame_len, MAX_FRAME_LEN_ETHERNET));
+    else if (frame_inf->payload_type == FRAME_TYPE_80211_MGMT)
+        memcpy(frame_inf->frame_content.ieee_80211_mgmt_bytes, frame,
+               min(frame_inf->frame_len, MAX_FRAME_LEN_80211_MGMT));
+    else
+        /* Currently framework is interested only two types(
+         * FRAME_TYPE_ETHERNET_II and FRAME_TYPE_80211_MGMT) of packets, so
+         * ignore the all other types of packets received from driver */
+        ALOGI("Unknown format packet");
+}
+
 /**
     API to retrieve fates of outbound packets.
     - HAL implementation should fill |tx_report_bufs| with fates of
@@ -702,6 +893,10 @@ wifi_error wifi_start_pkt_fate_monitoring(wifi_interface_handle iface)
     - Framework may call this API multiple times for the same association.
     - Framework will ensure |n_requested_fates <= MAX_FATE_LOG_LEN|.
     - Framework will allocate and free the referenced storage.
+    The capture keeps the latest MAX_FATE_LOG_LEN fates, which are
+    reported oldest first. Only the entry metadata is copied under
+    pkt_fate_stats_lock; frames the capture overwrites meanwhile are
+    dropped from the report.
 */
 wifi_error wifi_get_tx_pkt_fates(wifi_interface_handle iface,
                                  wifi_tx_report *tx_report_bufs,
@@ -710,53 +905,55 @@ wifi_error wifi_get_tx_pkt_fates(wifi_interface_handle iface,
 {
     wifi_handle wifiHandle = getWifiHandle(iface);
     hal_info *info = getHalInfo(wifiHandle);
+    packet_fate_monitor_info *fates;
     wifi_tx_report_i *tx_fate_stats;
-    size_t i;
+    u64 first, seq;
+    size_t i, n, stale;
 
     if (info->fate_monitoring_enabled != true) {
         ALOGE("Packet monitoring is not yet triggered");
         return WIFI_ERROR_UNINITIALIZED;
     }
-    pthread_mutex_lock(&info->pkt_fate_stats_lock);
-
-    tx_fate_stats = &info->pkt_fate_stats->tx_fate_stats[0];
+    fates = info->pkt_fate_stats;
 
-    *n_provided_fates = min(n_requested_fates,
-                            info->pkt_fate_stats->n_tx_stats_collected);
-
-    for (i=0; i < *n_provided_fates; i++) {
+    pthread_mutex_lock(&info->pkt_fate_stats_lock);
+    n = pkt_fate_window(fates->tx_seq, fates->tx_first_seq,
+                        n_requested_fates, &first);
+    for (i = 0; i < n; i++) {
+        tx_fate_stats = &fates->tx_fate_stats[(first + i) % MAX_FATE_LOG_LEN];
         memcpy(tx_report_bufs[i].md5_prefix,
-                    tx_fate_stats[i].md5_prefix, MD5_PREFIX_LEN);
-        tx_report_bufs[i].fate = tx_fate_stats[i].fate;
+                    tx_fate_stats->md5_prefix, MD5_PREFIX_LEN);
+        tx_report_bufs[i].fate = tx_fate_stats->fate;
         tx_report_bufs[i].frame_inf.payload_type =
-            tx_fate_stats[i].frame_inf.payload_type;
+            tx_fate_stats->frame_inf.payload_type;
         tx_report_bufs[i].frame_inf.driver_timestamp_usec =
-            tx_fate_stats[i].frame_inf.driver_timestamp_usec;
+            tx_fate_stats->frame_inf.driver_timestamp_usec;
         tx_report_bufs[i].frame_inf.firmware_timestamp_usec =
-            tx_fate_stats[i].frame_inf.firmware_timestamp_usec;
+            tx_fate_stats->frame_inf.firmware_timestamp_usec;
         tx_report_bufs[i].frame_inf.frame_len =
-            tx_fate_stats[i].frame_inf.frame_len;
-
-        if (tx_report_bufs[i].frame_inf.payload_type == FRAME_TYPE_ETHERNET_II)
-            memcpy(tx_report_bufs[i].frame_inf.frame_content.ethernet_ii_bytes,
-                   tx_fate_stats[i].frame_inf.frame_content,
-                   min(tx_fate_stats[i].frame_inf.frame_len,
-                       MAX_FRAME_LEN_ETHERNET));
-        else if (tx_report_bufs[i].frame_inf.payload_type ==
-                                                         FRAME_TYPE_80211_MGMT)
-            memcpy(
-                tx_report_bufs[i].frame_inf.frame_content.ieee_80211_mgmt_bytes,
-                tx_fate_stats[i].frame_inf.frame_content,
-                min(tx_fate_stats[i].frame_inf.frame_len,
-                    MAX_FRAME_LEN_80211_MGMT));
-        else
-            /* Currently framework is interested only two types(
-             * FRAME_TYPE_ETHERNET_II and FRAME_TYPE_80211_MGMT) of packets, so
-             * ignore the all other types of packets received from driver */
-            ALOGI("Unknown format packet");
+            tx_fate_stats->frame_inf.frame_len;
+    }
+    pthread_mutex_unlock(&info->pkt_fate_stats_lock);
+
+    /* Slab slots are fixed, so the frames can be copied without the lock */
+    for (i = 0; i < n; i++) {
+        tx_fate_stats = &fates->tx_fate_stats[(first + i) % MAX_FATE_LOG_LEN];
+        pkt_fate_copy_frame(&tx_report_bufs[i].frame_inf,
+                            tx_fate_stats->frame_inf.frame_content);
     }
+
+    pthread_mutex_lock(&info->pkt_fate_stats_lock);
+    seq = fates->tx_seq;
     pthread_mutex_unlock(&info->pkt_fate_stats_lock);
 
+    stale = pkt_fate_stale(first, n, seq);
+    if (stale) {
+        n -= stale;
+        memmove(&tx_report_bufs[0], &tx_report_bufs[stale],
+                n * sizeof(wifi_tx_report));
+    }
+    *n_provided_fates = n;
+
     return WIFI_SUCCESS;
 }
 
@@ -772,6 +969,7 @@ wifi_error wifi_get_tx_pkt_fates(wifi_interface_handle iface,
     - Framework may call this API multiple times for the same association.
     - Framework will ensure |n_requested_fates <= MAX_FATE_LOG_LEN|.
     - Framework will allocate and free the referenced storage.
+    Reported like the outbound fates, see wifi_get_tx_pkt_fates().
 */
 wifi_error wifi_get_rx_pkt_fates(wifi_interface_handle iface,
                                  wifi_rx_report *rx_report_bufs,
@@ -780,53 +978,54 @@ wifi_error wifi_get_rx_pkt_fates(wifi_interface_handle iface,
 {
     wifi_handle wifiHandle = getWifiHandle(iface);
     hal_info *info = getHalInfo(wifiHandle);
+    packet_fate_monitor_info *fates;
     wifi_rx_report_i *rx_fate_stats;
-    size_t i;
+    u64 first, seq;
+    size_t i, n, stale;
 
     if (info->fate_monitoring_enabled != true) {
         ALOGE("Packet monitoring is not yet triggered");
         return WIFI_ERROR_UNINITIALIZED;
     }
-    pthread_mutex_lock(&info->pkt_fate_stats_lock);
+    fates = info->pkt_fate_stats;
 
-    rx_fate_stats = &info->pkt_fate_stats->rx_fate_stats[0];
-
-    *n_provided_fates = min(n_requested_fates,
-                            info->pkt_fate_stats->n_rx_stats_collected);
-
-    for (i=0; i < *n_provided_fates; i++) {
+    pthread_mutex_lock(&info->pkt_fate_stats_lock);
+    n = pkt_fate_window(fates->rx_seq, fates->rx_first_seq,
+                        n_requested_fates, &first);
+    for (i = 0; i < n; i++) {
+        rx_fate_stats = &fates->rx_fate_stats[(first + i) % MAX_FATE_LOG_LEN];
         memcpy(rx_report_bufs[i].md5_prefix,
-                    rx_fate_stats[i].md5_prefix, MD5_PREFIX_LEN);
-        rx_report_bufs[i].fate = rx_fate_stats[i].fate;
+                    rx_fate_stats->md5_prefix, MD5_PREFIX_LEN);
+        rx_report_bufs[i].fate = rx_fate_stats->fate;
         rx_report_bufs[i].frame_inf.payload_type =
-            rx_fate_stats[i].frame_inf.payload_type;
+            rx_fate_stats->frame_inf.payload_type;
         rx_report_bufs[i].frame_inf.driver_timestamp_usec =
-            rx_fate_stats[i].frame_inf.driver_timestamp_usec;
+            rx_fate_stats->frame_inf.driver_timestamp_usec;
         rx_report_bufs[i].frame_inf.firmware_timestamp_usec =
-            rx_fate_stats[i].frame_inf.firmware_timestamp_usec;
+            rx_fate_stats->frame_inf.firmware_timestamp_usec;
         rx_report_bufs[i].frame_inf.frame_len =
-            rx_fate_stats[i].frame_inf.frame_len;
-
-        if (rx_report_bufs[i].frame_inf.payload_type == FRAME_TYPE_ETHERNET_II)
-            memcpy(rx_report_bufs[i].frame_inf.frame_content.ethernet_ii_bytes,
-                   rx_fate_stats[i].frame_inf.frame_content,
-                   min(rx_fate_stats[i].frame_inf.frame_len,
-                   MAX_FRAME_LEN_ETHERNET));
-        else if (rx_report_bufs[i].frame_inf.payload_type ==
-                                                         FRAME_TYPE_80211_MGMT)
-            memcpy(
-                rx_report_bufs[i].frame_inf.frame_content.ieee_80211_mgmt_bytes,
-                rx_fate_stats[i].frame_inf.frame_content,
-                min(rx_fate_stats[i].frame_inf.frame_len,
-                    MAX_FRAME_LEN_80211_MGMT));
-        else
-            /* Currently framework is interested only two types(
-             * FRAME_TYPE_ETHERNET_II and FRAME_TYPE_80211_MGMT) of packets, so
-             * ignore the all other types of packets received from driver */
-            ALOGI("Unknown format packet");
+            rx_fate_stats->frame_inf.frame_len;
+    }
+    pthread_mutex_unlock(&info->pkt_fate_stats_lock);
+
+    for (i = 0; i < n; i++) {
+        rx_fate_stats = &fates->rx_fate_stats[(first + i) % MAX_FATE_LOG_LEN];
+        pkt_fate_copy_frame(&rx_report_bufs[i].frame_inf,
+                            rx_fate_stats->frame_inf.frame_content);
     }
+
+    pthread_mutex_lock(&info->pkt_fate_stats_lock);
+    seq = fates->rx_seq;
     pthread_mutex_unlock(&info->pkt_fate_stats_lock);
 
+    stale = pkt_fate_stale(first, n, seq);
+    if (stale) {
+        n -= stale;
+        memmove(&rx_report_bufs[0], &rx_report_bufs[stale],
+                n * sizeof(wifi_rx_report));
+    }
+    *n_provided_fates = n;
+
     return WIFI_SUCCESS;
 }
 
@@ -870,20 +1069,10 @@ out:
     return ret;
 }
 
-void rb_timerhandler(hal_info *info)
-{
-   struct timeval now;
-   int rb_id;
-
-   gettimeofday(&now,NULL);
-   for (rb_id = 0; rb_id < NUM_RING_BUFS; rb_id++) {
-       rb_check_for_timeout(&info->rb_infos[rb_id], &now);
-   }
-}
-
 wifi_error wifi_logger_ring_buffers_init(hal_info *info)
 {
     wifi_error ret;
+    char persist_dir[PROPERTY_VALUE_MAX];
 
     /* Check Supported logger capability */
     if (!(info->supported_logger_feature_set & LOGGER_RING_BUFFER)) {
@@ -892,11 +1081,17 @@ wifi_error wifi_logger_ring_buffers_init(hal_info *info)
         return WIFI_ERROR_NOT_SUPPORTED;
     }
 
+    /* Optional directory in which the lock-free rings are kept across HAL
+     * restarts, e.g. for post-mortem analysis after a crash */
+    property_get("persist.vendor.wifi.hal.ring_dir", persist_dir, "");
+
     ret = rb_init(info, &info->rb_infos[POWER_EVENTS_RB_ID],
                   POWER_EVENTS_RB_ID,
                   POWER_EVENTS_RB_BUF_SIZE,
                   POWER_EVENTS_NUM_BUFS,
-                  power_events_ring_name);
+                  RB_ENGINE_LOCKED,
+                  power_events_ring_name,
+                  persist_dir);
     if (ret != WIFI_SUCCESS) {
         ALOGE("Failed to initialize power events ring buffer");
         goto cleanup;
@@ -906,7 +1101,9 @@ wifi_error wifi_logger_ring_buffers_init(hal_info *info)
                   CONNECTIVITY_EVENTS_RB_ID,
                   CONNECTIVITY_EVENTS_RB_BUF_SIZE,
                   CONNECTIVITY_EVENTS_NUM_BUFS,
-                  connectivity_events_ring_name);
+                  RB_ENGINE_LOCKED,
+                  connectivity_events_ring_name,
+                  persist_dir);
     if (ret != WIFI_SUCCESS) {
         ALOGE("Failed to initialize connectivity events ring buffer");
         goto cleanup;
@@ -916,7 +1113,9 @@ wifi_error wifi_logger_ring_buffers_init(hal_info *info)
                   PKT_STATS_RB_ID,
                   PKT_STATS_RB_BUF_SIZE,
                   PKT_STATS_NUM_BUFS,
-                  pkt_stats_ring_name);
+                  RB_ENGINE_SPSC,
+                  pkt_stats_ring_name,
+                  persist_dir);
     if (ret != WIFI_SUCCESS) {
         ALOGE("Failed to initialize per packet stats ring buffer");
         goto cleanup;
@@ -926,7 +1125,9 @@ wifi_error wifi_logger_ring_buffers_init(hal_info *info)
                   DRIVER_PRINTS_RB_ID,
                   DRIVER_PRINTS_RB_BUF_SIZE,
                   DRIVER_PRINTS_NUM_BUFS,
-                  driver_prints_ring_name);
+                  RB_ENGINE_SPSC,
+                  driver_prints_ring_name,
+                  persist_dir);
     if (ret != WIFI_SUCCESS) {
         ALOGE("Failed to initialize driver prints ring buffer");
         goto cleanup;
@@ -936,12 +1137,31 @@ wifi_error wifi_logger_ring_buffers_init(hal_info *info)
                   FIRMWARE_PRINTS_RB_ID,
                   FIRMWARE_PRINTS_RB_BUF_SIZE,
                   FIRMWARE_PRINTS_NUM_BUFS,
-                  firmware_prints_ring_name);
+                  RB_ENGINE_SPSC,
+                  firmware_prints_ring_name,
+                  persist_dir);
     if (ret != WIFI_SUCCESS) {
         ALOGE("Failed to initialize firmware prints ring buffer");
         goto cleanup;
     }
 
+    /* Adaptive rings share twice the memory they start with */
+    info->rb_mem_budget = 0;
+    for (int i = 0; i < NUM_RING_BUFS; i++)
+        info->rb_mem_budget += info->rb_infos[i].num_bufs *
+                               info->rb_infos[i].buf_size;
+    info->rb_mem_budget *= RB_MEM_BUDGET_FACTOR;
+
+    /* The print rings carry repetitive text; optionally hand them to the
+     * framework as LZ compressed frames (see rb_compress.h) */
+    if (property_get_bool("persist.vendor.wifi.hal.ring_compress", false)) {
+        if (rb_enable_compression(&info->rb_infos[DRIVER_PRINTS_RB_ID],
+                                  DRIVER_PRINTS_RB_BUF_SIZE) != WIFI_SUCCESS ||
+            rb_enable_compression(&info->rb_infos[FIRMWARE_PRINTS_RB_ID],
+                                  FIRMWARE_PRINTS_RB_BUF_SIZE) != WIFI_SUCCESS)
+            ALOGE("Failed to enable print ring compression");
+    }
+
     pthread_mutex_init(&info->lh_lock, NULL);
     pthread_mutex_init(&info->ah_lock, NULL);
 
@@ -1007,8 +1227,15 @@ wifi_error WifiLoggerCommand::requestEvent()
     int status;
     wifi_error res = WIFI_SUCCESS;
     struct nl_cb *cb = NULL;
+    cmd_sock_info *cs;
+    u64 send_us, reply_us;
 
-    pthread_mutex_lock(&mInfo->cb_lock);
+    cs = wifi_get_cmd_sock(mInfo);
+    if (!cs) {
+        ALOGE("%s: No command socket available", __FUNCTION__);
+        mMsg.destroy();
+        return WIFI_ERROR_UNKNOWN;
+    }
     cb = nl_cb_alloc(NL_CB_DEFAULT);
     if (!cb) {
         ALOGE("%s: Callback allocation failed",__FUNCTION__);
@@ -1017,7 +1244,8 @@ wifi_error WifiLoggerCommand::requestEvent()
     }
 
     /* Send message */
-    status = nl_send_auto_complete(mInfo->cmd_sock, mMsg.getMessage());
+    send_us = wifi_monotonic_us();
+    status = nl_send_auto_complete(cs->sock, mMsg.getMessage());
     if (status < 0) {
         res = mapKernelErrortoWifiHalError(status);
         goto out;
@@ -1031,8 +1259,14 @@ wifi_error WifiLoggerCommand::requestEvent()
 
     /* Err is populated as part of finish_handler. */
     while (status > 0){
-         nl_recvmsgs(mInfo->cmd_sock, cb);
+         nl_recvmsgs(cs->sock, cb);
     }
+    reply_us = wifi_monotonic_us();
+
+    /* The reply has been consumed; give the socket back before waiting for
+     * the asynchronous event so other commands are not held up. */
+    wifi_put_cmd_sock(cs);
+    cs = NULL;
 
     ALOGV("%s: Msg sent, status=%d, mWaitForRsp=%d", __FUNCTION__, status, mWaitforRsp);
     /* Only wait for the asynchronous event if HDD returns success, res=0 */
@@ -1047,11 +1281,13 @@ wifi_error WifiLoggerCommand::requestEvent()
         ALOGV("%s: Command invoked return value:%d, mWaitForRsp=%d",
             __FUNCTION__, res, mWaitforRsp);
     }
+    wifi_record_msg_latency(mInfo, mMsg.getMessage(), send_us, reply_us, 0,
+                            status < 0 || res != WIFI_SUCCESS);
 out:
     nl_cb_put(cb);
     /* Cleanup the mMsg */
     mMsg.destroy();
-    pthread_mutex_unlock(&mInfo->cb_lock);
+    wifi_put_cmd_sock(cs);
     return res;
 }
 
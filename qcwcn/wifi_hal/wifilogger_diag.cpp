@@ -71,6 +71,8 @@
 #include <netlink/genl/family.h>
 #include <netlink/genl/ctrl.h>
 #include <linux/rtnetlink.h>
+#include <linux/if_ether.h>
+#include <endian.h>
 #include <netinet/in.h>
 #include <cld80211_lib.h>
 #include "wifiloggercmd.h"
@@ -80,6 +82,7 @@
 #include "pkt_stats.h"
 #include <errno.h>
 #include "wifi_hal_ctrl.h"
+#include "pcapng.h"
 
 #define MAX_EVENT_REASON_CODE 1024
 static uint32_t get_le32(const uint8_t *pos)
@@ -575,7 +578,7 @@ static wifi_error process_extscan_event(hal_info *info, u32 id,
     return status;
 }
 
-static wifi_error process_addba_success_event(hal_info *info,
+static wifi_error process_addba_success_event(hal_info *info, u32 id,
                                       u8* buf, int length)
 {
     wifi_ring_buffer_driver_connectivity_event *pConnectEvent;
@@ -619,7 +622,7 @@ static wifi_error process_addba_success_event(hal_info *info,
     return status;
 }
 
-static wifi_error process_addba_failed_event(hal_info *info,
+static wifi_error process_addba_failed_event(hal_info *info, u32 id,
                                       u8* buf, int length)
 {
     wifi_ring_buffer_driver_connectivity_event *pConnectEvent;
@@ -823,25 +826,22 @@ wifi_error process_firmware_prints(hal_info *info, u8 *buf, u16 length)
     /* Write if verbose and handler is set */
     if (info->rb_infos[FIRMWARE_PRINTS_RB_ID].verbose_level >= 1 &&
         info->on_ring_buffer_data) {
-        /* Write header and payload separately to avoid
-         * complete payload memcpy */
+        struct iovec iov[2];
+
         if (sizeof(wifi_ring_buffer_entry) + length > 2000) {
             ALOGE("Invalid length of buffer wifi_ring_buffer_entry size: %zu length %u ",sizeof(wifi_ring_buffer_entry), length);
             return WIFI_ERROR_UNKNOWN;
         }
-        status = ring_buffer_write(&info->rb_infos[FIRMWARE_PRINTS_RB_ID],
-                                   (u8*)&rb_entry_hdr,
-                                   sizeof(wifi_ring_buffer_entry),
-                                   0,
-                                   sizeof(wifi_ring_buffer_entry) + length);
-        if (status != WIFI_SUCCESS) {
-            ALOGE("Failed to write firmware prints rb header %d", status);
-            return status;
-        }
-        status = ring_buffer_write(&info->rb_infos[FIRMWARE_PRINTS_RB_ID],
-                                   buf, length, 1, length);
+        /* Write header and payload as one record to avoid
+         * complete payload memcpy */
+        iov[0].iov_base = &rb_entry_hdr;
+        iov[0].iov_len = sizeof(wifi_ring_buffer_entry);
+        iov[1].iov_base = buf;
+        iov[1].iov_len = length;
+        status = ring_buffer_writev(&info->rb_infos[FIRMWARE_PRINTS_RB_ID],
+                                    iov, 2, 1);
         if (status != WIFI_SUCCESS) {
-            ALOGE("Failed to write firmware prints rb payload %d", status);
+            ALOGE("Failed to write firmware prints rb record %d", status);
             return status;
         }
     }
@@ -849,7 +849,7 @@ wifi_error process_firmware_prints(hal_info *info, u8 *buf, u16 length)
     return WIFI_SUCCESS;
 }
 
-static wifi_error process_beacon_received_event(hal_info *info,
+static wifi_error process_beacon_received_event(hal_info *info, u32 id,
                                       u8* buf, int length)
 {
     wifi_ring_buffer_driver_connectivity_event *pConnectEvent;
@@ -888,6 +888,177 @@ static wifi_error process_beacon_received_event(hal_info *info,
     return status;
 }
 
+/* Firmware diag events with a decoder. Each decoder turns its event into a
+ * record of the ring it feeds; payloads shorter than min_len are dropped.
+ * Entry 0 stands for all events without a decoder.
+ */
+typedef struct {
+    u32 id;
+    u32 min_len;
+    int ring;
+    wifi_error (*decode)(hal_info *info, u32 id, u8 *buf, int length);
+} diag_event_decoder;
+
+static constexpr diag_event_decoder diag_event_decoders[] = {
+    { 0, 0, CONNECTIVITY_EVENTS_RB_ID, NULL },
+    { EVENT_WLAN_BT_COEX_BT_SCO_START,
+      sizeof(wlan_bt_coex_bt_sco_start_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_bt_coex_event },
+    { EVENT_WLAN_BT_COEX_BT_SCO_STOP,
+      sizeof(wlan_bt_coex_bt_sco_stop_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_bt_coex_event },
+    { EVENT_WLAN_BT_COEX_BT_HID_START,
+      sizeof(wlan_bt_coex_bt_hid_start_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_bt_coex_event },
+    { EVENT_WLAN_BT_COEX_BT_HID_STOP,
+      sizeof(wlan_bt_coex_bt_hid_stop_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_bt_coex_event },
+    { EVENT_WLAN_BT_COEX_BT_SCAN_START,
+      sizeof(wlan_bt_coex_bt_scan_start_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_bt_coex_scan_event },
+    { EVENT_WLAN_BT_COEX_BT_SCAN_STOP,
+      sizeof(wlan_bt_coex_bt_scan_stop_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_bt_coex_scan_event },
+    { EVENT_WLAN_EXTSCAN_CYCLE_STARTED,
+      sizeof(wlan_ext_scan_cycle_started_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_extscan_event },
+    { EVENT_WLAN_EXTSCAN_CYCLE_COMPLETED,
+      sizeof(wlan_ext_scan_cycle_completed_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_extscan_event },
+    { EVENT_WLAN_EXTSCAN_BUCKET_STARTED,
+      sizeof(wlan_ext_scan_bucket_started_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_extscan_event },
+    { EVENT_WLAN_EXTSCAN_BUCKET_COMPLETED,
+      sizeof(wlan_ext_scan_bucket_completed_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_extscan_event },
+    { EVENT_WLAN_EXTSCAN_FEATURE_STOP,
+      sizeof(wlan_ext_scan_feature_stop_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_extscan_event },
+    { EVENT_WLAN_EXTSCAN_RESULTS_AVAILABLE,
+      sizeof(wlan_ext_scan_results_available_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_extscan_event },
+    /* Only the channels actually scanned are sent */
+    { EVENT_WLAN_ROAM_SCAN_STARTED,
+      offsetof(wlan_roam_scan_started_payload_type, scan_channels),
+      CONNECTIVITY_EVENTS_RB_ID, process_roam_event },
+    { EVENT_WLAN_ROAM_SCAN_COMPLETE,
+      sizeof(wlan_roam_scan_complete_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_roam_event },
+    { EVENT_WLAN_ROAM_CANDIDATE_FOUND,
+      sizeof(wlan_roam_candidate_found_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_roam_event },
+    { EVENT_WLAN_ROAM_SCAN_CONFIG,
+      sizeof(wlan_roam_scan_config_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_roam_event },
+    { EVENT_WLAN_ADD_BLOCK_ACK_SUCCESS,
+      sizeof(wlan_add_block_ack_success_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_addba_success_event },
+    { EVENT_WLAN_ADD_BLOCK_ACK_FAILED,
+      sizeof(wlan_add_block_ack_failed_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_addba_failed_event },
+    { EVENT_WLAN_BEACON_EVENT,
+      sizeof(wlan_beacon_received_payload_type),
+      CONNECTIVITY_EVENTS_RB_ID, process_beacon_received_event },
+};
+
+#define NUM_DIAG_EVENT_DECODERS \
+    (sizeof(diag_event_decoders) / sizeof(diag_event_decoders[0]))
+#define DIAG_EVENT_ID_BASE  EVENT_WLAN_ADD_BLOCK_ACK_SUCCESS
+#define DIAG_EVENT_ID_RANGE (EVENT_WLAN_BEACON_EVENT - DIAG_EVENT_ID_BASE + 1)
+
+static_assert(NUM_DIAG_EVENT_DECODERS <= DIAG_EVENT_COUNTER_SLOTS,
+              "diag event counters too small");
+
+/* Decoder entry of every event id in the range, 0 if none */
+struct diag_event_index {
+    u8 entry[DIAG_EVENT_ID_RANGE];
+
+    constexpr diag_event_index() : entry() {
+        for (size_t i = 1; i < NUM_DIAG_EVENT_DECODERS; i++)
+            entry[diag_event_decoders[i].id - DIAG_EVENT_ID_BASE] = i;
+    }
+};
+
+static constexpr bool diag_event_decoders_valid()
+{
+    for (size_t i = 1; i < NUM_DIAG_EVENT_DECODERS; i++) {
+        if (diag_event_decoders[i].id < DIAG_EVENT_ID_BASE ||
+            diag_event_decoders[i].id >= DIAG_EVENT_ID_BASE + DIAG_EVENT_ID_RANGE)
+            return false;
+        for (size_t j = 1; j < i; j++)
+            if (diag_event_decoders[i].id == diag_event_decoders[j].id)
+                return false;
+    }
+    return true;
+}
+static_assert(diag_event_decoders_valid(),
+              "diag event ids must be unique and within the index range");
+
+static constexpr diag_event_index diag_event_idx;
+
+static wifi_error process_diag_event(hal_info *info, u32 id, u8 *payload,
+                                     u32 payloadlen)
+{
+    const diag_event_decoder *decoder;
+    diag_event_counter *counter;
+    u32 entry = 0;
+    wifi_error status;
+
+    if (id - DIAG_EVENT_ID_BASE < DIAG_EVENT_ID_RANGE)
+        entry = diag_event_idx.entry[id - DIAG_EVENT_ID_BASE];
+    decoder = &diag_event_decoders[entry];
+    counter = &info->diag_event_counters[entry];
+    counter->events++;
+    counter->bytes += payloadlen;
+
+    if (decoder->decode == NULL)
+        return WIFI_SUCCESS;
+    if (payloadlen < decoder->min_len) {
+        ALOGE("Diag event 0x%x too short: %u < %u", id, payloadlen,
+              decoder->min_len);
+        counter->failures++;
+        return WIFI_SUCCESS;
+    }
+    /* Decoders only feed their ring; skip them while it is not logged */
+    if (info->rb_infos[decoder->ring].verbose_level < 1 ||
+        !info->on_ring_buffer_data)
+        return WIFI_SUCCESS;
+
+    status = decoder->decode(info, id, payload, payloadlen);
+    if (status != WIFI_SUCCESS) {
+        ALOGE("Failed to process diag event 0x%x", id);
+        counter->failures++;
+    }
+    return status;
+}
+
+wifi_error wifi_get_diag_event_stats(wifi_handle handle,
+            wifi_diag_event_stats *stats, int max_stats, int *num_stats)
+{
+    hal_info *info = getHalInfo(handle);
+    diag_event_counter *counter;
+    size_t i;
+    int num = 0;
+
+    if (!info || !stats || !num_stats)
+        return WIFI_ERROR_INVALID_ARGS;
+
+    pthread_mutex_lock(&info->diag_lock);
+    for (i = 0; i < NUM_DIAG_EVENT_DECODERS && num < max_stats; i++) {
+        counter = &info->diag_event_counters[i];
+        if (!counter->events)
+            continue;
+        stats[num].event_id = diag_event_decoders[i].id;
+        stats[num].events = counter->events;
+        stats[num].bytes = counter->bytes;
+        stats[num].failures = counter->failures;
+        num++;
+    }
+    pthread_mutex_unlock(&info->diag_lock);
+    *num_stats = num;
+    return WIFI_SUCCESS;
+}
+
 static wifi_error process_fw_diag_msg(hal_info *info, u8* buf, u32 length)
 {
     u32 count = 0, id;
@@ -944,85 +1115,9 @@ static wifi_error process_fw_diag_msg(hal_info *info, u8* buf, u32 length)
                     return WIFI_ERROR_UNKNOWN;
                 }
 
-                switch (id) {
-                    case EVENT_WLAN_BT_COEX_BT_SCO_START:
-                    case EVENT_WLAN_BT_COEX_BT_SCO_STOP:
-                    case EVENT_WLAN_BT_COEX_BT_HID_START:
-                    case EVENT_WLAN_BT_COEX_BT_HID_STOP:
-                        status = process_bt_coex_event(info, id,
-                                                       payload,
-                                                       payloadlen);
-                        if (status != WIFI_SUCCESS) {
-                            ALOGE("Failed to process bt_coex event");
-                            return status;
-                        }
-                        break;
-                    case EVENT_WLAN_BT_COEX_BT_SCAN_START:
-                    case EVENT_WLAN_BT_COEX_BT_SCAN_STOP:
-                        status = process_bt_coex_scan_event(info, id,
-                                                       payload,
-                                                       payloadlen);
-                        if (status != WIFI_SUCCESS) {
-                            ALOGE("Failed to process bt_coex_scan event");
-                            return status;
-                        }
-                        break;
-                   case EVENT_WLAN_EXTSCAN_CYCLE_STARTED:
-                   case EVENT_WLAN_EXTSCAN_CYCLE_COMPLETED:
-                   case EVENT_WLAN_EXTSCAN_BUCKET_STARTED:
-                   case EVENT_WLAN_EXTSCAN_BUCKET_COMPLETED:
-                   case EVENT_WLAN_EXTSCAN_FEATURE_STOP:
-                   case EVENT_WLAN_EXTSCAN_RESULTS_AVAILABLE:
-                        status = process_extscan_event(info, id,
-                                                       payload,
-                                                       payloadlen);
-                        if (status != WIFI_SUCCESS) {
-                            ALOGE("Failed to process extscan event");
-                            return status;
-                        }
-                        break;
-                   case EVENT_WLAN_ROAM_SCAN_STARTED:
-                   case EVENT_WLAN_ROAM_SCAN_COMPLETE:
-                   case EVENT_WLAN_ROAM_CANDIDATE_FOUND:
-                   case EVENT_WLAN_ROAM_SCAN_CONFIG:
-                        status = process_roam_event(info, id,
-                                                    payload,
-                                                    payloadlen);
-                        if (status != WIFI_SUCCESS) {
-                            ALOGE("Failed to process roam event");
-                            return status;
-                        }
-                        break;
-                   case EVENT_WLAN_ADD_BLOCK_ACK_SUCCESS:
-                        status = process_addba_success_event(info,
-                                                       payload,
-                                                       payloadlen);
-                        if (status != WIFI_SUCCESS) {
-                            ALOGE("Failed to process addba success event");
-                            return status;
-                        }
-                        break;
-                   case EVENT_WLAN_ADD_BLOCK_ACK_FAILED:
-                        status = process_addba_failed_event(info,
-                                                      payload,
-                                                      payloadlen);
-                        if (status != WIFI_SUCCESS) {
-                            ALOGE("Failed to process addba failed event");
-                            return status;
-                        }
-                        break;
-                   case EVENT_WLAN_BEACON_EVENT:
-                        status = process_beacon_received_event(info,
-                                                      payload,
-                                                      payloadlen);
-                        if (status != WIFI_SUCCESS) {
-                            ALOGE("Failed to process beacon received event");
-                            return status;
-                        }
-                        break;
-                   default:
-                        return WIFI_SUCCESS;
-                }
+                status = process_diag_event(info, id, payload, payloadlen);
+                if (status != WIFI_SUCCESS)
+                    return status;
             }
             break;
             case WLAN_DIAG_TYPE_LOG:
@@ -1382,10 +1477,263 @@ static void process_wlan_low_resource_failure(hal_info *info,
     }
 }
 
+#define PCAPNG_EXPORT_BUF_SIZE (256 * 1024)
+
+/* Radiotap fields of per packet stats records, in the order they appear */
+#define RADIOTAP_TSFT           0
+#define RADIOTAP_FLAGS          1
+#define RADIOTAP_RATE           2
+#define RADIOTAP_DB_ANTSIGNAL   12
+#define RADIOTAP_MCS            19
+#define RADIOTAP_VHT            21
+#define RADIOTAP_F_SHORTGI      0x80
+#define RADIOTAP_MAX_LEN        40
+
+struct radiotap_hdr {
+    u8 version;
+    u8 pad;
+    u16 len;
+    u32 present;
+} __attribute__((packed));
+
+wifi_error wifi_start_pcapng_export(wifi_handle handle, int fd,
+                                    const struct sockaddr *dest,
+                                    socklen_t dest_len)
+{
+    hal_info *info = getHalInfo(handle);
+    wifi_error ret = WIFI_SUCCESS;
+
+    pthread_mutex_lock(&info->diag_lock);
+    if (info->pcapng) {
+        ALOGE("%s: pcapng export already running", __FUNCTION__);
+        ret = WIFI_ERROR_BUSY;
+        goto out;
+    }
+
+    info->pcapng = pcapng_open(fd, dest, dest_len, PCAPNG_EXPORT_BUF_SIZE);
+    if (info->pcapng == NULL) {
+        ret = WIFI_ERROR_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    ALOGI("pcapng export started to %s", dest ? "ctrl client" : "file");
+out:
+    pthread_mutex_unlock(&info->diag_lock);
+    return ret;
+}
+
+static void pcapng_export_stop(hal_info *info)
+{
+    struct pcapng_stats stats;
+
+    if (info->pcapng == NULL)
+        return;
+
+    pcapng_get_stats(info->pcapng, &stats);
+    pcapng_close(info->pcapng);
+    info->pcapng = NULL;
+    ALOGI("pcapng export stopped: %" PRIu64 " packets, %" PRIu64 " bytes, %"
+          PRIu64 " dropped, %" PRIu64 " stalls", stats.packets, stats.bytes,
+          stats.dropped, stats.stalls);
+}
+
+void wifi_stop_pcapng_export(wifi_handle handle)
+{
+    hal_info *info = getHalInfo(handle);
+
+    pthread_mutex_lock(&info->diag_lock);
+    pcapng_export_stop(info);
+    pthread_mutex_unlock(&info->diag_lock);
+}
+
+/* Flushes the export once its buffered blocks are due, so they reach the
+ * sink after traffic stops; diag_lock held. Returns whether blocks are
+ * still buffered.
+ */
+bool pcapng_export_flush_due(hal_info *info)
+{
+    if (info->pcapng == NULL)
+        return false;
+    if (pcapng_flush_due(info->pcapng) == PCAPNG_SINK_FAILED) {
+        pcapng_export_stop(info);
+        return false;
+    }
+    return pcapng_pending(info->pcapng);
+}
+
+static void pcapng_export_packet(hal_info *info, u32 if_id, u64 ts_us,
+                                 u32 epb_flags, const void *hdr,
+                                 size_t hdr_len, const void *data,
+                                 size_t data_len, const char *comment)
+{
+    if (pcapng_write_packet(info->pcapng, if_id, ts_us, epb_flags, hdr,
+                            hdr_len, data, data_len, comment) ==
+        PCAPNG_SINK_FAILED)
+        pcapng_export_stop(info);
+}
+
+/* Exports a tx/rx packet fate with its whole frame: data frames as
+ * Ethernet, mgmt frames as 802.11 behind an empty radiotap header
+ */
+static void pcapng_export_fate(hal_info *info, u8 *buf, u16 size, bool tx)
+{
+    pktdump_hdr *log = (pktdump_hdr *)buf;
+    struct radiotap_hdr rt;
+    struct timeval now;
+    char comment[64];
+    size_t len = 0;
+
+    if (size > sizeof(pktdump_hdr))
+        len = size - sizeof(pktdump_hdr);
+
+    snprintf(comment, sizeof(comment), "%s fate %u drv_ts %u fw_ts %u",
+             tx ? "tx" : "rx", log->status, log->driver_ts, log->fw_ts);
+    gettimeofday(&now, NULL);
+
+    if (log->type == TX_MGMT_PKT || log->type == RX_MGMT_PKT) {
+        memset(&rt, 0, sizeof(rt));
+        rt.len = htole16(sizeof(rt));
+        pcapng_export_packet(info, PCAPNG_IF_RADIOTAP,
+                             (u64)now.tv_sec * 1000000 + now.tv_usec,
+                             tx ? PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND,
+                             &rt, sizeof(rt), buf + sizeof(pktdump_hdr), len,
+                             comment);
+    } else {
+        pcapng_export_packet(info, PCAPNG_IF_ETHERNET,
+                             (u64)now.tv_sec * 1000000 + now.tv_usec,
+                             tx ? PCAPNG_EPB_OUTBOUND : PCAPNG_EPB_INBOUND,
+                             NULL, 0, buf + sizeof(pktdump_hdr), len,
+                             comment);
+    }
+}
+
+/* Radiotap header carrying the PHY side of a per packet stats entry */
+static size_t pkt_stats_radiotap(u8 *rt,
+                                 const wifi_ring_per_packet_status_entry *pps)
+{
+    static const u8 vht_bw[] = {0, 1, 4, 11};
+    struct radiotap_hdr *hdr = (struct radiotap_hdr *)rt;
+    u8 *p = rt + sizeof(struct radiotap_hdr);
+    u32 present;
+    u64 tsft;
+    u16 known;
+    MCS mcs;
+
+    mcs.mcs = pps->MCS;
+    memset(rt, 0, RADIOTAP_MAX_LEN);
+
+    present = BIT(RADIOTAP_TSFT) | BIT(RADIOTAP_FLAGS) |
+              BIT(RADIOTAP_DB_ANTSIGNAL);
+    tsft = htole64(pps->firmware_entry_timestamp);
+    memcpy(p, &tsft, sizeof(tsft));
+    p += sizeof(tsft);
+    *p++ = mcs.mcs_s.short_gi ? RADIOTAP_F_SHORTGI : 0;
+
+    /* HT and VHT use the same preamble codes in both pktlog versions */
+    if (mcs.mcs_s.preamble < WL_PREAMBLE_HT &&
+        pps->last_transmit_rate <= 0xFF) {
+        present |= BIT(RADIOTAP_RATE);
+        *p++ = pps->last_transmit_rate;
+    }
+    *p++ = pps->rssi;
+
+    if (mcs.mcs_s.preamble == WL_PREAMBLE_HT) {
+        present |= BIT(RADIOTAP_MCS);
+        *p++ = 0x07;    // bandwidth, mcs and guard interval known
+        *p++ = (mcs.mcs_s.bw ? 1 : 0) | (mcs.mcs_s.short_gi ? 0x04 : 0);
+        *p++ = mcs.mcs_s.nss * 8 + mcs.mcs_s.rate;
+    } else if (mcs.mcs_s.preamble == WL_PREAMBLE_VHT) {
+        present |= BIT(RADIOTAP_VHT);
+        p += (p - rt) & 1;
+        known = htole16(0x0044);    // guard interval and bandwidth known
+        memcpy(p, &known, sizeof(known));
+        p[2] = mcs.mcs_s.short_gi ? 0x04 : 0;
+        p[3] = vht_bw[mcs.mcs_s.bw];
+        p[4] = mcs.mcs_s.rate << 4 | (mcs.mcs_s.nss + 1);
+        p += 12;
+    }
+
+    hdr->len = htole16(p - rt);
+    hdr->present = htole32(present);
+    return p - rt;
+}
+
+static void pcapng_export_pkt_stats(hal_info *info,
+                                    wifi_ring_buffer_entry *rb_entry)
+{
+    wifi_ring_per_packet_status_entry *pps =
+        (wifi_ring_per_packet_status_entry *)(rb_entry + 1);
+    u8 rt[RADIOTAP_MAX_LEN];
+    size_t rt_len, len = 0;
+    char comment[128];
+
+    rt_len = pkt_stats_radiotap(rt, pps);
+    if ((pps->flags & PER_PACKET_ENTRY_FLAGS_80211_HEADER) &&
+        rb_entry->entry_size > sizeof(*pps))
+        len = rb_entry->entry_size - sizeof(*pps);
+
+    snprintf(comment, sizeof(comment),
+             "flags 0x%x tid %u seq %u retries %u rate %u contention_ts %"
+             PRIu64 " success_ts %" PRIu64, pps->flags, pps->tid,
+             pps->link_layer_transmit_sequence, pps->num_retries,
+             pps->last_transmit_rate, (u64)pps->start_contention_timestamp,
+             (u64)pps->transmit_success_timestamp);
+    pcapng_export_packet(info, PCAPNG_IF_RADIOTAP, rb_entry->timestamp, 0,
+                         rt, rt_len, pps->data, len, comment);
+}
+
+static wifi_error pkt_stats_batch_flush(hal_info *info)
+{
+    struct pkt_stats_batch *batch = &info->pkt_stats->batch;
+    wifi_error status = WIFI_SUCCESS;
+
+    if (batch->num_recs)
+        status = ring_buffer_write_batch(&info->rb_infos[PKT_STATS_RB_ID],
+                                         batch->buf, batch->rec_len,
+                                         batch->num_recs);
+    batch->num_recs = 0;
+    batch->len = 0;
+    return status;
+}
+
+/* Writes a pkt stats ring entry of hdr followed by data. While
+ * parse_stats() runs the entry is added to its batch instead.
+ */
+static wifi_error pkt_stats_write_entry(hal_info *info, const void *hdr,
+                                        size_t hdr_len, const void *data,
+                                        size_t data_len)
+{
+    struct pkt_stats_batch *batch = &info->pkt_stats->batch;
+    size_t len = hdr_len + data_len;
+    struct iovec iov[2];
+    wifi_error status;
+
+    if (!batch->active || len > sizeof(batch->buf)) {
+        iov[0].iov_base = (void *)hdr;
+        iov[0].iov_len = hdr_len;
+        iov[1].iov_base = (void *)data;
+        iov[1].iov_len = data_len;
+        return ring_buffer_writev(&info->rb_infos[PKT_STATS_RB_ID], iov,
+                                  data_len ? 2 : 1, 1);
+    }
+
+    if (len > sizeof(batch->buf) - batch->len ||
+        batch->num_recs == PKT_STATS_BATCH_MAX_RECS) {
+        status = pkt_stats_batch_flush(info);
+        if (status != WIFI_SUCCESS)
+            return status;
+    }
+    memcpy(batch->buf + batch->len, hdr, hdr_len);
+    if (data_len)
+        memcpy(batch->buf + batch->len + hdr_len, data, data_len);
+    batch->rec_len[batch->num_recs++] = len;
+    batch->len += len;
+    return WIFI_SUCCESS;
+}
+
 static wifi_error update_stats_to_ring_buf(hal_info *info,
                       u8 *rb_entry, u32 size)
 {
-    int num_records = 1;
     wifi_ring_buffer_entry *pRingBufferEntry =
         (wifi_ring_buffer_entry *)rb_entry;
     struct timeval time;
@@ -1397,14 +1745,13 @@ static wifi_error update_stats_to_ring_buf(hal_info *info,
     gettimeofday(&time,NULL);
     pRingBufferEntry->timestamp = (u64)time.tv_usec + (u64)time.tv_sec * 1000 * 1000;
 
+    if (info->pcapng)
+        pcapng_export_pkt_stats(info, pRingBufferEntry);
+
     // Write if verbose and handler is set
     if ((info->rb_infos[PKT_STATS_RB_ID].verbose_level >= VERBOSE_DEBUG_PROBLEM)
         && info->on_ring_buffer_data) {
-        ring_buffer_write(&info->rb_infos[PKT_STATS_RB_ID],
-                          (u8*)pRingBufferEntry,
-                          size,
-                          num_records,
-                          size);
+        pkt_stats_write_entry(info, pRingBufferEntry, size, NULL, 0);
     }
 
     return WIFI_SUCCESS;
@@ -1412,26 +1759,7 @@ static wifi_error update_stats_to_ring_buf(hal_info *info,
 
 static u8 cck_ratecode_mapping(u8 rate)
 {
-   u8 rate_code = 0;
-
-   switch (rate) {
-      case 0x1:
-           rate_code = 0x3;
-           break;
-      case 0x2:
-      case 0x5:
-           rate_code = 0x2;
-           break;
-      case 0x3:
-      case 0x6:
-           rate_code = 0x1;
-           break;
-      case 0x4:
-      case 0x7:
-           rate_code = 0x0;
-           break;
-   }
-   return rate_code;
+    return cck_ratecode[rate & 0xF];
 }
 
 static u8 ofdm_ratecode_mapping(u8 rate)
@@ -1442,152 +1770,26 @@ static u8 ofdm_ratecode_mapping(u8 rate)
    return rate_code;
 }
 
+static inline u16 mcs_rate_idx(MCS mcs)
+{
+    return mcs_rate_idx(mcs.mcs_s.rate, mcs.mcs_s.nss, mcs.mcs_s.preamble,
+                        mcs.mcs_s.bw, mcs.mcs_s.short_gi);
+}
+
 static u16 get_rate_v1(u16 mcs_r)
 {
     MCS mcs;
-    int index = 0;
-    u16 tx_rate = 0;
-    u8 nss;
 
     mcs.mcs = mcs_r;
-    nss = mcs.mcs_s.nss + 1;
-
-    switch (mcs.mcs_s.preamble) {
-      case WIFI_HW_RATECODE_PREAM_OFDM:
-           for (index = 0; index < MAX_OFDM_MCS_IDX; index++) {
-               if ((mcs.mcs_s.rate & 0xF) == index)
-                  tx_rate = (u16) ofdm_mcs_nss1[index].ofdm_rate[mcs.mcs_s.short_gi] / 1000;
-           }
-           break;
-      case WIFI_HW_RATECODE_PREAM_CCK:
-           for (index = 0; index < MAX_CCK_MCS_IDX; index++) {
-               if ((mcs.mcs_s.rate & 0xF) == index)
-                  tx_rate = (u16) cck_mcs_nss1[index].cck_rate[mcs.mcs_s.short_gi] / 1000;
-           }
-           break;
-      case WIFI_HW_RATECODE_PREAM_HT:
-           if (nss == 1) {
-              for (index = 0; index < MAX_HT_MCS_IDX; index++) {
-                  if (mcs.mcs_s.rate == index) {
-                     if (mcs.mcs_s.bw == BW_20MHZ)
-                        tx_rate = (u16) mcs_nss1[index].ht20_rate[mcs.mcs_s.short_gi] / 10;
-                     if (mcs.mcs_s.bw == BW_40MHZ)
-                        tx_rate = (u16) mcs_nss1[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
-                  }
-              }
-           } else if (nss == 2) {
-               for (index = 0; index < MAX_HT_MCS_IDX; index++) {
-                   if (mcs.mcs_s.rate == index) {
-                      if (mcs.mcs_s.bw == BW_20MHZ)
-                         tx_rate = (u16) mcs_nss2[index].ht20_rate[mcs.mcs_s.short_gi] / 10;
-                      if (mcs.mcs_s.bw == BW_40MHZ)
-                         tx_rate = (u16) mcs_nss2[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
-                   }
-               }
-           } else {
-               ALOGE("Unexpected nss %d", nss);
-           }
-           break;
-      case WIFI_HW_RATECODE_PREAM_VHT:
-           if (nss == 1) {
-              for (index = 0; index < MAX_VHT_MCS_IDX; index++) {
-                  if (mcs.mcs_s.rate == index) {
-                     if (mcs.mcs_s.bw == BW_20MHZ)
-                        tx_rate = (u16) vht_mcs_nss1[index].ht20_rate[mcs.mcs_s.short_gi] / 10;
-                     if (mcs.mcs_s.bw == BW_40MHZ)
-                        tx_rate = (u16) vht_mcs_nss1[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
-                     if (mcs.mcs_s.bw == BW_80MHZ)
-                        tx_rate = (u16) vht_mcs_nss1[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
-                  }
-              }
-           } else if (nss == 2) {
-               for (index = 0; index < MAX_VHT_MCS_IDX; index++) {
-                   if (mcs.mcs_s.rate == index) {
-                      if (mcs.mcs_s.bw == BW_20MHZ)
-                          tx_rate = (u16) vht_mcs_nss2[index].ht20_rate[mcs.mcs_s.short_gi] / 10;
-                      if (mcs.mcs_s.bw == BW_40MHZ)
-                          tx_rate = (u16) vht_mcs_nss2[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
-                      if (mcs.mcs_s.bw == BW_80MHZ)
-                          tx_rate = (u16) vht_mcs_nss2[index].ht40_rate[mcs.mcs_s.short_gi] / 10;
-                   }
-               }
-           } else {
-               ALOGE("Unexpected nss %d", nss);
-           }
-           break;
-      default:
-           ALOGE("Unexpected preamble %d", mcs.mcs_s.preamble);
-    }
-    return tx_rate;
+    return mcs_rates.rate_v1[mcs_rate_idx(mcs)];
 }
 
 static u16 get_rate(u16 mcs_r)
 {
-    u16 tx_rate = 0;
     MCS mcs;
-    static u16 rate_lookup[][8] = {{96, 48, 24, 12, 108, 72, 36, 18},
-                            {22, 11,  4,  2,  22, 11,  4,  0}};
-    static u16 MCS_rate_lookup_ht[][8] =
-                                  {{ 13,  14,  27,  30,  59,  65,  117,  130},
-                                   { 26,  29,  54,  60, 117, 130,  234,  260},
-                                   { 39,  43,  81,  90, 176, 195,  351,  390},
-                                   { 52,  58, 108, 120, 234, 260,  468,  520},
-                                   { 78,  87, 162, 180, 351, 390,  702,  780},
-                                   {104, 116, 216, 240, 468, 520,  936, 1040},
-                                   {117, 130, 243, 270, 527, 585, 1053, 1170},
-                                   {130, 144, 270, 300, 585, 650, 1170, 1300},
-                                   {156, 173, 324, 360, 702, 780, 1404, 1560},
-                                   {  0,   0, 360, 400, 780, 867, 1560, 1733},
-                                   { 26,  29,  54,  60, 117, 130,  234,  260},
-                                   { 52,  58, 108, 120, 234, 260,  468,  520},
-                                   { 78,  87, 162, 180, 351, 390,  702,  780},
-                                   {104, 116, 216, 240, 468, 520,  936, 1040},
-                                   {156, 173, 324, 360, 702, 780, 1404, 1560},
-                                   {208, 231, 432, 480, 936,1040, 1872, 2080},
-                                   {234, 261, 486, 540,1053,1170, 2106, 2340},
-                                   {260, 289, 540, 600,1170,1300, 2340, 2600},
-                                   {312, 347, 648, 720,1404,1560, 2808, 3120},
-                                   {  0,   0, 720, 800,1560,1733, 3120, 3467}};
 
     mcs.mcs = mcs_r;
-    if ((mcs.mcs_s.preamble <= WL_PREAMBLE_VHT) && (mcs.mcs_s.rate < 10)) {
-        switch(mcs.mcs_s.preamble)
-        {
-            case WL_PREAMBLE_CCK:
-            case WL_PREAMBLE_OFDM:
-                if(mcs.mcs_s.rate<8) {
-                    tx_rate = rate_lookup [mcs.mcs_s.preamble][mcs.mcs_s.rate];
-                    if (mcs.mcs_s.nss)
-                        tx_rate *=2;
-                } else {
-                    ALOGE("Unexpected rate value");
-                }
-            break;
-            case WL_PREAMBLE_HT:
-                if(mcs.mcs_s.rate<8) {
-                    if (!mcs.mcs_s.nss)
-                        tx_rate = MCS_rate_lookup_ht[mcs.mcs_s.rate]
-                                        [2*mcs.mcs_s.bw+mcs.mcs_s.short_gi];
-                    else
-                        tx_rate = MCS_rate_lookup_ht[10+mcs.mcs_s.rate]
-                                        [2*mcs.mcs_s.bw+mcs.mcs_s.short_gi];
-                } else {
-                    ALOGE("Unexpected HT mcs.mcs_s index");
-                }
-            break;
-            case WL_PREAMBLE_VHT:
-                if (!mcs.mcs_s.nss)
-                    tx_rate = MCS_rate_lookup_ht[mcs.mcs_s.rate]
-                                        [2*mcs.mcs_s.bw+mcs.mcs_s.short_gi];
-                else
-                    tx_rate = MCS_rate_lookup_ht[10+mcs.mcs_s.rate]
-                                        [2*mcs.mcs_s.bw+mcs.mcs_s.short_gi];
-            break;
-            default:
-                ALOGE("Unexpected preamble");
-        }
-    }
-    return tx_rate;
+    return mcs_rates.rate[mcs_rate_idx(mcs)];
 }
 
 static wifi_error populate_rx_aggr_stats(hal_info *info)
@@ -1621,12 +1823,48 @@ static wifi_error populate_rx_aggr_stats(hal_info *info)
                             + sizeof(wifi_ring_buffer_entry)
                             + pRingBufferEntry->entry_size);
     }
-    memset(info->rx_aggr_pkts, 0, info->rx_buf_size_occupied);
+    /* Staged entries are written in full, so nothing needs clearing */
     info->rx_buf_size_occupied = 0;
 
     return WIFI_SUCCESS;
 }
 
+/* Stages an MPDU entry of len bytes for the PPDU being aggregated. The
+ * arena is sized at init for the largest A-MPDU; should a PPDU still not
+ * fit, the entries staged so far are flushed early instead of growing it.
+ */
+static wifi_error rx_aggr_stage_entry(hal_info *info, u32 len,
+                                      wifi_ring_buffer_entry **entry)
+{
+    wifi_error status;
+
+    if (len > info->rx_buf_size_allocated) {
+        ALOGE("%s: Entry of %u bytes exceeds the rx aggr arena of %u bytes",
+              __FUNCTION__, len, info->rx_buf_size_allocated);
+        return WIFI_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (len + info->rx_buf_size_occupied > info->rx_buf_size_allocated) {
+        ALOGV("%s: A-MPDU exceeds the rx aggr arena, flushing early",
+              __FUNCTION__);
+        status = populate_rx_aggr_stats(info);
+        if (status != WIFI_SUCCESS)
+            return status;
+    }
+
+    *entry = (wifi_ring_buffer_entry *)((u8 *)info->rx_aggr_pkts
+             + info->rx_buf_size_occupied);
+    info->rx_buf_size_occupied += len;
+
+    /* Fill size of the entry in rb entry which can be used while populating
+     * the data. Actual size that needs to be sent to ring buffer is only pps
+     * entry size
+     */
+    (*entry)->entry_size = len;
+
+    return WIFI_SUCCESS;
+}
+
 static wifi_error parse_rx_stats_v2(hal_info *info, u8 *buf, u16 size)
 {
     wifi_error status = WIFI_SUCCESS;
@@ -1636,7 +1874,6 @@ static wifi_error parse_rx_stats_v2(hal_info *info, u8 *buf, u16 size)
 
     if (size < sizeof(rb_pkt_stats_t)) {
         ALOGE("%s Unexpected rx stats event length: %d", __FUNCTION__, size);
-        memset(info->rx_aggr_pkts, 0, info->rx_buf_size_occupied);
         memset(&info->aggr_stats, 0, sizeof(rx_aggr_stats));
         info->rx_buf_size_occupied = 0;
         return WIFI_ERROR_UNKNOWN;
@@ -1646,35 +1883,11 @@ static wifi_error parse_rx_stats_v2(hal_info *info, u8 *buf, u16 size)
                             + sizeof(wifi_ring_per_packet_status_entry)
                             + RX_HTT_HDR_STATUS_LEN_V1;
 
-    if (len_ring_buffer_entry + info->rx_buf_size_occupied
-            > info->rx_buf_size_allocated) {
-        wifi_ring_buffer_entry *temp;
-        temp = (wifi_ring_buffer_entry *)realloc(info->rx_aggr_pkts,
-                len_ring_buffer_entry + info->rx_buf_size_occupied);
-        if (temp == NULL) {
-            ALOGE("%s: Failed to reallocate memory", __FUNCTION__);
-            free(info->rx_aggr_pkts);
-            info->rx_aggr_pkts = NULL;
-            return WIFI_ERROR_OUT_OF_MEMORY;
-        }
-        info->rx_aggr_pkts = temp;
-        memset((u8 *)info->rx_aggr_pkts + info->rx_buf_size_allocated, 0,
-                len_ring_buffer_entry + info->rx_buf_size_occupied
-                - info->rx_buf_size_allocated);
-        info->rx_buf_size_allocated =
-            len_ring_buffer_entry + info->rx_buf_size_occupied;
-    }
-
-    pRingBufferEntry = (wifi_ring_buffer_entry *)((u8 *)info->rx_aggr_pkts
-            + info->rx_buf_size_occupied);
-
-    info->rx_buf_size_occupied += len_ring_buffer_entry;
+    status = rx_aggr_stage_entry(info, len_ring_buffer_entry,
+                                 &pRingBufferEntry);
+    if (status != WIFI_SUCCESS)
+        return status;
 
-    /* Fill size of the entry in rb entry which can be used while populating
-     * the data. Actual size that needs to be sent to ring buffer is only pps
-     * entry size
-     */
-    pRingBufferEntry->entry_size = len_ring_buffer_entry;
     wifi_ring_per_packet_status_entry *rb_pkt_stats =
         (wifi_ring_per_packet_status_entry *)(pRingBufferEntry + 1);
 
@@ -1766,7 +1979,6 @@ static wifi_error parse_rx_stats(hal_info *info, u8 *buf, u16 size)
 
     if (size < sizeof(rb_pkt_stats_t)) {
         ALOGE("%s Unexpected rx stats event length: %d", __FUNCTION__, size);
-        memset(info->rx_aggr_pkts, 0, info->rx_buf_size_occupied);
         memset(&info->aggr_stats, 0, sizeof(rx_aggr_stats));
         info->rx_buf_size_occupied = 0;
         return WIFI_ERROR_UNKNOWN;
@@ -1776,35 +1988,11 @@ static wifi_error parse_rx_stats(hal_info *info, u8 *buf, u16 size)
                             + sizeof(wifi_ring_per_packet_status_entry)
                             + RX_HTT_HDR_STATUS_LEN;
 
-    if (len_ring_buffer_entry + info->rx_buf_size_occupied
-            > info->rx_buf_size_allocated) {
-        wifi_ring_buffer_entry *temp;
-        temp = (wifi_ring_buffer_entry *)realloc(info->rx_aggr_pkts,
-                len_ring_buffer_entry + info->rx_buf_size_occupied);
-        if (temp == NULL) {
-            ALOGE("%s: Failed to reallocate memory", __FUNCTION__);
-            free(info->rx_aggr_pkts);
-            info->rx_aggr_pkts = NULL;
-            return WIFI_ERROR_OUT_OF_MEMORY;
-        }
-        info->rx_aggr_pkts = temp;
-        memset((u8 *)info->rx_aggr_pkts + info->rx_buf_size_allocated, 0,
-                len_ring_buffer_entry + info->rx_buf_size_occupied
-                - info->rx_buf_size_allocated);
-        info->rx_buf_size_allocated =
-            len_ring_buffer_entry + info->rx_buf_size_occupied;
-    }
-
-    pRingBufferEntry = (wifi_ring_buffer_entry *)((u8 *)info->rx_aggr_pkts
-            + info->rx_buf_size_occupied);
-
-    info->rx_buf_size_occupied += len_ring_buffer_entry;
+    status = rx_aggr_stage_entry(info, len_ring_buffer_entry,
+                                 &pRingBufferEntry);
+    if (status != WIFI_SUCCESS)
+        return status;
 
-    /* Fill size of the entry in rb entry which can be used while populating
-     * the data. Actual size that needs to be sent to ring buffer is only pps
-     * entry size
-     */
-    pRingBufferEntry->entry_size = len_ring_buffer_entry;
     wifi_ring_per_packet_status_entry *rb_pkt_stats =
         (wifi_ring_per_packet_status_entry *)(pRingBufferEntry + 1);
 
@@ -2201,22 +2389,10 @@ wifi_error write_per_packet_stats_to_rb(hal_info *info, u8 *buf, u16 length)
     /* Write if verbose and handler is set */
     if (info->rb_infos[PKT_STATS_RB_ID].verbose_level >= 3 &&
         info->on_ring_buffer_data) {
-        /* Write header and payload separately to avoid
-         * complete payload memcpy */
-        status = ring_buffer_write(&info->rb_infos[PKT_STATS_RB_ID],
-                                   (u8*)&rb_entry_hdr,
-                                   sizeof(wifi_ring_buffer_entry),
-                                   0,
-                                   sizeof(wifi_ring_buffer_entry) + length);
-        if (status != WIFI_SUCCESS) {
-            ALOGE("Failed to write driver prints rb header %d", status);
-            return status;
-        }
-        status = ring_buffer_write(&info->rb_infos[PKT_STATS_RB_ID],
-                                   buf,
-                                   length,
-                                   1,
-                                   length);
+        /* Header and payload go in as one record */
+        status = pkt_stats_write_entry(info, &rb_entry_hdr,
+                                       sizeof(wifi_ring_buffer_entry),
+                                       buf, length);
         if (status != WIFI_SUCCESS) {
             ALOGE("Failed to write PKT stats into the ring buffer");
         }
@@ -2225,19 +2401,29 @@ wifi_error write_per_packet_stats_to_rb(hal_info *info, u8 *buf, u16 length)
     return WIFI_SUCCESS;
 }
 
+/* Copies the frame of a pktdump record into an entry's slab slot,
+ * truncated to the configured length; returns the bytes kept
+ */
+static size_t copy_pkt_fate_frame(packet_fate_monitor_info *fates,
+                                  char *frame_content, u8 *buf, u16 size)
+{
+    size_t frame_len = 0;
+
+    if (size > sizeof(pktdump_hdr))
+        frame_len = min((size_t)(size - sizeof(pktdump_hdr)),
+                        fates->frame_len_max);
+    memcpy(frame_content, buf + sizeof(pktdump_hdr), frame_len);
+    return frame_len;
+}
+
 static wifi_error parse_tx_pkt_fate_stats(hal_info *info, u8 *buf, u16 size)
 {
     pktdump_hdr *log = (pktdump_hdr *)buf;
+    packet_fate_monitor_info *fates = info->pkt_fate_stats;
     wifi_tx_report_i *pkt_fate_stats;
 
-    if (info->pkt_fate_stats->n_tx_stats_collected >= MAX_FATE_LOG_LEN) {
-        ALOGD("Only %u events are expected, don't process this event",
-              MAX_FATE_LOG_LEN);
-        return WIFI_SUCCESS;
-    }
-
-    pkt_fate_stats = &info->pkt_fate_stats->tx_fate_stats[
-                                   info->pkt_fate_stats->n_tx_stats_collected];
+    /* Once the capture wraps, this overwrites the oldest fate */
+    pkt_fate_stats = &fates->tx_fate_stats[fates->tx_seq % MAX_FATE_LOG_LEN];
 
     pkt_fate_stats->fate = (wifi_tx_packet_fate)log->status;
 
@@ -2254,19 +2440,11 @@ static wifi_error parse_tx_pkt_fate_stats(hal_info *info, u8 *buf, u16 size)
 
     pkt_fate_stats->frame_inf.driver_timestamp_usec = log->driver_ts;
     pkt_fate_stats->frame_inf.firmware_timestamp_usec = log->fw_ts;
-    pkt_fate_stats->frame_inf.frame_len = size - sizeof(pktdump_hdr);
-    pkt_fate_stats->frame_inf.frame_content =
-             (char *)malloc(pkt_fate_stats->frame_inf.frame_len * sizeof(char));
-    if (pkt_fate_stats->frame_inf.frame_content) {
-        memcpy(pkt_fate_stats->frame_inf.frame_content,
-               buf + sizeof(pktdump_hdr), pkt_fate_stats->frame_inf.frame_len);
-    } else {
-        ALOGE("Failed to allocate mem for Tx frame_content for packet: %zu",
-              info->pkt_fate_stats->n_tx_stats_collected);
-        pkt_fate_stats->frame_inf.frame_len = 0;
-    }
+    pkt_fate_stats->frame_inf.frame_len =
+        copy_pkt_fate_frame(fates, pkt_fate_stats->frame_inf.frame_content,
+                            buf, size);
 
-    info->pkt_fate_stats->n_tx_stats_collected++;
+    fates->tx_seq++;
 
     return WIFI_SUCCESS;
 }
@@ -2275,16 +2453,11 @@ static wifi_error parse_tx_pkt_fate_stats(hal_info *info, u8 *buf, u16 size)
 static wifi_error parse_rx_pkt_fate_stats(hal_info *info, u8 *buf, u16 size)
 {
     pktdump_hdr *log = (pktdump_hdr *)buf;
+    packet_fate_monitor_info *fates = info->pkt_fate_stats;
     wifi_rx_report_i *pkt_fate_stats;
 
-    if (info->pkt_fate_stats->n_rx_stats_collected >= MAX_FATE_LOG_LEN) {
-        ALOGD("Only %u events are expected, don't process this event",
-              MAX_FATE_LOG_LEN);
-        return WIFI_SUCCESS;
-    }
-
-    pkt_fate_stats = &info->pkt_fate_stats->rx_fate_stats[
-                                   info->pkt_fate_stats->n_rx_stats_collected];
+    /* Once the capture wraps, this overwrites the oldest fate */
+    pkt_fate_stats = &fates->rx_fate_stats[fates->rx_seq % MAX_FATE_LOG_LEN];
 
     pkt_fate_stats->fate = (wifi_rx_packet_fate)log->status;
     if (log->type == RX_MGMT_PKT)
@@ -2294,41 +2467,123 @@ static wifi_error parse_rx_pkt_fate_stats(hal_info *info, u8 *buf, u16 size)
 
     pkt_fate_stats->frame_inf.driver_timestamp_usec = log->driver_ts;
     pkt_fate_stats->frame_inf.firmware_timestamp_usec = log->fw_ts;
-    pkt_fate_stats->frame_inf.frame_len = size - sizeof(pktdump_hdr);
-    pkt_fate_stats->frame_inf.frame_content =
-             (char *)malloc(pkt_fate_stats->frame_inf.frame_len * sizeof(char));
-    if (pkt_fate_stats->frame_inf.frame_content) {
-        memcpy(pkt_fate_stats->frame_inf.frame_content,
-               buf + sizeof(pktdump_hdr), pkt_fate_stats->frame_inf.frame_len);
-    } else {
-        ALOGE("Failed to allocate mem for Rx frame_content for packet: %zu",
-              info->pkt_fate_stats->n_rx_stats_collected);
-        pkt_fate_stats->frame_inf.frame_len = 0;
-    }
+    pkt_fate_stats->frame_inf.frame_len =
+        copy_pkt_fate_frame(fates, pkt_fate_stats->frame_inf.frame_content,
+                            buf, size);
 
-    info->pkt_fate_stats->n_rx_stats_collected++;
+    fates->rx_seq++;
 
     return WIFI_SUCCESS;
 }
 
 
-static wifi_error trigger_fate_stats(hal_info *info, u8 *buf, u16 size)
+static int pkt_fate_data_class(const u8 *frame, size_t len)
 {
-    int i;
-    packet_fate_monitor_info *pkt_fate_stats = info->pkt_fate_stats;
+    const u8 *ip, *udp;
+    u16 ether_type, sport, dport;
+    size_t ip_hlen;
+
+    if (len < ETH_HLEN)
+        return PKT_FATE_CLASS_DATA;
+
+    ether_type = frame[12] << 8 | frame[13];
+    ip = frame + ETH_HLEN;
+    len -= ETH_HLEN;
+    switch (ether_type) {
+        case ETH_P_PAE:
+            return PKT_FATE_CLASS_EAPOL;
+        case ETH_P_ARP:
+            return PKT_FATE_CLASS_ARP;
+        case ETH_P_IP:
+            if (len < 20 || ip[9] != IPPROTO_UDP)
+                return PKT_FATE_CLASS_DATA;
+            ip_hlen = (ip[0] & 0xF) * 4;
+            if (ip_hlen < 20 || len < ip_hlen + 4)
+                return PKT_FATE_CLASS_DATA;
+            udp = ip + ip_hlen;
+            sport = udp[0] << 8 | udp[1];
+            dport = udp[2] << 8 | udp[3];
+            if ((sport == 67 || sport == 68) && (dport == 67 || dport == 68))
+                return PKT_FATE_CLASS_DHCP;
+            return PKT_FATE_CLASS_DATA;
+        case ETH_P_IPV6:
+            /* DHCPv6 is sent without extension headers */
+            if (len < 44 || ip[6] != IPPROTO_UDP)
+                return PKT_FATE_CLASS_DATA;
+            udp = ip + 40;
+            sport = udp[0] << 8 | udp[1];
+            dport = udp[2] << 8 | udp[3];
+            if ((sport == 546 || sport == 547) && (dport == 546 || dport == 547))
+                return PKT_FATE_CLASS_DHCP;
+            return PKT_FATE_CLASS_DATA;
+    }
+    return PKT_FATE_CLASS_DATA;
+}
 
-    for (i=0; i<MAX_FATE_LOG_LEN; i++) {
-        if (pkt_fate_stats->tx_fate_stats[i].frame_inf.frame_content) {
-            free (pkt_fate_stats->tx_fate_stats[i].frame_inf.frame_content);
-            pkt_fate_stats->tx_fate_stats[i].frame_inf.frame_content = NULL;
+/* Runs a tx/rx pktdump event through the fate capture filter, before
+ * anything of it is copied
+ */
+static bool pkt_fate_filter_match(packet_fate_monitor_info *fates, u8 *buf,
+                                  u16 size)
+{
+    pktdump_hdr *log = (pktdump_hdr *)buf;
+    pkt_fate_filter *filter = &fates->filter;
+    const u8 *frame = buf + sizeof(pktdump_hdr);
+    const u8 *da = NULL, *sa = NULL;
+    size_t len = 0;
+    u32 fate_mask;
+    int cls;
+
+    if (size > sizeof(pktdump_hdr))
+        len = size - sizeof(pktdump_hdr);
+
+    if (log->type == TX_MGMT_PKT || log->type == TX_DATA_PKT)
+        fate_mask = filter->tx_fate_mask;
+    else
+        fate_mask = filter->rx_fate_mask;
+    if (!(fate_mask & (1U << min(log->status, 31))))
+        return false;
+
+    if (log->type == TX_MGMT_PKT || log->type == RX_MGMT_PKT) {
+        cls = PKT_FATE_CLASS_MGMT;
+        /* 802.11 header: frame control, duration, addr1 (DA), addr2 (SA) */
+        if (len && !(filter->mgmt_subtype_mask & BIT(frame[0] >> 4)))
+            return false;
+        if (len >= 4 + 2 * ETH_ALEN) {
+            da = frame + 4;
+            sa = frame + 4 + ETH_ALEN;
         }
-
-        if (pkt_fate_stats->rx_fate_stats[i].frame_inf.frame_content) {
-            free (pkt_fate_stats->rx_fate_stats[i].frame_inf.frame_content);
-            pkt_fate_stats->rx_fate_stats[i].frame_inf.frame_content = NULL;
+    } else {
+        cls = pkt_fate_data_class(frame, len);
+        if (len >= ETH_HLEN) {
+            da = frame;
+            sa = frame + ETH_ALEN;
         }
     }
-    memset(pkt_fate_stats, 0, sizeof(packet_fate_monitor_info));
+
+    if (!(filter->class_mask & BIT(cls)))
+        return false;
+
+    if (filter->match_mac &&
+        (da == NULL || (memcmp(da, filter->mac, ETH_ALEN) &&
+                        memcmp(sa, filter->mac, ETH_ALEN))))
+        return false;
+
+    if (filter->sample[cls] > 1 &&
+        fates->sample_seen[cls]++ % filter->sample[cls])
+        return false;
+
+    return true;
+}
+
+
+static wifi_error trigger_fate_stats(hal_info *info, u8 *buf, u16 size)
+{
+    packet_fate_monitor_info *pkt_fate_stats = info->pkt_fate_stats;
+
+    /* Start a new capture; entries and their slab slots are reused as is */
+    pkt_fate_stats->tx_first_seq = pkt_fate_stats->tx_seq;
+    pkt_fate_stats->rx_first_seq = pkt_fate_stats->rx_seq;
 
     return WIFI_SUCCESS;
 }
@@ -2336,7 +2591,9 @@ static wifi_error trigger_fate_stats(hal_info *info, u8 *buf, u16 size)
 
 static wifi_error report_fate_stats(hal_info *info, u8 *buf, u16 size)
 {
-    ALOGI("Fate Tx-Rx: Packet fate stats stop received");
+    ALOGI("Fate Tx-Rx: Packet fate stats stop received, %" PRIu64
+          " matched, %" PRIu64 " dropped by filter",
+          info->pkt_fate_stats->n_matched, info->pkt_fate_stats->n_dropped);
     return WIFI_SUCCESS;
 }
 
@@ -2355,10 +2612,24 @@ static wifi_error parse_pkt_fate_stats(hal_info *info, u8 *buf, u16 size)
         break;
         case TX_MGMT_PKT:
         case TX_DATA_PKT:
+            if (!pkt_fate_filter_match(info->pkt_fate_stats, buf, size)) {
+                info->pkt_fate_stats->n_dropped++;
+                break;
+            }
+            info->pkt_fate_stats->n_matched++;
+            if (info->pcapng)
+                pcapng_export_fate(info, buf, size, true);
             parse_tx_pkt_fate_stats(info, buf, size);
         break;
         case RX_MGMT_PKT:
         case RX_DATA_PKT:
+            if (!pkt_fate_filter_match(info->pkt_fate_stats, buf, size)) {
+                info->pkt_fate_stats->n_dropped++;
+                break;
+            }
+            info->pkt_fate_stats->n_matched++;
+            if (info->pcapng)
+                pcapng_export_fate(info, buf, size, false);
             parse_rx_pkt_fate_stats(info, buf, size);
         break;
         default:
@@ -2572,67 +2843,88 @@ static wifi_error parse_stats_record_v1(hal_info *info,
     return status;
 }
 
-static wifi_error parse_stats(hal_info *info, u8 *data, u32 buflen)
+/* Returns the length of the pktlog record at data, 0 if it is truncated */
+static u32 pktlog_record_len(hal_info *info, u8 *data, u32 buflen)
 {
-    wh_pktlog_hdr_t *pkt_stats_header;
-    wh_pktlog_hdr_v2_t *pkt_stats_header_v2_t;
-    wifi_error status = WIFI_SUCCESS;
+    wh_pktlog_hdr_t *pkt_stats_header = (wh_pktlog_hdr_t *)data;
+    wh_pktlog_hdr_v2_t *pkt_stats_header_v2_t = (wh_pktlog_hdr_v2_t *)data;
+    u32 record_len;
+
+    if (buflen < sizeof(wh_pktlog_hdr_t))
+        return 0;
+
+    if (info->pkt_log_ver == PKT_LOG_V2 ||
+        (pkt_stats_header->flags & PKT_INFO_FLG_PKT_DUMP_V2)) {
+        if (buflen < sizeof(wh_pktlog_hdr_v2_t))
+            return 0;
+        record_len = (sizeof(wh_pktlog_hdr_v2_t) + pkt_stats_header_v2_t->size);
+    } else {
+        record_len = (sizeof(wh_pktlog_hdr_t) + pkt_stats_header->size);
+    }
 
-    do {
-        u32 record_len;
+    return buflen < record_len ? 0 : record_len;
+}
 
-        if (buflen < sizeof(wh_pktlog_hdr_t)) {
-            status = WIFI_ERROR_INVALID_ARGS;
-            break;
-        }
+/* Records indexed per pass of parse_stats() */
+#define PKTLOG_INDEX_LEN 64
 
-        pkt_stats_header = (wh_pktlog_hdr_t *)data;
-        pkt_stats_header_v2_t = (wh_pktlog_hdr_v2_t *)data;
+/* Walks the record headers of a pktlog buffer first and then decodes the
+ * indexed records. Records are decoded in order, as TX stats and RX
+ * aggregation build their entries across records of different types. The
+ * pkt stats entries decoded go to the ring as one batch.
+ */
+static wifi_error parse_stats(hal_info *info, u8 *data, u32 buflen)
+{
+    u8 *records[PKTLOG_INDEX_LEN];
+    wifi_error status = WIFI_SUCCESS, ret;
+    u32 record_len;
+    int num, i;
 
-        if (info->pkt_log_ver == PKT_LOG_V2) {
-            if (buflen < sizeof(wh_pktlog_hdr_v2_t)) {
+    info->pkt_stats->batch.active = true;
+    do {
+        num = 0;
+        do {
+            record_len = pktlog_record_len(info, data, buflen);
+            if (!record_len) {
                 status = WIFI_ERROR_INVALID_ARGS;
                 break;
             }
-            record_len = (sizeof(wh_pktlog_hdr_v2_t) + pkt_stats_header_v2_t->size);
-        } else {
-            if (pkt_stats_header->flags & PKT_INFO_FLG_PKT_DUMP_V2){
-                if (buflen < sizeof(wh_pktlog_hdr_v2_t)) {
-                    status = WIFI_ERROR_INVALID_ARGS;
-                    break;
-                }
-                record_len = (sizeof(wh_pktlog_hdr_v2_t) + pkt_stats_header_v2_t->size);
+            records[num++] = data;
+            data += record_len;
+            buflen -= record_len;
+        } while (buflen > 0 && num < PKTLOG_INDEX_LEN);
+
+        for (i = 0; i < num && !info->clean_up; i++) {
+            /* Pkt_log_V2 based packet parsing */
+            if (info->pkt_log_ver == PKT_LOG_V2) {
+                wh_pktlog_hdr_v2_t *pkt_stats_header_v2_t =
+                    (wh_pktlog_hdr_v2_t *)records[i];
+
+                ret = parse_stats_record_v2(info, pkt_stats_header_v2_t);
+                if (ret != WIFI_SUCCESS)
+                    ALOGE("Failed to parse the stats type : %d",
+                         pkt_stats_header_v2_t->log_type);
+            /* Pkt_log_V1 based packet parsing */
             } else {
-                record_len = (sizeof(wh_pktlog_hdr_t) + pkt_stats_header->size);
-            }
-        }
+                wh_pktlog_hdr_t *pkt_stats_header =
+                    (wh_pktlog_hdr_t *)records[i];
 
-        if (buflen < record_len) {
-            status = WIFI_ERROR_INVALID_ARGS;
-            break;
-        }
-        /* Pkt_log_V2 based packet parsing */
-        if (info->pkt_log_ver == PKT_LOG_V2) {
-            status = parse_stats_record_v2(info, pkt_stats_header_v2_t);
-            if (status != WIFI_SUCCESS) {
-                ALOGE("Failed to parse the stats type : %d",
-                     pkt_stats_header_v2_t->log_type);
-                return status;
+                ret = parse_stats_record_v1(info, pkt_stats_header);
+                if (ret != WIFI_SUCCESS)
+                    ALOGE("Failed to parse the stats type : %d",
+                         pkt_stats_header->log_type);
             }
-        /* Pkt_log_V1 based packet parsing */
-        } else {
-            status = parse_stats_record_v1(info, pkt_stats_header);
-            if (status != WIFI_SUCCESS) {
-                ALOGE("Failed to parse the stats type : %d",
-                     pkt_stats_header->log_type);
-                return status;
+            if (ret != WIFI_SUCCESS) {
+                status = ret;
+                goto out;
             }
         }
-        data += record_len;
-        buflen -= record_len;
-
-    } while (!info->clean_up && (buflen > 0));
+    } while (status == WIFI_SUCCESS && !info->clean_up && (buflen > 0));
 
+out:
+    info->pkt_stats->batch.active = false;
+    if (pkt_stats_batch_flush(info) != WIFI_SUCCESS)
+        ALOGE("Failed to write pkt stats into the ring buffer");
     return status;
 }
 
@@ -2651,21 +2943,18 @@ wifi_error process_driver_prints(hal_info *info, u8 *buf, u16 length)
     /* Write if verbose and handler is set */
     if (info->rb_infos[DRIVER_PRINTS_RB_ID].verbose_level >= 1 &&
         info->on_ring_buffer_data) {
-        /* Write header and payload separately to avoid
+        struct iovec iov[2];
+
+        /* Write header and payload as one record to avoid
          * complete payload memcpy */
-        status = ring_buffer_write(&info->rb_infos[DRIVER_PRINTS_RB_ID],
-                                   (u8*)&rb_entry_hdr,
-                                   sizeof(wifi_ring_buffer_entry),
-                                   0,
-                                   sizeof(wifi_ring_buffer_entry) + length);
-        if (status != WIFI_SUCCESS) {
-            ALOGE("Failed to write driver prints rb header %d", status);
-            return status;
-        }
-        status = ring_buffer_write(&info->rb_infos[DRIVER_PRINTS_RB_ID],
-                                   buf, length, 1, length);
+        iov[0].iov_base = &rb_entry_hdr;
+        iov[0].iov_len = sizeof(wifi_ring_buffer_entry);
+        iov[1].iov_base = buf;
+        iov[1].iov_len = length;
+        status = ring_buffer_writev(&info->rb_infos[DRIVER_PRINTS_RB_ID],
+                                    iov, 2, 1);
         if (status != WIFI_SUCCESS) {
-            ALOGE("Failed to write driver prints rb payload %d", status);
+            ALOGE("Failed to write driver prints rb record %d", status);
             return status;
         }
     }
@@ -2673,7 +2962,112 @@ wifi_error process_driver_prints(hal_info *info, u8 *buf, u16 length)
     return WIFI_SUCCESS;
 }
 
+/* Forwards a cld80211 OEM message to the ctrl clients registered for it */
+static wifi_error process_oem_msg(hal_info *info, struct nlmsghdr *nlh)
+{
+    struct genlmsghdr *genlh = (struct genlmsghdr *)nlmsg_data(nlh);
+    struct nlattr *attrs[CLD80211_ATTR_MAX + 1];
+    struct nlattr *tb_vendor[CLD80211_ATTR_MAX + 1];
+    wifihal_ctrl_event_t *ctrl_evt;
+    wifihal_mon_sock_t *reg;
+    int result;
+
+    result = nla_parse(attrs, CLD80211_ATTR_MAX, genlmsg_attrdata(genlh, 0),
+                       genlmsg_attrlen(genlh, 0), NULL);
+    if (result || !attrs[CLD80211_ATTR_VENDOR_DATA]) {
+        ALOGE("Invalid data received");
+        return WIFI_ERROR_UNKNOWN;
+    }
+    if (info->wifihal_ctrl_sock.s <= 0)
+        return WIFI_SUCCESS;
+
+    nla_parse(tb_vendor, CLD80211_ATTR_MAX,
+              (struct nlattr *)nla_data(attrs[CLD80211_ATTR_VENDOR_DATA]),
+              nla_len(attrs[CLD80211_ATTR_VENDOR_DATA]), NULL);
+    if (!(tb_vendor[CLD80211_ATTR_DATA] || tb_vendor[CLD80211_ATTR_CMD])) {
+        ALOGE("Invalid oem data received from driver");
+        return WIFI_ERROR_UNKNOWN;
+    }
+    ctrl_evt = (wifihal_ctrl_event_t *)malloc(sizeof(*ctrl_evt) + nlh->nlmsg_len);
+
+    if(ctrl_evt == NULL)
+    {
+      ALOGE("Memory allocation failure");
+      return WIFI_ERROR_OUT_OF_MEMORY;
+    }
+    memset((char *)ctrl_evt, 0, sizeof(*ctrl_evt) + nlh->nlmsg_len);
+
+    ctrl_evt->family_name = CLD80211_FAMILY;
+    ctrl_evt->cmd_id = WLAN_NL_MSG_OEM;
+    ctrl_evt->data_len = nlh->nlmsg_len;
+    memcpy(ctrl_evt->data, (char *)nlh,  ctrl_evt->data_len);
+
+    //! Send oem data to all the registered clients
+
+    list_for_each_entry(reg, &info->monitor_sockets, list) {
+
+        if (reg->family_name != CLD80211_FAMILY || reg->cmd_id != WLAN_NL_MSG_OEM)
+            continue;
+
+        /* found match! */
+        /* Indicate the received OEM msg to respective client
+           it is responsibility of the registered client to check
+           the oem_msg is meant for them or not based on oem_msg sub type */
+        ALOGI("send oem msg of len : %d to apps",ctrl_evt->data_len);
+        if (sendto(info->wifihal_ctrl_sock.s, (char *)ctrl_evt,
+                   sizeof(*ctrl_evt) + ctrl_evt->data_len, 0,
+                   (struct sockaddr *)&reg->monsock, reg->monsock_len) < 0)
+        {
+          int _errno = errno;
+          ALOGE("socket send failed : %d",_errno);
+
+          if (_errno == ENOBUFS || _errno == EAGAIN) {
+              /*
+               * The socket send buffer could be full. This
+               * may happen if client programs are not
+               * receiving their pending messages. Close and
+               * reopen the socket as a workaround to avoid
+               * getting stuck being unable to send any new
+               * responses.
+               */
+          }
+        }
+    }
+    free(ctrl_evt);
+    return WIFI_SUCCESS;
+}
+
+/* user_sock message handler. OEM messages are control traffic for the ctrl
+ * clients and go out right away; diag messages are handed to the diag
+ * worker, or decoded here while it is not running.
+ */
 wifi_error diag_message_handler(hal_info *info, nl_msg *msg)
+{
+    struct nlmsghdr *nlh = nlmsg_hdr(msg);
+    wifi_error status;
+
+    if (info->cldctx) {
+        struct genlmsghdr *genlh = (struct genlmsghdr *)nlmsg_data(nlh);
+
+        if (genlh->cmd == WLAN_NL_MSG_OEM)
+            return process_oem_msg(info, nlh);
+        if (genlh->cmd != ANI_NL_MSG_PUMAC &&
+            genlh->cmd != ANI_NL_MSG_LOG &&
+            genlh->cmd != ANI_NL_MSG_CNSS_DIAG)
+            return WIFI_SUCCESS;
+    }
+
+    if (info->diag_worker)
+        return diag_worker_queue_msg(info->diag_worker, nlh);
+
+    pthread_mutex_lock(&info->diag_lock);
+    status = process_diag_nlmsg(info, nlh);
+    pthread_mutex_unlock(&info->diag_lock);
+    return status;
+}
+
+/* Decodes one diag message into the rings, with diag_lock held */
+wifi_error process_diag_nlmsg(hal_info *info, struct nlmsghdr *nlh)
 {
     tAniNlHdr *wnl;
     u8 *buf;
@@ -2685,13 +3079,11 @@ wifi_error diag_message_handler(hal_info *info, nl_msg *msg)
         struct nlattr *attrs[CLD80211_ATTR_MAX + 1];
         struct genlmsghdr *genlh;
         struct nlattr *tb_vendor[CLD80211_ATTR_MAX + 1];
-        struct  nlmsghdr *nlh = nlmsg_hdr(msg);
 
         genlh = (struct genlmsghdr *)nlmsg_data(nlh);
         if (genlh->cmd == ANI_NL_MSG_PUMAC ||
             genlh->cmd == ANI_NL_MSG_LOG ||
-            genlh->cmd == ANI_NL_MSG_CNSS_DIAG ||
-            genlh->cmd == WLAN_NL_MSG_OEM)
+            genlh->cmd == ANI_NL_MSG_CNSS_DIAG)
         {
             cmd = genlh->cmd;
             int result = nla_parse(attrs, CLD80211_ATTR_MAX, genlmsg_attrdata(genlh, 0),
@@ -2709,70 +3101,13 @@ wifi_error diag_message_handler(hal_info *info, nl_msg *msg)
                 ALOGE("Invalid data received");
                 return WIFI_ERROR_UNKNOWN;
             }
-            if (genlh->cmd != WLAN_NL_MSG_OEM && !clh) {
+            if (!clh) {
                 ALOGE("Invalid data received from driver");
                 return WIFI_ERROR_UNKNOWN;
             }
-
-            if((info->wifihal_ctrl_sock.s > 0) && (genlh->cmd == WLAN_NL_MSG_OEM)) {
-               wifihal_ctrl_event_t *ctrl_evt;
-               wifihal_mon_sock_t *reg;
-
-               if (!(tb_vendor[CLD80211_ATTR_DATA] || tb_vendor[CLD80211_ATTR_CMD])) {
-                   ALOGE("Invalid oem data received from driver");
-                   return WIFI_ERROR_UNKNOWN;
-               }
-               ctrl_evt = (wifihal_ctrl_event_t *)malloc(sizeof(*ctrl_evt) + nlh->nlmsg_len);
-
-               if(ctrl_evt == NULL)
-               {
-                 ALOGE("Memory allocation failure");
-                 return WIFI_ERROR_OUT_OF_MEMORY;
-               }
-               memset((char *)ctrl_evt, 0, sizeof(*ctrl_evt) + nlh->nlmsg_len);
-
-               ctrl_evt->family_name = CLD80211_FAMILY;
-               ctrl_evt->cmd_id = WLAN_NL_MSG_OEM;
-               ctrl_evt->data_len = nlh->nlmsg_len;
-               memcpy(ctrl_evt->data, (char *)nlh,  ctrl_evt->data_len);
-
-               //! Send oem data to all the registered clients
-
-               list_for_each_entry(reg, &info->monitor_sockets, list) {
-
-                   if (reg->family_name != CLD80211_FAMILY || reg->cmd_id != WLAN_NL_MSG_OEM)
-                       continue;
-
-                   /* found match! */
-                   /* Indicate the received OEM msg to respective client
-                      it is responsibility of the registered client to check
-                      the oem_msg is meant for them or not based on oem_msg sub type */
-                   ALOGI("send oem msg of len : %d to apps",ctrl_evt->data_len);
-                   if (sendto(info->wifihal_ctrl_sock.s, (char *)ctrl_evt,
-                              sizeof(*ctrl_evt) + ctrl_evt->data_len, 0,
-                              (struct sockaddr *)&reg->monsock, reg->monsock_len) < 0)
-                   {
-                     int _errno = errno;
-                     ALOGE("socket send failed : %d",_errno);
-
-                     if (_errno == ENOBUFS || _errno == EAGAIN) {
-                         /*
-                          * The socket send buffer could be full. This
-                          * may happen if client programs are not
-                          * receiving their pending messages. Close and
-                          * reopen the socket as a workaround to avoid
-                          * getting stuck being unable to send any new
-                          * responses.
-                          */
-                     }
-                   }
-               }
-               free(ctrl_evt);
-               return WIFI_SUCCESS;
-            }
         }
     } else {
-        wnl = (tAniNlHdr *)nlmsg_hdr(msg);
+        wnl = (tAniNlHdr *)nlh;
         cmd = wnl->nlh.nlmsg_type;
     }
 
@@ -2888,7 +3223,6 @@ wifi_error diag_message_handler(hal_info *info, nl_msg *msg)
         }
     } else if (cmd == ANI_NL_MSG_CNSS_DIAG) {
         uint16_t diag_fw_type;
-        struct nlmsghdr *nlh = nlmsg_hdr(msg);
 
         if (!info->cldctx) {
             buf = (uint8_t *)NLMSG_DATA(wnl) + sizeof(wnl->clh.radio);
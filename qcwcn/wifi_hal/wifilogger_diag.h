@@ -51,6 +51,9 @@
 #define FEATURE_NOT_SUPPORTED         0xFF
 
 #define DATA_STALL_OFFSET_REASON_CODE 256
+/* Alert reason codes for HAL netlink socket overruns (lost events) */
+#define NL_OVERFLOW_EVENT_SOCK_REASON_CODE 512
+#define NL_OVERFLOW_USER_SOCK_REASON_CODE  513
 /*
  *  - verbose_level 0 corresponds to no collection
  *  - verbose_level 1 correspond to normal log level, with minimal user impact.
@@ -248,5 +251,13 @@ typedef struct {
 } wlan_data_stall_event_t;
 
 wifi_error diag_message_handler(hal_info *info, nl_msg *msg);
+wifi_error process_diag_nlmsg(hal_info *info, struct nlmsghdr *nlh);
+
+struct diag_worker *diag_worker_start(hal_info *info);
+void diag_worker_stop(struct diag_worker *worker);
+wifi_error diag_worker_queue_msg(struct diag_worker *worker,
+                                 const struct nlmsghdr *nlh);
+void diag_worker_post_rb_timeout(struct diag_worker *worker, int rb_id);
+void diag_worker_post_flush(struct diag_worker *worker);
 
 #endif /* __WIFI_HAL_WIFILOGGER_DIAG_H__ */
@@ -109,11 +109,21 @@ public:
     virtual void getWakeStatsRspParams(
                     WLAN_DRIVER_WAKE_REASON_CNT *wifi_wake_reason_cnt);
 };
-void rb_timerhandler(hal_info *info);
 wifi_error wifi_logger_ring_buffers_init(hal_info *info);
 void wifi_logger_ring_buffers_deinit(hal_info *info);
 void push_out_all_ring_buffers(hal_info *info);
+wifi_error wifi_get_diag_event_stats(wifi_handle handle,
+            wifi_diag_event_stats *stats, int max_stats, int *num_stats);
+wifi_error wifi_get_diag_queue_stats(wifi_handle handle,
+            wifi_diag_queue_stats *stats);
+wifi_error wifi_get_ring_compress_stats(wifi_handle handle,
+            wifi_ring_compress_stats *stats, int max_stats, int *num_stats);
+wifi_error wifi_start_pcapng_export(wifi_handle handle, int fd,
+            const struct sockaddr *dest, socklen_t dest_len);
+void wifi_stop_pcapng_export(wifi_handle handle);
+bool pcapng_export_flush_due(hal_info *info);
 void send_alert(hal_info *info, int reason_code);
+void send_alert_msg(hal_info *info, const char *msg, int reason_code);
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */